@@ -0,0 +1,128 @@
+#ifndef BASE_STRIDED_VIEW_HPP
+#define BASE_STRIDED_VIEW_HPP
+
+#include <stddef.h>
+#include <string.h>
+#include <iterator>
+
+namespace base
+{
+    namespace detail
+    {
+        //true if T and U only differ by the const qualifier of T
+        template<typename T, typename U> struct IsSameValueType { enum { value = 0 }; };
+        template<typename T> struct IsSameValueType<T, T> { enum { value = 1 }; };
+        template<typename T> struct IsSameValueType<const T, T> { enum { value = 1 }; };
+    }
+
+    /** Random access iterator over elements which are stride elements apart */
+    template<typename T>
+    class StridedIterator
+    {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T* pointer;
+        typedef T& reference;
+
+        StridedIterator()
+            : ptr(NULL), stride(1) {}
+
+        StridedIterator(T *ptr, ptrdiff_t stride)
+            : ptr(ptr), stride(stride) {}
+
+        reference operator*() const { return *ptr; }
+        pointer operator->() const { return ptr; }
+        reference operator[](difference_type n) const { return ptr[n * stride]; }
+
+        StridedIterator &operator++() { ptr += stride; return *this; }
+        StridedIterator &operator--() { ptr -= stride; return *this; }
+        StridedIterator operator++(int) { StridedIterator it(*this); ptr += stride; return it; }
+        StridedIterator operator--(int) { StridedIterator it(*this); ptr -= stride; return it; }
+        StridedIterator &operator+=(difference_type n) { ptr += n * stride; return *this; }
+        StridedIterator &operator-=(difference_type n) { ptr -= n * stride; return *this; }
+        StridedIterator operator+(difference_type n) const { return StridedIterator(ptr + n * stride, stride); }
+        StridedIterator operator-(difference_type n) const { return StridedIterator(ptr - n * stride, stride); }
+        difference_type operator-(const StridedIterator &other) const { return (ptr - other.ptr) / stride; }
+
+        bool operator==(const StridedIterator &other) const { return ptr == other.ptr; }
+        bool operator!=(const StridedIterator &other) const { return ptr != other.ptr; }
+        bool operator<(const StridedIterator &other) const { return (other.ptr - ptr) * stride > 0; }
+        bool operator>(const StridedIterator &other) const { return other < *this; }
+        bool operator<=(const StridedIterator &other) const { return !(other < *this); }
+        bool operator>=(const StridedIterator &other) const { return !(*this < other); }
+
+    private:
+        T *ptr;
+        ptrdiff_t stride;
+    };
+
+    /** Non-owning view on count elements which are stride elements apart
+     *
+     * This is used to access rows and columns of two dimensional data
+     * independent of its memory layout, without copying. The view is only
+     * valid as long as the underlying memory is not reallocated.
+     */
+    template<typename T>
+    class StridedView
+    {
+    public:
+        typedef T value_type;
+        typedef size_t size_type;
+        typedef StridedIterator<T> iterator;
+
+        StridedView()
+            : first(NULL), count(0), step(1) {}
+
+        StridedView(T *first, size_t count, ptrdiff_t stride)
+            : first(first), count(count), step(stride) {}
+
+        /** Allows to convert views on mutable data into views on const data */
+        template<typename U>
+        StridedView(const StridedView<U> &other)
+            : first(other.data()), count(other.size()), step(other.stride()) {}
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        /** distance between two elements in number of elements */
+        ptrdiff_t stride() const { return step; }
+        /** pointer to the first element */
+        T *data() const { return first; }
+        /** returns true if the elements are consecutive in memory */
+        bool isContiguous() const { return step == 1; }
+
+        T &operator[](size_t index) const { return first[index * step]; }
+
+        iterator begin() const { return iterator(first, step); }
+        iterator end() const { return iterator(first + count * step, step); }
+
+        /** Copies all elements to dst which must hold size() elements */
+        template<typename U>
+        void copyTo(U *dst) const
+        {
+            if(step == 1 && count && detail::IsSameValueType<T, U>::value)
+            {
+                memcpy(dst, first, count * sizeof(U));
+                return;
+            }
+            for(size_t i = 0; i < count; ++i)
+                dst[i] = first[i * step];
+        }
+
+        /** Sets all elements from src which must hold size() elements */
+        template<typename U>
+        void copyFrom(const U *src) const
+        {
+            for(size_t i = 0; i < count; ++i)
+                first[i * step] = src[i];
+        }
+
+    private:
+        T *first;
+        size_t count;
+        ptrdiff_t step;
+    };
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef BASE_TRANSPOSE_H__
+#define BASE_TRANSPOSE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace base {
+
+    namespace detail {
+        inline void transposeScalar(const uint8_t *src, size_t src_stride,
+                uint8_t *dst, size_t dst_stride, size_t rows, size_t columns)
+        {
+            for(size_t row = 0; row < rows; ++row)
+                for(size_t column = 0; column < columns; ++column)
+                    dst[column*dst_stride+row] = src[row*src_stride+column];
+        }
+
+#ifdef __SSE2__
+        //transposes a 16x16 block by four rounds of perfect shuffles
+        inline void transpose16x16(const uint8_t *src, size_t src_stride,
+                uint8_t *dst, size_t dst_stride)
+        {
+            __m128i x[16];
+            __m128i y[16];
+            for(int i = 0; i < 16; ++i)
+                x[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i*src_stride));
+            for(int round = 0; round < 2; ++round)
+            {
+                for(int i = 0; i < 8; ++i)
+                {
+                    y[2*i] = _mm_unpacklo_epi8(x[i], x[i+8]);
+                    y[2*i+1] = _mm_unpackhi_epi8(x[i], x[i+8]);
+                }
+                for(int i = 0; i < 8; ++i)
+                {
+                    x[2*i] = _mm_unpacklo_epi8(y[i], y[i+8]);
+                    x[2*i+1] = _mm_unpackhi_epi8(y[i], y[i+8]);
+                }
+            }
+            for(int i = 0; i < 16; ++i)
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i*dst_stride), x[i]);
+        }
+#endif
+    }
+
+    /** Transposes a row major 8 bit matrix
+     *
+     * @param src matrix with rows x columns elements
+     * @param dst destination for the columns x rows elements of the
+     *            transposed matrix. It must not overlap with src.
+     *
+     * The matrix is processed in tiles that fit into the L1 cache. Inside a
+     * tile, 16x16 blocks are transposed with SSE2 if it is available.
+     */
+    inline void transpose(const uint8_t *src, uint8_t *dst, size_t rows, size_t columns)
+    {
+        const size_t tile = 64;
+        for(size_t row0 = 0; row0 < rows; row0 += tile)
+        {
+            const size_t tile_rows = rows - row0 < tile ? rows - row0 : tile;
+            for(size_t column0 = 0; column0 < columns; column0 += tile)
+            {
+                const size_t tile_columns = columns - column0 < tile ? columns - column0 : tile;
+                const uint8_t *src_tile = src + row0*columns + column0;
+                uint8_t *dst_tile = dst + column0*rows + row0;
+
+                size_t simd_rows = 0;
+                size_t simd_columns = 0;
+#ifdef __SSE2__
+                simd_rows = tile_rows - tile_rows % 16;
+                simd_columns = tile_columns - tile_columns % 16;
+                for(size_t row = 0; row < simd_rows; row += 16)
+                    for(size_t column = 0; column < simd_columns; column += 16)
+                        detail::transpose16x16(src_tile + row*columns + column, columns,
+                                dst_tile + column*rows + row, rows);
+#endif
+                //remaining columns of the SIMD rows and remaining rows
+                detail::transposeScalar(src_tile + simd_columns, columns,
+                        dst_tile + simd_columns*rows, rows,
+                        simd_rows, tile_columns - simd_columns);
+                detail::transposeScalar(src_tile + simd_rows*columns, columns,
+                        dst_tile + simd_rows, rows,
+                        tile_rows - simd_rows, tile_columns);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,349 @@
+#ifndef BASE_SAMPLES_COMPACT_LASER_SCAN_H__
+#define BASE_SAMPLES_COMPACT_LASER_SCAN_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <base/Time.hpp>
+#include <base/samples/LaserScan.hpp>
+
+namespace base { namespace samples {
+
+    namespace detail
+    {
+        /** Fixed point encoding of laser ranges
+         *
+         * Ranges below END_LASER_RANGE_ERRORS are error codes and stored
+         * unchanged. All other ranges are stored in units of scale
+         * millimeters, rounded to the nearest unit and clamped to
+         * [END_LASER_RANGE_ERRORS, 65535] so that they never turn into
+         * error codes.
+         */
+        inline uint16_t encodeRange(uint32_t range, uint16_t scale, bool &exact)
+        {
+            if(range < END_LASER_RANGE_ERRORS)
+                return range;
+            if(range > 0xFFFFu * scale)
+            {
+                exact = false;
+                return 0xFFFF;
+            }
+            const uint32_t value = (range + scale / 2) / scale;
+            if(value * scale != range)
+                exact = false;
+            if(value < END_LASER_RANGE_ERRORS)
+            {
+                exact = false;
+                return END_LASER_RANGE_ERRORS;
+            }
+            return value;
+        }
+
+        inline uint32_t decodeRange(uint16_t value, uint16_t scale)
+        {
+            return value < END_LASER_RANGE_ERRORS ? value : uint32_t(value) * scale;
+        }
+
+        /** Encodes size ranges into dst
+         *
+         * @return true if decodeRanges restores the ranges exactly
+         */
+        inline bool encodeRanges(const uint32_t *src, size_t size, uint16_t scale, uint16_t *dst)
+        {
+            if(scale == 0)
+                throw std::runtime_error("encodeRanges: the scale must not be zero");
+            bool exact = true;
+            size_t i = 0;
+#ifdef __SSE2__
+            //the vectorized path handles scales which are powers of two
+            int shift = 0;
+            while((1 << shift) < scale)
+                ++shift;
+            if((1 << shift) == scale)
+            {
+                const __m128i sign = _mm_set1_epi32(0x80000000);
+                const __m128i errors = _mm_xor_si128(_mm_set1_epi32(END_LASER_RANGE_ERRORS), sign);
+                const __m128i lower = _mm_xor_si128(_mm_set1_epi32((END_LASER_RANGE_ERRORS << shift) - 1), sign);
+                const __m128i upper = _mm_xor_si128(_mm_set1_epi32(0xFFFF << shift), sign);
+                const __m128i fraction = _mm_set1_epi32(scale - 1);
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i bias32 = _mm_set1_epi32(0x8000);
+                const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+                const __m128i count = _mm_cvtsi32_si128(shift);
+                for(; i + 8 <= size; i += 8)
+                {
+                    const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                    const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4));
+                    const __m128i f0 = _mm_xor_si128(v0, sign);
+                    const __m128i f1 = _mm_xor_si128(v1, sign);
+                    //error codes, or multiples of scale which fit into 16 bit
+                    const __m128i error0 = _mm_cmplt_epi32(f0, errors);
+                    const __m128i error1 = _mm_cmplt_epi32(f1, errors);
+                    const __m128i fits0 = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(v0, fraction), zero),
+                            _mm_andnot_si128(_mm_cmpgt_epi32(f0, upper), _mm_cmpgt_epi32(f0, lower)));
+                    const __m128i fits1 = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(v1, fraction), zero),
+                            _mm_andnot_si128(_mm_cmpgt_epi32(f1, upper), _mm_cmpgt_epi32(f1, lower)));
+                    const __m128i ok = _mm_and_si128(_mm_or_si128(error0, fits0), _mm_or_si128(error1, fits1));
+                    if(_mm_movemask_epi8(ok) != 0xFFFF)
+                    {
+                        for(size_t j = i; j < i + 8; ++j)
+                            dst[j] = encodeRange(src[j], scale, exact);
+                        continue;
+                    }
+                    //error codes are smaller than END_LASER_RANGE_ERRORS << shift,
+                    //so they are kept by selecting the unshifted value
+                    const __m128i q0 = _mm_or_si128(_mm_and_si128(error0, v0), _mm_andnot_si128(error0, _mm_srl_epi32(v0, count)));
+                    const __m128i q1 = _mm_or_si128(_mm_and_si128(error1, v1), _mm_andnot_si128(error1, _mm_srl_epi32(v1, count)));
+                    //unsigned 16 bit packing by moving the values into the signed range
+                    const __m128i packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(q0, bias32), _mm_sub_epi32(q1, bias32)), bias16);
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), packed);
+                }
+            }
+#endif
+            for(; i < size; ++i)
+                dst[i] = encodeRange(src[i], scale, exact);
+            return exact;
+        }
+
+        /** Decodes size ranges into dst */
+        inline void decodeRanges(const uint16_t *src, size_t size, uint16_t scale, uint32_t *dst)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            //unsigned comparisons by flipping the sign bit
+            const __m128i sign = _mm_set1_epi16(short(0x8000));
+            const __m128i errors = _mm_xor_si128(_mm_set1_epi16(END_LASER_RANGE_ERRORS), sign);
+            const __m128i factor = _mm_set1_epi16(short(scale));
+            for(; i + 8 <= size; i += 8)
+            {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                //32 bit products of the 16 bit values
+                const __m128i lo = _mm_mullo_epi16(v, factor);
+                const __m128i hi = _mm_mulhi_epu16(v, factor);
+                //error codes are kept unchanged
+                const __m128i error = _mm_cmplt_epi16(_mm_xor_si128(v, sign), errors);
+                const __m128i p_lo = _mm_or_si128(_mm_and_si128(error, v), _mm_andnot_si128(error, lo));
+                const __m128i p_hi = _mm_andnot_si128(error, hi);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_unpacklo_epi16(p_lo, p_hi));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_unpackhi_epi16(p_lo, p_hi));
+            }
+#endif
+            for(; i < size; ++i)
+                dst[i] = decodeRange(src[i], scale);
+        }
+
+        /** Encodes remissions as multiples of scale, rounded to the nearest
+         * multiple with ties rounded up and clamped to the range of T
+         * (uint8_t or uint16_t)
+         *
+         * @return true if decodeRemissions restores the values exactly
+         */
+        template<typename T>
+        inline bool encodeRemissions(const float *src, size_t size, float scale, T *dst)
+        {
+            const float max_value = T(-1);
+            bool exact = true;
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128 factor = _mm_set1_ps(scale);
+            const __m128 lower = _mm_setzero_ps();
+            const __m128 upper = _mm_set1_ps(max_value);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128i bias32 = _mm_set1_epi32(0x8000);
+            const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+            __m128i mismatch = _mm_setzero_si128();
+            for(; i + 8 <= size; i += 8)
+            {
+                const __m128 r0 = _mm_loadu_ps(src + i);
+                const __m128 r1 = _mm_loadu_ps(src + i + 4);
+                //clamping also maps NaN to zero, which is detected below
+                const __m128 c0 = _mm_min_ps(_mm_max_ps(_mm_div_ps(r0, factor), lower), upper);
+                const __m128 c1 = _mm_min_ps(_mm_max_ps(_mm_div_ps(r1, factor), lower), upper);
+                //rounds ties up like the scalar code, the values are positive
+                const __m128i q0 = _mm_cvttps_epi32(_mm_add_ps(c0, half));
+                const __m128i q1 = _mm_cvttps_epi32(_mm_add_ps(c1, half));
+                mismatch = _mm_or_si128(mismatch, _mm_castps_si128(_mm_cmpneq_ps(_mm_mul_ps(_mm_cvtepi32_ps(q0), factor), r0)));
+                mismatch = _mm_or_si128(mismatch, _mm_castps_si128(_mm_cmpneq_ps(_mm_mul_ps(_mm_cvtepi32_ps(q1), factor), r1)));
+                //the values are already clamped to the range of T
+                if(sizeof(T) == 1)
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_setzero_si128()));
+                else
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                            _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(q0, bias32), _mm_sub_epi32(q1, bias32)), bias16));
+            }
+            if(_mm_movemask_epi8(mismatch))
+                exact = false;
+#endif
+            for(; i < size; ++i)
+            {
+                const float value = src[i] / scale;
+                const float clamped = value > 0 ? (value < max_value ? value : max_value) : 0;
+                dst[i] = T(floor(clamped + 0.5f));
+                if(dst[i] * scale != src[i])
+                    exact = false;
+            }
+            return exact;
+        }
+
+        /** Decodes size remissions into dst */
+        template<typename T>
+        inline void decodeRemissions(const T *src, size_t size, float scale, float *dst)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128 factor = _mm_set1_ps(scale);
+            const __m128i zero = _mm_setzero_si128();
+            for(; i + 8 <= size; i += 8)
+            {
+                __m128i v;
+                if(sizeof(T) == 1)
+                    v = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)), zero);
+                else
+                    v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), factor));
+                _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), factor));
+            }
+#endif
+            for(; i < size; ++i)
+                dst[i] = src[i] * scale;
+        }
+    }
+
+    /** Compact representation of a LaserScan for storage and transport
+     *
+     * Ranges are stored as 16 bit values in units of range_scale
+     * millimeters, remissions optionally as 8 or 16 bit values in units of
+     * remission_scale. The special LASER_RANGE_ERRORS values are preserved.
+     * This needs 2 to 4 bytes per beam instead of 8.
+     *
+     * The conversion is lossless if all valid ranges are multiples of
+     * range_scale up to 65535 * range_scale and all remissions are
+     * multiples of remission_scale which fit into the chosen encoding.
+     * compress() reports whether this is the case.
+     */
+    struct CompactLaserScan
+    {
+        enum RemissionEncoding
+        {
+            REMISSION_NONE,
+            REMISSION_UINT8,
+            REMISSION_UINT16
+        };
+
+        CompactLaserScan()
+            : start_angle(0), angular_resolution(0), speed(0), minRange(0), maxRange(0)
+            , range_scale(1), remission_encoding(REMISSION_UINT16), remission_scale(1) {}
+
+        explicit CompactLaserScan(const LaserScan &scan, uint16_t range_scale = 1,
+                RemissionEncoding remission_encoding = REMISSION_UINT16, float remission_scale = 1)
+        {
+            compress(scan, range_scale, remission_encoding, remission_scale);
+        }
+
+        /** Converts scan. The memory of the vectors is reused
+         *
+         * @param range_scale unit of the stored ranges in millimeters
+         * @param remission_encoding REMISSION_NONE drops the remissions
+         * @param remission_scale unit of the stored remissions
+         * @return true if decompress() restores scan exactly
+         * @throws std::runtime_error if a scale is not positive
+         */
+        bool compress(const LaserScan &scan, uint16_t range_scale = 1,
+                RemissionEncoding remission_encoding = REMISSION_UINT16, float remission_scale = 1)
+        {
+            if(range_scale == 0 || !(remission_scale > 0))
+                throw std::runtime_error("CompactLaserScan::compress: the scales must be positive");
+            time = scan.time;
+            start_angle = scan.start_angle;
+            angular_resolution = scan.angular_resolution;
+            speed = scan.speed;
+            minRange = scan.minRange;
+            maxRange = scan.maxRange;
+            this->range_scale = range_scale;
+            this->remission_encoding = remission_encoding;
+            this->remission_scale = remission_scale;
+
+            ranges.resize(scan.ranges.size());
+            bool exact = true;
+            if(!ranges.empty())
+                exact = detail::encodeRanges(&scan.ranges[0], ranges.size(), range_scale, &ranges[0]);
+
+            const size_t remission_count = scan.remission.size();
+            remission8.clear();
+            remission16.clear();
+            if(remission_encoding == REMISSION_NONE)
+                return exact && remission_count == 0;
+            if(remission_encoding == REMISSION_UINT8)
+            {
+                remission8.resize(remission_count);
+                if(remission_count)
+                    exact &= detail::encodeRemissions(&scan.remission[0], remission_count, remission_scale, &remission8[0]);
+            }
+            else
+            {
+                remission16.resize(remission_count);
+                if(remission_count)
+                    exact &= detail::encodeRemissions(&scan.remission[0], remission_count, remission_scale, &remission16[0]);
+            }
+            return exact;
+        }
+
+        /** Restores the scan. The memory of scan is reused */
+        void decompress(LaserScan &scan) const
+        {
+            scan.time = time;
+            scan.start_angle = start_angle;
+            scan.angular_resolution = angular_resolution;
+            scan.speed = speed;
+            scan.minRange = minRange;
+            scan.maxRange = maxRange;
+            scan.ranges.resize(ranges.size());
+            if(!ranges.empty())
+                detail::decodeRanges(&ranges[0], ranges.size(), range_scale, &scan.ranges[0]);
+
+            if(remission_encoding == REMISSION_UINT8)
+            {
+                scan.remission.resize(remission8.size());
+                if(!remission8.empty())
+                    detail::decodeRemissions(&remission8[0], remission8.size(), remission_scale, &scan.remission[0]);
+            }
+            else if(remission_encoding == REMISSION_UINT16)
+            {
+                scan.remission.resize(remission16.size());
+                if(!remission16.empty())
+                    detail::decodeRemissions(&remission16[0], remission16.size(), remission_scale, &scan.remission[0]);
+            }
+            else
+                scan.remission.clear();
+        }
+
+        Time time;
+        double start_angle;
+        double angular_resolution;
+        double speed;
+        uint32_t minRange;
+        uint32_t maxRange;
+
+        /** unit of ranges in millimeters */
+        uint16_t range_scale;
+        /** ranges in units of range_scale, values below
+         * END_LASER_RANGE_ERRORS are the error codes of LaserScan */
+        std::vector<uint16_t> ranges;
+
+        RemissionEncoding remission_encoding;
+        /** unit of the stored remissions */
+        float remission_scale;
+        /** remissions if remission_encoding is REMISSION_UINT8 */
+        std::vector<uint8_t> remission8;
+        /** remissions if remission_encoding is REMISSION_UINT16 */
+        std::vector<uint16_t> remission16;
+    };
+}}
+
+#endif
@@ -0,0 +1,580 @@
+#ifndef BASE_SAMPLES_COMPACT_POINTCLOUD_H__
+#define BASE_SAMPLES_COMPACT_POINTCLOUD_H__
+
+#include <stdint.h>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <Eigen/Geometry>
+#include <base/Time.hpp>
+#include <base/samples/Pointcloud.hpp>
+
+namespace base { namespace samples {
+
+    namespace detail
+    {
+        /** packs a color with components in [0, 1] into RGBA8, red in the
+         * lowest byte. Components outside are clamped, NaN becomes 0 */
+        inline uint32_t packColor(const base::Vector4d &color)
+        {
+#ifdef __SSE2__
+            const __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(&color[0]));
+            const __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(&color[2]));
+            __m128 c = _mm_mul_ps(_mm_movelh_ps(low, high), _mm_set1_ps(255.0f));
+            c = _mm_min_ps(_mm_max_ps(_mm_add_ps(c, _mm_set1_ps(0.5f)), _mm_setzero_ps()), _mm_set1_ps(255.0f));
+            const __m128i i = _mm_cvttps_epi32(c);
+            return uint32_t(_mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(i, i), _mm_setzero_si128())));
+#else
+            uint32_t packed = 0;
+            for(int j = 0; j < 4; ++j)
+            {
+                //NaN becomes 0 like with the SSE2 min and max
+                const double value = color[j] * 255 + 0.5;
+                if(!(value >= 0))
+                    continue;
+                packed |= uint32_t(std::min(value, 255.0)) << (8 * j);
+            }
+            return packed;
+#endif
+        }
+
+        inline base::Vector4d unpackColor(uint32_t packed)
+        {
+            const double scale = 1.0 / 255;
+            return base::Vector4d((packed & 0xFF) * scale, ((packed >> 8) & 0xFF) * scale,
+                    ((packed >> 16) & 0xFF) * scale, (packed >> 24) * scale);
+        }
+    }
+
+    /** Point cloud in structure of arrays layout with float coordinates
+     *
+     * Compared to Pointcloud, a point costs 12 instead of 24 bytes and a
+     * color 4 instead of 32 bytes. Each coordinate and channel is a
+     * contiguous array, so that kernels load four values of the same
+     * coordinate with one SIMD instruction instead of shuffling
+     * interleaved points.
+     *
+     * The optional channels hold one value per point if their bit is set in
+     * channels and are empty otherwise. resize() and push_back() keep all
+     * present channels at the size of the cloud, setChannels() adds and
+     * removes them.
+     *
+     * fromPointcloud() and toPointcloud() convert from and to Pointcloud.
+     * The coordinates are rounded to float, the color components to
+     * multiples of 1/255.
+     *
+     * Kernels which process whole channels get the pointers to a range of
+     * points from getBlock() or are called for consecutive blocks by
+     * forEachBlock(). Blocks do not share points, so they can also be
+     * processed in parallel.
+     */
+    struct CompactPointcloud
+    {
+        /** the optional channels */
+        enum Channel
+        {
+            INTENSITY = 1,
+            COLOR = 2,
+            NORMAL = 4,
+            TIME = 8,
+            RING = 16
+        };
+
+        /** Pointers to the coordinates and channels of the points begin to
+         * begin + size - 1, NULL for channels which are not present */
+        template<typename Float, typename Uint32, typename Uint16>
+        struct BlockOf
+        {
+            size_t begin;
+            size_t size;
+            Float *x;
+            Float *y;
+            Float *z;
+            Float *intensity;
+            Uint32 *colors;
+            Float *normal_x;
+            Float *normal_y;
+            Float *normal_z;
+            Uint32 *time_offsets;
+            Uint16 *rings;
+        };
+        typedef BlockOf<float, uint32_t, uint16_t> Block;
+        typedef BlockOf<const float, const uint32_t, const uint16_t> ConstBlock;
+
+        /** default number of points of forEachBlock(), the coordinates of
+         * a block fit into the L1 cache */
+        static size_t defaultBlockSize()
+        {
+            return 1024;
+        }
+
+        /** The timestamp of this reading */
+        Time time;
+
+        /** coordinates of the points */
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+
+        /** intensity of each point */
+        std::vector<float> intensity;
+        /** color of each point in RGBA8, red in the lowest byte */
+        std::vector<uint32_t> colors;
+        /** normal of each point */
+        std::vector<float> normal_x;
+        std::vector<float> normal_y;
+        std::vector<float> normal_z;
+        /** time of each point in microseconds after time */
+        std::vector<uint32_t> time_offsets;
+        /** ring (layer) of the scanner which measured each point */
+        std::vector<uint16_t> rings;
+
+        /** bit mask of the present channels, see Channel */
+        uint32_t channels;
+
+        CompactPointcloud() : channels(0) {}
+
+        size_t size() const
+        {
+            return x.size();
+        }
+
+        bool empty() const
+        {
+            return x.empty();
+        }
+
+        /** bit mask of the present channels */
+        uint32_t getChannels() const
+        {
+            return channels;
+        }
+
+        bool hasChannel(Channel channel) const
+        {
+            return getChannels() & channel;
+        }
+
+        /** Adds the channels of the mask which are missing, with zero
+         * values, and removes the others */
+        void setChannels(uint32_t channels)
+        {
+            this->channels = channels & (INTENSITY | COLOR | NORMAL | TIME | RING);
+            setChannel(intensity, channels & INTENSITY);
+            setChannel(colors, channels & COLOR);
+            setChannel(normal_x, channels & NORMAL);
+            setChannel(normal_y, channels & NORMAL);
+            setChannel(normal_z, channels & NORMAL);
+            setChannel(time_offsets, channels & TIME);
+            setChannel(rings, channels & RING);
+        }
+
+        /** resizes the coordinates and the present channels */
+        void resize(size_t size)
+        {
+            x.resize(size);
+            y.resize(size);
+            z.resize(size);
+            resizeChannels(channels, size);
+        }
+
+        void reserve(size_t size)
+        {
+            x.reserve(size);
+            y.reserve(size);
+            z.reserve(size);
+            if(channels & INTENSITY)
+                intensity.reserve(size);
+            if(channels & COLOR)
+                colors.reserve(size);
+            if(channels & NORMAL)
+            {
+                normal_x.reserve(size);
+                normal_y.reserve(size);
+                normal_z.reserve(size);
+            }
+            if(channels & TIME)
+                time_offsets.reserve(size);
+            if(channels & RING)
+                rings.reserve(size);
+        }
+
+        /** removes all points and channels */
+        void clear()
+        {
+            x.clear();
+            y.clear();
+            z.clear();
+            setChannels(0);
+        }
+
+        /** appends a point, its channels are zero */
+        void push_back(float px, float py, float pz)
+        {
+            x.push_back(px);
+            y.push_back(py);
+            z.push_back(pz);
+            resizeChannels(channels, x.size());
+        }
+
+        Eigen::Vector3f getPoint(size_t i) const
+        {
+            return Eigen::Vector3f(x[i], y[i], z[i]);
+        }
+
+        /** Converts cloud. The colors are kept if there is one per point */
+        void fromPointcloud(const Pointcloud &cloud)
+        {
+            const size_t count = cloud.points.size();
+            const bool has_colors = count && cloud.colors.size() == count;
+            time = cloud.time;
+            x.resize(count);
+            y.resize(count);
+            z.resize(count);
+            setChannels(has_colors ? COLOR : 0);
+            if(!count)
+                return;
+
+            const double *in = &cloud.points[0].x();
+            size_t i = 0;
+#ifdef __SSE2__
+            //two interleaved points are (x0 y0) (z0 x1) (y1 z1)
+            for(; i + 2 <= count; i += 2, in += 6)
+            {
+                const __m128d a = _mm_loadu_pd(in);
+                const __m128d b = _mm_loadu_pd(in + 2);
+                const __m128d c = _mm_loadu_pd(in + 4);
+                _mm_storel_pi(reinterpret_cast<__m64*>(&x[i]), _mm_cvtpd_ps(_mm_shuffle_pd(a, b, 2)));
+                _mm_storel_pi(reinterpret_cast<__m64*>(&y[i]), _mm_cvtpd_ps(_mm_shuffle_pd(a, c, 1)));
+                _mm_storel_pi(reinterpret_cast<__m64*>(&z[i]), _mm_cvtpd_ps(_mm_shuffle_pd(b, c, 2)));
+            }
+#endif
+            for(; i < count; ++i, in += 3)
+            {
+                x[i] = in[0];
+                y[i] = in[1];
+                z[i] = in[2];
+            }
+            if(has_colors)
+            {
+                for(size_t j = 0; j < count; ++j)
+                    colors[j] = detail::packColor(cloud.colors[j]);
+            }
+        }
+
+        /** Converts into cloud, its memory is reused. Colors are written
+         * if the cloud has the color channel */
+        void toPointcloud(Pointcloud &cloud) const
+        {
+            const size_t count = size();
+            cloud.time = time;
+            cloud.points.resize(count);
+            cloud.colors.resize(colors.size() == count ? count : 0);
+            if(!count)
+                return;
+
+            double *out = &cloud.points[0].x();
+            size_t i = 0;
+#ifdef __SSE2__
+            for(; i + 2 <= count; i += 2, out += 6)
+            {
+                const __m128d px = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&x[i]))));
+                const __m128d py = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&y[i]))));
+                const __m128d pz = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&z[i]))));
+                _mm_storeu_pd(out, _mm_unpacklo_pd(px, py));
+                _mm_storeu_pd(out + 2, _mm_shuffle_pd(pz, px, 2));
+                _mm_storeu_pd(out + 4, _mm_unpackhi_pd(py, pz));
+            }
+#endif
+            for(; i < count; ++i, out += 3)
+            {
+                out[0] = x[i];
+                out[1] = y[i];
+                out[2] = z[i];
+            }
+            for(size_t j = 0; j < cloud.colors.size(); ++j)
+                cloud.colors[j] = detail::unpackColor(colors[j]);
+        }
+
+        /** Transforms the points and rotates the normals */
+        void transform(const Eigen::Affine3d &transformation)
+        {
+            const Eigen::Matrix3f rotation = transformation.linear().cast<float>();
+            const Eigen::Vector3f translation = transformation.translation().cast<float>();
+            transformChannels(rotation, translation, x, y, z);
+            if(!normal_x.empty())
+                transformChannels(rotation, Eigen::Vector3f::Zero(), normal_x, normal_y, normal_z);
+        }
+
+        /** Computes the axis aligned bounding box of the points, which
+         * must be finite
+         *
+         * @return false if the cloud is empty
+         */
+        bool getBounds(Eigen::Vector3f &min, Eigen::Vector3f &max) const
+        {
+            const size_t count = size();
+            if(!count)
+                return false;
+            min = max = getPoint(0);
+            size_t i = 0;
+#ifdef __SSE2__
+            if(count >= 4)
+            {
+                __m128 min_x = _mm_loadu_ps(&x[0]), max_x = min_x;
+                __m128 min_y = _mm_loadu_ps(&y[0]), max_y = min_y;
+                __m128 min_z = _mm_loadu_ps(&z[0]), max_z = min_z;
+                for(i = 4; i + 4 <= count; i += 4)
+                {
+                    const __m128 px = _mm_loadu_ps(&x[i]);
+                    const __m128 py = _mm_loadu_ps(&y[i]);
+                    const __m128 pz = _mm_loadu_ps(&z[i]);
+                    min_x = _mm_min_ps(min_x, px);
+                    max_x = _mm_max_ps(max_x, px);
+                    min_y = _mm_min_ps(min_y, py);
+                    max_y = _mm_max_ps(max_y, py);
+                    min_z = _mm_min_ps(min_z, pz);
+                    max_z = _mm_max_ps(max_z, pz);
+                }
+                float lanes[6][4];
+                _mm_storeu_ps(lanes[0], min_x);
+                _mm_storeu_ps(lanes[1], min_y);
+                _mm_storeu_ps(lanes[2], min_z);
+                _mm_storeu_ps(lanes[3], max_x);
+                _mm_storeu_ps(lanes[4], max_y);
+                _mm_storeu_ps(lanes[5], max_z);
+                for(int j = 0; j < 4; ++j)
+                {
+                    for(int k = 0; k < 3; ++k)
+                    {
+                        min[k] = std::min(min[k], lanes[k][j]);
+                        max[k] = std::max(max[k], lanes[k + 3][j]);
+                    }
+                }
+            }
+#endif
+            for(; i < count; ++i)
+            {
+                const Eigen::Vector3f p = getPoint(i);
+                min = min.cwiseMin(p);
+                max = max.cwiseMax(p);
+            }
+            return true;
+        }
+
+        /** Removes the points with NaN coordinates together with their
+         * channels
+         *
+         * @return the number of removed points
+         */
+        size_t removeInvalid()
+        {
+            const size_t count = size();
+            size_t kept = 0;
+            size_t i = 0;
+#ifdef __SSE2__
+            //blocks of valid points in front are kept in place
+            for(; i + 4 <= count; i += 4)
+            {
+                const __m128 ordered = _mm_and_ps(_mm_cmpord_ps(_mm_loadu_ps(&x[i]), _mm_loadu_ps(&y[i])),
+                        _mm_cmpord_ps(_mm_loadu_ps(&z[i]), _mm_loadu_ps(&z[i])));
+                if(_mm_movemask_ps(ordered) != 0xF)
+                    break;
+            }
+            kept = i;
+#endif
+            for(; i < count; ++i)
+            {
+                if(!(x[i] == x[i] && y[i] == y[i] && z[i] == z[i]))
+                    continue;
+                if(i != kept)
+                    movePoint(i, kept);
+                ++kept;
+            }
+            resize(kept);
+            return count - kept;
+        }
+
+        /** Copies the points with the given indices and their channels
+         * into out, whose memory is reused */
+        void select(const std::vector<size_t> &indices, CompactPointcloud &out) const
+        {
+            out.time = time;
+            out.x.resize(indices.size());
+            out.y.resize(indices.size());
+            out.z.resize(indices.size());
+            out.setChannels(channels);
+            for(size_t i = 0; i < indices.size(); ++i)
+                out.copyPoint(*this, indices[i], i);
+        }
+
+        /** pointers to the points begin to end - 1 */
+        Block getBlock(size_t begin, size_t end)
+        {
+            Block block;
+            fillBlock(*this, begin, end, block);
+            return block;
+        }
+
+        /** pointers to the points begin to end - 1 */
+        ConstBlock getBlock(size_t begin, size_t end) const
+        {
+            ConstBlock block;
+            fillBlock(*this, begin, end, block);
+            return block;
+        }
+
+        /** Calls functor(block) for consecutive blocks of at most
+         * block_size points which cover the cloud and returns the functor */
+        template<typename Functor>
+        Functor forEachBlock(Functor functor, size_t block_size = defaultBlockSize())
+        {
+            block_size = std::max<size_t>(block_size, 1);
+            for(size_t begin = 0; begin < size(); begin += block_size)
+                functor(getBlock(begin, std::min(size(), begin + block_size)));
+            return functor;
+        }
+
+        template<typename Functor>
+        Functor forEachBlock(Functor functor, size_t block_size = defaultBlockSize()) const
+        {
+            block_size = std::max<size_t>(block_size, 1);
+            for(size_t begin = 0; begin < size(); begin += block_size)
+                functor(getBlock(begin, std::min(size(), begin + block_size)));
+            return functor;
+        }
+
+    private:
+        template<typename T, typename Vector>
+        static T *channelPointer(Vector &channel, size_t begin)
+        {
+            return channel.empty() ? NULL : &channel[0] + begin;
+        }
+
+        /** Cloud is CompactPointcloud for Block and const CompactPointcloud
+         * for ConstBlock */
+        template<typename Cloud, typename Float, typename Uint32, typename Uint16>
+        static void fillBlock(Cloud &cloud, size_t begin, size_t end, BlockOf<Float, Uint32, Uint16> &block)
+        {
+            block.begin = begin;
+            block.size = end - begin;
+            block.x = channelPointer<Float>(cloud.x, begin);
+            block.y = channelPointer<Float>(cloud.y, begin);
+            block.z = channelPointer<Float>(cloud.z, begin);
+            block.intensity = channelPointer<Float>(cloud.intensity, begin);
+            block.colors = channelPointer<Uint32>(cloud.colors, begin);
+            block.normal_x = channelPointer<Float>(cloud.normal_x, begin);
+            block.normal_y = channelPointer<Float>(cloud.normal_y, begin);
+            block.normal_z = channelPointer<Float>(cloud.normal_z, begin);
+            block.time_offsets = channelPointer<Uint32>(cloud.time_offsets, begin);
+            block.rings = channelPointer<Uint16>(cloud.rings, begin);
+        }
+
+        template<typename T>
+        void setChannel(std::vector<T> &channel, bool present)
+        {
+            if(!present)
+            {
+                std::vector<T>().swap(channel);
+                return;
+            }
+            channel.resize(size());
+        }
+
+        void resizeChannels(uint32_t channels, size_t size)
+        {
+            if(channels & INTENSITY)
+                intensity.resize(size);
+            if(channels & COLOR)
+                colors.resize(size);
+            if(channels & NORMAL)
+            {
+                normal_x.resize(size);
+                normal_y.resize(size);
+                normal_z.resize(size);
+            }
+            if(channels & TIME)
+                time_offsets.resize(size);
+            if(channels & RING)
+                rings.resize(size);
+        }
+
+        void movePoint(size_t from, size_t to)
+        {
+            x[to] = x[from];
+            y[to] = y[from];
+            z[to] = z[from];
+            if(!intensity.empty())
+                intensity[to] = intensity[from];
+            if(!colors.empty())
+                colors[to] = colors[from];
+            if(!normal_x.empty())
+            {
+                normal_x[to] = normal_x[from];
+                normal_y[to] = normal_y[from];
+                normal_z[to] = normal_z[from];
+            }
+            if(!time_offsets.empty())
+                time_offsets[to] = time_offsets[from];
+            if(!rings.empty())
+                rings[to] = rings[from];
+        }
+
+        void copyPoint(const CompactPointcloud &cloud, size_t from, size_t to)
+        {
+            x[to] = cloud.x[from];
+            y[to] = cloud.y[from];
+            z[to] = cloud.z[from];
+            if(!cloud.intensity.empty())
+                intensity[to] = cloud.intensity[from];
+            if(!cloud.colors.empty())
+                colors[to] = cloud.colors[from];
+            if(!cloud.normal_x.empty())
+            {
+                normal_x[to] = cloud.normal_x[from];
+                normal_y[to] = cloud.normal_y[from];
+                normal_z[to] = cloud.normal_z[from];
+            }
+            if(!cloud.time_offsets.empty())
+                time_offsets[to] = cloud.time_offsets[from];
+            if(!cloud.rings.empty())
+                rings[to] = cloud.rings[from];
+        }
+
+        static void transformChannels(const Eigen::Matrix3f &r, const Eigen::Vector3f &t,
+                std::vector<float> &x, std::vector<float> &y, std::vector<float> &z)
+        {
+            const size_t count = x.size();
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128 r00 = _mm_set1_ps(r(0, 0)), r01 = _mm_set1_ps(r(0, 1)), r02 = _mm_set1_ps(r(0, 2));
+            const __m128 r10 = _mm_set1_ps(r(1, 0)), r11 = _mm_set1_ps(r(1, 1)), r12 = _mm_set1_ps(r(1, 2));
+            const __m128 r20 = _mm_set1_ps(r(2, 0)), r21 = _mm_set1_ps(r(2, 1)), r22 = _mm_set1_ps(r(2, 2));
+            const __m128 tx = _mm_set1_ps(t.x()), ty = _mm_set1_ps(t.y()), tz = _mm_set1_ps(t.z());
+            for(; i + 4 <= count; i += 4)
+            {
+                const __m128 px = _mm_loadu_ps(&x[i]);
+                const __m128 py = _mm_loadu_ps(&y[i]);
+                const __m128 pz = _mm_loadu_ps(&z[i]);
+                _mm_storeu_ps(&x[i], _mm_add_ps(tx, _mm_add_ps(_mm_mul_ps(r00, px), _mm_add_ps(_mm_mul_ps(r01, py), _mm_mul_ps(r02, pz)))));
+                _mm_storeu_ps(&y[i], _mm_add_ps(ty, _mm_add_ps(_mm_mul_ps(r10, px), _mm_add_ps(_mm_mul_ps(r11, py), _mm_mul_ps(r12, pz)))));
+                _mm_storeu_ps(&z[i], _mm_add_ps(tz, _mm_add_ps(_mm_mul_ps(r20, px), _mm_add_ps(_mm_mul_ps(r21, py), _mm_mul_ps(r22, pz)))));
+            }
+#endif
+            for(; i < count; ++i)
+            {
+                const Eigen::Vector3f p = r * Eigen::Vector3f(x[i], y[i], z[i]) + t;
+                x[i] = p.x();
+                y[i] = p.y();
+                z[i] = p.z();
+            }
+        }
+    };
+}}
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef BASE_SAMPLES_COMPRESSED_SONARSCAN_H__
+#define BASE_SAMPLES_COMPRESSED_SONARSCAN_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <base/Time.hpp>
+#include <base/Angle.hpp>
+#include <base/samples/SonarBeam.hpp>
+#include <base/samples/SonarScan.hpp>
+
+namespace base { namespace samples {
+
+    namespace detail
+    {
+        /** Byte oriented codec for sonar intensities
+         *
+         * The stream starts with the number of values as varint followed by
+         * tokens. The upper two bits of the first byte of a token select its
+         * type, the lower six bits hold the number of values minus one:
+         *  - ZERO_RUN   run of zeros, followed by a varint extending the
+         *               length if the lower bits are all set
+         *  - REPEAT_RUN like ZERO_RUN but followed by the repeated value
+         *  - LITERAL    followed by the raw values
+         *  - DELTA      followed by 4 bit signed differences to the previous
+         *               value, two per byte, low nibble first
+         *
+         * The previous value of the first token is zero.
+         */
+        enum SonarCodecToken
+        {
+            ZERO_RUN = 0x00,
+            LITERAL = 0x40,
+            DELTA = 0x80,
+            REPEAT_RUN = 0xC0
+        };
+
+        enum { MAX_TOKEN_LENGTH = 64 };
+
+        inline void writeVarint(size_t value, std::vector<uint8_t> &out)
+        {
+            while(value >= 0x80)
+            {
+                out.push_back(uint8_t(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(uint8_t(value));
+        }
+
+        inline size_t readVarint(const uint8_t *&in, const uint8_t *end)
+        {
+            size_t value = 0;
+            for(int shift = 0; in != end && shift < 64; shift += 7)
+            {
+                const uint8_t byte = *in++;
+                value |= size_t(byte & 0x7F) << shift;
+                if(!(byte & 0x80))
+                    return value;
+            }
+            throw std::runtime_error("decompressSonarData: truncated varint");
+        }
+
+        /** number of values equal to src[0], at most size */
+        inline size_t runLength(const uint8_t *src, size_t size)
+        {
+            const uint8_t value = src[0];
+            size_t i = 1;
+#ifdef __SSE2__
+            const __m128i reference = _mm_set1_epi8(char(value));
+            for(; i + 16 <= size; i += 16)
+            {
+                const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), reference));
+                if(mask != 0xFFFF)
+                    return i + __builtin_ctz(~mask);
+            }
+#endif
+            for(; i < size && src[i] == value; ++i);
+            return i;
+        }
+
+        inline bool isSmallDelta(int delta)
+        {
+            return delta >= -8 && delta <= 7;
+        }
+
+        //runs shorter than this are cheaper as literal or delta
+        inline bool startsRun(const uint8_t *src, size_t size)
+        {
+            const size_t min_length = src[0] == 0 ? 2 : 4;
+            if(size < min_length)
+                return false;
+            for(size_t i = 1; i < min_length; ++i)
+                if(src[i] != src[0])
+                    return false;
+            return true;
+        }
+
+        //number of values which can be delta encoded, stops in front of runs
+        inline size_t deltaLength(const uint8_t *src, size_t size, uint8_t previous)
+        {
+            size = std::min(size, size_t(MAX_TOKEN_LENGTH));
+            size_t i = 0;
+            for(; i < size && isSmallDelta(int(src[i]) - previous); ++i)
+            {
+                if(i && startsRun(src + i, size - i))
+                    break;
+                previous = src[i];
+            }
+            return i;
+        }
+
+        inline void writeToken(uint8_t type, size_t length, std::vector<uint8_t> &out)
+        {
+            //only runs can be longer than MAX_TOKEN_LENGTH
+            if((type == ZERO_RUN || type == REPEAT_RUN) && length >= MAX_TOKEN_LENGTH)
+            {
+                out.push_back(type | (MAX_TOKEN_LENGTH - 1));
+                writeVarint(length - MAX_TOKEN_LENGTH, out);
+            }
+            else
+                out.push_back(type | uint8_t(length - 1));
+        }
+
+        /** Appends the compressed representation of src to out */
+        inline void compressSonarData(const uint8_t *src, size_t size, std::vector<uint8_t> &out)
+        {
+            writeVarint(size, out);
+            uint8_t previous = 0;
+            size_t i = 0;
+            while(i < size)
+            {
+                if(startsRun(src + i, size - i))
+                {
+                    const size_t length = runLength(src + i, size - i);
+                    if(src[i] == 0)
+                        writeToken(ZERO_RUN, length, out);
+                    else
+                    {
+                        writeToken(REPEAT_RUN, length, out);
+                        out.push_back(src[i]);
+                    }
+                    previous = src[i];
+                    i += length;
+                    continue;
+                }
+
+                const size_t delta_length = deltaLength(src + i, size - i, previous);
+                if(delta_length >= 4)
+                {
+                    writeToken(DELTA, delta_length, out);
+                    for(size_t j = 0; j < delta_length; j += 2)
+                    {
+                        uint8_t byte = (src[i + j] - previous) & 0x0F;
+                        previous = src[i + j];
+                        if(j + 1 < delta_length)
+                        {
+                            byte |= ((src[i + j + 1] - previous) & 0x0F) << 4;
+                            previous = src[i + j + 1];
+                        }
+                        out.push_back(byte);
+                    }
+                    i += delta_length;
+                    continue;
+                }
+
+                //literals up to the next run or delta sequence
+                size_t length = 1;
+                const size_t max_length = std::min(size - i, size_t(MAX_TOKEN_LENGTH));
+                while(length < max_length && !startsRun(src + i + length, size - i - length)
+                        && deltaLength(src + i + length, std::min(size - i - length, size_t(4)), src[i + length - 1]) < 4)
+                    ++length;
+                writeToken(LITERAL, length, out);
+                out.insert(out.end(), src + i, src + i + length);
+                previous = src[i + length - 1];
+                i += length;
+            }
+        }
+
+        /** Returns the number of values stored in the compressed stream */
+        inline size_t decompressedSize(const uint8_t *in, size_t size)
+        {
+            return readVarint(in, in + size);
+        }
+
+        /** Returns the number of values stored in the compressed stream
+         * after checking that its tokens hold exactly that many values, so
+         * that a corrupted count does not allocate more than the stream
+         * can fill
+         *
+         * @throws std::runtime_error if the stream is corrupted
+         */
+        inline size_t validatedSize(const uint8_t *in, size_t size)
+        {
+            const uint8_t *end = in + size;
+            const size_t count = readVarint(in, end);
+            size_t values = 0;
+            while(values != count)
+            {
+                if(in == end)
+                    throw std::runtime_error("decompressSonarData: truncated data");
+                const uint8_t type = *in & 0xC0;
+                size_t length = (*in++ & 0x3F) + 1;
+                if((type == ZERO_RUN || type == REPEAT_RUN) && length == MAX_TOKEN_LENGTH)
+                    length += readVarint(in, end);
+                if(length > count - values)
+                    throw std::runtime_error("decompressSonarData: too many values");
+                const size_t bytes = type == REPEAT_RUN ? 1 : type == LITERAL ? length
+                    : type == DELTA ? (length + 1) / 2 : 0;
+                if(bytes > size_t(end - in))
+                    throw std::runtime_error("decompressSonarData: truncated data");
+                in += bytes;
+                values += length;
+            }
+            return count;
+        }
+
+        /** Decompresses the stream into dst which must hold
+         * decompressedSize() values */
+        inline void decompressSonarData(const uint8_t *in, size_t size, uint8_t *dst)
+        {
+            const uint8_t *end = in + size;
+            const size_t count = readVarint(in, end);
+            uint8_t *out = dst;
+            uint8_t *out_end = dst + count;
+            uint8_t previous = 0;
+            while(out != out_end)
+            {
+                if(in == end)
+                    throw std::runtime_error("decompressSonarData: truncated data");
+                const uint8_t type = *in & 0xC0;
+                size_t length = (*in++ & 0x3F) + 1;
+                if((type == ZERO_RUN || type == REPEAT_RUN) && length == MAX_TOKEN_LENGTH)
+                    length += readVarint(in, end);
+                if(length > size_t(out_end - out))
+                    throw std::runtime_error("decompressSonarData: too many values");
+
+                switch(type)
+                {
+                case ZERO_RUN:
+                    memset(out, 0, length);
+                    previous = 0;
+                    break;
+                case REPEAT_RUN:
+                    if(in == end)
+                        throw std::runtime_error("decompressSonarData: truncated data");
+                    previous = *in++;
+                    memset(out, previous, length);
+                    break;
+                case LITERAL:
+                    if(length > size_t(end - in))
+                        throw std::runtime_error("decompressSonarData: truncated data");
+                    memcpy(out, in, length);
+                    in += length;
+                    previous = out[length - 1];
+                    break;
+                default:
+                    if((length + 1) / 2 > size_t(end - in))
+                        throw std::runtime_error("decompressSonarData: truncated data");
+                    for(size_t j = 0; j < length; j += 2, ++in)
+                    {
+                        //sign extension of the nibbles
+                        previous += int8_t(*in << 4) >> 4;
+                        out[j] = previous;
+                        if(j + 1 < length)
+                        {
+                            previous += int8_t(*in) >> 4;
+                            out[j + 1] = previous;
+                        }
+                    }
+                }
+                out += length;
+            }
+        }
+    }
+
+    /** Compressed representation of a SonarBeam
+     *
+     * All header fields are stored uncompressed, the bins are compressed
+     * with a combination of zero run-length, repeat run-length and 4 bit
+     * delta encoding which suits the mostly empty water column of sonar
+     * beams.
+     */
+    struct CompressedSonarBeam
+    {
+        CompressedSonarBeam()
+            : sampling_interval(0), speed_of_sound(0)
+            , beamwidth_horizontal(0), beamwidth_vertical(0) {}
+
+        explicit CompressedSonarBeam(const SonarBeam &sonar_beam)
+        {
+            compress(sonar_beam);
+        }
+
+        /** Compresses sonar_beam. The memory of data is reused */
+        void compress(const SonarBeam &sonar_beam)
+        {
+            time = sonar_beam.time;
+            bearing = sonar_beam.bearing;
+            sampling_interval = sonar_beam.sampling_interval;
+            speed_of_sound = sonar_beam.speed_of_sound;
+            beamwidth_horizontal = sonar_beam.beamwidth_horizontal;
+            beamwidth_vertical = sonar_beam.beamwidth_vertical;
+            data.clear();
+            detail::compressSonarData(sonar_beam.beam.empty() ? NULL : &sonar_beam.beam[0],
+                    sonar_beam.beam.size(), data);
+        }
+
+        /** Restores the original beam. The memory of sonar_beam is reused
+         *
+         * @throws std::runtime_error if data is corrupted
+         */
+        void decompress(SonarBeam &sonar_beam) const
+        {
+            sonar_beam.time = time;
+            sonar_beam.bearing = bearing;
+            sonar_beam.sampling_interval = sampling_interval;
+            sonar_beam.speed_of_sound = speed_of_sound;
+            sonar_beam.beamwidth_horizontal = beamwidth_horizontal;
+            sonar_beam.beamwidth_vertical = beamwidth_vertical;
+            if(data.empty())
+                throw std::runtime_error("CompressedSonarBeam::decompress: no data");
+            //the beam has no size of its own which the count could be checked against
+            sonar_beam.beam.resize(detail::validatedSize(&data[0], data.size()));
+            if(!sonar_beam.beam.empty())
+                detail::decompressSonarData(&data[0], data.size(), &sonar_beam.beam[0]);
+        }
+
+        Time time;
+        Angle bearing;
+        double sampling_interval;
+        float speed_of_sound;
+        float beamwidth_horizontal;
+        float beamwidth_vertical;
+
+        /** compressed bins */
+        std::vector<uint8_t> data;
+    };
+
+    /** Compressed representation of a SonarScan
+     *
+     * All header fields and the beam time stamps are stored uncompressed,
+     * the data is compressed in its memory layout with the same codec as
+     * CompressedSonarBeam.
+     */
+    struct CompressedSonarScan
+    {
+        CompressedSonarScan()
+            : number_of_beams(0), number_of_bins(0), sampling_interval(0), speed_of_sound(0)
+            , memory_layout_column(false), polar_coordinates(true) {}
+
+        explicit CompressedSonarScan(const SonarScan &sonar_scan)
+        {
+            compress(sonar_scan);
+        }
+
+        /** Compresses sonar_scan. The memory of data is reused */
+        void compress(const SonarScan &sonar_scan)
+        {
+            time = sonar_scan.time;
+            time_beams = sonar_scan.time_beams;
+            number_of_beams = sonar_scan.number_of_beams;
+            number_of_bins = sonar_scan.number_of_bins;
+            start_bearing = sonar_scan.start_bearing;
+            angular_resolution = sonar_scan.angular_resolution;
+            sampling_interval = sonar_scan.sampling_interval;
+            speed_of_sound = sonar_scan.speed_of_sound;
+            beamwidth_horizontal = sonar_scan.beamwidth_horizontal;
+            beamwidth_vertical = sonar_scan.beamwidth_vertical;
+            memory_layout_column = sonar_scan.memory_layout_column;
+            polar_coordinates = sonar_scan.polar_coordinates;
+            data.clear();
+            detail::compressSonarData(sonar_scan.data.empty() ? NULL : &sonar_scan.data[0],
+                    sonar_scan.data.size(), data);
+        }
+
+        /** Restores the original scan. The memory of sonar_scan is reused
+         *
+         * @throws std::runtime_error if data is corrupted or does not hold
+         *         number_of_beams*number_of_bins values
+         */
+        void decompress(SonarScan &sonar_scan) const
+        {
+            sonar_scan.time = time;
+            sonar_scan.time_beams = time_beams;
+            sonar_scan.number_of_beams = number_of_beams;
+            sonar_scan.number_of_bins = number_of_bins;
+            sonar_scan.start_bearing = start_bearing;
+            sonar_scan.angular_resolution = angular_resolution;
+            sonar_scan.sampling_interval = sampling_interval;
+            sonar_scan.speed_of_sound = speed_of_sound;
+            sonar_scan.beamwidth_horizontal = beamwidth_horizontal;
+            sonar_scan.beamwidth_vertical = beamwidth_vertical;
+            sonar_scan.memory_layout_column = memory_layout_column;
+            sonar_scan.polar_coordinates = polar_coordinates;
+            if(data.empty())
+                throw std::runtime_error("CompressedSonarScan::decompress: no data");
+            const size_t size = detail::decompressedSize(&data[0], data.size());
+            if(size != size_t(number_of_beams) * number_of_bins)
+                throw std::runtime_error("CompressedSonarScan::decompress: the data does not match number_of_beams*number_of_bins");
+            sonar_scan.data.resize(size);
+            if(!sonar_scan.data.empty())
+                detail::decompressSonarData(&data[0], data.size(), &sonar_scan.data[0]);
+        }
+
+        Time time;
+        std::vector<base::Time> time_beams;
+        uint16_t number_of_beams;
+        uint16_t number_of_bins;
+        Angle start_bearing;
+        Angle angular_resolution;
+        double sampling_interval;
+        float speed_of_sound;
+        Angle beamwidth_horizontal;
+        Angle beamwidth_vertical;
+        bool memory_layout_column;
+        bool polar_coordinates;
+
+        /** compressed data */
+        std::vector<uint8_t> data;
+    };
+}}
+
+#endif
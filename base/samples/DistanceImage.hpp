@@ -122,15 +122,25 @@ namespace samples
 	    return true;
 	}
 
+        /** 
+         * Converts the distance image into a pointcloud holding the scene
+         * points of all pixels with a distance value, see getScenePoint().
+         *
+         * DistanceImageConverter does the same with a cached ray table,
+         * SIMD and threads, and reuses the memory of the pointcloud.
+         */
         base::samples::Pointcloud getPointCloud() const
         {
             base::samples::Pointcloud pointCloud;
+            pointCloud.time = time;
+            pointCloud.points.reserve( data.size() );
             Eigen::Vector3d point;
             for(size_t y = 0; y < height ; y++)
             {
                 for(size_t x = 0; x < width ; x++)
                 {
-                    pointCloud.points.push_back(point);
+                    if( getScenePoint( x, y, point ) )
+                        pointCloud.points.push_back(point);
                 }
             }
             return pointCloud;
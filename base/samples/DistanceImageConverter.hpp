@@ -0,0 +1,360 @@
+#ifndef BASE_SAMPLES_DISTANCE_IMAGE_CONVERTER_H__
+#define BASE_SAMPLES_DISTANCE_IMAGE_CONVERTER_H__
+
+#include <stdint.h>
+#include <vector>
+#include <limits>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <boost/math/special_functions/fpclassify.hpp>
+#include <base/samples/DistanceImage.hpp>
+#include <base/samples/Pointcloud.hpp>
+
+namespace base { namespace samples {
+
+    namespace detail
+    {
+        /** bit mask of the lanes of d holding normal numbers, i.e. neither
+         * zero, subnormal, infinite nor NaN like boost::math::isnormal */
+        inline int normalMask(const float *d)
+        {
+#ifdef __SSE2__
+            const __m128i exponent = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(d)), 23),
+                    _mm_set1_epi32(0xFF));
+            const __m128i invalid = _mm_or_si128(_mm_cmpeq_epi32(exponent, _mm_setzero_si128()),
+                    _mm_cmpeq_epi32(exponent, _mm_set1_epi32(0xFF)));
+            return ~_mm_movemask_ps(_mm_castsi128_ps(invalid)) & 0xF;
+#else
+            int mask = 0;
+            for(int j = 0; j < 4; ++j)
+                mask |= int(boost::math::isnormal(d[j])) << j;
+            return mask;
+#endif
+        }
+
+        /** number of bits set in a 4 bit mask */
+        inline int maskCount(int mask)
+        {
+            static const int counts[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+            return counts[mask];
+        }
+    }
+
+    /** Converts distance images into points with a cached ray table
+     *
+     * The ray of pixel (x, y) is (x*scale_x+center_x, y*scale_y+center_y, 1),
+     * its point is the ray times the distance of the pixel. As the ray is
+     * separable, the table holds one x component per column and one y
+     * component per row. It is computed once and reused as long as
+     * consecutive images have the same size and intrinsics.
+     *
+     * Only pixels whose distance is a normal number give points, like in
+     * DistanceImage::getScenePoint(). The rows are converted in parallel
+     * with OpenMP: the valid pixels of each row are counted first, so that
+     * each row knows where its points start. Within a row, the validity of
+     * four pixels is tested at once with SSE2 on the exponent bits, and the
+     * points are computed with SSE2. Points are either written into a
+     * Pointcloud or into three float arrays (structure of arrays). The
+     * outputs are provided by the caller so that their memory is reused.
+     *
+     * The points of the Pointcloud are the ones of
+     * DistanceImage::getScenePoint() in row major order, up to float
+     * rounding as the ray table evaluates the projection in another order.
+     */
+    class DistanceImageConverter
+    {
+    public:
+        DistanceImageConverter()
+            : width(0), height(0), scale_x(0), scale_y(0), center_x(0), center_y(0)
+            , table_valid(false), point_count(0)
+        {
+        }
+
+        /** Converts image into cloud
+         *
+         * @param skip_invalid_points if false, invalid pixels generate NaN
+         *        points so that the indices match the pixels
+         * @return the number of points
+         * @throws std::runtime_error if the size of data does not match the
+         * size of the image
+         */
+        size_t convert(const DistanceImage &image, Pointcloud &cloud, bool skip_invalid_points = true)
+        {
+            prepare(image, skip_invalid_points);
+            cloud.time = image.time;
+            cloud.colors.clear();
+            cloud.points.resize(point_count);
+            if(!point_count)
+                return 0;
+
+            const int rows = height;
+            const size_t columns = width;
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            base::Point *points = &cloud.points[0];
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int row = 0; row < rows; ++row)
+            {
+                const float *d = &image.data[row * columns];
+                const double ry = ray_y[row];
+                base::Point *out = points + (skip_invalid_points ? offsets[row] : row * columns);
+                size_t x = 0;
+#ifdef __SSE2__
+                const __m128d ry2 = _mm_set1_pd(ry);
+                for(; x + 4 <= columns; x += 4)
+                {
+                    const int valid = detail::normalMask(d + x);
+                    if(skip_invalid_points && !valid)
+                        continue;
+                    const __m128 d4 = _mm_loadu_ps(d + x);
+                    const __m128 rx4 = _mm_loadu_ps(&ray_x[x]);
+                    //lanes 0, 1 and 2, 3 in double precision
+                    const __m128d d_lo = _mm_cvtps_pd(d4);
+                    const __m128d d_hi = _mm_cvtps_pd(_mm_movehl_ps(d4, d4));
+                    const __m128d px[2] = {_mm_mul_pd(_mm_cvtps_pd(rx4), d_lo), _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(rx4, rx4)), d_hi)};
+                    const __m128d py[2] = {_mm_mul_pd(ry2, d_lo), _mm_mul_pd(ry2, d_hi)};
+                    const __m128d pz[2] = {d_lo, d_hi};
+                    for(int j = 0; j < 4; ++j)
+                    {
+                        if(valid & (1 << j))
+                        {
+                            if(j & 1)
+                            {
+                                _mm_storeh_pd(&out->x(), px[j >> 1]);
+                                _mm_storeh_pd(&out->y(), py[j >> 1]);
+                                _mm_storeh_pd(&out->z(), pz[j >> 1]);
+                            }
+                            else
+                            {
+                                _mm_storel_pd(&out->x(), px[j >> 1]);
+                                _mm_storel_pd(&out->y(), py[j >> 1]);
+                                _mm_storel_pd(&out->z(), pz[j >> 1]);
+                            }
+                            ++out;
+                        }
+                        else if(!skip_invalid_points)
+                            *out++ = base::Point(nan, nan, nan);
+                    }
+                }
+#endif
+                for(; x < columns; ++x)
+                {
+                    if(boost::math::isnormal(d[x]))
+                    {
+                        const double distance = d[x];
+                        *out++ = base::Point(ray_x[x] * distance, ry * distance, distance);
+                    }
+                    else if(!skip_invalid_points)
+                        *out++ = base::Point(nan, nan, nan);
+                }
+            }
+            return point_count;
+        }
+
+        /** Converts image into float arrays (structure of arrays)
+         *
+         * x, y and z must hold width * height values each.
+         *
+         * @param skip_invalid_points if false, invalid pixels generate NaN
+         *        points so that the indices match the pixels
+         * @return the number of points written
+         * @throws std::runtime_error if the size of data does not match the
+         * size of the image
+         */
+        size_t convert(const DistanceImage &image, float *x, float *y, float *z, bool skip_invalid_points = true)
+        {
+            prepare(image, skip_invalid_points);
+            if(!point_count)
+                return 0;
+
+            const int rows = height;
+            const size_t columns = width;
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int row = 0; row < rows; ++row)
+            {
+                const float *d = &image.data[row * columns];
+                const float ry = ray_y[row];
+                size_t count = skip_invalid_points ? offsets[row] : row * columns;
+                size_t column = 0;
+#ifdef __SSE2__
+                const __m128 ry4 = _mm_set1_ps(ry);
+                const __m128 nan4 = _mm_set1_ps(nan);
+                float buffer[3][4];
+                for(; column + 4 <= columns; column += 4)
+                {
+                    const int valid = detail::normalMask(d + column);
+                    if(skip_invalid_points && !valid)
+                        continue;
+                    __m128 pz = _mm_loadu_ps(d + column);
+                    __m128 px = _mm_mul_ps(_mm_loadu_ps(&ray_x[column]), pz);
+                    __m128 py = _mm_mul_ps(ry4, pz);
+
+                    if(valid == 0xF || !skip_invalid_points)
+                    {
+                        if(valid != 0xF)
+                        {
+                            const __m128 mask = _mm_castsi128_ps(_mm_set_epi32(
+                                        valid & 8 ? -1 : 0, valid & 4 ? -1 : 0, valid & 2 ? -1 : 0, valid & 1 ? -1 : 0));
+                            px = _mm_or_ps(_mm_and_ps(mask, px), _mm_andnot_ps(mask, nan4));
+                            py = _mm_or_ps(_mm_and_ps(mask, py), _mm_andnot_ps(mask, nan4));
+                            pz = _mm_or_ps(_mm_and_ps(mask, pz), _mm_andnot_ps(mask, nan4));
+                        }
+                        _mm_storeu_ps(x + count, px);
+                        _mm_storeu_ps(y + count, py);
+                        _mm_storeu_ps(z + count, pz);
+                        count += 4;
+                        continue;
+                    }
+
+                    //compact the valid points
+                    _mm_storeu_ps(buffer[0], px);
+                    _mm_storeu_ps(buffer[1], py);
+                    _mm_storeu_ps(buffer[2], pz);
+                    for(int j = 0; j < 4; ++j)
+                    {
+                        if(!(valid & (1 << j)))
+                            continue;
+                        x[count] = buffer[0][j];
+                        y[count] = buffer[1][j];
+                        z[count] = buffer[2][j];
+                        ++count;
+                    }
+                }
+#endif
+                for(; column < columns; ++column)
+                {
+                    const float distance = d[column];
+                    if(boost::math::isnormal(distance))
+                    {
+                        x[count] = ray_x[column] * distance;
+                        y[count] = ry * distance;
+                        z[count] = distance;
+                        ++count;
+                    }
+                    else if(!skip_invalid_points)
+                    {
+                        x[count] = y[count] = z[count] = nan;
+                        ++count;
+                    }
+                }
+            }
+            return point_count;
+        }
+
+        /** Converts image into float vectors (structure of arrays). The
+         * vectors are resized to the number of points, their memory is
+         * reused */
+        size_t convert(const DistanceImage &image, std::vector<float> &x, std::vector<float> &y, std::vector<float> &z,
+                bool skip_invalid_points = true)
+        {
+            const size_t size = image.data.size();
+            x.resize(size);
+            y.resize(size);
+            z.resize(size);
+            if(!size)
+                return 0;
+            const size_t count = convert(image, &x[0], &y[0], &z[0], skip_invalid_points);
+            x.resize(count);
+            y.resize(count);
+            z.resize(count);
+            return count;
+        }
+
+        /** cached x component of the rays of the last converted image */
+        const std::vector<float> &getRaysX() const
+        {
+            return ray_x;
+        }
+
+        /** cached y component of the rays of the last converted image */
+        const std::vector<float> &getRaysY() const
+        {
+            return ray_y;
+        }
+
+    private:
+        //checks the image, updates the table and computes the index of the
+        //first point of each row
+        void prepare(const DistanceImage &image, bool skip_invalid_points)
+        {
+            if(image.data.size() != size_t(image.width) * image.height)
+                throw std::runtime_error("DistanceImageConverter: the size of data does not match the size of the image");
+            updateTable(image);
+            if(!skip_invalid_points || image.data.empty())
+            {
+                point_count = image.data.size();
+                return;
+            }
+
+            const int rows = height;
+            const size_t columns = width;
+            offsets.resize(rows + 1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int row = 0; row < rows; ++row)
+            {
+                const float *d = &image.data[row * columns];
+                size_t count = 0;
+                size_t x = 0;
+                for(; x + 4 <= columns; x += 4)
+                    count += detail::maskCount(detail::normalMask(d + x));
+                for(; x < columns; ++x)
+                    count += boost::math::isnormal(d[x]);
+                offsets[row + 1] = count;
+            }
+            offsets[0] = 0;
+            for(int row = 0; row < rows; ++row)
+                offsets[row + 1] += offsets[row];
+            point_count = offsets[rows];
+        }
+
+        void updateTable(const DistanceImage &image)
+        {
+            if(table_valid && width == image.width && height == image.height
+                    && scale_x == image.scale_x && scale_y == image.scale_y
+                    && center_x == image.center_x && center_y == image.center_y)
+                return;
+            width = image.width;
+            height = image.height;
+            scale_x = image.scale_x;
+            scale_y = image.scale_y;
+            center_x = image.center_x;
+            center_y = image.center_y;
+
+            //the same float expressions as in DistanceImage::getScenePoint()
+            ray_x.resize(width);
+            for(size_t x = 0; x < width; ++x)
+                ray_x[x] = (x * scale_x) + center_x;
+            ray_y.resize(height);
+            for(size_t y = 0; y < height; ++y)
+                ray_y[y] = (y * scale_y) + center_y;
+            table_valid = true;
+        }
+
+        uint16_t width;
+        uint16_t height;
+        float scale_x;
+        float scale_y;
+        float center_x;
+        float center_y;
+        bool table_valid;
+
+        std::vector<float> ray_x;
+        std::vector<float> ray_y;
+        std::vector<size_t> offsets;
+        size_t point_count;
+    };
+}}
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef BASE_SAMPLES_FRAME_QUALITY_H__
+#define BASE_SAMPLES_FRAME_QUALITY_H__
+
+#include <stdint.h>
+#include <stdexcept>
+
+#include <base/Time.hpp>
+#include <base/samples/Frame.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace base { namespace samples { namespace frame {
+
+    /** Parameters of the sampling grid used by computeFrameQuality()
+     *
+     * The metrics are evaluated at the pixels (1 + i*column_step, 1 +
+     * j*row_step). The kernels themselves always use the direct neighbours of
+     * a grid pixel, so a coarser grid makes the computation cheaper without
+     * changing what "sharp" means.
+     */
+    struct FrameQualityConfig
+    {
+        FrameQualityConfig()
+            : row_step(2), column_step(2)
+            , underexposure_level(5), overexposure_level(250)
+            , tenengrad_threshold(0) {}
+
+        /** distance in pixels between two evaluated rows */
+        uint16_t row_step;
+        /** distance in pixels between two evaluated columns
+         *
+         * 1, 2, 4 and 8 are processed with SIMD, any other value falls back
+         * to scalar code
+         */
+        uint16_t column_step;
+        /** pixels with an intensity less or equal to this value are counted as underexposed */
+        uint8_t underexposure_level;
+        /** pixels with an intensity greater or equal to this value are counted as overexposed */
+        uint8_t overexposure_level;
+        /** squared Sobel magnitudes below or equal to this value are not
+         * taken into account by the Tenengrad measure */
+        uint32_t tenengrad_threshold;
+    };
+
+    /** Sharpness and exposure measures of a single frame */
+    struct FrameQuality
+    {
+        FrameQuality()
+            : laplacian_variance(0), tenengrad(0), mean_intensity(0)
+            , underexposed_fraction(0), overexposed_fraction(0)
+            , sample_count(0) {}
+
+        /** time of the frame the measures were computed from */
+        base::Time time;
+
+        /** variance of the 4-neighbour Laplacian. Higher is sharper */
+        double laplacian_variance;
+
+        /** Tenengrad sharpness measure, i.e. the squared Sobel gradient
+         * magnitude averaged over all grid pixels. Higher is sharper */
+        double tenengrad;
+
+        /** mean intensity of the grid pixels */
+        double mean_intensity;
+
+        /** fraction [0,1] of grid pixels at or below the underexposure level */
+        double underexposed_fraction;
+
+        /** fraction [0,1] of grid pixels at or above the overexposure level */
+        double overexposed_fraction;
+
+        /** number of evaluated pixels */
+        uint32_t sample_count;
+
+        /** fraction [0,1] of clipped grid pixels */
+        double getClippedFraction() const
+        {
+            return underexposed_fraction + overexposed_fraction;
+        }
+    };
+
+    namespace detail {
+        struct FrameQualitySums
+        {
+            FrameQualitySums()
+                : laplacian(0), laplacian2(0), tenengrad(0), intensity(0)
+                , underexposed(0), overexposed(0) {}
+
+            int64_t laplacian;
+            int64_t laplacian2;
+            int64_t tenengrad;
+            int64_t intensity;
+            int64_t underexposed;
+            int64_t overexposed;
+        };
+
+        //evaluates the grid pixels of one row in [x_begin,x_end) with plain C++
+        inline void accumulateFrameQualityRow(const uint8_t *above, const uint8_t *row, const uint8_t *below,
+                int x_begin, int x_end, int column_step,
+                const FrameQualityConfig &config, FrameQualitySums &sums)
+        {
+            for(int x = x_begin; x < x_end; x += column_step)
+            {
+                const int center = row[x];
+                const int laplacian = above[x] + below[x] + row[x-1] + row[x+1] - 4*center;
+                const int gx = (above[x+1] - above[x-1]) + 2*(row[x+1] - row[x-1]) + (below[x+1] - below[x-1]);
+                const int gy = (below[x-1] + 2*below[x] + below[x+1]) - (above[x-1] + 2*above[x] + above[x+1]);
+                const int64_t gradient2 = gx*gx + gy*gy;
+
+                sums.laplacian += laplacian;
+                sums.laplacian2 += laplacian*laplacian;
+                if(gradient2 > config.tenengrad_threshold)
+                    sums.tenengrad += gradient2;
+                sums.intensity += center;
+                if(center <= config.underexposure_level)
+                    ++sums.underexposed;
+                if(center >= config.overexposure_level)
+                    ++sums.overexposed;
+            }
+        }
+
+#ifdef __SSE2__
+        inline int64_t horizontalSum32(__m128i v)
+        {
+            int32_t lanes[4];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), v);
+            return int64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+        }
+
+        inline __m128i load8(const uint8_t *p)
+        {
+            return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+        }
+
+        //evaluates eight pixels per iteration starting at x = 1. Lanes which
+        //are not on the grid are masked out. Returns the first column which
+        //was not processed.
+        inline int accumulateFrameQualityRowSSE2(const uint8_t *above, const uint8_t *row, const uint8_t *below,
+                int width, int column_step, const FrameQualityConfig &config, FrameQualitySums &sums)
+        {
+            int16_t mask_lanes[8];
+            for(int i = 0; i < 8; ++i)
+                mask_lanes[i] = (i % column_step) == 0 ? -1 : 0;
+            const __m128i grid_mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_lanes));
+            const __m128i ones = _mm_set1_epi16(1);
+            const __m128i under_level = _mm_set1_epi16(int16_t(config.underexposure_level) + 1);
+            const __m128i over_level = _mm_set1_epi16(int16_t(config.overexposure_level) - 1);
+            const __m128i tenengrad_threshold = _mm_set1_epi32(int32_t(config.tenengrad_threshold));
+
+            //the 32 bit accumulators are flushed before they can overflow
+            //(2*1020^2 per lane and iteration)
+            const int max_iterations = 256;
+
+            int x = 1;
+            while(x + 8 <= width - 1)
+            {
+                __m128i acc_laplacian = _mm_setzero_si128();
+                __m128i acc_laplacian2 = _mm_setzero_si128();
+                __m128i acc_tenengrad = _mm_setzero_si128();
+                __m128i acc_intensity = _mm_setzero_si128();
+                __m128i acc_under = _mm_setzero_si128();
+                __m128i acc_over = _mm_setzero_si128();
+                for(int i = 0; i < max_iterations && x + 8 <= width - 1; ++i, x += 8)
+                {
+                    const __m128i a_l = load8(above + x - 1);
+                    const __m128i a_c = load8(above + x);
+                    const __m128i a_r = load8(above + x + 1);
+                    const __m128i r_l = load8(row + x - 1);
+                    const __m128i r_c = load8(row + x);
+                    const __m128i r_r = load8(row + x + 1);
+                    const __m128i b_l = load8(below + x - 1);
+                    const __m128i b_c = load8(below + x);
+                    const __m128i b_r = load8(below + x + 1);
+
+                    __m128i laplacian = _mm_add_epi16(_mm_add_epi16(a_c, b_c), _mm_add_epi16(r_l, r_r));
+                    laplacian = _mm_sub_epi16(laplacian, _mm_slli_epi16(r_c, 2));
+                    laplacian = _mm_and_si128(laplacian, grid_mask);
+
+                    __m128i gx = _mm_add_epi16(_mm_sub_epi16(a_r, a_l), _mm_sub_epi16(b_r, b_l));
+                    gx = _mm_add_epi16(gx, _mm_slli_epi16(_mm_sub_epi16(r_r, r_l), 1));
+                    __m128i gy = _mm_sub_epi16(_mm_add_epi16(b_l, b_r), _mm_add_epi16(a_l, a_r));
+                    gy = _mm_add_epi16(gy, _mm_slli_epi16(_mm_sub_epi16(b_c, a_c), 1));
+                    gx = _mm_and_si128(gx, grid_mask);
+                    gy = _mm_and_si128(gy, grid_mask);
+
+                    //interleaving gx and gy lets madd compute gx^2+gy^2 per pixel
+                    const __m128i g_lo = _mm_unpacklo_epi16(gx, gy);
+                    const __m128i g_hi = _mm_unpackhi_epi16(gx, gy);
+                    const __m128i g2_lo = _mm_madd_epi16(g_lo, g_lo);
+                    const __m128i g2_hi = _mm_madd_epi16(g_hi, g_hi);
+                    acc_tenengrad = _mm_add_epi32(acc_tenengrad,
+                            _mm_and_si128(g2_lo, _mm_cmpgt_epi32(g2_lo, tenengrad_threshold)));
+                    acc_tenengrad = _mm_add_epi32(acc_tenengrad,
+                            _mm_and_si128(g2_hi, _mm_cmpgt_epi32(g2_hi, tenengrad_threshold)));
+
+                    acc_laplacian = _mm_add_epi32(acc_laplacian, _mm_madd_epi16(laplacian, ones));
+                    acc_laplacian2 = _mm_add_epi32(acc_laplacian2, _mm_madd_epi16(laplacian, laplacian));
+
+                    const __m128i center = _mm_and_si128(r_c, grid_mask);
+                    acc_intensity = _mm_add_epi32(acc_intensity, _mm_madd_epi16(center, ones));
+                    //comparison masks are -1, subtracting them counts the pixels
+                    acc_under = _mm_sub_epi16(acc_under,
+                            _mm_and_si128(_mm_cmplt_epi16(r_c, under_level), grid_mask));
+                    acc_over = _mm_sub_epi16(acc_over,
+                            _mm_and_si128(_mm_cmpgt_epi16(r_c, over_level), grid_mask));
+                }
+                sums.laplacian += horizontalSum32(acc_laplacian);
+                sums.laplacian2 += horizontalSum32(acc_laplacian2);
+                sums.tenengrad += horizontalSum32(acc_tenengrad);
+                sums.intensity += horizontalSum32(acc_intensity);
+                sums.underexposed += horizontalSum32(_mm_madd_epi16(acc_under, ones));
+                sums.overexposed += horizontalSum32(_mm_madd_epi16(acc_over, ones));
+            }
+            return x;
+        }
+#endif
+    }
+
+    /** Computes sharpness and exposure measures of a frame
+     *
+     * Only 8 bit single channel frames (grayscale or raw bayer) are supported.
+     * Border pixels are never evaluated. The function holds no state and can
+     * be called concurrently for several frames.
+     *
+     * @throws std::runtime_error if the frame mode or depth is not supported
+     */
+    inline FrameQuality computeFrameQuality(const Frame &frame,
+            const FrameQualityConfig &config = FrameQualityConfig())
+    {
+        if(frame.isCompressed() || frame.getChannelCount() != 1 || frame.getPixelSize() != 1)
+            throw std::runtime_error("computeFrameQuality: only 8 bit single channel frames are supported");
+        if(config.row_step == 0 || config.column_step == 0)
+            throw std::runtime_error("computeFrameQuality: grid steps must be positive");
+
+        FrameQuality quality;
+        quality.time = frame.time;
+
+        const int width = frame.getWidth();
+        const int height = frame.getHeight();
+        if(width < 3 || height < 3)
+            return quality;
+
+        const int row_step = config.row_step;
+        const int column_step = config.column_step;
+        const int columns = (width - 3) / column_step + 1;
+        const int rows = (height - 3) / row_step + 1;
+        quality.sample_count = columns * rows;
+
+        const uint8_t *image = frame.getImageConstPtr();
+        const int row_size = frame.getRowSize();
+        detail::FrameQualitySums sums;
+        for(int y = 1; y < height - 1; y += row_step)
+        {
+            const uint8_t *row = image + y * row_size;
+            int x = 1;
+#ifdef __SSE2__
+            if(8 % column_step == 0)
+                x = detail::accumulateFrameQualityRowSSE2(row - row_size, row, row + row_size,
+                        width, column_step, config, sums);
+#endif
+            detail::accumulateFrameQualityRow(row - row_size, row, row + row_size,
+                    x, width - 1, column_step, config, sums);
+        }
+
+        const double count = quality.sample_count;
+        const double mean_laplacian = sums.laplacian / count;
+        quality.laplacian_variance = sums.laplacian2 / count - mean_laplacian * mean_laplacian;
+        quality.tenengrad = sums.tenengrad / count;
+        quality.mean_intensity = sums.intensity / count;
+        quality.underexposed_fraction = sums.underexposed / count;
+        quality.overexposed_fraction = sums.overexposed / count;
+        return quality;
+    }
+}}}
+
+#endif
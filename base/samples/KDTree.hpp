@@ -0,0 +1,391 @@
+#ifndef BASE_SAMPLES_KD_TREE_H__
+#define BASE_SAMPLES_KD_TREE_H__
+
+#include <stdint.h>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Core>
+#include <base/samples/Pointcloud.hpp>
+#include <base/samples/CompactPointcloud.hpp>
+
+namespace base { namespace samples {
+
+    namespace detail
+    {
+        /** The cloud type whose coordinates a KDTree<Scalar> refers to */
+        template<typename Scalar>
+        struct KDTreeCloud;
+
+        template<>
+        struct KDTreeCloud<double>
+        {
+            typedef Pointcloud Cloud;
+
+            static void getAxes(const Pointcloud &cloud, const double **axes, size_t &stride, size_t &count)
+            {
+                const double *data = cloud.points.empty() ? NULL : &cloud.points[0].x();
+                axes[0] = data;
+                axes[1] = data ? data + 1 : NULL;
+                axes[2] = data ? data + 2 : NULL;
+                stride = 3;
+                count = cloud.points.size();
+            }
+        };
+
+        template<>
+        struct KDTreeCloud<float>
+        {
+            typedef CompactPointcloud Cloud;
+
+            static void getAxes(const CompactPointcloud &cloud, const float **axes, size_t &stride, size_t &count)
+            {
+                axes[0] = cloud.empty() ? NULL : &cloud.x[0];
+                axes[1] = cloud.empty() ? NULL : &cloud.y[0];
+                axes[2] = cloud.empty() ? NULL : &cloud.z[0];
+                stride = 1;
+                count = cloud.size();
+            }
+        };
+    }
+
+    /** k-d tree for nearest neighbour and radius queries on point clouds
+     *
+     * The tree does not copy the points: it refers to the coordinates of
+     * the cloud given to build(), which must neither change nor be
+     * destroyed while the tree is used, and only stores a permutation of
+     * the point indices and the nodes. Scalar is double for Pointcloud and
+     * float for CompactPointcloud, see PointcloudKDTree and
+     * CompactPointcloudKDTree.
+     *
+     * A node splits its points at the median of the axis with the largest
+     * extent, so that the tree is balanced and node i has the children
+     * 2i+1 and 2i+2. The tree is built level by level, the nodes of a level
+     * are split in parallel with OpenMP. Nodes with at most leaf_size
+     * points are leaves. Points with NaN or infinite coordinates, e.g. of
+     * organized clouds, are not indexed and are never found.
+     *
+     * The batch queries process the queries in parallel with OpenMP. The
+     * k nearest neighbours are written into flat arrays with k entries per
+     * query, so that no memory is allocated during the queries.
+     */
+    template<typename Scalar>
+    class KDTree
+    {
+    public:
+        /** index of missing neighbours if the cloud has less than k points */
+        static uint32_t invalidIndex()
+        {
+            return ~uint32_t(0);
+        }
+
+        KDTree(size_t leaf_size = 16)
+            : leaf_size(std::max<size_t>(leaf_size, 1)), count(0), stride(0)
+        {
+            axes[0] = axes[1] = axes[2] = NULL;
+        }
+
+        /** Builds the tree over the points of cloud, which are referenced
+         *
+         * The cloud is a Pointcloud for KDTree<double> and a
+         * CompactPointcloud for KDTree<float>, the other one does not
+         * compile as its coordinates cannot be referenced
+         */
+        void build(const typename detail::KDTreeCloud<Scalar>::Cloud &cloud)
+        {
+            const Scalar *cloud_axes[3];
+            size_t stride, count;
+            detail::KDTreeCloud<Scalar>::getAxes(cloud, cloud_axes, stride, count);
+            build(cloud_axes[0], cloud_axes[1], cloud_axes[2], stride, count);
+        }
+
+        /** Builds the tree over count points whose coordinates are
+         * x[i * stride], y[i * stride] and z[i * stride]
+         *
+         * @throws std::runtime_error if there are too many points
+         */
+        void build(const Scalar *x, const Scalar *y, const Scalar *z, size_t stride, size_t count)
+        {
+            if(count >= invalidIndex())
+                throw std::runtime_error("KDTree: too many points");
+            axes[0] = x;
+            axes[1] = y;
+            axes[2] = z;
+            this->stride = stride;
+            //NaN and infinite coordinates would break the ordering of the
+            //splits, so these points are left out
+            permutation.clear();
+            permutation.reserve(count);
+            for(size_t i = 0; i < count; ++i)
+            {
+                const Scalar px = x[i * stride], py = y[i * stride], pz = z[i * stride];
+                if(px - px == 0 && py - py == 0 && pz - pz == 0)
+                    permutation.push_back(i);
+            }
+            this->count = permutation.size();
+            nodes.assign(1, Node(0, this->count));
+
+            size_t level_begin = 0, level_end = 1;
+            while(level_begin < level_end)
+            {
+                nodes.resize(2 * level_end + 1);
+                const int level_size = level_end - level_begin;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+                for(int n = 0; n < level_size; ++n)
+                    splitNode(level_begin + n);
+                level_begin = 2 * level_begin + 1;
+                level_end = 2 * level_end + 1;
+                //skip the levels below leaves
+                while(level_begin < level_end && nodes[level_end - 1].axis == UNUSED)
+                    --level_end;
+                while(level_begin < level_end && nodes[level_begin].axis == UNUSED)
+                    ++level_begin;
+            }
+        }
+
+        /** the number of indexed points, which excludes points with NaN or
+         * infinite coordinates */
+        size_t size() const
+        {
+            return count;
+        }
+
+        /** Finds the k nearest neighbours of query
+         *
+         * @param indices output, the indices of the points ordered by distance
+         * @param squared_distances output, their squared distances
+         * @return the number of neighbours, which is less than k if the
+         *         cloud has less points
+         */
+        size_t knnSearch(const Eigen::Vector3d &query, size_t k,
+                std::vector<uint32_t> &indices, std::vector<Scalar> &squared_distances) const
+        {
+            indices.resize(k);
+            squared_distances.resize(k);
+            if(!k)
+                return 0;
+            const size_t found = knnSearch(query, k, &indices[0], &squared_distances[0]);
+            indices.resize(found);
+            squared_distances.resize(found);
+            return found;
+        }
+
+        /** Finds the k nearest neighbours of all queries in parallel
+         *
+         * @param indices output, k indices per query ordered by distance.
+         *        Missing neighbours are invalidIndex()
+         * @param squared_distances output, k squared distances per query.
+         *        Missing neighbours have infinite distance
+         */
+        void knnSearch(const std::vector<base::Point> &queries, size_t k,
+                std::vector<uint32_t> &indices, std::vector<Scalar> &squared_distances) const
+        {
+            indices.resize(queries.size() * k);
+            squared_distances.resize(queries.size() * k);
+            if(!k)
+                return;
+            const int query_count = queries.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+            for(int q = 0; q < query_count; ++q)
+                knnSearch(queries[q], k, &indices[q * k], &squared_distances[q * k]);
+        }
+
+        /** Finds all points within radius of query
+         *
+         * @param indices output, the indices of the points in no particular order
+         * @return the number of points
+         */
+        size_t radiusSearch(const Eigen::Vector3d &query, double radius, std::vector<uint32_t> &indices) const
+        {
+            indices.clear();
+            if(count && radius >= 0)
+            {
+                const Scalar q[3] = {Scalar(query.x()), Scalar(query.y()), Scalar(query.z())};
+                radiusSearch(0, q, Scalar(radius), Scalar(radius) * Scalar(radius), indices);
+            }
+            return indices.size();
+        }
+
+        /** Finds all points within radius of all queries in parallel. The
+         * memory of the vectors of indices is reused */
+        void radiusSearch(const std::vector<base::Point> &queries, double radius,
+                std::vector<std::vector<uint32_t> > &indices) const
+        {
+            indices.resize(queries.size());
+            const int query_count = queries.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+            for(int q = 0; q < query_count; ++q)
+                radiusSearch(queries[q], radius, indices[q]);
+        }
+
+    private:
+        /** axis of leaves and of nodes which are not part of the tree */
+        enum { LEAF = -1, UNUSED = -2 };
+
+        struct Node
+        {
+            Node() : begin(0), end(0), axis(UNUSED), split(0) {}
+            Node(uint32_t begin, uint32_t end) : begin(begin), end(end), axis(LEAF), split(0) {}
+
+            /** the points of the node are permutation[begin] to permutation[end - 1] */
+            uint32_t begin;
+            uint32_t end;
+            int axis;
+            Scalar split;
+        };
+
+        struct CompareAxis
+        {
+            CompareAxis(const Scalar *axis, size_t stride) : axis(axis), stride(stride) {}
+
+            bool operator()(uint32_t a, uint32_t b) const
+            {
+                return axis[a * stride] < axis[b * stride];
+            }
+
+            const Scalar *axis;
+            size_t stride;
+        };
+
+        Scalar coordinate(uint32_t index, int axis) const
+        {
+            return axes[axis][index * stride];
+        }
+
+        Scalar squaredDistance(uint32_t index, const Scalar *q) const
+        {
+            const size_t offset = index * stride;
+            const Scalar dx = axes[0][offset] - q[0];
+            const Scalar dy = axes[1][offset] - q[1];
+            const Scalar dz = axes[2][offset] - q[2];
+            return dx * dx + dy * dy + dz * dz;
+        }
+
+        void splitNode(size_t n)
+        {
+            Node &node = nodes[n];
+            if(node.axis == UNUSED)
+                return;
+            if(node.end - node.begin <= leaf_size)
+            {
+                node.axis = LEAF;
+                return;
+            }
+
+            //split the axis with the largest extent at the median
+            Scalar min[3], max[3];
+            for(int a = 0; a < 3; ++a)
+                min[a] = max[a] = coordinate(permutation[node.begin], a);
+            for(uint32_t i = node.begin + 1; i < node.end; ++i)
+            {
+                const size_t offset = permutation[i] * stride;
+                for(int a = 0; a < 3; ++a)
+                {
+                    const Scalar value = axes[a][offset];
+                    min[a] = std::min(min[a], value);
+                    max[a] = std::max(max[a], value);
+                }
+            }
+            int axis = 0;
+            for(int a = 1; a < 3; ++a)
+                if(max[a] - min[a] > max[axis] - min[axis])
+                    axis = a;
+
+            const uint32_t middle = node.begin + (node.end - node.begin) / 2;
+            std::nth_element(permutation.begin() + node.begin, permutation.begin() + middle, permutation.begin() + node.end,
+                    CompareAxis(axes[axis], stride));
+            node.axis = axis;
+            node.split = coordinate(permutation[middle], axis);
+            nodes[2 * n + 1] = Node(node.begin, middle);
+            nodes[2 * n + 2] = Node(middle, node.end);
+        }
+
+        size_t knnSearch(const Eigen::Vector3d &query, size_t k, uint32_t *result, Scalar *distances) const
+        {
+            for(size_t i = 0; i < k; ++i)
+            {
+                result[i] = invalidIndex();
+                distances[i] = std::numeric_limits<Scalar>::infinity();
+            }
+            if(!count)
+                return 0;
+            const Scalar q[3] = {Scalar(query.x()), Scalar(query.y()), Scalar(query.z())};
+            size_t found = 0;
+            knnSearch(0, q, k, result, distances, found);
+            return found;
+        }
+
+        void knnSearch(size_t n, const Scalar *q, size_t k, uint32_t *result, Scalar *distances, size_t &found) const
+        {
+            const Node &node = nodes[n];
+            if(node.axis == LEAF)
+            {
+                for(uint32_t i = node.begin; i < node.end; ++i)
+                {
+                    const uint32_t index = permutation[i];
+                    const Scalar distance = squaredDistance(index, q);
+                    if(found == k && !(distance < distances[k - 1]))
+                        continue;
+                    //insertion into the sorted neighbours
+                    size_t j = found < k ? found++ : k - 1;
+                    for(; j > 0 && distances[j - 1] > distance; --j)
+                    {
+                        distances[j] = distances[j - 1];
+                        result[j] = result[j - 1];
+                    }
+                    distances[j] = distance;
+                    result[j] = index;
+                }
+                return;
+            }
+            const Scalar difference = q[node.axis] - node.split;
+            const size_t near = difference < 0 ? 2 * n + 1 : 2 * n + 2;
+            knnSearch(near, q, k, result, distances, found);
+            if(found < k || difference * difference < distances[k - 1])
+                knnSearch(near == 2 * n + 1 ? 2 * n + 2 : 2 * n + 1, q, k, result, distances, found);
+        }
+
+        void radiusSearch(size_t n, const Scalar *q, Scalar radius, Scalar squared_radius,
+                std::vector<uint32_t> &result) const
+        {
+            const Node &node = nodes[n];
+            if(node.axis == LEAF)
+            {
+                for(uint32_t i = node.begin; i < node.end; ++i)
+                {
+                    if(squaredDistance(permutation[i], q) <= squared_radius)
+                        result.push_back(permutation[i]);
+                }
+                return;
+            }
+            const Scalar difference = q[node.axis] - node.split;
+            if(difference <= radius)
+                radiusSearch(2 * n + 1, q, radius, squared_radius, result);
+            if(difference >= -radius)
+                radiusSearch(2 * n + 2, q, radius, squared_radius, result);
+        }
+
+        size_t leaf_size;
+        size_t count;
+        const Scalar *axes[3];
+        size_t stride;
+        /** the point indices, the points of each node are contiguous */
+        std::vector<uint32_t> permutation;
+        std::vector<Node> nodes;
+    };
+
+    /** k-d tree over the points of a Pointcloud */
+    typedef KDTree<double> PointcloudKDTree;
+    /** k-d tree over the points of a CompactPointcloud */
+    typedef KDTree<float> CompactPointcloudKDTree;
+}}
+
+#endif
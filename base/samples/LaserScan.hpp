@@ -67,7 +67,7 @@ namespace base { namespace samples {
             : start_angle(0), angular_resolution(0), speed(0), minRange(0), maxRange(0) {}
             
         bool isValidBeam(const unsigned int i) const {
-	    if(i > ranges.size())
+	    if(i >= ranges.size())
 		throw std::out_of_range("Invalid beam index given");
             return isRangeValid(ranges[i]);
 	}
@@ -189,10 +189,10 @@ namespace base { namespace samples {
 	    if(!isValidBeam(i))
 		return false;
 	    
-	    //get a vector with the right length
-	    point = Eigen::Vector3d(ranges[i] / 1000.0, 0.0, 0.0);
-	    //rotate
-	    point = Eigen::Quaterniond(Eigen::AngleAxisd(start_angle + i * angular_resolution, Eigen::Vector3d::UnitZ())) * point;
+	    //rotate a vector with the right length around the z-axis
+	    const double range = ranges[i] / 1000.0;
+	    const double angle = start_angle + i * angular_resolution;
+	    point = Eigen::Vector3d(range * cos(angle), range * sin(angle), 0.0);
 	    
 	    return true;
 	}
@@ -0,0 +1,331 @@
+#ifndef BASE_SAMPLES_LASER_SCAN_CONVERTER_H__
+#define BASE_SAMPLES_LASER_SCAN_CONVERTER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <Eigen/Geometry>
+#include <base/Eigen.hpp>
+#include <base/samples/LaserScan.hpp>
+#include <base/samples/RigidBodyStateInterpolator.hpp>
+
+namespace base { namespace samples {
+
+    /** Converts laser scans into points with cached beam directions
+     *
+     * The cosine and sine of every beam angle only depend on start_angle,
+     * angular_resolution and the number of beams. They are computed once
+     * and reused as long as consecutive scans have the same geometry. The
+     * rotation part of the transformation is applied to the beam directions
+     * once per scan, so that each point costs a multiplication of the range
+     * with its direction plus the translation.
+     *
+     * Points are either written into a vector of Eigen::Vector3d or into
+     * three float arrays (structure of arrays), which is converted with
+     * SSE2 four beams at a time. Both outputs are provided by the caller so
+     * that their memory is reused.
+     *
+     * The points are equal to the ones of
+     * LaserScan::convertScanToPointCloud().
+     *
+     * convertInterpolated() is the batched counterpart of
+     * LaserScan::convertScanToPointCloudInterpolated(). It interpolates the
+     * pose of the scanner for each beam from a pose history, reusing the
+     * bracketing poses across consecutive beams, and only computes the two
+     * rotation axes which are needed to rotate the cached beam directions.
+     */
+    class LaserScanConverter
+    {
+    public:
+        LaserScanConverter()
+            : start_angle(0), angular_resolution(0), beam_count(0), table_valid(false)
+        {
+        }
+
+        /** Converts scan into points
+         *
+         * @param points output, resized to the number of points. Its memory is reused
+         * @param transform transformation applied to all points
+         * @param skip_invalid_points if false, invalid beams generate NaN
+         *        points so that the indices match the ranges
+         * @return the number of points
+         */
+        size_t convert(const LaserScan &scan, std::vector<Eigen::Vector3d> &points,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity(),
+                bool skip_invalid_points = true)
+        {
+            updateTable(scan);
+            const size_t size = scan.ranges.size();
+            const Eigen::Vector3d x_axis = transform.linear().col(0) * 0.001;
+            const Eigen::Vector3d y_axis = transform.linear().col(1) * 0.001;
+            const Eigen::Vector3d translation = transform.translation();
+            const uint32_t min_range = minValidRange(scan);
+            const uint32_t max_range = scan.maxRange;
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+
+            points.resize(size);
+            size_t count = 0;
+            for(size_t i = 0; i < size; ++i)
+            {
+                const uint32_t range = scan.ranges[i];
+                if(range >= min_range && range <= max_range)
+                {
+                    const double r = range;
+                    points[count++] = translation + (x_axis * cosines[i] + y_axis * sines[i]) * r;
+                }
+                else if(!skip_invalid_points)
+                    points[count++] = Eigen::Vector3d(nan, nan, nan);
+            }
+            points.resize(count);
+            return count;
+        }
+
+        /** Converts scan into float arrays (structure of arrays)
+         *
+         * x, y and z must hold scan.ranges.size() values each.
+         *
+         * @param transform transformation applied to all points
+         * @param skip_invalid_points if false, invalid beams generate NaN
+         *        points so that the indices match the ranges
+         * @return the number of points written
+         */
+        size_t convert(const LaserScan &scan, float *x, float *y, float *z,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity(),
+                bool skip_invalid_points = true)
+        {
+            updateTable(scan);
+            const size_t size = scan.ranges.size();
+            const Eigen::Matrix3d rotation = transform.linear() * 0.001;
+            const Eigen::Vector3d translation = transform.translation();
+            const uint32_t min_range = minValidRange(scan);
+            const uint32_t max_range = scan.maxRange;
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            const float *c = &float_cosines[0];
+            const float *s = &float_sines[0];
+            const uint32_t *ranges = size ? &scan.ranges[0] : NULL;
+
+            size_t count = 0;
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128 r00 = _mm_set1_ps(rotation(0, 0)), r01 = _mm_set1_ps(rotation(0, 1));
+            const __m128 r10 = _mm_set1_ps(rotation(1, 0)), r11 = _mm_set1_ps(rotation(1, 1));
+            const __m128 r20 = _mm_set1_ps(rotation(2, 0)), r21 = _mm_set1_ps(rotation(2, 1));
+            const __m128 tx = _mm_set1_ps(translation.x());
+            const __m128 ty = _mm_set1_ps(translation.y());
+            const __m128 tz = _mm_set1_ps(translation.z());
+            //unsigned comparisons by flipping the sign bit
+            const __m128i sign = _mm_set1_epi32(0x80000000);
+            //min_range is at least END_LASER_RANGE_ERRORS, so min_range - 1 does not wrap
+            const __m128i lower = _mm_xor_si128(_mm_set1_epi32(int(min_range - 1)), sign);
+            const __m128i upper = _mm_xor_si128(_mm_set1_epi32(int(max_range)), sign);
+            const __m128 nan4 = _mm_set1_ps(nan);
+            float buffer[3][4];
+            for(; i + 4 <= size; i += 4)
+            {
+                const __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges + i));
+                const __m128i flipped = _mm_xor_si128(raw, sign);
+                const __m128i valid_mask = _mm_andnot_si128(_mm_cmpgt_epi32(flipped, upper), _mm_cmpgt_epi32(flipped, lower));
+                const int valid = _mm_movemask_ps(_mm_castsi128_ps(valid_mask));
+                if(!valid && skip_invalid_points)
+                    continue;
+
+                //ranges beyond 2^31 mm are invalid anyway
+                const __m128 r = _mm_cvtepi32_ps(raw);
+                const __m128 dc = _mm_mul_ps(_mm_loadu_ps(c + i), r);
+                const __m128 ds = _mm_mul_ps(_mm_loadu_ps(s + i), r);
+                __m128 px = _mm_add_ps(tx, _mm_add_ps(_mm_mul_ps(r00, dc), _mm_mul_ps(r01, ds)));
+                __m128 py = _mm_add_ps(ty, _mm_add_ps(_mm_mul_ps(r10, dc), _mm_mul_ps(r11, ds)));
+                __m128 pz = _mm_add_ps(tz, _mm_add_ps(_mm_mul_ps(r20, dc), _mm_mul_ps(r21, ds)));
+
+                if(valid == 0xF || !skip_invalid_points)
+                {
+                    if(valid != 0xF)
+                    {
+                        const __m128 mask = _mm_castsi128_ps(valid_mask);
+                        px = _mm_or_ps(_mm_and_ps(mask, px), _mm_andnot_ps(mask, nan4));
+                        py = _mm_or_ps(_mm_and_ps(mask, py), _mm_andnot_ps(mask, nan4));
+                        pz = _mm_or_ps(_mm_and_ps(mask, pz), _mm_andnot_ps(mask, nan4));
+                    }
+                    _mm_storeu_ps(x + count, px);
+                    _mm_storeu_ps(y + count, py);
+                    _mm_storeu_ps(z + count, pz);
+                    count += 4;
+                    continue;
+                }
+
+                //compact the valid points
+                _mm_storeu_ps(buffer[0], px);
+                _mm_storeu_ps(buffer[1], py);
+                _mm_storeu_ps(buffer[2], pz);
+                for(int j = 0; j < 4; ++j)
+                {
+                    if(!(valid & (1 << j)))
+                        continue;
+                    x[count] = buffer[0][j];
+                    y[count] = buffer[1][j];
+                    z[count] = buffer[2][j];
+                    ++count;
+                }
+            }
+#endif
+            for(; i < size; ++i)
+            {
+                const uint32_t range = ranges[i];
+                if(range >= min_range && range <= max_range)
+                {
+                    const float dc = c[i] * float(range);
+                    const float ds = s[i] * float(range);
+                    x[count] = float(translation.x()) + (float(rotation(0, 0)) * dc + float(rotation(0, 1)) * ds);
+                    y[count] = float(translation.y()) + (float(rotation(1, 0)) * dc + float(rotation(1, 1)) * ds);
+                    z[count] = float(translation.z()) + (float(rotation(2, 0)) * dc + float(rotation(2, 1)) * ds);
+                    ++count;
+                }
+                else if(!skip_invalid_points)
+                {
+                    x[count] = y[count] = z[count] = nan;
+                    ++count;
+                }
+            }
+            return count;
+        }
+
+        /** Converts scan into float vectors (structure of arrays). The
+         * vectors are resized to the number of points, their memory is
+         * reused */
+        size_t convert(const LaserScan &scan, std::vector<float> &x, std::vector<float> &y, std::vector<float> &z,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity(),
+                bool skip_invalid_points = true)
+        {
+            const size_t size = scan.ranges.size();
+            x.resize(size);
+            y.resize(size);
+            z.resize(size);
+            if(!size)
+                return 0;
+            const size_t count = convert(scan, &x[0], &y[0], &z[0], transform, skip_invalid_points);
+            x.resize(count);
+            y.resize(count);
+            z.resize(count);
+            return count;
+        }
+
+        /** Converts scan into points using the pose of the scanner at the
+         * time of each beam
+         *
+         * The time of beam i is start_time + (start_angle /
+         * angular_resolution + i) * angular_resolution / speed like in
+         * LaserScan::convertScanToPointCloudInterpolated(). Beams whose time
+         * is not covered by poses are treated like invalid beams.
+         *
+         * @param poses poses of the scanner sorted by time
+         * @param points output, resized to the number of points. Its memory is reused
+         * @param skip_invalid_points if false, invalid beams generate NaN
+         *        points so that the indices match the ranges
+         * @param interpolation NLERP is cheaper than SLERP and deviates
+         *        little for the small rotations between consecutive poses
+         * @return the number of points
+         */
+        size_t convertInterpolated(const LaserScan &scan, const std::vector<RigidBodyState> &poses,
+                const base::Time &start_time, std::vector<Eigen::Vector3d> &points,
+                bool skip_invalid_points = true,
+                RigidBodyStateInterpolator::OrientationInterpolation interpolation = RigidBodyStateInterpolator::SLERP)
+        {
+            updateTable(scan);
+            interpolator.setHistory(poses);
+            interpolator.setOrientationInterpolation(interpolation);
+            const size_t size = scan.ranges.size();
+            const uint32_t min_range = minValidRange(scan);
+            const uint32_t max_range = scan.maxRange;
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            const double first_beam = scan.start_angle / scan.angular_resolution;
+            const double beam_duration = scan.angular_resolution / scan.speed;
+
+            points.resize(size);
+            size_t count = 0;
+            Eigen::Vector3d position;
+            Eigen::Quaterniond orientation;
+            for(size_t i = 0; i < size; ++i)
+            {
+                const uint32_t range = scan.ranges[i];
+                if(range >= min_range && range <= max_range
+                        && interpolator.getPose(start_time + base::Time::fromSeconds((first_beam + i) * beam_duration),
+                            position, orientation))
+                {
+                    //first two columns of the rotation matrix of orientation
+                    const double qx = orientation.x(), qy = orientation.y();
+                    const double qz = orientation.z(), qw = orientation.w();
+                    const Eigen::Vector3d x_axis(1 - 2 * (qy * qy + qz * qz), 2 * (qx * qy + qw * qz), 2 * (qx * qz - qw * qy));
+                    const Eigen::Vector3d y_axis(2 * (qx * qy - qw * qz), 1 - 2 * (qx * qx + qz * qz), 2 * (qy * qz + qw * qx));
+                    const double r = range * 0.001;
+                    points[count++] = position + (x_axis * cosines[i] + y_axis * sines[i]) * r;
+                }
+                else if(!skip_invalid_points)
+                    points[count++] = Eigen::Vector3d(nan, nan, nan);
+            }
+            points.resize(count);
+            return count;
+        }
+
+        /** cached cosine of the beam angles of the last converted geometry */
+        const std::vector<double> &getCosines() const
+        {
+            return cosines;
+        }
+
+        /** cached sine of the beam angles of the last converted geometry */
+        const std::vector<double> &getSines() const
+        {
+            return sines;
+        }
+
+    private:
+        static uint32_t minValidRange(const LaserScan &scan)
+        {
+            return std::max(scan.minRange, uint32_t(END_LASER_RANGE_ERRORS));
+        }
+
+        void updateTable(const LaserScan &scan)
+        {
+            if(table_valid && start_angle == scan.start_angle
+                    && angular_resolution == scan.angular_resolution
+                    && beam_count == scan.ranges.size())
+                return;
+            start_angle = scan.start_angle;
+            angular_resolution = scan.angular_resolution;
+            beam_count = scan.ranges.size();
+            cosines.resize(beam_count);
+            sines.resize(beam_count);
+            //one spare element keeps the data pointer valid for empty scans
+            float_cosines.resize(beam_count + 1);
+            float_sines.resize(beam_count + 1);
+            for(size_t i = 0; i < beam_count; ++i)
+            {
+                const double angle = start_angle + i * angular_resolution;
+                cosines[i] = cos(angle);
+                sines[i] = sin(angle);
+                float_cosines[i] = cosines[i];
+                float_sines[i] = sines[i];
+            }
+            table_valid = true;
+        }
+
+        double start_angle;
+        double angular_resolution;
+        size_t beam_count;
+        bool table_valid;
+        std::vector<double> cosines;
+        std::vector<double> sines;
+        std::vector<float> float_cosines;
+        std::vector<float> float_sines;
+        RigidBodyStateInterpolator interpolator;
+    };
+}}
+
+#endif
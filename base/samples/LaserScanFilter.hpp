@@ -0,0 +1,401 @@
+#ifndef BASE_SAMPLES_LASER_SCAN_FILTER_H__
+#define BASE_SAMPLES_LASER_SCAN_FILTER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <base/samples/LaserScan.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the LaserScanFilter */
+    struct LaserScanFilterConfig
+    {
+        LaserScanFilterConfig()
+            : median_window(0)
+            , min_remission(0), max_remission(std::numeric_limits<float>::infinity())
+            , shadow_min_angle(0), shadow_window(1)
+            , outlier_distance(0), outlier_window(2), outlier_min_neighbors(1) {}
+
+        /** number of beams of the range median filter: 0 (disabled), 3 or 5.
+         * Beams are only smoothed if all beams of the window are valid */
+        int median_window;
+
+        /** beams with a remission outside of [min_remission, max_remission]
+         * are rejected as MEASUREMENT_ERROR. Only used if the scan has one
+         * remission per beam */
+        float min_remission;
+        float max_remission;
+
+        /** beams which see the surface towards one of their neighbours at
+         * an angle below shadow_min_angle (in radians) are mixed pixels
+         * at an edge. The farther beam of such a pair is rejected as
+         * MEASUREMENT_ERROR. 0 disables the filter */
+        double shadow_min_angle;
+        /** number of neighbours on each side checked by the shadow filter */
+        int shadow_window;
+
+        /** beams with less than outlier_min_neighbors neighbours closer than
+         * outlier_distance (in mm) are rejected as OTHER_RANGE_ERRORS.
+         * 0 disables the filter */
+        float outlier_distance;
+        /** number of neighbours on each side checked by the outlier filter */
+        int outlier_window;
+        int outlier_min_neighbors;
+    };
+
+    namespace detail
+    {
+        inline bool isLaserRangeValid(uint32_t range, uint32_t min_range, uint32_t max_range)
+        {
+            return range >= min_range && range <= max_range;
+        }
+
+        inline uint32_t laserMedian3(uint32_t a, uint32_t b, uint32_t c)
+        {
+            return std::max(std::min(a, b), std::min(std::max(a, b), c));
+        }
+
+        inline uint32_t laserMedian5(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t e)
+        {
+            //the median of five is the median of e and the two middle
+            //values of a,b,c,d after discarding their minimum and maximum
+            return laserMedian3(e, std::max(std::min(a, b), std::min(c, d)), std::min(std::max(a, b), std::max(c, d)));
+        }
+
+#ifdef __SSE2__
+        //minimum and maximum of unsigned values whose sign bit is flipped
+        inline __m128i minFlipped(__m128i a, __m128i b)
+        {
+            const __m128i greater = _mm_cmpgt_epi32(a, b);
+            return _mm_or_si128(_mm_and_si128(greater, b), _mm_andnot_si128(greater, a));
+        }
+
+        inline __m128i maxFlipped(__m128i a, __m128i b)
+        {
+            const __m128i greater = _mm_cmpgt_epi32(a, b);
+            return _mm_or_si128(_mm_and_si128(greater, a), _mm_andnot_si128(greater, b));
+        }
+
+        inline __m128i laserMedian3Flipped(__m128i a, __m128i b, __m128i c)
+        {
+            return maxFlipped(minFlipped(a, b), minFlipped(maxFlipped(a, b), c));
+        }
+#endif
+
+        /** Median filter of size ranges over window (3 or 5) beams
+         *
+         * dst[i] is the median of the window around src[i] if all its
+         * ranges are within [min_range, max_range], otherwise src[i].
+         */
+        inline void medianLaserRanges(const uint32_t *src, uint32_t *dst, size_t size, int window,
+                uint32_t min_range, uint32_t max_range)
+        {
+            const size_t half = window / 2;
+            if(size < size_t(window) || half == 0)
+            {
+                std::copy(src, src + size, dst);
+                return;
+            }
+            std::copy(src, src + half, dst);
+            std::copy(src + size - half, src + size, dst + size - half);
+            size_t i = half;
+#ifdef __SSE2__
+            const __m128i sign = _mm_set1_epi32(0x80000000);
+            const __m128i lower = _mm_xor_si128(_mm_set1_epi32(int(min_range - 1)), sign);
+            const __m128i upper = _mm_xor_si128(_mm_set1_epi32(int(max_range)), sign);
+            for(; i + 4 + half <= size; i += 4)
+            {
+                __m128i v[5];
+                __m128i valid = _mm_set1_epi32(-1);
+                for(size_t k = 0; k < size_t(window); ++k)
+                {
+                    v[k] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + k - half)), sign);
+                    valid = _mm_and_si128(valid, _mm_andnot_si128(_mm_cmpgt_epi32(v[k], upper), _mm_cmpgt_epi32(v[k], lower)));
+                }
+                __m128i median;
+                if(window == 3)
+                    median = laserMedian3Flipped(v[0], v[1], v[2]);
+                else
+                    median = laserMedian3Flipped(v[4],
+                            maxFlipped(minFlipped(v[0], v[1]), minFlipped(v[2], v[3])),
+                            minFlipped(maxFlipped(v[0], v[1]), maxFlipped(v[2], v[3])));
+                const __m128i center = v[half];
+                median = _mm_or_si128(_mm_and_si128(valid, median), _mm_andnot_si128(valid, center));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(median, sign));
+            }
+#endif
+            for(; i + half < size; ++i)
+            {
+                bool valid = true;
+                for(size_t k = i - half; k <= i + half; ++k)
+                    valid &= isLaserRangeValid(src[k], min_range, max_range);
+                if(!valid)
+                    dst[i] = src[i];
+                else if(window == 3)
+                    dst[i] = laserMedian3(src[i - 1], src[i], src[i + 1]);
+                else
+                    dst[i] = laserMedian5(src[i - 2], src[i - 1], src[i + 1], src[i + 2], src[i]);
+            }
+        }
+
+        /** Parameters of rejectLaserBeams */
+        struct LaserBeamRejection
+        {
+            //shadow filter: tan of the minimal angle, sine and cosine of
+            //k*angular_resolution for k = 1..shadow_window
+            int shadow_window;
+            float tan_min_angle;
+            const float *sines;
+            const float *cosines;
+            //outlier filter
+            int outlier_window;
+            float outlier_distance;
+            float outlier_min_neighbors;
+        };
+
+        /** Evaluates the shadow and outlier tests for size beams in one pass
+         *
+         * ranges holds the ranges in mm as float, NaN for invalid beams,
+         * with padding NaNs for the largest window before and after the
+         * beams. codes[i] is set to the error code of rejected beams and
+         * left unchanged otherwise.
+         */
+        inline void rejectLaserBeams(const float *ranges, size_t size, const LaserBeamRejection &p, uint8_t *codes)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128 tan_min = _mm_set1_ps(p.tan_min_angle);
+            const __m128 distance = _mm_set1_ps(p.outlier_distance);
+            const __m128 min_neighbors = _mm_set1_ps(p.outlier_min_neighbors);
+            const __m128 one = _mm_set1_ps(1);
+            for(; i + 4 <= size; i += 4)
+            {
+                const __m128 ri = _mm_loadu_ps(ranges + i);
+                __m128 shadow = _mm_setzero_ps();
+                for(int k = 1; k <= p.shadow_window; ++k)
+                {
+                    const __m128 s = _mm_set1_ps(p.sines[k - 1]);
+                    const __m128 c = _mm_set1_ps(p.cosines[k - 1]);
+                    for(int side = -1; side <= 1; side += 2)
+                    {
+                        const __m128 rj = _mm_loadu_ps(ranges + i + side * k);
+                        const __m128 lhs = _mm_mul_ps(rj, s);
+                        const __m128 rhs = _mm_mul_ps(tan_min, _mm_and_ps(abs_mask, _mm_sub_ps(ri, _mm_mul_ps(rj, c))));
+                        shadow = _mm_or_ps(shadow, _mm_and_ps(_mm_cmplt_ps(lhs, rhs), _mm_cmpgt_ps(ri, rj)));
+                    }
+                }
+                __m128 neighbors = _mm_setzero_ps();
+                for(int k = 1; k <= p.outlier_window; ++k)
+                {
+                    for(int side = -1; side <= 1; side += 2)
+                    {
+                        const __m128 rj = _mm_loadu_ps(ranges + i + side * k);
+                        const __m128 close = _mm_cmple_ps(_mm_and_ps(abs_mask, _mm_sub_ps(ri, rj)), distance);
+                        neighbors = _mm_add_ps(neighbors, _mm_and_ps(close, one));
+                    }
+                }
+                const __m128 outlier = p.outlier_window > 0
+                    ? _mm_and_ps(_mm_cmplt_ps(neighbors, min_neighbors), _mm_cmpeq_ps(ri, ri))
+                    : _mm_setzero_ps();
+                const int shadow_bits = _mm_movemask_ps(shadow);
+                const int outlier_bits = _mm_movemask_ps(outlier);
+                if(!(shadow_bits | outlier_bits))
+                    continue;
+                for(int j = 0; j < 4; ++j)
+                {
+                    if(shadow_bits & (1 << j))
+                        codes[i + j] = MEASUREMENT_ERROR;
+                    else if(outlier_bits & (1 << j))
+                        codes[i + j] = OTHER_RANGE_ERRORS;
+                }
+            }
+#endif
+            for(; i < size; ++i)
+            {
+                const float ri = ranges[i];
+                if(!(ri == ri))
+                    continue;
+                bool shadow = false;
+                for(int k = 1; k <= p.shadow_window; ++k)
+                {
+                    for(int side = -1; side <= 1; side += 2)
+                    {
+                        const float rj = ranges[i + side * k];
+                        if(rj * p.sines[k - 1] < p.tan_min_angle * fabsf(ri - rj * p.cosines[k - 1]) && ri > rj)
+                            shadow = true;
+                    }
+                }
+                float neighbors = 0;
+                for(int k = 1; k <= p.outlier_window; ++k)
+                {
+                    for(int side = -1; side <= 1; side += 2)
+                    {
+                        if(fabsf(ri - ranges[i + side * k]) <= p.outlier_distance)
+                            neighbors += 1;
+                    }
+                }
+                if(shadow)
+                    codes[i] = MEASUREMENT_ERROR;
+                else if(p.outlier_window > 0 && neighbors < p.outlier_min_neighbors)
+                    codes[i] = OTHER_RANGE_ERRORS;
+            }
+        }
+    }
+
+    /** Filter chain which cleans up the ranges of laser scans in place
+     *
+     * The stages are applied in this order and can be enabled separately:
+     *  - median filter of the ranges
+     *  - remission thresholds
+     *  - shadow (veiling) filter, which removes mixed pixels at edges
+     *  - outlier filter, which removes isolated beams
+     *
+     * The remission, shadow and outlier tests are evaluated in a single
+     * pass over the ranges after the median filter, so they do not see the
+     * beams rejected by each other. Rejected beams are set to the
+     * LASER_RANGE_ERRORS code documented for each test in
+     * LaserScanFilterConfig, beams which are already invalid are left
+     * unchanged.
+     *
+     * The filter keeps its buffers and the tables of the shadow filter
+     * between scans, so one instance should be reused for a stream of
+     * scans.
+     */
+    class LaserScanFilter
+    {
+    public:
+        LaserScanFilter(const LaserScanFilterConfig &config = LaserScanFilterConfig())
+            : table_resolution(0)
+        {
+            setConfig(config);
+        }
+
+        /** @throws std::runtime_error if median_window is not 0, 3 or 5 or a
+         * window is negative */
+        void setConfig(const LaserScanFilterConfig &config)
+        {
+            if(config.median_window != 0 && config.median_window != 3 && config.median_window != 5)
+                throw std::runtime_error("LaserScanFilter: median_window must be 0, 3 or 5");
+            if(config.shadow_window < 0 || config.outlier_window < 0)
+                throw std::runtime_error("LaserScanFilter: the windows must not be negative");
+            this->config = config;
+            sines.clear();
+            cosines.clear();
+        }
+
+        const LaserScanFilterConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Filters the ranges of scan in place
+         *
+         * @return the number of beams rejected by the remission, shadow and
+         * outlier tests
+         */
+        size_t process(LaserScan &scan)
+        {
+            const size_t size = scan.ranges.size();
+            if(size == 0)
+                return 0;
+            const uint32_t min_range = std::max(scan.minRange, uint32_t(END_LASER_RANGE_ERRORS));
+            const uint32_t max_range = scan.maxRange;
+
+            if(config.median_window)
+            {
+                median_buffer.resize(size);
+                detail::medianLaserRanges(&scan.ranges[0], &median_buffer[0], size, config.median_window, min_range, max_range);
+                scan.ranges.swap(median_buffer);
+            }
+
+            const bool use_remission = scan.remission.size() == size
+                && (config.min_remission > 0 || config.max_remission < std::numeric_limits<float>::infinity());
+            const bool use_shadow = config.shadow_min_angle > 0 && config.shadow_window > 0;
+            const bool use_outlier = config.outlier_distance > 0 && config.outlier_window > 0;
+            if(!use_remission && !use_shadow && !use_outlier)
+                return 0;
+
+            codes.assign(size, 0);
+            if(use_remission)
+            {
+                for(size_t i = 0; i < size; ++i)
+                {
+                    const float remission = scan.remission[i];
+                    if(!(remission >= config.min_remission && remission <= config.max_remission))
+                        codes[i] = MEASUREMENT_ERROR;
+                }
+            }
+
+            if(use_shadow || use_outlier)
+            {
+                detail::LaserBeamRejection p;
+                p.shadow_window = use_shadow ? config.shadow_window : 0;
+                p.outlier_window = use_outlier ? config.outlier_window : 0;
+                p.outlier_distance = config.outlier_distance;
+                p.outlier_min_neighbors = config.outlier_min_neighbors;
+                p.tan_min_angle = tan(config.shadow_min_angle);
+                updateTable(scan.angular_resolution);
+                p.sines = sines.empty() ? NULL : &sines[0];
+                p.cosines = cosines.empty() ? NULL : &cosines[0];
+
+                //float ranges with NaN for invalid beams and the padding
+                const size_t padding = std::max(p.shadow_window, p.outlier_window);
+                ranges.assign(size + 2 * padding, std::numeric_limits<float>::quiet_NaN());
+                for(size_t i = 0; i < size; ++i)
+                {
+                    const uint32_t range = scan.ranges[i];
+                    if(detail::isLaserRangeValid(range, min_range, max_range))
+                        ranges[padding + i] = range;
+                }
+                detail::rejectLaserBeams(&ranges[padding], size, p, &codes[0]);
+            }
+
+            size_t rejected = 0;
+            for(size_t i = 0; i < size; ++i)
+            {
+                if(codes[i] && detail::isLaserRangeValid(scan.ranges[i], min_range, max_range))
+                {
+                    scan.ranges[i] = codes[i];
+                    ++rejected;
+                }
+            }
+            return rejected;
+        }
+
+    private:
+        void updateTable(double angular_resolution)
+        {
+            if(sines.size() == size_t(config.shadow_window) && table_resolution == angular_resolution)
+                return;
+            table_resolution = angular_resolution;
+            sines.resize(config.shadow_window);
+            cosines.resize(config.shadow_window);
+            for(int k = 1; k <= config.shadow_window; ++k)
+            {
+                //the sine is positive for neighbours on both sides
+                sines[k - 1] = fabs(sin(k * angular_resolution));
+                cosines[k - 1] = cos(k * angular_resolution);
+            }
+        }
+
+        LaserScanFilterConfig config;
+        double table_resolution;
+        std::vector<float> sines;
+        std::vector<float> cosines;
+        std::vector<uint32_t> median_buffer;
+        std::vector<float> ranges;
+        std::vector<uint8_t> codes;
+    };
+}}
+
+#endif
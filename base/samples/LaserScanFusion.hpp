@@ -0,0 +1,405 @@
+#ifndef BASE_SAMPLES_LASER_SCAN_FUSION_H__
+#define BASE_SAMPLES_LASER_SCAN_FUSION_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Geometry>
+#include <base/Eigen.hpp>
+#include <base/samples/LaserScan.hpp>
+#include <base/samples/LaserScanConverter.hpp>
+#include <base/samples/RigidBodyStateInterpolator.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the LaserScanFusion */
+    struct LaserScanFusionConfig
+    {
+        LaserScanFusionConfig()
+            : start_angle(-M_PI), angular_resolution(2 * M_PI / 720) {}
+
+        /** angle of the first beam of the virtual scan in the body frame */
+        double start_angle;
+        /** angle between two beams of the virtual scan in radians. The
+         * virtual scan covers 360 degrees */
+        double angular_resolution;
+    };
+
+    /** Fuses the scans of several planar scanners into one virtual 360
+     * degree LaserScan in the body frame
+     *
+     * Each scanner is added with its static transformation from the sensor
+     * into the body frame. Its points are projected on the xy plane of the
+     * body frame, each beam of the virtual scan keeps the closest valid
+     * point whose direction seen from the origin of the body frame falls
+     * into its bin.
+     *
+     * As the scanners are not at the origin, the bin of a point depends on
+     * its range. For each beam of a scanner, the ranges at which its point
+     * crosses the border between two bins are computed once per scan
+     * geometry, so that the bin of a range is found by comparing it to
+     * these thresholds. Far away points change the bin rarely, so most
+     * lookups cost one comparison.
+     *
+     * Bins without any point are set to OTHER_RANGE_ERRORS, or to TOO_FAR
+     * if a beam reporting TOO_FAR points into them.
+     *
+     * fuseInterpolated() compensates the motion of the body during the
+     * scans: each beam is transformed with the pose of the body at its
+     * time, which is interpolated from a pose history, into the body frame
+     * at the time of the virtual scan.
+     */
+    class LaserScanFusion
+    {
+    public:
+        LaserScanFusion(const LaserScanFusionConfig &config = LaserScanFusionConfig())
+        {
+            setConfig(config);
+        }
+
+        /** @throws std::runtime_error if the configuration is invalid */
+        void setConfig(const LaserScanFusionConfig &config)
+        {
+            if(!(config.angular_resolution > 0) || config.angular_resolution > M_PI)
+                throw std::runtime_error("LaserScanFusion: invalid angular resolution");
+            this->config = config;
+            bin_count = size_t(ceil(2 * M_PI / config.angular_resolution - 1e-9));
+            for(size_t i = 0; i < sensors.size(); ++i)
+                sensors[i].table_valid = false;
+        }
+
+        const LaserScanFusionConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Adds a scanner with its transformation from the sensor into the
+         * body frame
+         *
+         * @return the index of its scans in fuse()
+         */
+        size_t addSensor(const Eigen::Affine3d &sensor2body)
+        {
+            Sensor sensor;
+            sensor.origin_x = sensor2body.translation().x() * 1000;
+            sensor.origin_y = sensor2body.translation().y() * 1000;
+            sensor.x_axis = sensor2body.linear().col(0).head<2>();
+            sensor.y_axis = sensor2body.linear().col(1).head<2>();
+            sensor.sensor2body = sensor2body.matrix();
+            sensors.push_back(sensor);
+            return sensors.size() - 1;
+        }
+
+        void clearSensors()
+        {
+            sensors.clear();
+        }
+
+        size_t getSensorCount() const
+        {
+            return sensors.size();
+        }
+
+        /** Fuses scans into result
+         *
+         * @param scans one scan per sensor in the order of addSensor()
+         * @param result the virtual scan, its memory is reused. Its time is
+         *        the time of the latest scan
+         * @return the number of valid beams of result
+         * @throws std::runtime_error if the number of scans does not match
+         *         the number of sensors
+         */
+        size_t fuse(const std::vector<LaserScan> &scans, LaserScan &result)
+        {
+            initResult(scans, result);
+            for(size_t s = 0; s < sensors.size(); ++s)
+            {
+                const LaserScan &scan = scans[s];
+                Sensor &sensor = sensors[s];
+                updateTable(scan, sensor);
+                const bool remission = keep_remission;
+                const uint32_t min_range = std::max(scan.minRange, uint32_t(END_LASER_RANGE_ERRORS));
+                for(size_t i = 0; i < scan.ranges.size(); ++i)
+                {
+                    const uint32_t range = scan.ranges[i];
+                    const uint32_t first = sensor.first_entry[i];
+                    const uint32_t last = sensor.first_entry[i + 1];
+                    if(first == last)
+                        continue;
+                    if(range < min_range || range > scan.maxRange)
+                    {
+                        if(range == TOO_FAR)
+                            markTooFar(result, sensor.entries[last - 1].bin);
+                        continue;
+                    }
+                    //the thresholds grow with the range, far points are at the end
+                    uint32_t entry = last - 1;
+                    while(sensor.entries[entry].range > range)
+                        --entry;
+                    const double r = range;
+                    const double x = sensor.origin_x + sensor.direction_x[i] * r;
+                    const double y = sensor.origin_y + sensor.direction_y[i] * r;
+                    insert(result, sensor.entries[entry].bin, sqrt(x * x + y * y),
+                            remission ? scan.remission[i] : 0);
+                }
+            }
+            return countValid(result);
+        }
+
+        /** Fuses scans into result and compensates the motion of the body
+         *
+         * The time of a beam is the time of its scan plus the time the
+         * scanner needs to turn from the zero step to the beam (see
+         * LaserScan::time), its point is transformed into the body frame at
+         * result_time with the poses of the body interpolated from poses.
+         * Beams outside of the pose history are dropped.
+         *
+         * @param poses pose history of the body, sorted by time
+         * @param result_time time of the virtual scan
+         * @throws std::runtime_error if the number of scans does not match
+         *         the number of sensors
+         */
+        size_t fuseInterpolated(const std::vector<LaserScan> &scans, const std::vector<RigidBodyState> &poses,
+                const base::Time &result_time, LaserScan &result,
+                RigidBodyStateInterpolator::OrientationInterpolation interpolation = RigidBodyStateInterpolator::SLERP)
+        {
+            initResult(scans, result);
+            result.time = result_time;
+            interpolator.setHistory(poses);
+            interpolator.setOrientationInterpolation(interpolation);
+            Eigen::Vector3d result_position;
+            Eigen::Quaterniond result_orientation;
+            if(!interpolator.getPose(result_time, result_position, result_orientation))
+                return 0;
+            const Eigen::Matrix3d result_rotation = result_orientation.conjugate().toRotationMatrix();
+
+            Eigen::Vector3d position;
+            Eigen::Quaterniond orientation;
+            for(size_t s = 0; s < sensors.size(); ++s)
+            {
+                const LaserScan &scan = scans[s];
+                Sensor &sensor = sensors[s];
+                updateTable(scan, sensor);
+                const bool remission = keep_remission;
+                const Eigen::Affine3d sensor2body(sensor.sensor2body);
+                converter.convert(scan, points, sensor2body, false);
+                const double first_beam = scan.start_angle / scan.angular_resolution;
+                const double beam_duration = scan.speed != 0 ? scan.angular_resolution / scan.speed : 0;
+                for(size_t i = 0; i < points.size(); ++i)
+                {
+                    const uint32_t first = sensor.first_entry[i];
+                    const uint32_t last = sensor.first_entry[i + 1];
+                    if(first == last)
+                        continue;
+                    if(!(points[i].x() == points[i].x()))
+                    {
+                        if(scan.ranges[i] == TOO_FAR)
+                            markTooFar(result, sensor.entries[last - 1].bin);
+                        continue;
+                    }
+                    if(!interpolator.getPose(scan.time + base::Time::fromSeconds((first_beam + i) * beam_duration),
+                                position, orientation))
+                        continue;
+                    const Eigen::Vector3d point = result_rotation * (orientation * points[i] + position - result_position);
+                    insert(result, getBin(atan2(point.y(), point.x())),
+                            sqrt(point.x() * point.x() + point.y() * point.y()) * 1000,
+                            remission ? scan.remission[i] : 0);
+                }
+            }
+            return countValid(result);
+        }
+
+        /** number of beams of the virtual scan */
+        size_t getBinCount() const
+        {
+            return bin_count;
+        }
+
+        /** index of the beam of the virtual scan containing the direction angle */
+        size_t getBin(double angle) const
+        {
+            double a = fmod(angle - config.start_angle + 0.5 * config.angular_resolution, 2 * M_PI);
+            if(a < 0)
+                a += 2 * M_PI;
+            const size_t bin = size_t(a / config.angular_resolution);
+            return bin < bin_count ? bin : bin_count - 1;
+        }
+
+    private:
+        /** the bin of a beam for all ranges starting at range */
+        struct Entry
+        {
+            uint32_t range;
+            uint32_t bin;
+        };
+
+        struct Sensor
+        {
+            //origin in the body plane in mm, projected rotation axes
+            double origin_x;
+            double origin_y;
+            base::Vector2d x_axis;
+            base::Vector2d y_axis;
+            base::Matrix4d sensor2body;
+
+            //geometry of the table
+            bool table_valid;
+            double start_angle;
+            double angular_resolution;
+            size_t beam_count;
+            uint32_t min_range;
+            uint32_t max_range;
+
+            //projected beam directions and the entries of beam i, which are
+            //entries[first_entry[i]] to entries[first_entry[i + 1] - 1]
+            std::vector<double> direction_x;
+            std::vector<double> direction_y;
+            std::vector<uint32_t> first_entry;
+            std::vector<Entry> entries;
+
+            Sensor() : table_valid(false) {}
+        };
+
+        void initResult(const std::vector<LaserScan> &scans, LaserScan &result)
+        {
+            if(scans.size() != sensors.size())
+                throw std::runtime_error("LaserScanFusion: the number of scans does not match the number of sensors");
+            result.start_angle = config.start_angle;
+            result.angular_resolution = config.angular_resolution;
+            result.speed = 0;
+            result.minRange = END_LASER_RANGE_ERRORS;
+            result.maxRange = 0;
+            keep_remission = !scans.empty();
+            for(size_t s = 0; s < scans.size(); ++s)
+            {
+                if(s == 0 || result.time < scans[s].time)
+                    result.time = scans[s].time;
+                const double offset = sqrt(sensors[s].origin_x * sensors[s].origin_x + sensors[s].origin_y * sensors[s].origin_y);
+                result.maxRange = std::max(result.maxRange, uint32_t(scans[s].maxRange + offset + 1));
+                keep_remission = keep_remission && scans[s].remission.size() == scans[s].ranges.size();
+            }
+            result.ranges.assign(bin_count, OTHER_RANGE_ERRORS);
+            if(keep_remission)
+                result.remission.assign(bin_count, 0);
+            else
+                result.remission.clear();
+        }
+
+        void insert(LaserScan &result, uint32_t bin, double range, float remission) const
+        {
+            //ranges below END_LASER_RANGE_ERRORS would read as error codes
+            const uint32_t value = uint32_t(std::max(range + 0.5, double(END_LASER_RANGE_ERRORS)));
+            uint32_t &current = result.ranges[bin];
+            if(current < END_LASER_RANGE_ERRORS || value < current)
+            {
+                current = value;
+                if(keep_remission)
+                    result.remission[bin] = remission;
+            }
+        }
+
+        static void markTooFar(LaserScan &result, uint32_t bin)
+        {
+            if(result.ranges[bin] == OTHER_RANGE_ERRORS)
+                result.ranges[bin] = TOO_FAR;
+        }
+
+        static size_t countValid(const LaserScan &result)
+        {
+            size_t count = 0;
+            for(size_t i = 0; i < result.ranges.size(); ++i)
+                count += result.ranges[i] >= END_LASER_RANGE_ERRORS;
+            return count;
+        }
+
+        /** computes the bin thresholds of all beams of scan */
+        void updateTable(const LaserScan &scan, Sensor &sensor)
+        {
+            const uint32_t min_range = std::max(scan.minRange, uint32_t(END_LASER_RANGE_ERRORS));
+            if(sensor.table_valid && sensor.start_angle == scan.start_angle
+                    && sensor.angular_resolution == scan.angular_resolution
+                    && sensor.beam_count == scan.ranges.size()
+                    && sensor.min_range == min_range && sensor.max_range == scan.maxRange)
+                return;
+
+            const size_t size = scan.ranges.size();
+            sensor.direction_x.resize(size);
+            sensor.direction_y.resize(size);
+            sensor.first_entry.resize(size + 1);
+            sensor.entries.clear();
+            const Eigen::Vector2d origin(sensor.origin_x, sensor.origin_y);
+            for(size_t i = 0; i < size; ++i)
+            {
+                sensor.first_entry[i] = sensor.entries.size();
+                const double angle = scan.start_angle + i * scan.angular_resolution;
+                const Eigen::Vector2d direction = sensor.x_axis * cos(angle) + sensor.y_axis * sin(angle);
+                sensor.direction_x[i] = direction.x();
+                sensor.direction_y[i] = direction.y();
+                //beams orthogonal to the plane have no direction in it
+                if(direction.squaredNorm() < 1e-12)
+                    continue;
+                addEntries(origin, direction, min_range, std::max(min_range, scan.maxRange), sensor.entries);
+            }
+            sensor.first_entry[size] = sensor.entries.size();
+
+            sensor.table_valid = true;
+            sensor.start_angle = scan.start_angle;
+            sensor.angular_resolution = scan.angular_resolution;
+            sensor.beam_count = size;
+            sensor.min_range = min_range;
+            sensor.max_range = scan.maxRange;
+        }
+
+        /** appends the bins of the points origin + r * direction for r from
+         * min_range to max_range */
+        void addEntries(const Eigen::Vector2d &origin, const Eigen::Vector2d &direction,
+                uint32_t min_range, uint32_t max_range, std::vector<Entry> &entries) const
+        {
+            const Eigen::Vector2d near = origin + direction * double(min_range);
+            const Eigen::Vector2d far = origin + direction * double(max_range);
+            const double cross = origin.x() * direction.y() - origin.y() * direction.x();
+            const uint32_t last_bin = getBin(atan2(far.y(), far.x()));
+            //a beam through the origin of the body frame keeps its direction
+            uint32_t bin = fabs(cross) > 1e-9 * origin.norm() * direction.norm()
+                ? getBin(atan2(near.y(), near.x())) : last_bin;
+            Entry entry = {0, bin};
+            entries.push_back(entry);
+
+            //the angle of the point turns in the direction of the cross
+            //product of origin and direction
+            const int step = cross > 0 ? 1 : -1;
+            for(size_t n = 0; bin != last_bin && n < bin_count; ++n)
+            {
+                //angle of the border to the next bin
+                double border;
+                if(step > 0)
+                    border = bin + 1 == bin_count ? config.start_angle - 0.5 * config.angular_resolution
+                        : config.start_angle + (bin + 0.5) * config.angular_resolution;
+                else
+                    border = config.start_angle + (bin - 0.5) * config.angular_resolution;
+                const double ux = cos(border), uy = sin(border);
+                //range at which the point lies on the border
+                const double denominator = ux * direction.y() - uy * direction.x();
+                double range = denominator != 0 ? -(ux * origin.y() - uy * origin.x()) / denominator : min_range;
+                range = std::min(std::max(ceil(range), double(entries.back().range)), double(max_range));
+                bin = step > 0 ? (bin + 1) % bin_count : (bin + bin_count - 1) % bin_count;
+                Entry next = {uint32_t(range), bin};
+                entries.push_back(next);
+            }
+        }
+
+        LaserScanFusionConfig config;
+        size_t bin_count;
+        std::vector<Sensor> sensors;
+        bool keep_remission;
+
+        LaserScanConverter converter;
+        RigidBodyStateInterpolator interpolator;
+        std::vector<Eigen::Vector3d> points;
+    };
+}}
+
+#endif
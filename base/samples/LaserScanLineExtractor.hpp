@@ -0,0 +1,333 @@
+#ifndef BASE_SAMPLES_LASER_SCAN_LINE_EXTRACTOR_H__
+#define BASE_SAMPLES_LASER_SCAN_LINE_EXTRACTOR_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include <Eigen/Geometry>
+#include <base/Eigen.hpp>
+#include <base/samples/LaserScan.hpp>
+#include <base/samples/LaserScanConverter.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the LaserScanLineExtractor. Distances are in m */
+    struct LaserScanLineExtractorConfig
+    {
+        LaserScanLineExtractorConfig()
+            : split_distance(0.03), merge_rms(0.01), max_gap(0.3)
+            , min_points(5), min_length(0.2), point_sigma(0.01) {}
+
+        /** a segment is split if a point is further away from the line
+         * through its end points */
+        double split_distance;
+        /** neighbouring segments are merged if the RMS distance of their
+         * points to the common fitted line is below this value */
+        double merge_rms;
+        /** consecutive valid points further apart than this never belong
+         * to the same segment */
+        double max_gap;
+        /** segments with less points are dropped */
+        size_t min_points;
+        /** segments shorter than this are dropped */
+        double min_length;
+        /** standard deviation of the position of a point, used for the
+         * covariances */
+        double point_sigma;
+    };
+
+    /** Line segment extracted from a laser scan in the sensor frame
+     *
+     * The line is given in Hessian normal form x*cos(alpha) + y*sin(alpha)
+     * = distance with distance >= 0.
+     */
+    struct LaserLineSegment
+    {
+        /** end points, the projections of the first and last point on the line */
+        base::Vector2d start;
+        base::Vector2d end;
+        /** covariances of the end points */
+        base::Matrix2d start_covariance;
+        base::Matrix2d end_covariance;
+
+        /** angle of the normal of the line in rad */
+        double alpha;
+        /** distance of the line to the sensor in m */
+        double distance;
+        /** covariance of (alpha, distance) */
+        base::Matrix2d line_covariance;
+
+        /** indices of the first and last beam of the segment */
+        size_t first_beam;
+        size_t last_beam;
+        /** number of valid beams of the segment */
+        size_t point_count;
+        /** RMS distance of the points to the line */
+        double rms;
+    };
+
+    /** Extracts line segments from the ordered beams of a laser scan
+     *
+     * The valid beams are grouped into clusters of consecutive points
+     * without gaps. Each cluster is split recursively at the point which
+     * is furthest from the line through the end points (split-and-merge).
+     * Neighbouring segments of a cluster are then merged if a common line
+     * fits their points. The lines are fitted by total least squares.
+     *
+     * Running sums of the coordinates and their products over the points
+     * make fitting any range of consecutive points O(1), so splitting and
+     * merging only cost the search for the furthest point. All buffers are
+     * kept between scans, beam directions are cached by a
+     * LaserScanConverter.
+     *
+     * The covariances assume independent isotropic noise of point_sigma on
+     * all points: the variance of the line angle is point_sigma^2 divided
+     * by the spread of the points along the line. The end points have this
+     * uncertainty across the line and point_sigma along it.
+     */
+    class LaserScanLineExtractor
+    {
+    public:
+        LaserScanLineExtractor(const LaserScanLineExtractorConfig &config = LaserScanLineExtractorConfig())
+            : config(config)
+        {
+        }
+
+        void setConfig(const LaserScanLineExtractorConfig &config)
+        {
+            this->config = config;
+        }
+
+        const LaserScanLineExtractorConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Extracts the segments of scan in the order of the beams
+         *
+         * @param segments output, its memory is reused
+         * @return the number of segments
+         */
+        size_t extract(const LaserScan &scan, std::vector<LaserLineSegment> &segments)
+        {
+            segments.clear();
+            converter.convert(scan, points, Eigen::Affine3d::Identity(), false);
+
+            //valid points and running sums
+            const size_t size = points.size();
+            x.clear();
+            y.clear();
+            beams.clear();
+            sums.resize(1);
+            sums[0] = Sums();
+            for(size_t i = 0; i < size; ++i)
+            {
+                const Eigen::Vector3d &point = points[i];
+                if(!(point.x() == point.x()))
+                    continue;
+                x.push_back(point.x());
+                y.push_back(point.y());
+                beams.push_back(i);
+                Sums next = sums.back();
+                next.x += point.x();
+                next.y += point.y();
+                next.xx += point.x() * point.x();
+                next.yy += point.y() * point.y();
+                next.xy += point.x() * point.y();
+                sums.push_back(next);
+            }
+
+            //split each cluster and merge neighbouring segments of the
+            //cluster. The ranges of neighbouring clusters touch as well, so
+            //they are merged before the next cluster is split
+            merged.clear();
+            const size_t count = x.size();
+            const double max_gap_squared = config.max_gap * config.max_gap;
+            size_t cluster_begin = 0;
+            for(size_t i = 1; i <= count; ++i)
+            {
+                if(i < count)
+                {
+                    const double dx = x[i] - x[i - 1];
+                    const double dy = y[i] - y[i - 1];
+                    if(dx * dx + dy * dy <= max_gap_squared)
+                        continue;
+                }
+                ranges.clear();
+                split(cluster_begin, i);
+                for(size_t j = 0; j < ranges.size(); ++j)
+                {
+                    if(j > 0 && merged.back().second == ranges[j].first)
+                    {
+                        Fit fit;
+                        fitLine(merged.back().first, ranges[j].second, fit);
+                        if(fit.rms <= config.merge_rms)
+                        {
+                            merged.back().second = ranges[j].second;
+                            continue;
+                        }
+                    }
+                    merged.push_back(ranges[j]);
+                }
+                cluster_begin = i;
+            }
+
+            for(size_t i = 0; i < merged.size(); ++i)
+            {
+                LaserLineSegment segment;
+                if(makeSegment(merged[i].first, merged[i].second, segment))
+                    segments.push_back(segment);
+            }
+            return segments.size();
+        }
+
+    private:
+        struct Sums
+        {
+            Sums() : x(0), y(0), xx(0), yy(0), xy(0) {}
+            double x, y, xx, yy, xy;
+        };
+
+        struct Fit
+        {
+            double alpha;
+            double distance;
+            double mean_x, mean_y;
+            /** variance of the points across and along the line */
+            double normal_variance;
+            double line_variance;
+            double rms;
+        };
+
+        /** fits a line to the points [begin, end) in O(1) */
+        void fitLine(size_t begin, size_t end, Fit &fit) const
+        {
+            const Sums &a = sums[begin];
+            const Sums &b = sums[end];
+            const double n = end - begin;
+            fit.mean_x = (b.x - a.x) / n;
+            fit.mean_y = (b.y - a.y) / n;
+            const double sxx = (b.xx - a.xx) / n - fit.mean_x * fit.mean_x;
+            const double syy = (b.yy - a.yy) / n - fit.mean_y * fit.mean_y;
+            const double sxy = (b.xy - a.xy) / n - fit.mean_x * fit.mean_y;
+            //the normal is the eigenvector of the smaller eigenvalue
+            fit.alpha = 0.5 * atan2(-2 * sxy, syy - sxx);
+            const double mean = 0.5 * (sxx + syy);
+            const double deviation = sqrt(0.25 * (sxx - syy) * (sxx - syy) + sxy * sxy);
+            fit.normal_variance = std::max(0.0, mean - deviation);
+            fit.line_variance = mean + deviation;
+            fit.distance = fit.mean_x * cos(fit.alpha) + fit.mean_y * sin(fit.alpha);
+            if(fit.distance < 0)
+            {
+                fit.distance = -fit.distance;
+                fit.alpha += fit.alpha < 0 ? M_PI : -M_PI;
+            }
+            fit.rms = sqrt(fit.normal_variance);
+        }
+
+        /** splits the points [begin, end) at the points furthest from the
+         * line through their end points and appends the ranges in order */
+        void split(size_t begin, size_t end)
+        {
+            stack.clear();
+            stack.push_back(std::make_pair(begin, end));
+            while(!stack.empty())
+            {
+                const std::pair<size_t, size_t> range = stack.back();
+                stack.pop_back();
+                const size_t first = range.first;
+                const size_t last = range.second - 1;
+                if(range.second - range.first < 3)
+                {
+                    ranges.push_back(range);
+                    continue;
+                }
+                //distance to the chord times its length
+                const double dx = x[last] - x[first];
+                const double dy = y[last] - y[first];
+                const double length = sqrt(dx * dx + dy * dy);
+                double max_distance = 0;
+                size_t split_index = first;
+                for(size_t i = first + 1; i < last; ++i)
+                {
+                    const double distance = fabs(dx * (y[i] - y[first]) - dy * (x[i] - x[first]));
+                    if(distance > max_distance)
+                    {
+                        max_distance = distance;
+                        split_index = i;
+                    }
+                }
+                if(max_distance <= config.split_distance * length)
+                {
+                    ranges.push_back(range);
+                    continue;
+                }
+                //the second half is processed last, so the ranges stay ordered
+                stack.push_back(std::make_pair(split_index, range.second));
+                stack.push_back(std::make_pair(range.first, split_index));
+            }
+        }
+
+        bool makeSegment(size_t begin, size_t end, LaserLineSegment &segment) const
+        {
+            const size_t n = end - begin;
+            if(n < std::max<size_t>(config.min_points, 2))
+                return false;
+            Fit fit;
+            fitLine(begin, end, fit);
+            const Eigen::Vector2d normal(cos(fit.alpha), sin(fit.alpha));
+            const Eigen::Vector2d direction(-normal.y(), normal.x());
+            const Eigen::Vector2d mean(fit.mean_x, fit.mean_y);
+            //positions of the end points along the line relative to the mean
+            const double s_start = direction.dot(Eigen::Vector2d(x[begin], y[begin]) - mean);
+            const double s_end = direction.dot(Eigen::Vector2d(x[end - 1], y[end - 1]) - mean);
+            if(fabs(s_end - s_start) < config.min_length)
+                return false;
+
+            const double sigma2 = config.point_sigma * config.point_sigma;
+            const double alpha_variance = sigma2 / std::max(fit.line_variance * n, 1e-12);
+            //the distance is measured at the origin: it depends on alpha
+            //through the position of the mean along the line
+            const double mean_along = direction.dot(mean);
+            Eigen::Matrix2d line_covariance;
+            line_covariance << alpha_variance, mean_along * alpha_variance,
+                mean_along * alpha_variance, sigma2 / n + mean_along * mean_along * alpha_variance;
+
+            segment.start = mean + direction * s_start;
+            segment.end = mean + direction * s_end;
+            segment.start_covariance = endPointCovariance(normal, direction, s_start, sigma2 / n, alpha_variance, sigma2);
+            segment.end_covariance = endPointCovariance(normal, direction, s_end, sigma2 / n, alpha_variance, sigma2);
+            segment.alpha = fit.alpha;
+            segment.distance = fit.distance;
+            segment.line_covariance = line_covariance;
+            segment.first_beam = beams[begin];
+            segment.last_beam = beams[end - 1];
+            segment.point_count = n;
+            segment.rms = fit.rms;
+            return true;
+        }
+
+        static Eigen::Matrix2d endPointCovariance(const Eigen::Vector2d &normal, const Eigen::Vector2d &direction,
+                double s, double offset_variance, double alpha_variance, double along_variance)
+        {
+            const double across_variance = offset_variance + s * s * alpha_variance;
+            return across_variance * normal * normal.transpose() + along_variance * direction * direction.transpose();
+        }
+
+        LaserScanLineExtractorConfig config;
+        LaserScanConverter converter;
+        std::vector<Eigen::Vector3d> points;
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<size_t> beams;
+        std::vector<Sums> sums;
+        std::vector<std::pair<size_t, size_t> > stack;
+        std::vector<std::pair<size_t, size_t> > ranges;
+        std::vector<std::pair<size_t, size_t> > merged;
+    };
+}}
+
+#endif
@@ -0,0 +1,436 @@
+#ifndef BASE_SAMPLES_LASER_SCAN_MATCHER_H__
+#define BASE_SAMPLES_LASER_SCAN_MATCHER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <Eigen/Geometry>
+#include <base/Pose.hpp>
+#include <base/samples/LaserScan.hpp>
+#include <base/samples/LaserScanConverter.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the LaserScanMatcher */
+    struct LaserScanMatcherConfig
+    {
+        LaserScanMatcherConfig()
+            : resolution(0.05), levels(5), sigma(0.05)
+            , search_x(0.5), search_y(0.5), search_yaw(0.3)
+            , max_points(400), min_score(0.2) {}
+
+        /** size of a cell of the finest likelihood table in m */
+        double resolution;
+        /** number of resolutions of the likelihood table, between 1 and 8.
+         * Level k holds the maximum over 2^k x 2^k cells */
+        int levels;
+        /** standard deviation of the likelihood of a point in m */
+        double sigma;
+
+        /** the search window around the initial guess: +-search_x and
+         * +-search_y in m, +-search_yaw in rad */
+        double search_x;
+        double search_y;
+        double search_yaw;
+
+        /** scans with more valid beams are subsampled to this number of
+         * points, which bounds the cost of a match */
+        size_t max_points;
+        /** matches scoring less than this fraction of the maximal score are
+         * rejected */
+        double min_score;
+    };
+
+    namespace detail
+    {
+        /** dst[i] = max(a[i], b[i]) */
+        inline void maxRows(const uint8_t *a, const uint8_t *b, uint8_t *dst, size_t size)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_max_epu8(va, vb));
+            }
+#endif
+            for(; i < size; ++i)
+                dst[i] = std::max(a[i], b[i]);
+        }
+
+        /** scores[j] += sum over the indices of table[index + j] for
+         * j = 0..15, i.e. the scores of 16 neighbouring offsets in x */
+        inline void scoreRow(const uint8_t *table, const int32_t *indices, size_t count, uint32_t *scores)
+        {
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            size_t i = 0;
+            while(i < count)
+            {
+                //16 bit sums do not overflow for 257 values of at most 255
+                const size_t block_end = std::min(count, i + 256);
+                __m128i lo = _mm_setzero_si128();
+                __m128i hi = _mm_setzero_si128();
+                for(; i < block_end; ++i)
+                {
+                    const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(table + indices[i]));
+                    lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(values, zero));
+                    hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(values, zero));
+                }
+                uint16_t lanes[16];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), lo);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes + 8), hi);
+                for(int j = 0; j < 16; ++j)
+                    scores[j] += lanes[j];
+            }
+#else
+            for(size_t i = 0; i < count; ++i)
+            {
+                const uint8_t *values = table + indices[i];
+                for(int j = 0; j < 16; ++j)
+                    scores[j] += values[j];
+            }
+#endif
+        }
+    }
+
+    /** Correlative scan matcher which aligns laser scans to a reference scan
+     *
+     * The reference scan is rendered into a likelihood table with the
+     * likelihood of observing a point in each cell, which falls off with
+     * the distance to the closest reference point. For each coarser
+     * resolution k, a table holds the maximum of 2^k x 2^k cells of the
+     * finest table, so that the sum over the points of a scan is an upper
+     * bound for the score of all offsets of a 2^k x 2^k block.
+     *
+     * match() searches the window around the initial guess with branch and
+     * bound: the blocks of the coarsest level for all orientations are
+     * scored and refined in the order of their bounds, blocks whose bound
+     * does not exceed the best score found so far are pruned. Blocks of
+     * 16 x 16 offsets or less are scored exhaustively with SSE2, which
+     * adds the table values of 16 neighbouring offsets with one load per
+     * point. The result is the best match on the grid of the finest
+     * resolution and the angular step, which is chosen so that no point
+     * moves more than one cell between two orientations.
+     *
+     * The worst case cost is bounded by the exhaustive search over the
+     * window with max_points points.
+     */
+    class LaserScanMatcher
+    {
+    public:
+        LaserScanMatcher(const LaserScanMatcherConfig &config = LaserScanMatcherConfig())
+            : width(0), height(0), origin_x(0), origin_y(0), margin(0)
+        {
+            setConfig(config);
+        }
+
+        /** @throws std::runtime_error if the configuration is invalid */
+        void setConfig(const LaserScanMatcherConfig &config)
+        {
+            if(!(config.resolution > 0) || !(config.sigma > 0) || config.levels < 1 || config.levels > 8)
+                throw std::runtime_error("LaserScanMatcher: invalid resolution, sigma or number of levels");
+            if(config.search_x < 0 || config.search_y < 0 || config.search_yaw < 0 || config.max_points == 0)
+                throw std::runtime_error("LaserScanMatcher: invalid search window");
+            this->config = config;
+            tables.clear();
+        }
+
+        const LaserScanMatcherConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Builds the likelihood tables from reference. Scans given to
+         * match() are aligned to the sensor frame of reference */
+        void setReference(const LaserScan &reference)
+        {
+            converter.convert(reference, points, Eigen::Affine3d::Identity(), true);
+            tables.clear();
+            if(points.empty())
+                return;
+
+            double min_x = points[0].x(), max_x = min_x;
+            double min_y = points[0].y(), max_y = min_y;
+            for(size_t i = 1; i < points.size(); ++i)
+            {
+                min_x = std::min(min_x, points[i].x());
+                max_x = std::max(max_x, points[i].x());
+                min_y = std::min(min_y, points[i].y());
+                max_y = std::max(max_y, points[i].y());
+            }
+            //room for the likelihood kernel, the offsets of the search window
+            //on both sides, the largest block and the 16 offsets of a row
+            kernel_radius = int(ceil(3 * config.sigma / config.resolution));
+            window_x = int(ceil(config.search_x / config.resolution));
+            window_y = int(ceil(config.search_y / config.resolution));
+            margin = kernel_radius + 2 * std::max(window_x, window_y) + (1 << config.levels) + 16;
+            origin_x = int(floor(min_x / config.resolution)) - margin;
+            origin_y = int(floor(min_y / config.resolution)) - margin;
+            width = int(floor(max_x / config.resolution)) - origin_x + margin + 1;
+            height = int(floor(max_y / config.resolution)) - origin_y + margin + 1;
+            reference_min_x = origin_x + margin;
+            reference_min_y = origin_y + margin;
+            reference_max_x = origin_x + width - margin - 1;
+            reference_max_y = origin_y + height - margin - 1;
+
+            //likelihood of each cell of the kernel
+            const int kernel_size = 2 * kernel_radius + 1;
+            kernel.resize(kernel_size * kernel_size);
+            for(int y = -kernel_radius; y <= kernel_radius; ++y)
+            {
+                for(int x = -kernel_radius; x <= kernel_radius; ++x)
+                {
+                    const double distance2 = (x * x + y * y) * config.resolution * config.resolution;
+                    kernel[(y + kernel_radius) * kernel_size + x + kernel_radius] =
+                        uint8_t(255 * exp(-0.5 * distance2 / (config.sigma * config.sigma)) + 0.5);
+                }
+            }
+
+            tables.resize(config.levels);
+            std::vector<uint8_t> &table = tables[0];
+            table.assign(size_t(width) * height, 0);
+            for(size_t i = 0; i < points.size(); ++i)
+            {
+                const int cx = int(floor(points[i].x() / config.resolution)) - origin_x;
+                const int cy = int(floor(points[i].y() / config.resolution)) - origin_y;
+                for(int y = -kernel_radius; y <= kernel_radius; ++y)
+                {
+                    uint8_t *row = &table[size_t(cy + y) * width + cx - kernel_radius];
+                    const uint8_t *kernel_row = &kernel[(y + kernel_radius) * kernel_size];
+                    detail::maxRows(row, kernel_row, row, kernel_size);
+                }
+            }
+
+            //level k is the maximum of four blocks of level k-1
+            for(int level = 1; level < config.levels; ++level)
+            {
+                const int step = 1 << (level - 1);
+                const std::vector<uint8_t> &previous = tables[level - 1];
+                std::vector<uint8_t> &current = tables[level];
+                current.assign(previous.size(), 0);
+                for(int y = 0; y < height; ++y)
+                {
+                    uint8_t *row = &current[size_t(y) * width];
+                    const uint8_t *a = &previous[size_t(y) * width];
+                    const uint8_t *b = y + step < height ? a + size_t(step) * width : NULL;
+                    detail::maxRows(a, a + step, row, width - step);
+                    std::copy(a + width - step, a + width, row + width - step);
+                    if(b)
+                    {
+                        detail::maxRows(row, b, row, width);
+                        detail::maxRows(row, b + step, row, width - step);
+                    }
+                }
+            }
+        }
+
+        /** Aligns scan to the reference scan
+         *
+         * @param guess initial guess of the pose of the sensor of scan in
+         *        the sensor frame of the reference scan
+         * @param result the best pose in the search window
+         * @return the score of the match between 0 and 1, or a negative
+         *         value if no match reaches min_score
+         */
+        double match(const LaserScan &scan, const base::Pose2D &guess, base::Pose2D &result)
+        {
+            result = guess;
+            if(tables.empty())
+                return -1;
+            converter.convert(scan, points, Eigen::Affine3d::Identity(), true);
+            if(points.empty())
+                return -1;
+
+            //subsample to at most max_points
+            const size_t step = (points.size() + config.max_points - 1) / config.max_points;
+            query.clear();
+            double max_range = 0;
+            for(size_t i = 0; i < points.size(); i += step)
+            {
+                query.push_back(Eigen::Vector2d(points[i].x(), points[i].y()));
+                max_range = std::max(max_range, query.back().norm());
+            }
+            point_count = query.size();
+
+            //no point moves more than a cell between two orientations
+            const double ratio = std::min(1.0, config.resolution / std::max(max_range, config.resolution));
+            const double yaw_step = acos(1 - 0.5 * ratio * ratio);
+            const int yaw_count = int(ceil(config.search_yaw / yaw_step));
+            orientations = 2 * yaw_count + 1;
+            indices.resize(orientations * point_count);
+            counts.resize(orientations);
+            for(int j = 0; j < orientations; ++j)
+            {
+                const double yaw = guess.orientation + (j - yaw_count) * yaw_step;
+                const Eigen::Rotation2Dd rotation(yaw);
+                int32_t *out = &indices[j * point_count];
+                size_t count = 0;
+                for(size_t i = 0; i < point_count; ++i)
+                {
+                    const Eigen::Vector2d p = rotation * query[i] + guess.position;
+                    const int cx = int(floor(p.x() / config.resolution));
+                    const int cy = int(floor(p.y() / config.resolution));
+                    //points which cannot reach a reference point score zero
+                    if(cx < reference_min_x - kernel_radius - window_x || cx > reference_max_x + kernel_radius + window_x
+                            || cy < reference_min_y - kernel_radius - window_y || cy > reference_max_y + kernel_radius + window_y)
+                        continue;
+                    out[count++] = int32_t(cy - origin_y) * width + int32_t(cx - origin_x);
+                }
+                counts[j] = count;
+            }
+
+            //branch and bound from the blocks of the coarsest level
+            best_score = uint32_t(config.min_score * 255 * point_count);
+            best_x = best_y = 0;
+            best_orientation = -1;
+            const int top = config.levels - 1;
+            std::vector<Candidate> candidates;
+            for(int j = 0; j < orientations; ++j)
+            {
+                for(int y = -window_y; y <= window_y; y += 1 << top)
+                {
+                    for(int x = -window_x; x <= window_x; x += 1 << top)
+                    {
+                        Candidate candidate(j, x, y);
+                        candidate.score = score(top, candidate);
+                        candidates.push_back(candidate);
+                    }
+                }
+            }
+            search(top, candidates);
+            if(best_orientation < 0)
+                return -1;
+
+            result.position = guess.position + Eigen::Vector2d(best_x, best_y) * config.resolution;
+            result.orientation = guess.orientation + (best_orientation - yaw_count) * yaw_step;
+            return double(best_score) / (255.0 * point_count);
+        }
+
+    private:
+        struct Candidate
+        {
+            Candidate(int orientation, int x, int y)
+                : orientation(orientation), x(x), y(y), score(0) {}
+
+            bool operator<(const Candidate &other) const
+            {
+                return score > other.score;
+            }
+
+            int orientation;
+            /** offset of the block in cells */
+            int x;
+            int y;
+            uint32_t score;
+        };
+
+        uint32_t score(int level, const Candidate &candidate) const
+        {
+            const uint8_t *table = &tables[level][0] + ptrdiff_t(candidate.y) * width + candidate.x;
+            const int32_t *index = &indices[candidate.orientation * point_count];
+            const size_t count = counts[candidate.orientation];
+            uint32_t sum = 0;
+            for(size_t i = 0; i < count; ++i)
+                sum += table[index[i]];
+            return sum;
+        }
+
+        /** scores all offsets of a block of size x size <= 16 x 16 cells */
+        void searchBlock(const Candidate &block, int size)
+        {
+            const int32_t *index = &indices[block.orientation * point_count];
+            const size_t count = counts[block.orientation];
+            const int max_y = std::min(block.y + size - 1, window_y);
+            const int lanes = std::min(size, window_x - block.x + 1);
+            for(int y = block.y; y <= max_y; ++y)
+            {
+                uint32_t scores[16] = {0};
+                detail::scoreRow(&tables[0][0] + ptrdiff_t(y) * width + block.x, index, count, scores);
+                for(int j = 0; j < lanes; ++j)
+                {
+                    if(scores[j] > best_score)
+                    {
+                        best_score = scores[j];
+                        best_x = block.x + j;
+                        best_y = y;
+                        best_orientation = block.orientation;
+                    }
+                }
+            }
+        }
+
+        void search(int level, std::vector<Candidate> &candidates)
+        {
+            std::sort(candidates.begin(), candidates.end());
+            for(size_t i = 0; i < candidates.size(); ++i)
+            {
+                const Candidate &candidate = candidates[i];
+                //the candidates are sorted, so all following ones are pruned
+                if(candidate.score <= best_score)
+                    return;
+                if(level <= 4)
+                {
+                    searchBlock(candidate, 1 << level);
+                    continue;
+                }
+                const int half = 1 << (level - 1);
+                std::vector<Candidate> children;
+                for(int dy = 0; dy < 2; ++dy)
+                {
+                    for(int dx = 0; dx < 2; ++dx)
+                    {
+                        Candidate child(candidate.orientation, candidate.x + dx * half, candidate.y + dy * half);
+                        if(child.x > window_x || child.y > window_y)
+                            continue;
+                        child.score = score(level - 1, child);
+                        children.push_back(child);
+                    }
+                }
+                search(level - 1, children);
+            }
+        }
+
+        LaserScanMatcherConfig config;
+        LaserScanConverter converter;
+        std::vector<Eigen::Vector3d> points;
+        std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > query;
+
+        //likelihood tables, the cell (0,0) is at (origin_x, origin_y) cells
+        std::vector<std::vector<uint8_t> > tables;
+        std::vector<uint8_t> kernel;
+        int width;
+        int height;
+        int origin_x;
+        int origin_y;
+        int margin;
+        int kernel_radius;
+        int window_x;
+        int window_y;
+        //cells holding reference points
+        int reference_min_x, reference_min_y;
+        int reference_max_x, reference_max_y;
+
+        //table indices of the points for each orientation
+        std::vector<int32_t> indices;
+        std::vector<size_t> counts;
+        size_t point_count;
+        int orientations;
+
+        uint32_t best_score;
+        int best_x;
+        int best_y;
+        int best_orientation;
+    };
+}}
+
+#endif
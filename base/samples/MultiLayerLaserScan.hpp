@@ -0,0 +1,159 @@
+#ifndef BASE_SAMPLES_MULTI_LAYER_LASER_SCAN_H__
+#define BASE_SAMPLES_MULTI_LAYER_LASER_SCAN_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <stdexcept>
+
+#include <Eigen/Core>
+#include <base/Time.hpp>
+#include <base/samples/LaserScan.hpp>
+
+namespace base { namespace samples {
+
+    /** Scan of a multi-layer (3D) lidar
+     *
+     * The scanner has number of rings given by the size of elevations,
+     * which are sampled at the same azimuth angles (the columns). The
+     * azimuth of column c is start_azimuth + c * azimuth_resolution, zero
+     * is at the front of the device and the angle turns counter-clockwise
+     * like in LaserScan. The elevation of a ring is positive upwards.
+     *
+     * The samples are stored column by column in structure of arrays
+     * layout: the range of ring r in column c is ranges[c * ring_count + r].
+     * intensities and time_offsets have the same layout and are either
+     * empty or hold one value per sample.
+     *
+     * Invalid samples are marked with the LASER_RANGE_ERRORS values like in
+     * LaserScan.
+     */
+    struct MultiLayerLaserScan
+    {
+        /** The timestamp of this reading */
+        Time time;
+
+        /** elevation of each ring in radians */
+        std::vector<double> elevations;
+
+        /** azimuth of the first column in radians */
+        double start_azimuth;
+        /** azimuth difference between two columns in radians */
+        double azimuth_resolution;
+        uint32_t number_of_columns;
+
+        /** minimal valid range in mm */
+        uint32_t minRange;
+        /** maximal valid range in mm */
+        uint32_t maxRange;
+
+        /** ranges in mm, column by column */
+        std::vector<uint32_t> ranges;
+        /** intensities of the samples, empty if not available */
+        std::vector<float> intensities;
+        /** time of the samples in microseconds after time, empty if not available */
+        std::vector<uint32_t> time_offsets;
+
+        MultiLayerLaserScan()
+            : start_azimuth(0), azimuth_resolution(0), number_of_columns(0), minRange(0), maxRange(0) {}
+
+        /** Sets the geometry and resizes ranges for it. All ranges are set
+         * to TOO_FAR, intensities and time_offsets are cleared */
+        void init(const std::vector<double> &elevations, uint32_t number_of_columns,
+                double start_azimuth, double azimuth_resolution)
+        {
+            this->elevations = elevations;
+            this->number_of_columns = number_of_columns;
+            this->start_azimuth = start_azimuth;
+            this->azimuth_resolution = azimuth_resolution;
+            ranges.assign(elevations.size() * number_of_columns, TOO_FAR);
+            intensities.clear();
+            time_offsets.clear();
+        }
+
+        //resets the sample
+        void reset()
+        {
+            elevations.clear();
+            start_azimuth = 0;
+            azimuth_resolution = 0;
+            number_of_columns = 0;
+            minRange = 0;
+            maxRange = 0;
+            ranges.clear();
+            intensities.clear();
+            time_offsets.clear();
+        }
+
+        uint32_t getRingCount() const
+        {
+            return elevations.size();
+        }
+
+        uint32_t getColumnCount() const
+        {
+            return number_of_columns;
+        }
+
+        /** index of the sample of ring in column */
+        size_t getIndex(uint32_t ring, uint32_t column) const
+        {
+            return size_t(column) * elevations.size() + ring;
+        }
+
+        double getAzimuth(uint32_t column) const
+        {
+            return start_azimuth + column * azimuth_resolution;
+        }
+
+        inline bool isRangeValid(uint32_t range) const
+        {
+            return range >= minRange && range <= maxRange && range >= END_LASER_RANGE_ERRORS;
+        }
+
+        /** @throws std::out_of_range if the indices are outside of the scan */
+        bool isValidPoint(uint32_t ring, uint32_t column) const
+        {
+            return isRangeValid(ranges[checkIndex(ring, column)]);
+        }
+
+        /** Returns the time of the sample, or time if the samples have no
+         * individual time stamps */
+        base::Time getPointTime(uint32_t ring, uint32_t column) const
+        {
+            const size_t index = checkIndex(ring, column);
+            if(time_offsets.size() != ranges.size())
+                return time;
+            return time + base::Time::fromMicroseconds(time_offsets[index]);
+        }
+
+        /** Computes the point of the sample in the sensor frame in m (x
+         * forward, y left, z up)
+         *
+         * @return false if the range is invalid
+         * @throws std::out_of_range if the indices are outside of the scan
+         */
+        bool getPoint(uint32_t ring, uint32_t column, Eigen::Vector3d &point) const
+        {
+            const uint32_t range = ranges[checkIndex(ring, column)];
+            if(!isRangeValid(range))
+                return false;
+            const double azimuth = getAzimuth(column);
+            const double r = range * 0.001;
+            const double horizontal = r * cos(elevations[ring]);
+            point = Eigen::Vector3d(horizontal * cos(azimuth), horizontal * sin(azimuth), r * sin(elevations[ring]));
+            return true;
+        }
+
+    private:
+        size_t checkIndex(uint32_t ring, uint32_t column) const
+        {
+            const size_t index = getIndex(ring, column);
+            if(ring >= elevations.size() || column >= number_of_columns || index >= ranges.size())
+                throw std::out_of_range("MultiLayerLaserScan: invalid ring or column");
+            return index;
+        }
+    };
+}}
+
+#endif
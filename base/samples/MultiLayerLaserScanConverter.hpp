@@ -0,0 +1,372 @@
+#ifndef BASE_SAMPLES_MULTI_LAYER_LASER_SCAN_CONVERTER_H__
+#define BASE_SAMPLES_MULTI_LAYER_LASER_SCAN_CONVERTER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <Eigen/Geometry>
+#include <base/samples/MultiLayerLaserScan.hpp>
+#include <base/samples/Pointcloud.hpp>
+
+namespace base { namespace samples {
+
+    /** Converts multi-layer laser scans into points with cached directions
+     *
+     * The direction of a sample is cos(elevation) times the horizontal
+     * direction of its column plus sin(elevation) times the up axis. The
+     * cosine and sine of all elevations and azimuths are computed once and
+     * reused as long as consecutive scans have the same geometry. The
+     * rotation of the transformation is applied once per column, so that
+     * each point costs two multiplications and additions per coordinate.
+     *
+     * The columns are converted in parallel with OpenMP, the rings of a
+     * column with SSE2. Points are either written into a Pointcloud or into
+     * three float arrays (structure of arrays). The outputs are provided by
+     * the caller so that their memory is reused.
+     *
+     * The points are equal to the ones of MultiLayerLaserScan::getPoint()
+     * transformed by the given transformation, in column by column order.
+     */
+    class MultiLayerLaserScanConverter
+    {
+    public:
+        MultiLayerLaserScanConverter()
+            : start_azimuth(0), azimuth_resolution(0), number_of_columns(0), table_valid(false), point_count(0)
+        {
+        }
+
+        /** Converts scan into cloud
+         *
+         * @param transform transformation applied to all points
+         * @param skip_invalid_points if false, invalid samples generate NaN
+         *        points so that the indices match the ranges
+         * @return the number of points
+         * @throws std::runtime_error if the number of ranges does not match
+         * the geometry of the scan
+         */
+        size_t convert(const MultiLayerLaserScan &scan, Pointcloud &cloud,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity(),
+                bool skip_invalid_points = true)
+        {
+            prepare(scan, skip_invalid_points);
+            cloud.time = scan.time;
+            cloud.colors.clear();
+            cloud.points.resize(point_count);
+            if(!point_count)
+                return 0;
+
+            const Eigen::Matrix3d rotation = transform.linear() * 0.001;
+            const Eigen::Vector3d translation = transform.translation();
+            const int columns = scan.number_of_columns;
+            const size_t rings = scan.elevations.size();
+            const uint32_t min_range = minValidRange(scan);
+            const uint32_t max_range = scan.maxRange;
+            base::Point *points = &cloud.points[0];
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int column = 0; column < columns; ++column)
+            {
+                //direction of the column and up axis in the target frame
+                const Eigen::Vector3d h = rotation.col(0) * column_cosines[column] + rotation.col(1) * column_sines[column];
+                const Eigen::Vector3d v = rotation.col(2);
+                const uint32_t *ranges = &scan.ranges[column * rings];
+                base::Point *out = points + (skip_invalid_points ? offsets[column] : column * rings);
+                size_t ring = 0;
+#ifdef __SSE2__
+                const __m128d hx = _mm_set1_pd(h.x()), hy = _mm_set1_pd(h.y()), hz = _mm_set1_pd(h.z());
+                const __m128d vx = _mm_set1_pd(v.x()), vy = _mm_set1_pd(v.y()), vz = _mm_set1_pd(v.z());
+                const __m128d tx = _mm_set1_pd(translation.x());
+                const __m128d ty = _mm_set1_pd(translation.y());
+                const __m128d tz = _mm_set1_pd(translation.z());
+                for(; ring + 2 <= rings; ring += 2)
+                {
+                    const bool valid0 = ranges[ring] >= min_range && ranges[ring] <= max_range;
+                    const bool valid1 = ranges[ring + 1] >= min_range && ranges[ring + 1] <= max_range;
+                    if(skip_invalid_points && !valid0 && !valid1)
+                        continue;
+                    const __m128d r = _mm_set_pd(ranges[ring + 1], ranges[ring]);
+                    const __m128d ce = _mm_loadu_pd(&ring_cosines[ring]);
+                    const __m128d se = _mm_loadu_pd(&ring_sines[ring]);
+                    const __m128d px = _mm_add_pd(tx, _mm_mul_pd(r, _mm_add_pd(_mm_mul_pd(ce, hx), _mm_mul_pd(se, vx))));
+                    const __m128d py = _mm_add_pd(ty, _mm_mul_pd(r, _mm_add_pd(_mm_mul_pd(ce, hy), _mm_mul_pd(se, vy))));
+                    const __m128d pz = _mm_add_pd(tz, _mm_mul_pd(r, _mm_add_pd(_mm_mul_pd(ce, hz), _mm_mul_pd(se, vz))));
+                    if(valid0)
+                    {
+                        _mm_storel_pd(&out->x(), px);
+                        _mm_storel_pd(&out->y(), py);
+                        _mm_storel_pd(&out->z(), pz);
+                        ++out;
+                    }
+                    else if(!skip_invalid_points)
+                        setNaN(*out++);
+                    if(valid1)
+                    {
+                        _mm_storeh_pd(&out->x(), px);
+                        _mm_storeh_pd(&out->y(), py);
+                        _mm_storeh_pd(&out->z(), pz);
+                        ++out;
+                    }
+                    else if(!skip_invalid_points)
+                        setNaN(*out++);
+                }
+#endif
+                for(; ring < rings; ++ring)
+                {
+                    const uint32_t range = ranges[ring];
+                    if(range >= min_range && range <= max_range)
+                        *out++ = translation + (h * ring_cosines[ring] + v * ring_sines[ring]) * double(range);
+                    else if(!skip_invalid_points)
+                        setNaN(*out++);
+                }
+            }
+            return point_count;
+        }
+
+        /** Converts scan into float arrays (structure of arrays)
+         *
+         * x, y and z must hold scan.ranges.size() values each.
+         *
+         * @param transform transformation applied to all points
+         * @param skip_invalid_points if false, invalid samples generate NaN
+         *        points so that the indices match the ranges
+         * @return the number of points written
+         * @throws std::runtime_error if the number of ranges does not match
+         * the geometry of the scan
+         */
+        size_t convert(const MultiLayerLaserScan &scan, float *x, float *y, float *z,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity(),
+                bool skip_invalid_points = true)
+        {
+            prepare(scan, skip_invalid_points);
+            if(!point_count)
+                return 0;
+
+            const Eigen::Matrix3d rotation = transform.linear() * 0.001;
+            const Eigen::Vector3d translation = transform.translation();
+            const int columns = scan.number_of_columns;
+            const size_t rings = scan.elevations.size();
+            const uint32_t min_range = minValidRange(scan);
+            const uint32_t max_range = scan.maxRange;
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int column = 0; column < columns; ++column)
+            {
+                const Eigen::Vector3f h = (rotation.col(0) * column_cosines[column] + rotation.col(1) * column_sines[column]).cast<float>();
+                const Eigen::Vector3f v = rotation.col(2).cast<float>();
+                const Eigen::Vector3f t = translation.cast<float>();
+                const uint32_t *ranges = &scan.ranges[column * rings];
+                size_t count = skip_invalid_points ? offsets[column] : column * rings;
+                size_t ring = 0;
+#ifdef __SSE2__
+                const __m128 hx = _mm_set1_ps(h.x()), hy = _mm_set1_ps(h.y()), hz = _mm_set1_ps(h.z());
+                const __m128 vx = _mm_set1_ps(v.x()), vy = _mm_set1_ps(v.y()), vz = _mm_set1_ps(v.z());
+                const __m128 tx = _mm_set1_ps(t.x()), ty = _mm_set1_ps(t.y()), tz = _mm_set1_ps(t.z());
+                //unsigned comparisons by flipping the sign bit
+                const __m128i sign = _mm_set1_epi32(0x80000000);
+                const __m128i lower = _mm_xor_si128(_mm_set1_epi32(int(min_range - 1)), sign);
+                const __m128i upper = _mm_xor_si128(_mm_set1_epi32(int(max_range)), sign);
+                const __m128 nan4 = _mm_set1_ps(nan);
+                float buffer[3][4];
+                for(; ring + 4 <= rings; ring += 4)
+                {
+                    const __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges + ring));
+                    const __m128i flipped = _mm_xor_si128(raw, sign);
+                    const __m128i valid_mask = _mm_andnot_si128(_mm_cmpgt_epi32(flipped, upper), _mm_cmpgt_epi32(flipped, lower));
+                    const int valid = _mm_movemask_ps(_mm_castsi128_ps(valid_mask));
+                    if(!valid && skip_invalid_points)
+                        continue;
+
+                    //ranges beyond 2^31 mm are invalid anyway
+                    const __m128 r = _mm_cvtepi32_ps(raw);
+                    const __m128 ce = _mm_loadu_ps(&float_ring_cosines[ring]);
+                    const __m128 se = _mm_loadu_ps(&float_ring_sines[ring]);
+                    __m128 px = _mm_add_ps(tx, _mm_mul_ps(r, _mm_add_ps(_mm_mul_ps(ce, hx), _mm_mul_ps(se, vx))));
+                    __m128 py = _mm_add_ps(ty, _mm_mul_ps(r, _mm_add_ps(_mm_mul_ps(ce, hy), _mm_mul_ps(se, vy))));
+                    __m128 pz = _mm_add_ps(tz, _mm_mul_ps(r, _mm_add_ps(_mm_mul_ps(ce, hz), _mm_mul_ps(se, vz))));
+
+                    if(valid == 0xF || !skip_invalid_points)
+                    {
+                        if(valid != 0xF)
+                        {
+                            const __m128 mask = _mm_castsi128_ps(valid_mask);
+                            px = _mm_or_ps(_mm_and_ps(mask, px), _mm_andnot_ps(mask, nan4));
+                            py = _mm_or_ps(_mm_and_ps(mask, py), _mm_andnot_ps(mask, nan4));
+                            pz = _mm_or_ps(_mm_and_ps(mask, pz), _mm_andnot_ps(mask, nan4));
+                        }
+                        _mm_storeu_ps(x + count, px);
+                        _mm_storeu_ps(y + count, py);
+                        _mm_storeu_ps(z + count, pz);
+                        count += 4;
+                        continue;
+                    }
+
+                    //compact the valid points
+                    _mm_storeu_ps(buffer[0], px);
+                    _mm_storeu_ps(buffer[1], py);
+                    _mm_storeu_ps(buffer[2], pz);
+                    for(int j = 0; j < 4; ++j)
+                    {
+                        if(!(valid & (1 << j)))
+                            continue;
+                        x[count] = buffer[0][j];
+                        y[count] = buffer[1][j];
+                        z[count] = buffer[2][j];
+                        ++count;
+                    }
+                }
+#endif
+                for(; ring < rings; ++ring)
+                {
+                    const uint32_t range = ranges[ring];
+                    if(range >= min_range && range <= max_range)
+                    {
+                        const float r = range;
+                        const float ce = float_ring_cosines[ring];
+                        const float se = float_ring_sines[ring];
+                        x[count] = t.x() + r * (ce * h.x() + se * v.x());
+                        y[count] = t.y() + r * (ce * h.y() + se * v.y());
+                        z[count] = t.z() + r * (ce * h.z() + se * v.z());
+                        ++count;
+                    }
+                    else if(!skip_invalid_points)
+                    {
+                        x[count] = y[count] = z[count] = nan;
+                        ++count;
+                    }
+                }
+            }
+            return point_count;
+        }
+
+        /** Converts scan into float vectors (structure of arrays). The
+         * vectors are resized to the number of points, their memory is
+         * reused */
+        size_t convert(const MultiLayerLaserScan &scan, std::vector<float> &x, std::vector<float> &y, std::vector<float> &z,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity(),
+                bool skip_invalid_points = true)
+        {
+            const size_t size = scan.ranges.size();
+            x.resize(size);
+            y.resize(size);
+            z.resize(size);
+            if(!size)
+                return 0;
+            const size_t count = convert(scan, &x[0], &y[0], &z[0], transform, skip_invalid_points);
+            x.resize(count);
+            y.resize(count);
+            z.resize(count);
+            return count;
+        }
+
+    private:
+        static uint32_t minValidRange(const MultiLayerLaserScan &scan)
+        {
+            return std::max(scan.minRange, uint32_t(END_LASER_RANGE_ERRORS));
+        }
+
+        static void setNaN(base::Point &point)
+        {
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            point = base::Point(nan, nan, nan);
+        }
+
+        //checks the scan, updates the tables and computes the index of the
+        //first point of each column
+        void prepare(const MultiLayerLaserScan &scan, bool skip_invalid_points)
+        {
+            const size_t rings = scan.elevations.size();
+            const int columns = scan.number_of_columns;
+            if(scan.ranges.size() != rings * columns)
+                throw std::runtime_error("MultiLayerLaserScanConverter: the number of ranges does not match the number of rings and columns");
+            updateTable(scan);
+            if(!skip_invalid_points || scan.ranges.empty())
+            {
+                point_count = scan.ranges.size();
+                return;
+            }
+
+            const uint32_t min_range = minValidRange(scan);
+            const uint32_t max_range = scan.maxRange;
+            offsets.resize(columns + 1);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int column = 0; column < columns; ++column)
+            {
+                const uint32_t *ranges = &scan.ranges[column * rings];
+                size_t count = 0;
+                for(size_t ring = 0; ring < rings; ++ring)
+                    count += ranges[ring] >= min_range && ranges[ring] <= max_range;
+                offsets[column + 1] = count;
+            }
+            offsets[0] = 0;
+            for(int column = 0; column < columns; ++column)
+                offsets[column + 1] += offsets[column];
+            point_count = offsets[columns];
+        }
+
+        void updateTable(const MultiLayerLaserScan &scan)
+        {
+            if(table_valid && start_azimuth == scan.start_azimuth
+                    && azimuth_resolution == scan.azimuth_resolution
+                    && number_of_columns == scan.number_of_columns
+                    && elevations == scan.elevations)
+                return;
+            start_azimuth = scan.start_azimuth;
+            azimuth_resolution = scan.azimuth_resolution;
+            number_of_columns = scan.number_of_columns;
+            elevations = scan.elevations;
+
+            column_cosines.resize(number_of_columns);
+            column_sines.resize(number_of_columns);
+            for(uint32_t column = 0; column < number_of_columns; ++column)
+            {
+                const double azimuth = scan.getAzimuth(column);
+                column_cosines[column] = cos(azimuth);
+                column_sines[column] = sin(azimuth);
+            }
+            const size_t rings = elevations.size();
+            ring_cosines.resize(rings);
+            ring_sines.resize(rings);
+            float_ring_cosines.resize(rings);
+            float_ring_sines.resize(rings);
+            for(size_t ring = 0; ring < rings; ++ring)
+            {
+                ring_cosines[ring] = cos(elevations[ring]);
+                ring_sines[ring] = sin(elevations[ring]);
+                float_ring_cosines[ring] = ring_cosines[ring];
+                float_ring_sines[ring] = ring_sines[ring];
+            }
+            table_valid = true;
+        }
+
+        double start_azimuth;
+        double azimuth_resolution;
+        uint32_t number_of_columns;
+        std::vector<double> elevations;
+        bool table_valid;
+        std::vector<double> column_cosines;
+        std::vector<double> column_sines;
+        std::vector<double> ring_cosines;
+        std::vector<double> ring_sines;
+        std::vector<float> float_ring_cosines;
+        std::vector<float> float_ring_sines;
+        std::vector<size_t> offsets;
+        size_t point_count;
+    };
+}}
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef BASE_SAMPLES_OCCUPANCY_GRID_H__
+#define BASE_SAMPLES_OCCUPANCY_GRID_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Geometry>
+#include <base/samples/LaserScan.hpp>
+#include <base/samples/LaserScanConverter.hpp>
+#include <base/samples/RigidBodyState.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the OccupancyGrid
+     *
+     * Log-odds are stored as integers in units of 0.01, the defaults
+     * correspond to a hit probability of 0.7, a miss probability of 0.4 and
+     * probabilities clamped to [0.12, 0.97].
+     */
+    struct OccupancyGridConfig
+    {
+        OccupancyGridConfig()
+            : cell_size(0.05), tile_size(64), width(32), height(32)
+            , hit_log_odds(85), miss_log_odds(-41), min_log_odds(-199), max_log_odds(347)
+            , max_range(40), scroll(true) {}
+
+        /** size of one cell in m */
+        double cell_size;
+        /** number of cells along each side of a tile, must be a power of two */
+        uint16_t tile_size;
+        /** number of tiles of the map window in x and y */
+        uint16_t width;
+        uint16_t height;
+
+        /** log-odds added to the cell of a beam end point */
+        int16_t hit_log_odds;
+        /** log-odds added to the cells between the sensor and an end point */
+        int16_t miss_log_odds;
+        /** limits of the log-odds of a cell */
+        int16_t min_log_odds;
+        int16_t max_log_odds;
+
+        /** beams are cut at this range in m. Cut beams only update free space */
+        double max_range;
+
+        /** moves the map window with the sensor, see OccupancyGrid::moveTo */
+        bool scroll;
+    };
+
+    /** 2D occupancy grid which integrates laser scans
+     *
+     * The map is a window of width x height square tiles of cells in the
+     * x-y plane of the world frame. The tiles are stored in a ring buffer:
+     * moving the window only clears the tiles which leave it, the others
+     * keep their memory and contents. Each cell holds its log-odds as 16
+     * bit integer, cells outside of the window are unknown (log-odds 0).
+     *
+     * Beams are projected onto the x-y plane with LaserScanConverter, which
+     * caches the beam directions. The cells between the sensor and the end
+     * point are traced with Bresenham's algorithm. Each cell is updated at
+     * most once per scan, and cells hit by a beam are not updated as free
+     * in the same scan.
+     *
+     * The free space is traced in parallel across sectors of beams. Rays of
+     * two sectors which are at least one sector apart cannot pass through
+     * the same cell beyond a radius around the sensor, which depends on the
+     * angle of a sector. The cells within this radius are traced first by a
+     * single thread, then the even and the odd sectors are traced in two
+     * parallel rounds, so no two threads write to the same cell.
+     */
+    class OccupancyGrid
+    {
+    public:
+        OccupancyGrid(const OccupancyGridConfig &config = OccupancyGridConfig())
+            : config(config), tile_shift(0), origin_x(0), origin_y(0), stamp(0)
+        {
+            if(!(config.cell_size > 0) || config.width == 0 || config.height == 0)
+                throw std::runtime_error("OccupancyGrid: the cell size and the number of tiles must be positive");
+            if(config.tile_size == 0 || (config.tile_size & (config.tile_size - 1)))
+                throw std::runtime_error("OccupancyGrid: the tile size must be a power of two");
+            while((1 << tile_shift) < config.tile_size)
+                ++tile_shift;
+            const size_t tile_cells = size_t(config.tile_size) * config.tile_size;
+            tiles.resize(size_t(config.width) * config.height);
+            for(size_t i = 0; i < tiles.size(); ++i)
+            {
+                tiles[i].log_odds.resize(tile_cells);
+                tiles[i].stamps.resize(tile_cells);
+            }
+            //centers the window on the world origin
+            origin_x = -int(config.width / 2);
+            origin_y = -int(config.height / 2);
+            resetTiles();
+        }
+
+        const OccupancyGridConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Integrates scan taken at the given pose of the laser scanner */
+        void integrate(const LaserScan &scan, const RigidBodyState &sensor_pose)
+        {
+            integrate(scan, Eigen::Affine3d(sensor_pose.getTransform()));
+        }
+
+        /** Integrates scan taken at the given pose of the laser scanner
+         *
+         * If scroll is enabled, the map window is first moved so that it
+         * is centered on the sensor, once the sensor is more than a quarter
+         * of the window away from its center.
+         */
+        void integrate(const LaserScan &scan, const Eigen::Affine3d &sensor_to_world)
+        {
+            const size_t size = scan.ranges.size();
+            const Eigen::Vector3d origin = sensor_to_world.translation();
+            if(config.scroll)
+            {
+                const double tile_length = config.cell_size * config.tile_size;
+                const double center_x = (origin_x + config.width * 0.5) * tile_length;
+                const double center_y = (origin_y + config.height * 0.5) * tile_length;
+                if(fabs(origin.x() - center_x) > config.width * tile_length * 0.25
+                        || fabs(origin.y() - center_y) > config.height * tile_length * 0.25)
+                    moveTo(origin.x(), origin.y());
+            }
+            if(size == 0)
+                return;
+
+            //end points in the world frame, NaN for invalid beams
+            converter.convert(scan, end_points, sensor_to_world, false);
+            nextStamp();
+
+            const int sensor_x = cellCoordinate(origin.x());
+            const int sensor_y = cellCoordinate(origin.y());
+            end_cells.resize(size);
+            hits.resize(size);
+            for(size_t i = 0; i < size; ++i)
+            {
+                hits[i] = false;
+                end_cells[i] = Eigen::Vector2i(sensor_x, sensor_y);
+                const Eigen::Vector3d &point = end_points[i];
+                if(!(point.x() == point.x()))
+                    continue;
+                //the projected range of the beam in the x-y plane
+                const Eigen::Vector2d ray = point.head<2>() - origin.head<2>();
+                const double length = ray.norm();
+                if(length > config.max_range)
+                {
+                    const Eigen::Vector2d end = origin.head<2>() + ray * (config.max_range / length);
+                    end_cells[i] = Eigen::Vector2i(cellCoordinate(end.x()), cellCoordinate(end.y()));
+                    continue;
+                }
+                end_cells[i] = Eigen::Vector2i(cellCoordinate(point.x()), cellCoordinate(point.y()));
+                hits[i] = true;
+            }
+
+            //hits first, so that the free space does not clear them
+            for(size_t i = 0; i < size; ++i)
+            {
+                if(hits[i])
+                    updateCell(end_cells[i].x(), end_cells[i].y(), config.hit_log_odds);
+            }
+
+            //sectors of at least 15 degrees, at most 16 of them
+            const double field_of_view = std::max(fabs(scan.angular_resolution) * size, 1e-6);
+            int sectors = std::min(16, int(field_of_view / (15 * M_PI / 180)));
+            sectors -= sectors % 2;
+            if(sectors < 2)
+            {
+                traceSectors(sensor_x, sensor_y, 0, size, 0, -1);
+                return;
+            }
+            const double sector_angle = std::min(fabs(scan.angular_resolution) * (size / sectors), M_PI / 2);
+            //rays more than a sector apart are further apart than two
+            //cell diagonals beyond this radius
+            const int near_radius = int(ceil(3 / sin(sector_angle))) + 1;
+            traceSectors(sensor_x, sensor_y, 0, size, 0, near_radius);
+            for(int round = 0; round < 2; ++round)
+            {
+                const int round_sectors = sectors / 2;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+                for(int k = 0; k < round_sectors; ++k)
+                {
+                    const int sector = 2 * k + round;
+                    traceSectors(sensor_x, sensor_y, size * sector / sectors, size * (sector + 1) / sectors, near_radius, -1);
+                }
+            }
+        }
+
+        /** Moves the map window so that it is centered on x, y
+         *
+         * Tiles which leave the window are cleared.
+         */
+        void moveTo(double x, double y)
+        {
+            const double tile_length = config.cell_size * config.tile_size;
+            origin_x = int(floor(x / tile_length)) - config.width / 2;
+            origin_y = int(floor(y / tile_length)) - config.height / 2;
+            resetTiles();
+        }
+
+        /** Returns the log-odds of the cell at x, y in units of 0.01. Cells
+         * outside of the map window are unknown (0) */
+        int16_t getLogOdds(double x, double y) const
+        {
+            const int cell_x = cellCoordinate(x);
+            const int cell_y = cellCoordinate(y);
+            if(!isInWindow(cell_x, cell_y))
+                return 0;
+            const Tile &tile = tiles[tileSlot(cell_x >> tile_shift, cell_y >> tile_shift)];
+            return tile.log_odds[cellOffset(cell_x, cell_y)];
+        }
+
+        /** Returns the occupancy probability of the cell at x, y */
+        double getProbability(double x, double y) const
+        {
+            return 1.0 - 1.0 / (1.0 + exp(getLogOdds(x, y) * 0.01));
+        }
+
+        /** Returns the area covered by the map window in m */
+        void getBounds(double &min_x, double &min_y, double &max_x, double &max_y) const
+        {
+            const double tile_length = config.cell_size * config.tile_size;
+            min_x = origin_x * tile_length;
+            min_y = origin_y * tile_length;
+            max_x = (origin_x + config.width) * tile_length;
+            max_y = (origin_y + config.height) * tile_length;
+        }
+
+        /** Sets all cells to unknown */
+        void clear()
+        {
+            for(size_t i = 0; i < tiles.size(); ++i)
+            {
+                std::fill(tiles[i].log_odds.begin(), tiles[i].log_odds.end(), 0);
+                std::fill(tiles[i].stamps.begin(), tiles[i].stamps.end(), 0);
+            }
+        }
+
+    private:
+        struct Tile
+        {
+            Tile() : x(0), y(0) {}
+
+            /** global tile coordinates of the tile held by this slot */
+            int x;
+            int y;
+            std::vector<int16_t> log_odds;
+            /** scan counter of the last update of each cell */
+            std::vector<uint16_t> stamps;
+        };
+
+        int cellCoordinate(double value) const
+        {
+            return int(floor(value / config.cell_size));
+        }
+
+        bool isInWindow(int cell_x, int cell_y) const
+        {
+            //arithmetic shifts round towards negative infinity
+            const int tile_x = cell_x >> tile_shift;
+            const int tile_y = cell_y >> tile_shift;
+            return tile_x >= origin_x && tile_x < origin_x + config.width
+                && tile_y >= origin_y && tile_y < origin_y + config.height;
+        }
+
+        size_t tileSlot(int tile_x, int tile_y) const
+        {
+            const int slot_x = ((tile_x % config.width) + config.width) % config.width;
+            const int slot_y = ((tile_y % config.height) + config.height) % config.height;
+            return size_t(slot_y) * config.width + slot_x;
+        }
+
+        size_t cellOffset(int cell_x, int cell_y) const
+        {
+            const int mask = config.tile_size - 1;
+            return size_t(cell_y & mask) * config.tile_size + (cell_x & mask);
+        }
+
+        //clears all slots which do not hold the tile the window expects
+        void resetTiles()
+        {
+            for(int tile_y = origin_y; tile_y < origin_y + config.height; ++tile_y)
+            {
+                for(int tile_x = origin_x; tile_x < origin_x + config.width; ++tile_x)
+                {
+                    Tile &tile = tiles[tileSlot(tile_x, tile_y)];
+                    if(tile.x == tile_x && tile.y == tile_y)
+                        continue;
+                    tile.x = tile_x;
+                    tile.y = tile_y;
+                    std::fill(tile.log_odds.begin(), tile.log_odds.end(), 0);
+                    std::fill(tile.stamps.begin(), tile.stamps.end(), 0);
+                }
+            }
+        }
+
+        void nextStamp()
+        {
+            if(++stamp == 0)
+            {
+                for(size_t i = 0; i < tiles.size(); ++i)
+                    std::fill(tiles[i].stamps.begin(), tiles[i].stamps.end(), 0);
+                stamp = 1;
+            }
+        }
+
+        //adds value to the cell if it was not updated in this scan yet
+        void updateCell(int cell_x, int cell_y, int value)
+        {
+            if(!isInWindow(cell_x, cell_y))
+                return;
+            Tile &tile = tiles[tileSlot(cell_x >> tile_shift, cell_y >> tile_shift)];
+            const size_t offset = cellOffset(cell_x, cell_y);
+            if(tile.stamps[offset] == stamp)
+                return;
+            tile.stamps[offset] = stamp;
+            const int log_odds = tile.log_odds[offset] + value;
+            tile.log_odds[offset] = std::min<int>(config.max_log_odds, std::max<int>(config.min_log_odds, log_odds));
+        }
+
+        /** Traces the free space of the beams [first, last)
+         *
+         * Only the cells whose distance to the sensor cell is above
+         * min_radius and, if max_radius is not negative, at most max_radius
+         * are updated.
+         */
+        void traceSectors(int sensor_x, int sensor_y, size_t first, size_t last, int min_radius, int max_radius)
+        {
+            const int min_squared = min_radius * min_radius;
+            const int max_squared = max_radius * max_radius;
+            for(size_t i = first; i < last; ++i)
+            {
+                const int end_x = end_cells[i].x();
+                const int end_y = end_cells[i].y();
+                //Bresenham from the sensor to the end point, without the end point
+                const int dx = abs(end_x - sensor_x);
+                const int dy = -abs(end_y - sensor_y);
+                const int step_x = sensor_x < end_x ? 1 : -1;
+                const int step_y = sensor_y < end_y ? 1 : -1;
+                int error = dx + dy;
+                int x = sensor_x;
+                int y = sensor_y;
+                while(x != end_x || y != end_y)
+                {
+                    const int distance = (x - sensor_x) * (x - sensor_x) + (y - sensor_y) * (y - sensor_y);
+                    if(max_radius >= 0 && distance > max_squared)
+                        break;
+                    if(distance > min_squared || (min_radius == 0 && distance == 0))
+                        updateCell(x, y, config.miss_log_odds);
+                    const int error2 = 2 * error;
+                    if(error2 >= dy)
+                    {
+                        error += dy;
+                        x += step_x;
+                    }
+                    if(error2 <= dx)
+                    {
+                        error += dx;
+                        y += step_y;
+                    }
+                }
+            }
+        }
+
+        OccupancyGridConfig config;
+        int tile_shift;
+        /** global tile coordinates of the lower left tile of the window */
+        int origin_x;
+        int origin_y;
+        uint16_t stamp;
+        std::vector<Tile> tiles;
+
+        LaserScanConverter converter;
+        std::vector<Eigen::Vector3d> end_points;
+        std::vector<Eigen::Vector2i> end_cells;
+        std::vector<bool> hits;
+    };
+}}
+
+#endif
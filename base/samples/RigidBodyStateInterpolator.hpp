@@ -0,0 +1,216 @@
+#ifndef BASE_SAMPLES_RIGID_BODY_STATE_INTERPOLATOR_H__
+#define BASE_SAMPLES_RIGID_BODY_STATE_INTERPOLATOR_H__
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <Eigen/Geometry>
+#include <base/Eigen.hpp>
+#include <base/Time.hpp>
+#include <base/samples/RigidBodyState.hpp>
+
+namespace base { namespace samples {
+
+    /** Interpolates poses from a time ordered history of rigid body states
+     *
+     * Positions are interpolated linearly, orientations by spherical
+     * linear interpolation (SLERP) or by the cheaper normalized linear
+     * interpolation (NLERP). Times outside of the history are not
+     * extrapolated.
+     *
+     * The index of the last bracketing pair of states is cached, so that
+     * consecutive queries with increasing times (the beams of a scan) are
+     * answered without a search. Queries far away from the cached bracket
+     * fall back to a binary search. The constants of the interpolation
+     * between both states are computed once per bracket.
+     *
+     * The interpolator only holds a pointer to the history, which therefore
+     * has to outlive it or has to be set again with setHistory().
+     */
+    class RigidBodyStateInterpolator
+    {
+    public:
+        enum OrientationInterpolation
+        {
+            SLERP,
+            NLERP
+        };
+
+        RigidBodyStateInterpolator(OrientationInterpolation interpolation = SLERP)
+            : history(NULL), index(0), interpolation(interpolation)
+        {
+            invalidateBracket();
+        }
+
+        explicit RigidBodyStateInterpolator(const std::vector<RigidBodyState> &history,
+                OrientationInterpolation interpolation = SLERP)
+            : history(&history), index(0), interpolation(interpolation)
+        {
+            invalidateBracket();
+        }
+
+        /** Sets the history which must be sorted by time */
+        void setHistory(const std::vector<RigidBodyState> &history)
+        {
+            this->history = &history;
+            index = 0;
+            invalidateBracket();
+        }
+
+        void setOrientationInterpolation(OrientationInterpolation interpolation)
+        {
+            this->interpolation = interpolation;
+        }
+
+        OrientationInterpolation getOrientationInterpolation() const
+        {
+            return interpolation;
+        }
+
+        /** Returns the position and orientation given by the states at time
+         *
+         * Returns false if time is not covered by the history
+         */
+        bool getPose(const base::Time &time, Eigen::Vector3d &position, Eigen::Quaterniond &orientation)
+        {
+            double ratio;
+            if(!findBracket(time, ratio))
+                return false;
+            const RigidBodyState &first = (*history)[index];
+            if(ratio == 0)
+            {
+                position = first.position;
+                orientation = first.orientation;
+                return true;
+            }
+            if(bracket != index)
+                updateBracket();
+
+            position = first.position + ratio * delta_position;
+            double first_weight, second_weight;
+            if(interpolation == NLERP || sin_angle < 1e-6)
+            {
+                first_weight = 1 - ratio;
+                second_weight = ratio;
+            }
+            else
+            {
+                first_weight = sin((1 - ratio) * angle) / sin_angle;
+                second_weight = sin(ratio * angle) / sin_angle;
+            }
+            orientation.coeffs() = first_weight * first.orientation.coeffs() + second_weight * second_orientation;
+            if(interpolation == NLERP || sin_angle < 1e-6)
+                orientation.normalize();
+            return true;
+        }
+
+        /** Returns the transformation given by the states at time
+         *
+         * Returns false if time is not covered by the history
+         */
+        bool getTransform(const base::Time &time, Eigen::Affine3d &transform)
+        {
+            Eigen::Vector3d position;
+            Eigen::Quaterniond orientation;
+            if(!getPose(time, position, orientation))
+                return false;
+            transform.setIdentity();
+            transform.rotate(orientation);
+            transform.translation() = position;
+            return true;
+        }
+
+    private:
+        /** Sets index so that history[index].time <= time < history[index+1].time
+         * and ratio to the relative position of time between both */
+        bool findBracket(const base::Time &time, double &ratio)
+        {
+            if(!history || history->empty())
+                return false;
+            const std::vector<RigidBodyState> &states = *history;
+            const size_t size = states.size();
+            if(time < states.front().time || states.back().time < time)
+                return false;
+            if(time == states.back().time)
+            {
+                index = size - 1;
+                ratio = 0;
+                return true;
+            }
+
+            if(index >= size - 1 || time < states[index].time)
+                index = search(time);
+            else
+            {
+                //check the next few states before searching
+                int steps = 0;
+                while(!(time < states[index + 1].time))
+                {
+                    if(++steps > 4)
+                    {
+                        index = search(time);
+                        break;
+                    }
+                    ++index;
+                }
+            }
+
+            const double duration = (states[index + 1].time - states[index].time).toSeconds();
+            ratio = duration > 0 ? (time - states[index].time).toSeconds() / duration : 0;
+            return true;
+        }
+
+        void invalidateBracket()
+        {
+            bracket = size_t(-1);
+        }
+
+        //computes the interpolation constants between history[index] and
+        //history[index+1]
+        void updateBracket()
+        {
+            const RigidBodyState &first = (*history)[index];
+            const RigidBodyState &second = (*history)[index + 1];
+            delta_position = second.position - first.position;
+            //interpolate along the shorter arc
+            second_orientation = second.orientation.coeffs();
+            double cos_angle = first.orientation.coeffs().dot(second.orientation.coeffs());
+            if(cos_angle < 0)
+            {
+                second_orientation = -second_orientation;
+                cos_angle = -cos_angle;
+            }
+            angle = acos(std::min(cos_angle, 1.0));
+            sin_angle = sin(angle);
+            bracket = index;
+        }
+
+        static bool earlier(const base::Time &time, const RigidBodyState &state)
+        {
+            return time < state.time;
+        }
+
+        size_t search(const base::Time &time) const
+        {
+            std::vector<RigidBodyState>::const_iterator it =
+                std::upper_bound(history->begin(), history->end(), time, earlier);
+            return (it - history->begin()) - 1;
+        }
+
+        const std::vector<RigidBodyState> *history;
+        size_t index;
+        OrientationInterpolation interpolation;
+
+        //interpolation constants of the bracket starting at index bracket.
+        //The unaligned types allow to use the class as member without
+        //aligned allocation
+        size_t bracket;
+        base::Vector3d delta_position;
+        base::Vector4d second_orientation;
+        double angle;
+        double sin_angle;
+    };
+}}
+
+#endif
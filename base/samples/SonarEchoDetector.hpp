@@ -0,0 +1,347 @@
+#ifndef BASE_SAMPLES_SONAR_ECHO_DETECTOR_H__
+#define BASE_SAMPLES_SONAR_ECHO_DETECTOR_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Geometry>
+#include <base/Eigen.hpp>
+#include <base/samples/SonarScan.hpp>
+#include <base/samples/Pointcloud.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace base { namespace samples {
+
+    /** Parameters of the SonarEchoDetector */
+    struct SonarEchoDetectorConfig
+    {
+        enum Mode
+        {
+            /** the first bin of a beam reaching the threshold */
+            FIRST_ECHO,
+            /** the bin with the highest intensity, if it reaches the threshold */
+            STRONGEST_ECHO
+        };
+
+        SonarEchoDetectorConfig()
+            : mode(FIRST_ECHO), threshold(128), min_range(0)
+            , max_range(std::numeric_limits<double>::infinity())
+            , intensity_as_color(false) {}
+
+        Mode mode;
+        /** minimal intensity of an echo */
+        uint8_t threshold;
+        /** echoes closer than this range in m are ignored (e.g. ringing of the transducer) */
+        double min_range;
+        /** echoes further away than this range in m are ignored */
+        double max_range;
+        /** if set, the intensity of each echo is stored as grey value in Pointcloud::colors */
+        bool intensity_as_color;
+    };
+
+    /** Extracts one echo per beam of a polar sonar scan and converts it into
+     * a 3D point
+     *
+     * The point of an echo at bin i of a beam with bearing b is
+     * (r*cos(b), r*sin(b), 0) with r = i*getSpatialResolution(), expressed in
+     * the sonar frame and then transformed by the given transformation.
+     *
+     * Both memory layouts are searched directly. In row layout the beams
+     * are scanned with SIMD one after the other, in column layout 16 beams
+     * are processed at once. If OpenMP is enabled, the beams are split
+     * between threads.
+     */
+    class SonarEchoDetector
+    {
+    public:
+        /** marks a beam without echo in getEchoBins() */
+        enum { NO_ECHO = 0xFFFF };
+
+        SonarEchoDetector(const SonarEchoDetectorConfig &config = SonarEchoDetectorConfig())
+            : config(config)
+        {
+        }
+
+        void setConfig(const SonarEchoDetectorConfig &config)
+        {
+            this->config = config;
+        }
+
+        const SonarEchoDetectorConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Detects the echoes of the given scan
+         *
+         * cloud is cleared and filled with one point per detected echo. Its
+         * memory is reused between calls.
+         *
+         * @throws std::runtime_error if the scan is not in polar coordinates
+         */
+        void detect(const SonarScan &scan, Pointcloud &cloud,
+                const Eigen::Affine3d &transform = Eigen::Affine3d::Identity())
+        {
+            if(!scan.polar_coordinates)
+                throw std::runtime_error("SonarEchoDetector: the sonar scan is not in polar coordinates");
+            const int beams = scan.number_of_beams;
+            const int bins = scan.number_of_bins;
+            if(scan.data.size() < size_t(beams) * bins)
+                throw std::runtime_error("SonarEchoDetector: the sonar scan holds less data than number_of_beams*number_of_bins");
+
+            echo_bins.assign(beams, NO_ECHO);
+            echo_intensities.assign(beams, 0);
+
+            const double resolution = scan.getSpatialResolution();
+            int min_bin = 0;
+            int max_bin = bins;
+            if(resolution > 0)
+            {
+                min_bin = std::max(0, int(ceil(config.min_range / resolution)));
+                if(config.max_range / resolution < bins)
+                    max_bin = int(floor(config.max_range / resolution)) + 1;
+            }
+            if(min_bin < max_bin && beams > 0)
+            {
+                if(scan.memory_layout_column)
+                    detectColumnLayout(scan.getDataConstPtr(), beams, min_bin, max_bin);
+                else
+                    detectRowLayout(scan.getDataConstPtr(), beams, bins, min_bin, max_bin);
+            }
+
+            cloud.time = scan.time;
+            cloud.points.clear();
+            cloud.colors.clear();
+            for(int beam = 0; beam < beams; ++beam)
+            {
+                if(echo_bins[beam] == NO_ECHO)
+                    continue;
+                const double bearing = scan.start_bearing.rad - beam * scan.angular_resolution.rad;
+                const double range = echo_bins[beam] * resolution;
+                cloud.points.push_back(transform * Eigen::Vector3d(range * cos(bearing), range * sin(bearing), 0));
+                if(config.intensity_as_color)
+                {
+                    const double grey = echo_intensities[beam] / 255.0;
+                    cloud.colors.push_back(base::Vector4d(grey, grey, grey, 1.0));
+                }
+            }
+        }
+
+        /** The bin of the echo of each beam of the last scan, NO_ECHO if
+         * there is none */
+        const std::vector<uint16_t> &getEchoBins() const
+        {
+            return echo_bins;
+        }
+
+        /** The intensity of the echo of each beam of the last scan */
+        const std::vector<uint8_t> &getEchoIntensities() const
+        {
+            return echo_intensities;
+        }
+
+    private:
+#ifdef __SSE2__
+        //unsigned a >= b, as byte mask
+        static __m128i greaterEqual(__m128i a, __m128i b)
+        {
+            return _mm_cmpeq_epi8(_mm_max_epu8(a, b), a);
+        }
+
+        static int firstBit(int mask)
+        {
+            int index = 0;
+            while(!(mask & 1))
+            {
+                mask >>= 1;
+                ++index;
+            }
+            return index;
+        }
+#endif
+
+        //index of the first value >= threshold in [begin,end), -1 if none
+        static int findFirst(const uint8_t *data, int begin, int end, uint8_t threshold)
+        {
+            int i = begin;
+#ifdef __SSE2__
+            const __m128i threshold_vector = _mm_set1_epi8(char(threshold));
+            for(; i + 16 <= end; i += 16)
+            {
+                const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                const int mask = _mm_movemask_epi8(greaterEqual(values, threshold_vector));
+                if(mask)
+                    return i + firstBit(mask);
+            }
+#endif
+            for(; i < end; ++i)
+                if(data[i] >= threshold)
+                    return i;
+            return -1;
+        }
+
+        //index of the first maximum in [begin,end)
+        static int findMaximum(const uint8_t *data, int begin, int end)
+        {
+            int i = begin;
+            uint8_t max = 0;
+#ifdef __SSE2__
+            __m128i max_vector = _mm_setzero_si128();
+            for(; i + 16 <= end; i += 16)
+                max_vector = _mm_max_epu8(max_vector, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)));
+            uint8_t lanes[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), max_vector);
+            max = *std::max_element(lanes, lanes + 16);
+#endif
+            for(; i < end; ++i)
+                max = std::max(max, data[i]);
+            return findFirst(data, begin, end, max);
+        }
+
+        void detectRowLayout(const uint8_t *data, int beams, int bins, int min_bin, int max_bin)
+        {
+            const uint8_t threshold = config.threshold;
+            const bool strongest = config.mode == SonarEchoDetectorConfig::STRONGEST_ECHO;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int beam = 0; beam < beams; ++beam)
+            {
+                const uint8_t *row = data + beam * bins;
+                int index = strongest ? findMaximum(row, min_bin, max_bin) : findFirst(row, min_bin, max_bin, threshold);
+                if(index >= 0 && row[index] >= threshold)
+                {
+                    echo_bins[beam] = index;
+                    echo_intensities[beam] = row[index];
+                }
+            }
+        }
+
+        void detectColumnLayout(const uint8_t *data, int beams, int min_bin, int max_bin)
+        {
+            //blocks of beams which are processed by one thread
+            const int block_size = 256;
+            const int blocks = (beams + block_size - 1) / block_size;
+            const bool strongest = config.mode == SonarEchoDetectorConfig::STRONGEST_ECHO;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int block = 0; block < blocks; ++block)
+            {
+                const int begin = block * block_size;
+                const int end = std::min(beams, begin + block_size);
+                if(strongest)
+                    findMaximumColumns(data, beams, begin, end, min_bin, max_bin);
+                else
+                    findFirstColumns(data, beams, begin, end, min_bin, max_bin);
+            }
+        }
+
+        //first echo of the beams [begin,end) in column layout
+        void findFirstColumns(const uint8_t *data, int beams, int begin, int end, int min_bin, int max_bin)
+        {
+            const uint8_t threshold = config.threshold;
+            int remaining = end - begin;
+            for(int bin = min_bin; bin < max_bin && remaining; ++bin)
+            {
+                const uint8_t *row = data + bin * beams;
+                int beam = begin;
+#ifdef __SSE2__
+                const __m128i threshold_vector = _mm_set1_epi8(char(threshold));
+                for(; beam + 16 <= end; beam += 16)
+                {
+                    const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + beam));
+                    int mask = _mm_movemask_epi8(greaterEqual(values, threshold_vector));
+                    for(int lane = 0; mask; ++lane, mask >>= 1)
+                    {
+                        if((mask & 1) && echo_bins[beam + lane] == NO_ECHO)
+                        {
+                            echo_bins[beam + lane] = bin;
+                            echo_intensities[beam + lane] = row[beam + lane];
+                            --remaining;
+                        }
+                    }
+                }
+#endif
+                for(; beam < end; ++beam)
+                {
+                    if(row[beam] >= threshold && echo_bins[beam] == NO_ECHO)
+                    {
+                        echo_bins[beam] = bin;
+                        echo_intensities[beam] = row[beam];
+                        --remaining;
+                    }
+                }
+            }
+        }
+
+        //strongest echo of the beams [begin,end) in column layout. The
+        //maxima and their bins are tracked element wise
+        void findMaximumColumns(const uint8_t *data, int beams, int begin, int end, int min_bin, int max_bin)
+        {
+            uint8_t *max = &echo_intensities[0];
+            uint16_t *index = &echo_bins[0];
+            for(int beam = begin; beam < end; ++beam)
+            {
+                max[beam] = data[min_bin * beams + beam];
+                index[beam] = min_bin;
+            }
+            for(int bin = min_bin + 1; bin < max_bin; ++bin)
+            {
+                const uint8_t *row = data + bin * beams;
+                int beam = begin;
+#ifdef __SSE2__
+                const __m128i sign = _mm_set1_epi8(char(0x80));
+                const __m128i bin_vector = _mm_set1_epi16(bin);
+                for(; beam + 16 <= end; beam += 16)
+                {
+                    const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + beam));
+                    const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(max + beam));
+                    //unsigned values > current
+                    const __m128i greater = _mm_cmpgt_epi8(_mm_xor_si128(values, sign), _mm_xor_si128(current, sign));
+                    if(!_mm_movemask_epi8(greater))
+                        continue;
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(max + beam), _mm_max_epu8(values, current));
+                    const __m128i mask_lo = _mm_unpacklo_epi8(greater, greater);
+                    const __m128i mask_hi = _mm_unpackhi_epi8(greater, greater);
+                    __m128i *index_lo = reinterpret_cast<__m128i*>(index + beam);
+                    __m128i *index_hi = reinterpret_cast<__m128i*>(index + beam + 8);
+                    _mm_storeu_si128(index_lo, _mm_or_si128(_mm_andnot_si128(mask_lo, _mm_loadu_si128(index_lo)),
+                                _mm_and_si128(mask_lo, bin_vector)));
+                    _mm_storeu_si128(index_hi, _mm_or_si128(_mm_andnot_si128(mask_hi, _mm_loadu_si128(index_hi)),
+                                _mm_and_si128(mask_hi, bin_vector)));
+                }
+#endif
+                for(; beam < end; ++beam)
+                {
+                    if(row[beam] > max[beam])
+                    {
+                        max[beam] = row[beam];
+                        index[beam] = bin;
+                    }
+                }
+            }
+            for(int beam = begin; beam < end; ++beam)
+            {
+                if(max[beam] < config.threshold)
+                {
+                    max[beam] = 0;
+                    index[beam] = NO_ECHO;
+                }
+            }
+        }
+
+        SonarEchoDetectorConfig config;
+        std::vector<uint16_t> echo_bins;
+        std::vector<uint8_t> echo_intensities;
+    };
+}}
+
+#endif
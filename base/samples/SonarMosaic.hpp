@@ -0,0 +1,533 @@
+#ifndef BASE_SAMPLES_SONAR_MOSAIC_H__
+#define BASE_SAMPLES_SONAR_MOSAIC_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <map>
+#include <set>
+#include <list>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Geometry>
+#include <base/samples/SonarScan.hpp>
+#include <base/samples/RigidBodyState.hpp>
+#include <base/samples/Frame.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the SonarMosaic */
+    struct SonarMosaicConfig
+    {
+        enum Blending
+        {
+            /** each cell holds the running average of all samples */
+            AVERAGE,
+            /** each cell holds the maximum of all samples */
+            MAXIMUM
+        };
+
+        SonarMosaicConfig()
+            : cell_size(0.1), tile_size(256), blending(AVERAGE), max_tiles_in_memory(0) {}
+
+        /** size of one cell in m */
+        double cell_size;
+        /** number of cells along each side of a tile */
+        uint16_t tile_size;
+        Blending blending;
+        /** maximum number of tiles kept in memory. The least recently used
+         * tiles are written to swap_directory if this number is exceeded.
+         * Zero disables the limit */
+        size_t max_tiles_in_memory;
+        /** existing directory for evicted tiles. Must be set if
+         * max_tiles_in_memory is not zero */
+        std::string swap_directory;
+    };
+
+    /** Integrates georeferenced sonar scans into a sparse, world-fixed grid
+     *
+     * The grid is split into square tiles which are allocated when a scan
+     * reaches them for the first time. Each cell stores the sum (or the
+     * maximum) of the samples integrated into it and their number, so the
+     * average does not depend on the order of integration. The x and y axes
+     * of the grid are the x and y axes of the world frame, scans are
+     * projected on the x-y plane.
+     *
+     * For each scan geometry the positions of all bins in the sonar frame
+     * are computed once. Beams and bins are subdivided so that neighbouring
+     * samples are closer than a cell, which prevents holes at long range.
+     *
+     * Several pings given to integrate() at once are projected in parallel.
+     * The samples are then sorted by tile and each tile is updated by a
+     * single thread, so no locking is required. Within a tile the samples
+     * are applied in the order of the pings.
+     */
+    class SonarMosaic
+    {
+    public:
+        typedef int64_t TileKey;
+
+        SonarMosaic(const SonarMosaicConfig &config = SonarMosaicConfig())
+            : config(config)
+        {
+            if(!(config.cell_size > 0) || config.tile_size == 0)
+                throw std::runtime_error("SonarMosaic: cell and tile size must be positive");
+            if(config.max_tiles_in_memory && config.swap_directory.empty())
+                throw std::runtime_error("SonarMosaic: a swap directory is required to limit the number of tiles in memory");
+        }
+
+        /** deletes all tiles including the swapped ones */
+        ~SonarMosaic()
+        {
+            clear();
+        }
+
+        const SonarMosaicConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Removes all tiles from memory and from the swap directory */
+        void clear()
+        {
+            for(TileMap::iterator it = tiles.begin(); it != tiles.end(); ++it)
+                delete it->second;
+            tiles.clear();
+            lru.clear();
+            for(std::set<TileKey>::const_iterator it = swapped.begin(); it != swapped.end(); ++it)
+                remove(tileFileName(*it).c_str());
+            swapped.clear();
+        }
+
+        /** Integrates one scan taken at the given pose of the sonar in the world frame */
+        void integrate(const SonarScan &scan, const RigidBodyState &pose)
+        {
+            integrate(scan, pose.getTransform());
+        }
+
+        void integrate(const SonarScan &scan, const Eigen::Affine3d &pose)
+        {
+            std::vector<const SonarScan*> scans(1, &scan);
+            std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > poses(1, pose);
+            integrate(scans, poses);
+        }
+
+        /** Integrates several scans in parallel. poses[i] is the pose of the
+         * sonar in the world frame when scans[i] was taken */
+        void integrate(const std::vector<SonarScan> &scans, const std::vector<RigidBodyState> &poses)
+        {
+            if(scans.size() != poses.size())
+                throw std::runtime_error("SonarMosaic::integrate: the number of scans and poses differ");
+            std::vector<const SonarScan*> scan_pointers(scans.size());
+            std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > transforms(poses.size());
+            for(size_t i = 0; i < scans.size(); ++i)
+            {
+                scan_pointers[i] = &scans[i];
+                transforms[i] = poses[i].getTransform();
+            }
+            integrate(scan_pointers, transforms);
+        }
+
+        void integrate(const std::vector<const SonarScan*> &scans,
+                const std::vector<Eigen::Affine3d, Eigen::aligned_allocator<Eigen::Affine3d> > &poses)
+        {
+            if(scans.size() != poses.size())
+                throw std::runtime_error("SonarMosaic::integrate: the number of scans and poses differ");
+
+            //the footprints are created sequentially as they are shared between pings
+            std::vector<const Footprint*> ping_footprints(scans.size());
+            for(size_t i = 0; i < scans.size(); ++i)
+            {
+                if(scans[i]->getData().size() < scans[i]->getBinCount())
+                    throw std::runtime_error("SonarMosaic::integrate: the sonar scan holds less data than number_of_beams*number_of_bins");
+                ping_footprints[i] = &getFootprint(*scans[i]);
+            }
+
+            //project all pings
+            if(projections.size() < scans.size())
+                projections.resize(scans.size());
+            const int count = scans.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+            for(int i = 0; i < count; ++i)
+                project(*scans[i], *ping_footprints[i], poses[i], projections[i]);
+
+            //distribute the samples to the tiles
+            std::vector<Tile*> active;
+            for(int i = 0; i < count; ++i)
+            {
+                const std::vector<Sample> &samples = projections[i];
+                TileKey last_key = 0;
+                Tile *tile = NULL;
+                for(size_t j = 0; j < samples.size(); ++j)
+                {
+                    if(!tile || samples[j].tile != last_key)
+                    {
+                        last_key = samples[j].tile;
+                        tile = &getTile(last_key);
+                        if(tile->pending.empty())
+                            active.push_back(tile);
+                    }
+                    tile->pending.push_back(Update(samples[j].cell, samples[j].value));
+                }
+            }
+
+            //update each tile by one thread
+            const int active_count = active.size();
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+            for(int i = 0; i < active_count; ++i)
+                apply(*active[i]);
+
+            //only the footprints of the latest geometries are kept
+            while(footprints.size() > 4)
+                footprints.pop_back();
+            evict();
+        }
+
+        /** Returns the intensity of the cell containing the given world
+         * position and the number of samples integrated into it. Returns
+         * false if no sample was integrated into the cell */
+        bool getCell(double x, double y, uint8_t &value, uint16_t &count)
+        {
+            int64_t cell_x = int64_t(floor(x / config.cell_size));
+            int64_t cell_y = int64_t(floor(y / config.cell_size));
+            TileKey key = tileKey(cell_x, cell_y);
+            if(tiles.find(key) == tiles.end() && swapped.find(key) == swapped.end())
+                return false;
+            const Tile &tile = getTile(key);
+            const uint32_t cell = cellIndex(cell_x, cell_y);
+            count = tile.counts[cell];
+            value = cellValue(tile, cell);
+            evict();
+            return count != 0;
+        }
+
+        /** Renders the rectangle starting at the given world position into
+         * a grayscale frame with one pixel per cell. The x-axis of the world
+         * points upwards in the image, the y-axis to the left. Cells without
+         * samples are set to background */
+        void render(double min_x, double min_y, uint16_t width, uint16_t height,
+                frame::Frame &frame, uint8_t background = 0)
+        {
+            frame.init(width, height, 8, frame::MODE_GRAYSCALE, background);
+            const int64_t first_x = int64_t(floor(min_x / config.cell_size));
+            const int64_t first_y = int64_t(floor(min_y / config.cell_size));
+            uint8_t *image = frame.getImagePtr();
+            for(int row = 0; row < height; ++row)
+            {
+                const int64_t cell_x = first_x + height - 1 - row;
+                for(int column = 0; column < width; ++column)
+                {
+                    const int64_t cell_y = first_y + width - 1 - column;
+                    TileKey key = tileKey(cell_x, cell_y);
+                    if(tiles.find(key) == tiles.end() && swapped.find(key) == swapped.end())
+                        continue;
+                    const Tile &tile = getTile(key);
+                    const uint32_t cell = cellIndex(cell_x, cell_y);
+                    if(tile.counts[cell])
+                        image[row * width + column] = cellValue(tile, cell);
+                }
+            }
+            frame.setStatus(frame::STATUS_VALID);
+            evict();
+        }
+
+        /** number of tiles in memory */
+        size_t getTilesInMemory() const
+        {
+            return tiles.size();
+        }
+
+        /** number of tiles in memory and in the swap directory */
+        size_t getTileCount() const
+        {
+            return tiles.size() + swapped.size();
+        }
+
+    private:
+        //position of one sub sample of a bin in the sonar frame
+        struct FootprintSample
+        {
+            float x;
+            float y;
+            uint32_t index;
+        };
+
+        struct Footprint
+        {
+            uint16_t number_of_beams;
+            uint16_t number_of_bins;
+            double start_bearing;
+            double angular_resolution;
+            double spatial_resolution;
+            bool memory_layout_column;
+            std::vector<FootprintSample> samples;
+
+            bool matches(const SonarScan &scan) const
+            {
+                return number_of_beams == scan.number_of_beams
+                    && number_of_bins == scan.number_of_bins
+                    && start_bearing == scan.start_bearing.rad
+                    && angular_resolution == scan.angular_resolution.rad
+                    && spatial_resolution == scan.getSpatialResolution()
+                    && memory_layout_column == scan.memory_layout_column;
+            }
+        };
+
+        struct Sample
+        {
+            TileKey tile;
+            uint32_t cell;
+            uint8_t value;
+        };
+
+        struct Update
+        {
+            Update(uint32_t cell, uint8_t value)
+                : cell(cell), value(value) {}
+            uint32_t cell;
+            uint8_t value;
+        };
+
+        struct Tile
+        {
+            //sum of the samples for AVERAGE, maximum for MAXIMUM blending
+            std::vector<uint32_t> values;
+            std::vector<uint16_t> counts;
+            std::vector<Update> pending;
+            std::list<TileKey>::iterator lru;
+        };
+
+        typedef std::map<TileKey, Tile*> TileMap;
+
+        const Footprint &getFootprint(const SonarScan &scan)
+        {
+            for(std::list<Footprint>::iterator it = footprints.begin(); it != footprints.end(); ++it)
+            {
+                if(it->matches(scan))
+                {
+                    footprints.splice(footprints.begin(), footprints, it);
+                    return footprints.front();
+                }
+            }
+            if(!scan.polar_coordinates)
+                throw std::runtime_error("SonarMosaic: the sonar scan is not in polar coordinates");
+            if(!(scan.getSpatialResolution() > 0))
+                throw std::runtime_error("SonarMosaic: the sonar scan has no valid spatial resolution");
+
+            footprints.push_front(Footprint());
+            Footprint &footprint = footprints.front();
+            footprint.number_of_beams = scan.number_of_beams;
+            footprint.number_of_bins = scan.number_of_bins;
+            footprint.start_bearing = scan.start_bearing.rad;
+            footprint.angular_resolution = scan.angular_resolution.rad;
+            footprint.spatial_resolution = scan.getSpatialResolution();
+            footprint.memory_layout_column = scan.memory_layout_column;
+
+            //samples are closer than max_distance so that every cell
+            //crossed by a beam gets at least one sample
+            const double max_distance = config.cell_size * 0.7;
+            const int range_steps = std::max(1, int(ceil(footprint.spatial_resolution / max_distance)));
+            for(int beam = 0; beam < footprint.number_of_beams; ++beam)
+            {
+                const double bearing = footprint.start_bearing - beam * footprint.angular_resolution;
+                for(int bin = 0; bin < footprint.number_of_bins; ++bin)
+                {
+                    const uint32_t index = footprint.memory_layout_column
+                        ? bin * footprint.number_of_beams + beam
+                        : beam * footprint.number_of_bins + bin;
+                    const double range = bin * footprint.spatial_resolution;
+                    const int beam_steps = std::max(1, int(ceil(range * footprint.angular_resolution / max_distance)));
+                    for(int i = 0; i < beam_steps; ++i)
+                    {
+                        const double sub_bearing = bearing + footprint.angular_resolution * ((i + 0.5) / beam_steps - 0.5);
+                        const double c = cos(sub_bearing);
+                        const double s = sin(sub_bearing);
+                        for(int j = 0; j < range_steps; ++j)
+                        {
+                            const double sub_range = range + footprint.spatial_resolution * ((j + 0.5) / range_steps - 0.5);
+                            if(sub_range < 0)
+                                continue;
+                            FootprintSample sample;
+                            sample.x = sub_range * c;
+                            sample.y = sub_range * s;
+                            sample.index = index;
+                            footprint.samples.push_back(sample);
+                        }
+                    }
+                }
+            }
+            return footprint;
+        }
+
+        TileKey tileKey(int64_t cell_x, int64_t cell_y) const
+        {
+            const int64_t tile_x = cell_x >= 0 ? cell_x / config.tile_size : (cell_x + 1) / config.tile_size - 1;
+            const int64_t tile_y = cell_y >= 0 ? cell_y / config.tile_size : (cell_y + 1) / config.tile_size - 1;
+            //shifting a negative signed value is undefined
+            return TileKey((uint64_t(tile_x) << 32) | uint32_t(tile_y));
+        }
+
+        uint32_t cellIndex(int64_t cell_x, int64_t cell_y) const
+        {
+            int64_t x = cell_x % config.tile_size;
+            int64_t y = cell_y % config.tile_size;
+            if(x < 0)
+                x += config.tile_size;
+            if(y < 0)
+                y += config.tile_size;
+            return y * config.tile_size + x;
+        }
+
+        void project(const SonarScan &scan, const Footprint &footprint,
+                const Eigen::Affine3d &pose, std::vector<Sample> &samples) const
+        {
+            const Eigen::Matrix3d rotation = pose.linear();
+            const double r00 = rotation(0, 0), r01 = rotation(0, 1);
+            const double r10 = rotation(1, 0), r11 = rotation(1, 1);
+            const double tx = pose.translation().x() / config.cell_size;
+            const double ty = pose.translation().y() / config.cell_size;
+            const double scale = 1.0 / config.cell_size;
+            const uint8_t *data = scan.getDataConstPtr();
+
+            samples.resize(footprint.samples.size());
+            for(size_t i = 0; i < footprint.samples.size(); ++i)
+            {
+                const FootprintSample &in = footprint.samples[i];
+                const int64_t cell_x = int64_t(floor(tx + (r00 * in.x + r01 * in.y) * scale));
+                const int64_t cell_y = int64_t(floor(ty + (r10 * in.x + r11 * in.y) * scale));
+                Sample &out = samples[i];
+                out.tile = tileKey(cell_x, cell_y);
+                out.cell = cellIndex(cell_x, cell_y);
+                out.value = data[in.index];
+            }
+        }
+
+        void apply(Tile &tile) const
+        {
+            uint32_t *values = &tile.values[0];
+            uint16_t *counts = &tile.counts[0];
+            const std::vector<Update> &pending = tile.pending;
+            if(config.blending == SonarMosaicConfig::MAXIMUM)
+            {
+                for(size_t i = 0; i < pending.size(); ++i)
+                {
+                    const uint32_t cell = pending[i].cell;
+                    values[cell] = std::max<uint32_t>(values[cell], pending[i].value);
+                    if(counts[cell] != 0xFFFF)
+                        ++counts[cell];
+                }
+            }
+            else
+            {
+                for(size_t i = 0; i < pending.size(); ++i)
+                {
+                    const uint32_t cell = pending[i].cell;
+                    //the sum cannot overflow as the count saturates
+                    if(counts[cell] != 0xFFFF)
+                    {
+                        ++counts[cell];
+                        values[cell] += pending[i].value;
+                    }
+                }
+            }
+            tile.pending.clear();
+        }
+
+        uint8_t cellValue(const Tile &tile, uint32_t cell) const
+        {
+            const uint32_t count = tile.counts[cell];
+            if(config.blending == SonarMosaicConfig::MAXIMUM || count == 0)
+                return tile.values[cell];
+            return (tile.values[cell] + count / 2) / count;
+        }
+
+        std::string tileFileName(TileKey key) const
+        {
+            std::stringstream name;
+            name << config.swap_directory << "/tile_" << (key >> 32) << "_" << int32_t(key & 0xFFFFFFFF) << ".bin";
+            return name.str();
+        }
+
+        //returns the tile with the given key and marks it as most recently
+        //used. The tile is loaded or created if required
+        Tile &getTile(TileKey key)
+        {
+            TileMap::iterator it = tiles.find(key);
+            if(it != tiles.end())
+            {
+                lru.splice(lru.begin(), lru, it->second->lru);
+                return *it->second;
+            }
+
+            const size_t cells = size_t(config.tile_size) * config.tile_size;
+            Tile *tile = new Tile;
+            tile->values.resize(cells, 0);
+            tile->counts.resize(cells, 0);
+            std::set<TileKey>::iterator swapped_it = swapped.find(key);
+            if(swapped_it != swapped.end())
+            {
+                const std::string file_name = tileFileName(key);
+                std::ifstream file(file_name.c_str(), std::ios::binary);
+                file.read(reinterpret_cast<char*>(&tile->values[0]), cells * sizeof(uint32_t));
+                file.read(reinterpret_cast<char*>(&tile->counts[0]), cells * sizeof(uint16_t));
+                if(!file)
+                {
+                    delete tile;
+                    throw std::runtime_error("SonarMosaic: cannot read tile " + file_name);
+                }
+                file.close();
+                remove(file_name.c_str());
+                swapped.erase(swapped_it);
+            }
+            lru.push_front(key);
+            tile->lru = lru.begin();
+            tiles.insert(std::make_pair(key, tile));
+            return *tile;
+        }
+
+        //writes the least recently used tiles to disk until the limit is met
+        void evict()
+        {
+            if(!config.max_tiles_in_memory)
+                return;
+            while(tiles.size() > config.max_tiles_in_memory)
+            {
+                const TileKey key = lru.back();
+                TileMap::iterator it = tiles.find(key);
+                const Tile &tile = *it->second;
+                const std::string file_name = tileFileName(key);
+                std::ofstream file(file_name.c_str(), std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char*>(&tile.values[0]), tile.values.size() * sizeof(uint32_t));
+                file.write(reinterpret_cast<const char*>(&tile.counts[0]), tile.counts.size() * sizeof(uint16_t));
+                if(!file)
+                    throw std::runtime_error("SonarMosaic: cannot write tile " + file_name);
+                swapped.insert(key);
+                delete it->second;
+                tiles.erase(it);
+                lru.pop_back();
+            }
+        }
+
+        SonarMosaicConfig config;
+        TileMap tiles;
+        std::list<TileKey> lru;
+        std::set<TileKey> swapped;
+        std::list<Footprint> footprints;
+        std::vector<std::vector<Sample> > projections;
+
+        //tiles hold raw pointers
+        SonarMosaic(const SonarMosaic &);
+        SonarMosaic &operator=(const SonarMosaic &);
+    };
+}}
+
+#endif
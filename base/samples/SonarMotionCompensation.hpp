@@ -0,0 +1,251 @@
+#ifndef BASE_SAMPLES_SONAR_MOTION_COMPENSATION_H__
+#define BASE_SAMPLES_SONAR_MOTION_COMPENSATION_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <Eigen/Geometry>
+#include <base/samples/SonarScan.hpp>
+#include <base/samples/RigidBodyState.hpp>
+#include <base/samples/RigidBodyStateInterpolator.hpp>
+#include <base/samples/Pointcloud.hpp>
+#include <base/samples/Frame.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the SonarMotionCompensation */
+    struct SonarMotionCompensationConfig
+    {
+        SonarMotionCompensationConfig()
+            : threshold(1), min_range(0), intensity_as_color(false)
+            , width(0), height(0), pixel_size(0.1) {}
+
+        /** bins below this intensity are not projected */
+        uint8_t threshold;
+        /** bins closer than this range in m are not projected */
+        double min_range;
+        /** fills the colors of the point cloud with the intensities */
+        bool intensity_as_color;
+
+        /** size of the generated frames in pixels */
+        uint16_t width;
+        uint16_t height;
+        /** size of one pixel in m */
+        double pixel_size;
+    };
+
+    /** Projects the beams of a sonar scan with the pose of the sonar at the
+     * time each beam was taken
+     *
+     * The beams of a mechanically scanning sonar are taken over several
+     * seconds. Projecting all of them from a single pose smears the scan if
+     * the vehicle moves. This class interpolates the pose of the sonar at
+     * the time stamp in time_beams for each beam (scan.time for beams
+     * without time stamp) from a history of sonar poses in a world frame.
+     * Beams outside of the history are skipped.
+     *
+     * The result is either a point cloud in the world frame or a grayscale
+     * image in the sonar frame at scan.time, with the sonar in the image
+     * center, x pointing upwards and y to the left. Overlapping bins keep the
+     * maximum intensity. Both are generated in a single pass over the scan.
+     */
+    class SonarMotionCompensation
+    {
+    public:
+        SonarMotionCompensation(const SonarMotionCompensationConfig &config = SonarMotionCompensationConfig())
+            : config(config)
+        {
+        }
+
+        void setConfig(const SonarMotionCompensationConfig &config)
+        {
+            this->config = config;
+        }
+
+        const SonarMotionCompensationConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Projects all bins above the threshold into cloud
+         *
+         * @param poses poses of the sonar in the world frame sorted by time
+         * @return the number of beams for which a pose was available
+         * @throws std::runtime_error if the scan is not in polar coordinates
+         */
+        size_t compensate(const SonarScan &scan, const std::vector<RigidBodyState> &poses, Pointcloud &cloud)
+        {
+            checkScan(scan);
+            interpolator.setHistory(poses);
+            cloud.time = scan.time;
+            cloud.points.clear();
+            cloud.colors.clear();
+
+            const int beams = scan.number_of_beams;
+            const int bins = scan.number_of_bins;
+            const int beam_step = scan.memory_layout_column ? 1 : bins;
+            const int bin_step = scan.memory_layout_column ? beams : 1;
+            const double spatial_resolution = scan.getSpatialResolution();
+            const int first_bin = std::max(0, int(ceil(config.min_range / spatial_resolution)));
+            const uint8_t *data = scan.getData().empty() ? NULL : scan.getDataConstPtr();
+
+            size_t compensated = 0;
+            Eigen::Affine3d pose;
+            for(int beam = 0; beam < beams; ++beam)
+            {
+                if(!interpolator.getTransform(beamTime(scan, beam), pose))
+                    continue;
+                ++compensated;
+                const double bearing = scan.start_bearing.rad - beam * scan.angular_resolution.rad;
+                const Eigen::Vector3d origin = pose.translation();
+                const Eigen::Vector3d step = pose.linear()
+                    * Eigen::Vector3d(cos(bearing), sin(bearing), 0) * spatial_resolution;
+                const uint8_t *p = data + beam * beam_step;
+                for(int bin = first_bin; bin < bins; ++bin)
+                {
+                    const uint8_t value = p[bin * bin_step];
+                    if(value < config.threshold)
+                        continue;
+                    cloud.points.push_back(origin + step * bin);
+                    if(config.intensity_as_color)
+                    {
+                        const double intensity = value / 255.0;
+                        cloud.colors.push_back(base::Vector4d(intensity, intensity, intensity, 1.0));
+                    }
+                }
+            }
+            return compensated;
+        }
+
+        /** Rasterizes all bins above the threshold into frame
+         *
+         * The frame is initialized as 8 bit grayscale frame of the configured
+         * size. Its memory is reused if it already has the right size. The
+         * beams are subdivided so that the fan has no holes at long range.
+         *
+         * @param poses poses of the sonar in the world frame sorted by time
+         * @return the number of beams for which a pose was available. This is
+         * zero if the pose at scan.time is not available
+         * @throws std::runtime_error if the scan is not in polar coordinates
+         * or the frame size is not configured
+         */
+        size_t compensate(const SonarScan &scan, const std::vector<RigidBodyState> &poses, frame::Frame &frame)
+        {
+            checkScan(scan);
+            if(config.width == 0 || config.height == 0 || !(config.pixel_size > 0))
+                throw std::runtime_error("SonarMotionCompensation: the frame size is not configured");
+            frame.init(config.width, config.height, 8, frame::MODE_GRAYSCALE, 0);
+            frame.time = scan.time;
+            frame.setStatus(frame::STATUS_VALID);
+            interpolator.setHistory(poses);
+
+            Eigen::Affine3d reference;
+            if(!interpolator.getTransform(scan.time, reference))
+                return 0;
+            const Eigen::Affine3d world_to_reference = reference.inverse();
+
+            const int beams = scan.number_of_beams;
+            const int bins = scan.number_of_bins;
+            const int beam_step = scan.memory_layout_column ? 1 : bins;
+            const int bin_step = scan.memory_layout_column ? beams : 1;
+            const double spatial_resolution = scan.getSpatialResolution();
+            const double angular_resolution = scan.angular_resolution.rad;
+            const int first_bin = std::max(0, int(ceil(config.min_range / spatial_resolution)));
+            const uint8_t *data = scan.getData().empty() ? NULL : scan.getDataConstPtr();
+
+            //number of sub beams per bin so that neighbouring samples are
+            //closer than a pixel
+            const double max_distance = 0.7 * config.pixel_size;
+            sub_beams.resize(bins);
+            int max_sub_beams = 1;
+            for(int bin = 0; bin < bins; ++bin)
+            {
+                sub_beams[bin] = std::max(1, int(ceil(bin * spatial_resolution * angular_resolution / max_distance)));
+                max_sub_beams = std::max(max_sub_beams, sub_beams[bin]);
+            }
+            //directions of k sub beams start at offset k*(k-1)/2
+            directions.resize(max_sub_beams * (max_sub_beams + 1) / 2);
+            const int range_steps = std::max(1, int(ceil(spatial_resolution / max_distance)));
+
+            uint8_t *image = frame.getImagePtr();
+            const double scale = 1.0 / config.pixel_size;
+            const double origin_row = 0.5 * config.height;
+            const double origin_column = 0.5 * config.width;
+            size_t compensated = 0;
+            Eigen::Affine3d pose;
+            for(int beam = 0; beam < beams; ++beam)
+            {
+                if(!interpolator.getTransform(beamTime(scan, beam), pose))
+                    continue;
+                ++compensated;
+                const Eigen::Affine3d transform = world_to_reference * pose;
+                const Eigen::Vector2d origin = transform.translation().head<2>();
+                const Eigen::Matrix3d rotation = transform.linear();
+                const double bearing = scan.start_bearing.rad - beam * angular_resolution;
+                for(int k = 1; k <= max_sub_beams; ++k)
+                {
+                    Eigen::Vector2d *direction = &directions[k * (k - 1) / 2];
+                    for(int i = 0; i < k; ++i)
+                    {
+                        const double angle = bearing + angular_resolution * ((i + 0.5) / k - 0.5);
+                        direction[i] = (rotation * Eigen::Vector3d(cos(angle), sin(angle), 0)).head<2>();
+                    }
+                }
+
+                const uint8_t *p = data + beam * beam_step;
+                for(int bin = first_bin; bin < bins; ++bin)
+                {
+                    const uint8_t value = p[bin * bin_step];
+                    if(value < config.threshold)
+                        continue;
+                    const int k = sub_beams[bin];
+                    const Eigen::Vector2d *direction = &directions[k * (k - 1) / 2];
+                    for(int j = 0; j < range_steps; ++j)
+                    {
+                        const double range = std::max(0.0, spatial_resolution * (bin + (j + 0.5) / range_steps - 0.5));
+                        for(int i = 0; i < k; ++i)
+                        {
+                            const Eigen::Vector2d point = origin + direction[i] * range;
+                            const double row = origin_row - point.x() * scale;
+                            const double column = origin_column - point.y() * scale;
+                            if(row < 0 || column < 0 || row >= config.height || column >= config.width)
+                                continue;
+                            uint8_t &pixel = image[int(row) * config.width + int(column)];
+                            pixel = std::max(pixel, value);
+                        }
+                    }
+                }
+            }
+            return compensated;
+        }
+
+    private:
+        void checkScan(const SonarScan &scan) const
+        {
+            if(!scan.polar_coordinates)
+                throw std::runtime_error("SonarMotionCompensation: the sonar scan is not in polar coordinates");
+            if(scan.getData().size() < scan.getBinCount())
+                throw std::runtime_error("SonarMotionCompensation: the sonar scan holds less data than number_of_beams*number_of_bins");
+            if(!(scan.getSpatialResolution() > 0))
+                throw std::runtime_error("SonarMotionCompensation: the sonar scan has no valid spatial resolution");
+        }
+
+        static const base::Time &beamTime(const SonarScan &scan, int beam)
+        {
+            if(scan.time_beams.size() == scan.number_of_beams && !scan.time_beams[beam].isNull())
+                return scan.time_beams[beam];
+            return scan.time;
+        }
+
+        SonarMotionCompensationConfig config;
+        RigidBodyStateInterpolator interpolator;
+        std::vector<int> sub_beams;
+        std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d> > directions;
+    };
+}}
+
+#endif
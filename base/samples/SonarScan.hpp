@@ -15,6 +15,8 @@
 
 #include <base/Time.hpp>
 #include <base/Angle.hpp>
+#include <base/Transpose.hpp>
+#include <base/StridedView.hpp>
 #include <base/samples/SonarBeam.hpp>
 
 namespace base { namespace samples { 
@@ -39,12 +41,19 @@ namespace base { namespace samples {
             }
 
             SonarScan(uint16_t number_of_beams,uint16_t number_of_bins,Angle start_bearing,Angle angular_resolution,bool memory_layout_column=true)
+                : number_of_beams(0)
+                , number_of_bins(0)
+                , sampling_interval(0)
+                , speed_of_sound(0)
+                , polar_coordinates(true)
             {
                 init(number_of_beams,number_of_bins,start_bearing,angular_resolution,memory_layout_column);
             }
 
             //makes a copy of other
             SonarScan(const SonarScan &other,bool bcopy = true)
+                : number_of_beams(0)
+                , number_of_bins(0)
             {
                 init(other,bcopy);
             }
@@ -198,27 +207,97 @@ namespace base { namespace samples {
                 sonar_beam.bearing = bearing;
             }
 
+            //strided views on the data of one beam or one bin
+            //they work for both memory layouts without copying the data 
+            //and stay valid as long as the data is not reallocated
+            typedef base::StridedView<uint8_t> View;
+            typedef base::StridedView<const uint8_t> ConstView;
+
+            //returns the bins of the beam with the given index
+            //an exception is thrown if the index is out of range
+            View beamView(uint16_t index)
+            {
+                checkBeamIndex(index);
+                return View(getDataPtr()+beamOffset(index),number_of_bins,memory_layout_column ? number_of_beams : 1);
+            }
+            ConstView beamView(uint16_t index)const
+            {
+                checkBeamIndex(index);
+                return ConstView(getDataConstPtr()+beamOffset(index),number_of_bins,memory_layout_column ? number_of_beams : 1);
+            }
+
+            //returns the values of all beams for the bin with the given index
+            //an exception is thrown if the index is out of range
+            View binView(uint16_t index)
+            {
+                checkBinIndex(index);
+                return View(getDataPtr()+binOffset(index),number_of_beams,memory_layout_column ? 1 : number_of_bins);
+            }
+            ConstView binView(uint16_t index)const
+            {
+                checkBinIndex(index);
+                return ConstView(getDataConstPtr()+binOffset(index),number_of_beams,memory_layout_column ? 1 : number_of_bins);
+            }
+
+            //returns the bearing of the beam with the given index 
+            Angle getBeamBearing(uint16_t index)const
+            {
+                return start_bearing-angular_resolution*index;
+            }
+
+            //returns the time stamp of the beam with the given index 
+            //this is time if no separate time stamp was set for the beam
+            base::Time getBeamTime(uint16_t index)const
+            {
+                if(index < time_beams.size() && !time_beams[index].isNull())
+                    return time_beams[index];
+                return time;
+            }
+
+            //calls functor(index,beamView(index)) for each beam in the order of 
+            //the beams and returns the functor 
+            //this allows per beam algorithms to run directly on both memory layouts
+            template<typename Functor>
+            Functor forEachBeam(Functor functor)
+            {
+                for(uint16_t i=0;i<number_of_beams;++i)
+                    functor(i,beamView(i));
+                return functor;
+            }
+            template<typename Functor>
+            Functor forEachBeam(Functor functor)const
+            {
+                for(uint16_t i=0;i<number_of_beams;++i)
+                    functor(i,beamView(i));
+                return functor;
+            }
+
             //this toggles the memory layout between one sonar beam per row and one sonar beam per column
             //to add sonar beams the memory layout must be one sonar beam per row 
+            //
+            //a temporary buffer is allocated for each call, use 
+            //toggleMemoryLayout(buffer) if the layout is toggled frequently
             void toggleMemoryLayout()
             {
                 std::vector<uint8_t> temp;
-                temp.resize(data.size());
+                toggleMemoryLayout(temp);
+            }
 
-                if(memory_layout_column)
-                {
-                    for(int row=0;row < number_of_beams;++row)
-                        for(int column=0;column < number_of_bins;++column)
-                            temp[row*number_of_bins+column] =data[column*number_of_beams+row]; 
-                }
-                else
+            //same as toggleMemoryLayout() but uses the given buffer as scratch memory
+            //the buffer is swapped with data afterwards, so passing the same 
+            //buffer again does not allocate memory as long as the scan size is unchanged
+            void toggleMemoryLayout(std::vector<uint8_t> &buffer)
+            {
+                buffer.resize(data.size());
+                if(!data.empty())
                 {
-                    for(int row=0;row < number_of_beams;++row)
-                        for(int column=0;column < number_of_bins;++column)
-                            temp[column*number_of_beams+row] =data[row*number_of_bins+column]; 
+                    if(memory_layout_column)
+                        base::transpose(&data[0],&buffer[0],number_of_bins,number_of_beams);
+                    else
+                        base::transpose(&data[0],&buffer[0],number_of_beams,number_of_bins);
                 }
                 memory_layout_column = !memory_layout_column;
-                data.swap(temp);
+                data.swap(buffer);
             }
 
             void swap(SonarScan &sonar_scan)
@@ -330,6 +409,27 @@ namespace base { namespace samples {
                 return static_cast<const uint8_t *>(&this->data[0]);
             }
 
+        private:
+            void checkBeamIndex(uint16_t index)const
+            {
+                if(index >= number_of_beams || data.size() < getBinCount())
+                    throw std::runtime_error("beamView: index out of range!");
+            }
+            void checkBinIndex(uint16_t index)const
+            {
+                if(index >= number_of_bins || data.size() < getBinCount())
+                    throw std::runtime_error("binView: index out of range!");
+            }
+            size_t beamOffset(uint16_t index)const
+            {
+                return memory_layout_column ? index : size_t(index)*number_of_bins;
+            }
+            size_t binOffset(uint16_t index)const
+            {
+                return memory_layout_column ? size_t(index)*number_of_beams : index;
+            }
+
+        public:
             //The time at which this sonar scan has been captured
             base::Time                  time;
 
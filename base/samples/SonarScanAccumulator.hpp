@@ -0,0 +1,223 @@
+#ifndef BASE_SAMPLES_SONARSCAN_ACCUMULATOR_H__
+#define BASE_SAMPLES_SONARSCAN_ACCUMULATOR_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <base/Float.hpp>
+#include <base/Time.hpp>
+#include <base/Angle.hpp>
+#include <base/samples/SonarBeam.hpp>
+#include <base/samples/SonarScan.hpp>
+
+namespace base { namespace samples {
+
+    /** Accumulates the beams of a mechanically scanning sonar into a sonar scan
+     *
+     * The sonar scan is allocated once for the full sweep and the beams are
+     * written in place, in row as well as in column memory layout. The
+     * accumulator keeps track of
+     *  - the beams which changed since the last call to clearChanges(), to
+     *    publish incremental updates
+     *  - the beams which were received since the last call to startSweep(),
+     *    to publish complete sweeps
+     *
+     * The accumulated scan is accessed by reference, so publishing a sweep
+     * does not require a copy of the scan.
+     */
+    class SonarScanAccumulator
+    {
+    public:
+        SonarScanAccumulator()
+            : sweep_beam_count(0)
+        {
+        }
+
+        SonarScanAccumulator(uint16_t number_of_beams, uint16_t number_of_bins,
+                Angle start_bearing, Angle angular_resolution, bool memory_layout_column = false)
+            : sweep_beam_count(0)
+        {
+            init(number_of_beams, number_of_bins, start_bearing, angular_resolution, memory_layout_column);
+        }
+
+        /** (Re)allocates the sweep and forgets all received beams */
+        void init(uint16_t number_of_beams, uint16_t number_of_bins,
+                Angle start_bearing, Angle angular_resolution, bool memory_layout_column = false)
+        {
+            scan.init(number_of_beams, number_of_bins, start_bearing, angular_resolution, memory_layout_column, 0);
+            scan.sampling_interval = 0;
+            scan.time_beams.assign(number_of_beams, base::Time());
+            changed.clear();
+            changed_flags.assign(number_of_beams, 0);
+            startSweep();
+        }
+
+        /** Resets the data and the beam times of the sweep and marks all
+         * beams as changed */
+        void clear()
+        {
+            scan.reset(0);
+            scan.time_beams.assign(scan.number_of_beams, base::Time());
+            changed.clear();
+            changed_flags.assign(scan.number_of_beams, 1);
+            for(uint16_t i = 0; i < scan.number_of_beams; ++i)
+                changed.push_back(i);
+            startSweep();
+        }
+
+        /** Writes the given beam into the sweep
+         *
+         * If the sampling interval or the speed of sound of the beam differs
+         * from the previous beams, the range of all bins changes and the
+         * previously received beams are cleared.
+         *
+         * Beams with less bins than the sweep are padded with zeros.
+         *
+         * @throws std::runtime_error if the beam has more bins than the sweep
+         * or if the bearing is not covered by the sweep
+         */
+        void addSonarBeam(const SonarBeam &sonar_beam)
+        {
+            const uint16_t number_of_bins = scan.number_of_bins;
+            if(sonar_beam.beam.size() > number_of_bins)
+                throw std::runtime_error("SonarScanAccumulator::addSonarBeam: too many bins");
+            int index = scan.beamIndexForBearing(sonar_beam.bearing);
+            if(index < 0)
+                throw std::runtime_error("SonarScanAccumulator::addSonarBeam: bearing is out of range");
+
+            if(differs(scan.sampling_interval, sonar_beam.sampling_interval)
+                    || differs(scan.speed_of_sound, sonar_beam.speed_of_sound))
+            {
+                if(scan.sampling_interval != 0)
+                    clear();
+                scan.sampling_interval = sonar_beam.sampling_interval;
+                scan.speed_of_sound = sonar_beam.speed_of_sound;
+                scan.beamwidth_horizontal = Angle::fromRad(sonar_beam.beamwidth_horizontal);
+                scan.beamwidth_vertical = Angle::fromRad(sonar_beam.beamwidth_vertical);
+            }
+
+            const size_t size = sonar_beam.beam.size();
+            if(scan.memory_layout_column)
+            {
+                const uint16_t number_of_beams = scan.number_of_beams;
+                uint8_t *p = &scan.data[index];
+                for(size_t bin = 0; bin < size; ++bin, p += number_of_beams)
+                    *p = sonar_beam.beam[bin];
+                for(size_t bin = size; bin < number_of_bins; ++bin, p += number_of_beams)
+                    *p = 0;
+            }
+            else
+            {
+                uint8_t *p = &scan.data[index * number_of_bins];
+                if(size)
+                    memcpy(p, &sonar_beam.beam[0], size);
+                memset(p + size, 0, number_of_bins - size);
+            }
+
+            scan.time_beams[index] = sonar_beam.time;
+            scan.time = sonar_beam.time;
+            if(!changed_flags[index])
+            {
+                changed_flags[index] = 1;
+                changed.push_back(index);
+            }
+            if(!sweep_flags[index])
+            {
+                sweep_flags[index] = 1;
+                ++sweep_beam_count;
+            }
+        }
+
+        /** The accumulated sweep */
+        const SonarScan &getSonarScan() const
+        {
+            return scan;
+        }
+
+        /** Returns true if each beam was received at least once since the
+         * last call to startSweep() */
+        bool isSweepComplete() const
+        {
+            return sweep_beam_count == scan.number_of_beams;
+        }
+
+        /** Starts a new sweep. The data of the previous sweep is kept and
+         * overwritten by the new beams */
+        void startSweep()
+        {
+            sweep_flags.assign(scan.number_of_beams, 0);
+            sweep_beam_count = 0;
+        }
+
+        bool hasChanges() const
+        {
+            return !changed.empty();
+        }
+
+        /** The indexes of the beams which changed since the last call to
+         * clearChanges(), in the order they were received */
+        const std::vector<uint16_t> &getChangedBeams() const
+        {
+            return changed;
+        }
+
+        /** Copies the changed beams into beams. The elements of beams are
+         * reused, so their memory is only allocated once. */
+        void getChangedSonarBeams(std::vector<SonarBeam> &beams) const
+        {
+            beams.resize(changed.size());
+            for(size_t i = 0; i < changed.size(); ++i)
+                getSonarBeam(changed[i], beams[i]);
+        }
+
+        void clearChanges()
+        {
+            for(size_t i = 0; i < changed.size(); ++i)
+                changed_flags[changed[i]] = 0;
+            changed.clear();
+        }
+
+        /** Copies the beam with the given index into sonar_beam */
+        void getSonarBeam(uint16_t index, SonarBeam &sonar_beam) const
+        {
+            if(index >= scan.number_of_beams)
+                throw std::runtime_error("SonarScanAccumulator::getSonarBeam: index out of range");
+            const uint16_t number_of_bins = scan.number_of_bins;
+            sonar_beam.beam.resize(number_of_bins);
+            if(scan.memory_layout_column)
+            {
+                const uint16_t number_of_beams = scan.number_of_beams;
+                const uint8_t *p = &scan.data[index];
+                for(uint16_t bin = 0; bin < number_of_bins; ++bin, p += number_of_beams)
+                    sonar_beam.beam[bin] = *p;
+            }
+            else if(number_of_bins)
+                memcpy(&sonar_beam.beam[0], &scan.data[index * number_of_bins], number_of_bins);
+
+            sonar_beam.time = scan.time_beams[index];
+            sonar_beam.bearing = scan.start_bearing - scan.angular_resolution * index;
+            sonar_beam.sampling_interval = scan.sampling_interval;
+            sonar_beam.speed_of_sound = scan.speed_of_sound;
+            sonar_beam.beamwidth_horizontal = scan.beamwidth_horizontal.rad;
+            sonar_beam.beamwidth_vertical = scan.beamwidth_vertical.rad;
+        }
+
+    private:
+        template<typename T>
+        static bool differs(T a, T b)
+        {
+            return a != b && !(base::isNaN(a) && base::isNaN(b));
+        }
+
+        SonarScan scan;
+        std::vector<uint16_t> changed;
+        std::vector<uint8_t> changed_flags;
+        std::vector<uint8_t> sweep_flags;
+        uint16_t sweep_beam_count;
+    };
+}}
+
+#endif
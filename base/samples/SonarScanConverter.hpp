@@ -0,0 +1,278 @@
+#ifndef BASE_SAMPLES_SONARSCAN_CONVERTER_H__
+#define BASE_SAMPLES_SONARSCAN_CONVERTER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <base/samples/SonarScan.hpp>
+#include <base/samples/Frame.hpp>
+
+namespace base { namespace samples {
+
+    /** Rasterizes polar sonar scans into Cartesian grayscale frames
+     *
+     * The mapping between image pixels and sonar bins only depends on the
+     * scan geometry and on the output parameters. It is computed once and
+     * cached, so that converting a scan reduces to a table lookup per pixel.
+     * The table is rebuilt automatically whenever the geometry of the
+     * converted scans changes.
+     *
+     * The sonar is placed at the bottom center of the image with the x-axis
+     * (bearing zero) pointing upwards and positive bearings to the left. If
+     * the scan covers bearings behind the sonar (more than 90 deg from the
+     * front) it is placed at the image center instead.
+     *
+     * If OpenMP is enabled, the image rows are rasterized in parallel.
+     */
+    class SonarScanConverter
+    {
+    public:
+        enum Interpolation
+        {
+            NEAREST,
+            BILINEAR
+        };
+
+        /**
+         * @param width width of the generated frames in pixels
+         * @param height height of the generated frames in pixels
+         * @param pixel_size size of one pixel in meters. If set to zero the
+         *        pixel size is chosen so that the whole scan fits into the frame
+         * @param interpolation interpolation between neighbouring beams and bins
+         * @param background value of the pixels which are not covered by the scan
+         */
+        SonarScanConverter(uint16_t width = 0, uint16_t height = 0, double pixel_size = 0,
+                Interpolation interpolation = BILINEAR, uint8_t background = 0)
+            : width(width), height(height), pixel_size(pixel_size)
+            , interpolation(interpolation), background(background)
+            , current_pixel_size(0), table_valid(false)
+        {
+        }
+
+        void setOutput(uint16_t width, uint16_t height, double pixel_size = 0)
+        {
+            this->width = width;
+            this->height = height;
+            this->pixel_size = pixel_size;
+            table_valid = false;
+        }
+
+        void setInterpolation(Interpolation interpolation)
+        {
+            this->interpolation = interpolation;
+            table_valid = false;
+        }
+
+        void setBackground(uint8_t background)
+        {
+            this->background = background;
+        }
+
+        /** Returns the size of one pixel in meters used for the last
+         * conversion. This differs from the configured value if that one is
+         * zero */
+        double getPixelSize() const
+        {
+            return current_pixel_size;
+        }
+
+        /** Converts the given polar sonar scan into frame
+         *
+         * frame is initialized as 8 bit grayscale frame of the configured
+         * size. Its memory is reused if it already has the right size.
+         *
+         * @throws std::runtime_error if the scan is not in polar coordinates
+         * or if its spatial resolution or the output size are invalid
+         */
+        void convert(const SonarScan &scan, frame::Frame &frame)
+        {
+            updateTable(scan);
+
+            frame.init(width, height, 8, frame::MODE_GRAYSCALE, -1);
+            frame.time = scan.time;
+            uint8_t *image = frame.getImagePtr();
+            const uint8_t *data = scan.getData().empty() ? NULL : scan.getDataConstPtr();
+            const int rows = height;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int row = 0; row < rows; ++row)
+            {
+                uint8_t *image_row = image + row * width;
+                memset(image_row, background, width);
+                const Entry *entry = row_begin[row] == row_begin[row + 1] ? NULL : &entries[row_begin[row]];
+                const Entry *end = entry + (row_begin[row + 1] - row_begin[row]);
+                if(interpolation == NEAREST)
+                {
+                    for(; entry != end; ++entry)
+                        image_row[entry->column] = data[entry->index];
+                }
+                else
+                {
+                    for(; entry != end; ++entry)
+                    {
+                        const uint8_t *p = data + entry->index;
+                        const int beam_weight = entry->beam_weight;
+                        const int bin_weight = entry->bin_weight;
+                        const int first = p[0] * (256 - beam_weight) + p[beam_step] * beam_weight;
+                        const int second = p[bin_step] * (256 - beam_weight) + p[bin_step + beam_step] * beam_weight;
+                        image_row[entry->column] = (first * (256 - bin_weight) + second * bin_weight + 32768) >> 16;
+                    }
+                }
+            }
+            frame.setStatus(frame::STATUS_VALID);
+        }
+
+    private:
+        //one covered pixel. For bilinear interpolation, the weights are
+        //the fractional beam and bin position in 1/256 units
+        struct Entry
+        {
+            uint16_t column;
+            uint8_t beam_weight;
+            uint8_t bin_weight;
+            int32_t index;
+        };
+
+        struct Geometry
+        {
+            Geometry()
+                : number_of_beams(0), number_of_bins(0), start_bearing(0)
+                , angular_resolution(0), spatial_resolution(0)
+                , memory_layout_column(false) {}
+
+            Geometry(const SonarScan &scan)
+                : number_of_beams(scan.number_of_beams), number_of_bins(scan.number_of_bins)
+                , start_bearing(scan.start_bearing.rad), angular_resolution(scan.angular_resolution.rad)
+                , spatial_resolution(scan.getSpatialResolution())
+                , memory_layout_column(scan.memory_layout_column) {}
+
+            bool operator==(const Geometry &other) const
+            {
+                return number_of_beams == other.number_of_beams
+                    && number_of_bins == other.number_of_bins
+                    && start_bearing == other.start_bearing
+                    && angular_resolution == other.angular_resolution
+                    && spatial_resolution == other.spatial_resolution
+                    && memory_layout_column == other.memory_layout_column;
+            }
+
+            uint16_t number_of_beams;
+            uint16_t number_of_bins;
+            double start_bearing;
+            double angular_resolution;
+            double spatial_resolution;
+            bool memory_layout_column;
+        };
+
+        void updateTable(const SonarScan &scan)
+        {
+            if(!scan.polar_coordinates)
+                throw std::runtime_error("SonarScanConverter: the sonar scan is not in polar coordinates");
+            if(scan.getData().size() < scan.getBinCount())
+                throw std::runtime_error("SonarScanConverter: the sonar scan holds less data than number_of_beams*number_of_bins");
+
+            Geometry new_geometry(scan);
+            if(table_valid && geometry == new_geometry)
+                return;
+            if(width == 0 || height == 0)
+                throw std::runtime_error("SonarScanConverter: output size is not set");
+            if(!(new_geometry.spatial_resolution > 0) || !(new_geometry.angular_resolution > 0))
+                throw std::runtime_error("SonarScanConverter: the sonar scan has no valid spatial or angular resolution");
+            geometry = new_geometry;
+            buildTable();
+            table_valid = true;
+        }
+
+        void buildTable()
+        {
+            const int beams = geometry.number_of_beams;
+            const int bins = geometry.number_of_bins;
+            beam_step = geometry.memory_layout_column ? 1 : bins;
+            bin_step = geometry.memory_layout_column ? beams : 1;
+
+            //check if the scan reaches behind the sonar
+            const double end_bearing = geometry.start_bearing - geometry.angular_resolution * (beams - 1);
+            const bool centered = geometry.start_bearing > M_PI / 2 || end_bearing < -M_PI / 2;
+            const double max_range = geometry.spatial_resolution * bins;
+            current_pixel_size = pixel_size;
+            if(current_pixel_size <= 0)
+                current_pixel_size = std::max(2.0 * max_range / width,
+                        (centered ? 2.0 : 1.0) * max_range / height);
+            const double origin_column = 0.5 * width;
+            const double origin_row = centered ? 0.5 * height : height;
+
+            entries.clear();
+            row_begin.resize(height + 1);
+            for(int row = 0; row < height; ++row)
+            {
+                row_begin[row] = entries.size();
+                const double x = (origin_row - row - 0.5) * current_pixel_size;
+                for(int column = 0; column < width; ++column)
+                {
+                    const double y = (origin_column - column - 0.5) * current_pixel_size;
+                    double beam = geometry.start_bearing - atan2(y, x);
+                    //beams are counted clockwise from the start bearing
+                    while(beam < -0.5 * geometry.angular_resolution)
+                        beam += 2 * M_PI;
+                    while(beam >= 2 * M_PI - 0.5 * geometry.angular_resolution)
+                        beam -= 2 * M_PI;
+                    beam /= geometry.angular_resolution;
+                    const double bin = sqrt(x * x + y * y) / geometry.spatial_resolution;
+                    if(beam > beams - 0.5 || bin > bins - 0.5)
+                        continue;
+
+                    Entry entry;
+                    entry.column = column;
+                    if(interpolation == NEAREST)
+                    {
+                        entry.beam_weight = 0;
+                        entry.bin_weight = 0;
+                        entry.index = int(beam + 0.5) * beam_step + int(bin + 0.5) * bin_step;
+                    }
+                    else
+                    {
+                        //clamp to the valid interpolation range
+                        beam = std::min(std::max(beam, 0.0), beams - 1.0);
+                        const double clamped_bin = std::min(bin, bins - 1.0);
+                        int beam_index = std::min(int(beam), beams - 2);
+                        int bin_index = std::min(int(clamped_bin), bins - 2);
+                        beam_index = std::max(beam_index, 0);
+                        bin_index = std::max(bin_index, 0);
+                        entry.beam_weight = beams > 1 ? std::min(255, int((beam - beam_index) * 256 + 0.5)) : 0;
+                        entry.bin_weight = bins > 1 ? std::min(255, int((clamped_bin - bin_index) * 256 + 0.5)) : 0;
+                        entry.index = beam_index * beam_step + bin_index * bin_step;
+                    }
+                    entries.push_back(entry);
+                }
+            }
+            row_begin[height] = entries.size();
+
+            //a single beam or bin has no neighbour to interpolate with
+            if(beams == 1)
+                beam_step = 0;
+            if(bins == 1)
+                bin_step = 0;
+        }
+
+        uint16_t width;
+        uint16_t height;
+        double pixel_size;
+        Interpolation interpolation;
+        uint8_t background;
+
+        Geometry geometry;
+        double current_pixel_size;
+        bool table_valid;
+        int beam_step;
+        int bin_step;
+        std::vector<Entry> entries;
+        std::vector<uint32_t> row_begin;
+    };
+}}
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef BASE_SAMPLES_SONARSCAN_RESAMPLER_H__
+#define BASE_SAMPLES_SONARSCAN_RESAMPLER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <base/Angle.hpp>
+#include <base/samples/SonarScan.hpp>
+
+namespace base { namespace samples {
+
+    /** Target geometry of the SonarScanResampler */
+    struct SonarScanResamplerConfig
+    {
+        SonarScanResamplerConfig()
+            : number_of_beams(0), number_of_bins(0), spatial_resolution(0) {}
+
+        SonarScanResamplerConfig(uint16_t number_of_beams, uint16_t number_of_bins,
+                Angle start_bearing, Angle angular_resolution, double spatial_resolution)
+            : number_of_beams(number_of_beams), number_of_bins(number_of_bins)
+            , start_bearing(start_bearing), angular_resolution(angular_resolution)
+            , spatial_resolution(spatial_resolution) {}
+
+        uint16_t number_of_beams;
+        uint16_t number_of_bins;
+        Angle start_bearing;
+        Angle angular_resolution;
+        /** range covered by one bin in m */
+        double spatial_resolution;
+    };
+
+    namespace detail
+    {
+        /** dst = (a*(256-weight) + b*weight + 128) / 256 */
+        inline void blendRows(const uint8_t *a, const uint8_t *b, uint8_t *dst, size_t size, uint16_t weight)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i weight_a = _mm_set1_epi16(short(256 - weight));
+            const __m128i weight_b = _mm_set1_epi16(short(weight));
+            const __m128i half = _mm_set1_epi16(128);
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                const __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), weight_a),
+                        _mm_mullo_epi16(_mm_unpacklo_epi8(y, zero), weight_b));
+                __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), weight_a),
+                        _mm_mullo_epi16(_mm_unpackhi_epi8(y, zero), weight_b));
+                low = _mm_srli_epi16(_mm_add_epi16(low, half), 8);
+                high = _mm_srli_epi16(_mm_add_epi16(high, half), 8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+            }
+#endif
+            for(; i < size; ++i)
+                dst[i] = (a[i] * (256 - weight) + b[i] * weight + 128) >> 8;
+        }
+    }
+
+    /** Resamples sonar scans onto a fixed grid of beams and bins
+     *
+     * Sonars which change their range settings produce scans with a
+     * varying number of bins and sampling interval. The resampler maps them
+     * onto the configured bearings and range resolution with linear
+     * interpolation, so that downstream consumers always get the same
+     * geometry. Samples outside of the input scan are set to zero.
+     *
+     * The interpolation is separable. The interpolation weights of both
+     * axes are computed once per input geometry and cached. The first pass
+     * interpolates along the axis which is contiguous in memory by a table
+     * lookup, the second pass blends whole rows with SSE2. Both passes run
+     * in parallel if OpenMP is enabled.
+     *
+     * The output has the memory layout of the input.
+     */
+    class SonarScanResampler
+    {
+    public:
+        SonarScanResampler(const SonarScanResamplerConfig &config = SonarScanResamplerConfig())
+            : config(config), table_valid(false)
+        {
+        }
+
+        void setConfig(const SonarScanResamplerConfig &config)
+        {
+            this->config = config;
+            table_valid = false;
+        }
+
+        const SonarScanResamplerConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Resamples scan into output
+         *
+         * All header fields of output are set. The sampling interval is
+         * chosen so that the configured spatial resolution is reached with
+         * the speed of sound of scan. The beam times are taken from the
+         * nearest input beam. The memory of output is reused.
+         *
+         * @throws std::runtime_error if the scan is not in polar coordinates,
+         * has no valid resolution, if the configuration is invalid or if
+         * scan and output are the same object
+         */
+        void resample(const SonarScan &scan, SonarScan &output)
+        {
+            if(&scan == &output)
+                throw std::runtime_error("SonarScanResampler::resample: in place resampling is not supported");
+            updateTables(scan);
+
+            const bool column = scan.memory_layout_column;
+            output.time = scan.time;
+            output.number_of_beams = config.number_of_beams;
+            output.number_of_bins = config.number_of_bins;
+            output.start_bearing = config.start_bearing;
+            output.angular_resolution = config.angular_resolution;
+            output.speed_of_sound = scan.speed_of_sound;
+            output.sampling_interval = 2.0 * config.spatial_resolution / scan.speed_of_sound;
+            output.beamwidth_horizontal = scan.beamwidth_horizontal;
+            output.beamwidth_vertical = scan.beamwidth_vertical;
+            output.memory_layout_column = column;
+            output.polar_coordinates = true;
+            output.data.resize(size_t(config.number_of_beams) * config.number_of_bins);
+            if(scan.time_beams.size() == scan.number_of_beams)
+            {
+                output.time_beams.resize(config.number_of_beams);
+                for(int i = 0; i < config.number_of_beams; ++i)
+                {
+                    const Entry &entry = beam_table[i];
+                    output.time_beams[i] = entry.valid
+                        ? scan.time_beams[entry.weight < 128 ? entry.first : entry.second] : base::Time();
+                }
+            }
+            else
+                output.time_beams.clear();
+            if(output.data.empty())
+                return;
+
+            //the contiguous axis is first interpolated into the rows of
+            //the intermediate image, then whole rows are blended
+            const std::vector<Entry> &column_table = column ? beam_table : bin_table;
+            const std::vector<Entry> &row_table = column ? bin_table : beam_table;
+            const int input_rows = column ? scan.number_of_bins : scan.number_of_beams;
+            const int input_columns = column ? scan.number_of_beams : scan.number_of_bins;
+            const int output_rows = row_table.size();
+            const int output_columns = column_table.size();
+            intermediate.resize(size_t(input_rows) * output_columns);
+            const uint8_t *src = &scan.data[0];
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int row = 0; row < input_rows; ++row)
+            {
+                if(!row_needed[row])
+                    continue;
+                const uint8_t *in = src + size_t(row) * input_columns;
+                uint8_t *out = &intermediate[size_t(row) * output_columns];
+                for(int i = 0; i < output_columns; ++i)
+                {
+                    const Entry &entry = column_table[i];
+                    out[i] = entry.valid
+                        ? (in[entry.first] * (256 - entry.weight) + in[entry.second] * entry.weight + 128) >> 8 : 0;
+                }
+            }
+
+            uint8_t *dst = &output.data[0];
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+            for(int row = 0; row < output_rows; ++row)
+            {
+                const Entry &entry = row_table[row];
+                uint8_t *out = dst + size_t(row) * output_columns;
+                if(!entry.valid)
+                    std::fill(out, out + output_columns, 0);
+                else
+                    detail::blendRows(&intermediate[size_t(entry.first) * output_columns],
+                            &intermediate[size_t(entry.second) * output_columns],
+                            out, output_columns, entry.weight);
+            }
+        }
+
+    private:
+        //linear interpolation between the input samples first and second,
+        //weight of second in 1/256 units
+        struct Entry
+        {
+            uint16_t first;
+            uint16_t second;
+            uint16_t weight;
+            bool valid;
+        };
+
+        struct Geometry
+        {
+            Geometry()
+                : number_of_beams(0), number_of_bins(0), start_bearing(0)
+                , angular_resolution(0), spatial_resolution(0), memory_layout_column(false) {}
+
+            Geometry(const SonarScan &scan)
+                : number_of_beams(scan.number_of_beams), number_of_bins(scan.number_of_bins)
+                , start_bearing(scan.start_bearing.rad), angular_resolution(scan.angular_resolution.rad)
+                , spatial_resolution(scan.getSpatialResolution())
+                , memory_layout_column(scan.memory_layout_column) {}
+
+            bool operator==(const Geometry &other) const
+            {
+                return number_of_beams == other.number_of_beams
+                    && number_of_bins == other.number_of_bins
+                    && start_bearing == other.start_bearing
+                    && angular_resolution == other.angular_resolution
+                    && spatial_resolution == other.spatial_resolution
+                    && memory_layout_column == other.memory_layout_column;
+            }
+
+            uint16_t number_of_beams;
+            uint16_t number_of_bins;
+            double start_bearing;
+            double angular_resolution;
+            double spatial_resolution;
+            bool memory_layout_column;
+        };
+
+        //position is the fractional input index of an output sample
+        static Entry makeEntry(double position, int size)
+        {
+            Entry entry;
+            entry.first = 0;
+            entry.second = 0;
+            entry.weight = 0;
+            entry.valid = size > 0 && position >= -0.5 && position <= size - 0.5;
+            if(!entry.valid)
+                return entry;
+            position = std::min(std::max(position, 0.0), size - 1.0);
+            const int first = std::min(int(position), std::max(size - 2, 0));
+            entry.first = first;
+            entry.second = std::min(first + 1, size - 1);
+            entry.weight = std::min(256, int((position - first) * 256 + 0.5));
+            return entry;
+        }
+
+        void updateTables(const SonarScan &scan)
+        {
+            if(!scan.polar_coordinates)
+                throw std::runtime_error("SonarScanResampler: the sonar scan is not in polar coordinates");
+            if(scan.getData().size() < scan.getBinCount())
+                throw std::runtime_error("SonarScanResampler: the sonar scan holds less data than number_of_beams*number_of_bins");
+
+            Geometry new_geometry(scan);
+            if(table_valid && geometry == new_geometry)
+                return;
+            if(!(new_geometry.spatial_resolution > 0) || !(new_geometry.angular_resolution > 0))
+                throw std::runtime_error("SonarScanResampler: the sonar scan has no valid spatial or angular resolution");
+            if(!(config.spatial_resolution > 0) || !(config.angular_resolution.rad > 0))
+                throw std::runtime_error("SonarScanResampler: the configured spatial or angular resolution is invalid");
+            geometry = new_geometry;
+
+            bin_table.resize(config.number_of_bins);
+            for(int i = 0; i < config.number_of_bins; ++i)
+                bin_table[i] = makeEntry(i * config.spatial_resolution / geometry.spatial_resolution,
+                        geometry.number_of_bins);
+
+            beam_table.resize(config.number_of_beams);
+            for(int i = 0; i < config.number_of_beams; ++i)
+            {
+                //beams are counted clockwise from the start bearing
+                const double bearing = config.start_bearing.rad - i * config.angular_resolution.rad;
+                double offset = geometry.start_bearing - bearing;
+                while(offset < -0.5 * geometry.angular_resolution)
+                    offset += 2 * M_PI;
+                while(offset >= 2 * M_PI - 0.5 * geometry.angular_resolution)
+                    offset -= 2 * M_PI;
+                beam_table[i] = makeEntry(offset / geometry.angular_resolution, geometry.number_of_beams);
+            }
+
+            //input rows which are used by at least one output row
+            const std::vector<Entry> &row_table = geometry.memory_layout_column ? bin_table : beam_table;
+            row_needed.assign(geometry.memory_layout_column ? geometry.number_of_bins : geometry.number_of_beams, 0);
+            for(size_t i = 0; i < row_table.size(); ++i)
+            {
+                if(!row_table[i].valid)
+                    continue;
+                row_needed[row_table[i].first] = 1;
+                row_needed[row_table[i].second] = 1;
+            }
+            table_valid = true;
+        }
+
+        SonarScanResamplerConfig config;
+        Geometry geometry;
+        bool table_valid;
+        std::vector<Entry> bin_table;
+        std::vector<Entry> beam_table;
+        std::vector<uint8_t> row_needed;
+        std::vector<uint8_t> intermediate;
+    };
+}}
+
+#endif
@@ -0,0 +1,420 @@
+#ifndef BASE_SAMPLES_SONAR_SIGNAL_CONDITIONER_H__
+#define BASE_SAMPLES_SONAR_SIGNAL_CONDITIONER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <base/samples/SonarBeam.hpp>
+#include <base/samples/SonarScan.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace base { namespace samples {
+
+    /** Parameters of the SonarSignalConditioner */
+    struct SonarSignalConditionerConfig
+    {
+        SonarSignalConditionerConfig()
+            : tvg(true), spreading_coefficient(20), absorption(0), gain_offset(0), min_range(1)
+            , normalize(false), normalization_target(255), max_normalization_gain(8)
+            , median(false) {}
+
+        /** enables the time varied gain compensation
+         *
+         * The gain in dB of a bin at range r is
+         *   spreading_coefficient*log10(max(r,min_range)) + 2*absorption*r + gain_offset
+         */
+        bool tvg;
+        /** 20 for spherical spreading, 40 for the two-way spreading of point targets */
+        double spreading_coefficient;
+        /** absorption coefficient of the medium in dB/m */
+        double absorption;
+        /** constant gain in dB added to all bins */
+        double gain_offset;
+        /** range in m below which the spreading loss is not compensated */
+        double min_range;
+
+        /** enables scaling of each beam so that its maximum reaches normalization_target */
+        bool normalize;
+        uint8_t normalization_target;
+        /** maximal linear gain applied by the normalization, to not amplify beams holding only noise */
+        double max_normalization_gain;
+
+        /** enables a 3x3 median filter over beams and bins (3 bins for
+         * single beams) to remove speckle */
+        bool median;
+    };
+
+    namespace detail {
+        //linear gains are stored as 8.8 fixed point numbers. They are limited
+        //to 32767 so that the 16 bit intermediate results never exceed the
+        //signed range used by the saturating pack
+        inline uint16_t toFixedPointGain(double gain)
+        {
+            return uint16_t(std::min(32767.0, std::max(0.0, gain * 256 + 0.5)));
+        }
+
+        inline uint8_t applyFixedPointGain(uint8_t value, uint16_t gain)
+        {
+            return std::min(255, (value * gain) >> 8);
+        }
+
+#ifdef __SSE2__
+        //multiplies 16 values by the given gains (8.8 fixed point) with
+        //saturation. mulhi of (value << 8) and gain is (value*gain) >> 8
+        inline __m128i applyFixedPointGainSSE2(__m128i values, __m128i gains_lo, __m128i gains_hi)
+        {
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i lo = _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, values), gains_lo);
+            const __m128i hi = _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, values), gains_hi);
+            return _mm_packus_epi16(lo, hi);
+        }
+
+        inline __m128i median3SSE2(__m128i a, __m128i b, __m128i c)
+        {
+            return _mm_max_epu8(_mm_min_epu8(a, b), _mm_min_epu8(_mm_max_epu8(a, b), c));
+        }
+#endif
+
+        inline uint8_t median3(uint8_t a, uint8_t b, uint8_t c)
+        {
+            return std::max(std::min(a, b), std::min(std::max(a, b), c));
+        }
+
+        /** data[i] = data[i]*gains[i] with saturation, returns the maximum of the result */
+        inline uint8_t applyGains(uint8_t *data, const uint16_t *gains, size_t size)
+        {
+            size_t i = 0;
+            uint8_t max = 0;
+#ifdef __SSE2__
+            __m128i max_vector = _mm_setzero_si128();
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i gains_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gains + i));
+                const __m128i gains_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gains + i + 8));
+                __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                values = applyFixedPointGainSSE2(values, gains_lo, gains_hi);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), values);
+                max_vector = _mm_max_epu8(max_vector, values);
+            }
+            uint8_t lanes[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), max_vector);
+            max = *std::max_element(lanes, lanes + 16);
+#endif
+            for(; i < size; ++i)
+            {
+                data[i] = applyFixedPointGain(data[i], gains[i]);
+                max = std::max(max, data[i]);
+            }
+            return max;
+        }
+
+        /** data[i] = data[i]*gain with saturation, returns the maximum of the result */
+        inline uint8_t applyGain(uint8_t *data, uint16_t gain, size_t size)
+        {
+            size_t i = 0;
+            uint8_t max = 0;
+#ifdef __SSE2__
+            const __m128i gains = _mm_set1_epi16(gain);
+            __m128i max_vector = _mm_setzero_si128();
+            for(; i + 16 <= size; i += 16)
+            {
+                __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                values = applyFixedPointGainSSE2(values, gains, gains);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), values);
+                max_vector = _mm_max_epu8(max_vector, values);
+            }
+            uint8_t lanes[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), max_vector);
+            max = *std::max_element(lanes, lanes + 16);
+#endif
+            for(; i < size; ++i)
+            {
+                data[i] = applyFixedPointGain(data[i], gain);
+                max = std::max(max, data[i]);
+            }
+            return max;
+        }
+
+        /** max[i] = max(max[i],data[i]) */
+        inline void updateMaximum(const uint8_t *data, uint8_t *max, size_t size)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                const __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(max + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(max + i), _mm_max_epu8(values, current));
+            }
+#endif
+            for(; i < size; ++i)
+                max[i] = std::max(max[i], data[i]);
+        }
+
+        /** dst[i] = median(src[i-1],src[i],src[i+1]) for 0 < i < size-1 */
+        inline void median3(const uint8_t *src, uint8_t *dst, size_t size)
+        {
+            if(size < 3)
+            {
+                memcpy(dst, src, size);
+                return;
+            }
+            dst[0] = src[0];
+            dst[size - 1] = src[size - 1];
+            size_t i = 1;
+#ifdef __SSE2__
+            for(; i + 17 <= size; i += 16)
+            {
+                const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i - 1));
+                const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), median3SSE2(a, b, c));
+            }
+#endif
+            for(; i < size - 1; ++i)
+                dst[i] = median3(src[i - 1], src[i], src[i + 1]);
+        }
+
+        /** sorts the three rows element wise into lo <= mid <= hi */
+        inline void sort3(const uint8_t *a, const uint8_t *b, const uint8_t *c,
+                uint8_t *lo, uint8_t *mid, uint8_t *hi, size_t size)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                const __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+                const __m128i min_ab = _mm_min_epu8(va, vb);
+                const __m128i max_ab = _mm_max_epu8(va, vb);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lo + i), _mm_min_epu8(min_ab, vc));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(hi + i), _mm_max_epu8(max_ab, vc));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(mid + i), median3SSE2(va, vb, vc));
+            }
+#endif
+            for(; i < size; ++i)
+            {
+                lo[i] = std::min(std::min(a[i], b[i]), c[i]);
+                hi[i] = std::max(std::max(a[i], b[i]), c[i]);
+                mid[i] = median3(a[i], b[i], c[i]);
+            }
+        }
+
+        /** 3x3 median of a row major image. The border is copied from src.
+         *
+         * The columns of each 3x3 window are sorted first. The median is
+         * then the median of the maximum of the minima, the median of the
+         * medians and the minimum of the maxima.
+         */
+        inline void median3x3(const uint8_t *src, uint8_t *dst, size_t rows, size_t columns,
+                std::vector<uint8_t> &buffer)
+        {
+            if(rows < 3 || columns < 3)
+            {
+                memcpy(dst, src, rows * columns);
+                return;
+            }
+            buffer.resize(3 * columns);
+            uint8_t *lo = &buffer[0];
+            uint8_t *mid = lo + columns;
+            uint8_t *hi = mid + columns;
+
+            memcpy(dst, src, columns);
+            memcpy(dst + (rows - 1) * columns, src + (rows - 1) * columns, columns);
+            for(size_t row = 1; row < rows - 1; ++row)
+            {
+                const uint8_t *center = src + row * columns;
+                uint8_t *out = dst + row * columns;
+                sort3(center - columns, center, center + columns, lo, mid, hi, columns);
+                out[0] = center[0];
+                out[columns - 1] = center[columns - 1];
+                size_t i = 1;
+#ifdef __SSE2__
+                for(; i + 17 <= columns; i += 16)
+                {
+                    const __m128i max_lo = _mm_max_epu8(_mm_max_epu8(
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo + i - 1)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo + i))),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo + i + 1)));
+                    const __m128i min_hi = _mm_min_epu8(_mm_min_epu8(
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi + i - 1)),
+                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi + i))),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi + i + 1)));
+                    const __m128i med_mid = median3SSE2(
+                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + i - 1)),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + i)),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(mid + i + 1)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), median3SSE2(max_lo, med_mid, min_hi));
+                }
+#endif
+                for(; i < columns - 1; ++i)
+                {
+                    const uint8_t max_lo = std::max(std::max(lo[i - 1], lo[i]), lo[i + 1]);
+                    const uint8_t min_hi = std::min(std::min(hi[i - 1], hi[i]), hi[i + 1]);
+                    const uint8_t med_mid = median3(mid[i - 1], mid[i], mid[i + 1]);
+                    out[i] = median3(max_lo, med_mid, min_hi);
+                }
+            }
+        }
+    }
+
+    /** Time varied gain compensation, per-beam normalization and speckle
+     * removal for sonar beams and sonar scans
+     *
+     * The stages are applied in this order and can be enabled separately.
+     * Sonar scans are processed in their current memory layout without
+     * transposing them. The TVG table is cached and only recomputed if the
+     * number of bins, the sampling interval or the speed of sound change.
+     */
+    class SonarSignalConditioner
+    {
+    public:
+        SonarSignalConditioner(const SonarSignalConditionerConfig &config = SonarSignalConditionerConfig())
+            : config(config), table_sampling_interval(0), table_speed_of_sound(0)
+        {
+        }
+
+        void setConfig(const SonarSignalConditionerConfig &config)
+        {
+            this->config = config;
+            gains.clear();
+        }
+
+        const SonarSignalConditionerConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Returns the TVG table for the given geometry in 8.8 fixed point */
+        const std::vector<uint16_t> &getGainTable(uint16_t number_of_bins, double sampling_interval, float speed_of_sound)
+        {
+            if(gains.size() != number_of_bins
+                    || table_sampling_interval != sampling_interval
+                    || table_speed_of_sound != speed_of_sound)
+            {
+                table_sampling_interval = sampling_interval;
+                table_speed_of_sound = speed_of_sound;
+                gains.resize(number_of_bins);
+                const double resolution = sampling_interval * 0.5 * speed_of_sound;
+                for(uint16_t bin = 0; bin < number_of_bins; ++bin)
+                {
+                    const double range = (bin + 0.5) * resolution;
+                    const double gain_db = config.spreading_coefficient * log10(std::max(range, config.min_range))
+                        + 2 * config.absorption * range + config.gain_offset;
+                    gains[bin] = detail::toFixedPointGain(pow(10.0, gain_db / 20.0));
+                }
+            }
+            return gains;
+        }
+
+        void process(SonarBeam &sonar_beam)
+        {
+            const size_t size = sonar_beam.beam.size();
+            if(size == 0)
+                return;
+            uint8_t *data = &sonar_beam.beam[0];
+            uint8_t max = 0;
+            if(config.tvg)
+                max = detail::applyGains(data, &getGainTable(size, sonar_beam.sampling_interval, sonar_beam.speed_of_sound)[0], size);
+            else if(config.normalize)
+                max = *std::max_element(data, data + size);
+            if(config.normalize)
+                detail::applyGain(data, normalizationGain(max), size);
+            if(config.median)
+            {
+                buffer.resize(size);
+                detail::median3(data, &buffer[0], size);
+                sonar_beam.beam.swap(buffer);
+            }
+        }
+
+        void process(SonarScan &scan)
+        {
+            const size_t beams = scan.number_of_beams;
+            const size_t bins = scan.number_of_bins;
+            if(beams == 0 || bins == 0 || scan.data.size() < beams * bins)
+                return;
+            uint8_t *data = scan.getDataPtr();
+
+            if(scan.memory_layout_column)
+            {
+                //one bin per row: each row has the same TVG gain and
+                //the per-beam maxima are accumulated element wise
+                maxima.assign(beams, 0);
+                const uint16_t *tvg = config.tvg ? &getGainTable(bins, scan.sampling_interval, scan.speed_of_sound)[0] : NULL;
+                for(size_t bin = 0; bin < bins; ++bin)
+                {
+                    uint8_t *row = data + bin * beams;
+                    if(tvg)
+                        detail::applyGain(row, tvg[bin], beams);
+                    if(config.normalize)
+                        detail::updateMaximum(row, &maxima[0], beams);
+                }
+                if(config.normalize)
+                {
+                    normalization.resize(beams);
+                    for(size_t beam = 0; beam < beams; ++beam)
+                        normalization[beam] = normalizationGain(maxima[beam]);
+                    for(size_t bin = 0; bin < bins; ++bin)
+                        detail::applyGains(data + bin * beams, &normalization[0], beams);
+                }
+            }
+            else
+            {
+                //one beam per row
+                const uint16_t *tvg = config.tvg ? &getGainTable(bins, scan.sampling_interval, scan.speed_of_sound)[0] : NULL;
+                for(size_t beam = 0; beam < beams; ++beam)
+                {
+                    uint8_t *row = data + beam * bins;
+                    uint8_t max = 0;
+                    if(tvg)
+                        max = detail::applyGains(row, tvg, bins);
+                    else if(config.normalize)
+                        max = *std::max_element(row, row + bins);
+                    if(config.normalize)
+                        detail::applyGain(row, normalizationGain(max), bins);
+                }
+            }
+
+            if(config.median)
+            {
+                //the 3x3 median is symmetric in beams and bins
+                buffer.resize(scan.data.size());
+                if(scan.memory_layout_column)
+                    detail::median3x3(data, &buffer[0], bins, beams, median_buffer);
+                else
+                    detail::median3x3(data, &buffer[0], beams, bins, median_buffer);
+                std::copy(scan.data.begin() + beams * bins, scan.data.end(), buffer.begin() + beams * bins);
+                scan.data.swap(buffer);
+            }
+        }
+
+    private:
+        uint16_t normalizationGain(uint8_t max) const
+        {
+            if(max == 0)
+                return 256;
+            return detail::toFixedPointGain(std::min(config.max_normalization_gain,
+                        (config.normalization_target + 0.5) / max));
+        }
+
+        SonarSignalConditionerConfig config;
+        std::vector<uint16_t> gains;
+        double table_sampling_interval;
+        float table_speed_of_sound;
+
+        std::vector<uint8_t> maxima;
+        std::vector<uint16_t> normalization;
+        std::vector<uint8_t> buffer;
+        std::vector<uint8_t> median_buffer;
+    };
+}}
+
+#endif
@@ -0,0 +1,354 @@
+#ifndef BASE_SAMPLES_SONAR_TEMPORAL_FILTER_H__
+#define BASE_SAMPLES_SONAR_TEMPORAL_FILTER_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <base/Float.hpp>
+#include <base/samples/SonarScan.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the SonarTemporalFilter */
+    struct SonarTemporalFilterConfig
+    {
+        enum Mode
+        {
+            /** exponential moving average */
+            EXPONENTIAL,
+            /** mean of the last window pings */
+            MEAN,
+            /** median of the last window pings */
+            MEDIAN
+        };
+
+        enum { MAX_WINDOW = 16 };
+
+        SonarTemporalFilterConfig()
+            : mode(EXPONENTIAL), alpha(0.25), window(4) {}
+
+        Mode mode;
+        /** weight of the latest ping for EXPONENTIAL, in [1/256, 255/256] */
+        double alpha;
+        /** number of pings for MEAN and MEDIAN, at most MAX_WINDOW */
+        uint8_t window;
+    };
+
+    namespace detail
+    {
+        /** state = state*(256-weight)/256 + value*weight in 8.8 fixed
+         * point, output = rounded state */
+        inline void exponentialAverage(const uint8_t *src, uint16_t *state, uint8_t *dst,
+                size_t size, uint16_t weight)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i old_weight = _mm_set1_epi16(short((256 - weight) << 8));
+            const __m128i new_weight = _mm_set1_epi16(short(weight << 8));
+            const __m128i half = _mm_set1_epi16(128);
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                __m128i *s = reinterpret_cast<__m128i*>(state + i);
+                __m128i low = _mm_adds_epu16(_mm_mulhi_epu16(_mm_loadu_si128(s), old_weight),
+                        _mm_mulhi_epu16(_mm_unpacklo_epi8(zero, x), new_weight));
+                __m128i high = _mm_adds_epu16(_mm_mulhi_epu16(_mm_loadu_si128(s + 1), old_weight),
+                        _mm_mulhi_epu16(_mm_unpackhi_epi8(zero, x), new_weight));
+                _mm_storeu_si128(s, low);
+                _mm_storeu_si128(s + 1, high);
+                low = _mm_srli_epi16(_mm_adds_epu16(low, half), 8);
+                high = _mm_srli_epi16(_mm_adds_epu16(high, half), 8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+            }
+#endif
+            for(; i < size; ++i)
+            {
+                const uint32_t s = ((uint32_t(state[i]) * ((256 - weight) << 8)) >> 16)
+                    + ((uint32_t(src[i]) << 8) * (weight << 8) >> 16);
+                state[i] = std::min(s, 65535u);
+                dst[i] = std::min(uint32_t(state[i]) + 128, 65535u) >> 8;
+            }
+        }
+
+        /** sum += src - removed, dst = round(sum / count), removed = src
+         *
+         * Each value of src is read before dst is written, so that dst may
+         * be src. reciprocal is ceil(65536/count). This is exact for
+         * count <= 16 */
+        inline void runningMean(const uint8_t *src, uint8_t *removed, uint16_t *sum,
+                uint8_t *dst, size_t size, uint16_t count, uint16_t reciprocal)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i factor = _mm_set1_epi16(short(reciprocal));
+            const __m128i half = _mm_set1_epi16(short(count / 2));
+            for(; i + 16 <= size; i += 16)
+            {
+                const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+                const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(removed + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(removed + i), x);
+                __m128i *s = reinterpret_cast<__m128i*>(sum + i);
+                __m128i low = _mm_sub_epi16(_mm_add_epi16(_mm_loadu_si128(s), _mm_unpacklo_epi8(x, zero)),
+                        _mm_unpacklo_epi8(r, zero));
+                __m128i high = _mm_sub_epi16(_mm_add_epi16(_mm_loadu_si128(s + 1), _mm_unpackhi_epi8(x, zero)),
+                        _mm_unpackhi_epi8(r, zero));
+                _mm_storeu_si128(s, low);
+                _mm_storeu_si128(s + 1, high);
+                if(count > 1)
+                {
+                    low = _mm_mulhi_epu16(_mm_add_epi16(low, half), factor);
+                    high = _mm_mulhi_epu16(_mm_add_epi16(high, half), factor);
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(low, high));
+            }
+#endif
+            for(; i < size; ++i)
+            {
+                const uint8_t value = src[i];
+                sum[i] = sum[i] + value - removed[i];
+                removed[i] = value;
+                dst[i] = count > 1 ? (uint32_t(sum[i] + count / 2) * reciprocal) >> 16 : sum[i];
+            }
+        }
+
+        /** Median of count rows of size values each. Even counts return
+         * the rounded up average of the two middle values. buffer must
+         * hold count values */
+        inline void temporalMedian(const uint8_t *const *rows, uint8_t *dst, size_t size,
+                size_t count, uint8_t *buffer)
+        {
+            size_t i = 0;
+#ifdef __SSE2__
+            __m128i v[SonarTemporalFilterConfig::MAX_WINDOW];
+            for(; i + 16 <= size; i += 16)
+            {
+                for(size_t j = 0; j < count; ++j)
+                    v[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[j] + i));
+                //odd-even transposition sort
+                for(size_t pass = 0; pass < count; ++pass)
+                {
+                    for(size_t j = pass & 1; j + 1 < count; j += 2)
+                    {
+                        const __m128i a = v[j];
+                        v[j] = _mm_min_epu8(a, v[j + 1]);
+                        v[j + 1] = _mm_max_epu8(a, v[j + 1]);
+                    }
+                }
+                __m128i median = v[count / 2];
+                if(!(count & 1))
+                    median = _mm_avg_epu8(v[count / 2 - 1], median);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), median);
+            }
+#endif
+            for(; i < size; ++i)
+            {
+                for(size_t j = 0; j < count; ++j)
+                    buffer[j] = rows[j][i];
+                std::sort(buffer, buffer + count);
+                dst[i] = count & 1 ? buffer[count / 2]
+                    : (buffer[count / 2 - 1] + buffer[count / 2] + 1) / 2;
+            }
+        }
+    }
+
+    /** Temporal filter for imaging sonar scans to suppress speckle
+     *
+     * Each bin is filtered over consecutive pings, either by an exponential
+     * moving average or by the mean or median of the last pings. The state
+     * per bin has a fixed size (a 16 bit average or sum plus a ring of at
+     * most MAX_WINDOW values for MEAN and MEDIAN) and is allocated once per
+     * geometry. The EXPONENTIAL and MEAN updates take constant time per bin.
+     *
+     * The filter is reset automatically whenever the geometry of the
+     * scans (size, memory layout, bearings or range resolution) changes.
+     */
+    class SonarTemporalFilter
+    {
+    public:
+        SonarTemporalFilter(const SonarTemporalFilterConfig &config = SonarTemporalFilterConfig())
+            : ping_count(0), next_slot(0)
+        {
+            setConfig(config);
+        }
+
+        /** Changes the configuration and resets the filter
+         *
+         * @throws std::runtime_error if alpha or window are out of range
+         */
+        void setConfig(const SonarTemporalFilterConfig &config)
+        {
+            if(config.mode == SonarTemporalFilterConfig::EXPONENTIAL && !(config.alpha > 0 && config.alpha < 1))
+                throw std::runtime_error("SonarTemporalFilter: alpha must be in (0,1)");
+            if(config.mode != SonarTemporalFilterConfig::EXPONENTIAL
+                    && (config.window == 0 || config.window > SonarTemporalFilterConfig::MAX_WINDOW))
+                throw std::runtime_error("SonarTemporalFilter: window must be in [1,MAX_WINDOW]");
+            this->config = config;
+            weight = std::min(255, std::max(1, int(config.alpha * 256 + 0.5)));
+            reset();
+        }
+
+        const SonarTemporalFilterConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Forgets all previous pings */
+        void reset()
+        {
+            ping_count = 0;
+            next_slot = 0;
+        }
+
+        /** number of pings which contributed to the last output */
+        size_t getPingCount() const
+        {
+            return config.mode == SonarTemporalFilterConfig::EXPONENTIAL
+                ? ping_count : std::min<size_t>(ping_count, config.window);
+        }
+
+        /** Filters scan and writes the result into output
+         *
+         * The header of output is copied from scan. The memory of output is
+         * reused, so it is only allocated for the first scan of a geometry.
+         * scan and output may be the same object.
+         *
+         * @throws std::runtime_error if the scan holds less data than
+         * number_of_beams*number_of_bins
+         */
+        void process(const SonarScan &scan, SonarScan &output)
+        {
+            const size_t size = scan.getBinCount();
+            if(scan.getData().size() < size)
+                throw std::runtime_error("SonarTemporalFilter::process: the sonar scan holds less data than number_of_beams*number_of_bins");
+            if(geometryChanged(scan))
+            {
+                reset();
+                geometry.number_of_beams = scan.number_of_beams;
+                geometry.number_of_bins = scan.number_of_bins;
+                geometry.start_bearing = scan.start_bearing.rad;
+                geometry.angular_resolution = scan.angular_resolution.rad;
+                geometry.spatial_resolution = scan.getSpatialResolution();
+                geometry.memory_layout_column = scan.memory_layout_column;
+                geometry.polar_coordinates = scan.polar_coordinates;
+            }
+            if(&output != &scan)
+                copyHeader(scan, output);
+            output.data.resize(size);
+            if(!size)
+                return;
+
+            const uint8_t *src = &scan.data[0];
+            uint8_t *dst = &output.data[0];
+            if(config.mode == SonarTemporalFilterConfig::EXPONENTIAL)
+            {
+                if(ping_count == 0)
+                {
+                    state.resize(size);
+                    for(size_t i = 0; i < size; ++i)
+                        state[i] = uint16_t(src[i]) << 8;
+                    if(dst != src)
+                        memcpy(dst, src, size);
+                }
+                else
+                    detail::exponentialAverage(src, &state[0], dst, size, weight);
+                ++ping_count;
+                return;
+            }
+
+            //ring buffer of the last pings
+            const size_t window = config.window;
+            if(ping_count == 0)
+            {
+                history.resize(window * size);
+                std::fill(history.begin(), history.end(), 0);
+                state.assign(size, 0);
+            }
+            uint8_t *slot = &history[next_slot * size];
+            const size_t count = std::min(ping_count + 1, window);
+            if(config.mode == SonarTemporalFilterConfig::MEAN)
+            {
+                //the slot holds the ping which leaves the window or zeros and
+                //is replaced by the raw ping, which dst may overwrite
+                const uint16_t reciprocal = count > 1 ? (65536 + count - 1) / count : 0;
+                detail::runningMean(src, slot, &state[0], dst, size, count, reciprocal);
+            }
+            else
+            {
+                memcpy(slot, src, size);
+                const uint8_t *rows[SonarTemporalFilterConfig::MAX_WINDOW];
+                for(size_t i = 0; i < count; ++i)
+                    rows[i] = &history[i * size];
+                uint8_t buffer[SonarTemporalFilterConfig::MAX_WINDOW];
+                detail::temporalMedian(rows, dst, size, count, buffer);
+            }
+            next_slot = (next_slot + 1) % window;
+            ++ping_count;
+        }
+
+    private:
+        struct Geometry
+        {
+            Geometry()
+                : number_of_beams(0), number_of_bins(0), start_bearing(0), angular_resolution(0)
+                , spatial_resolution(0), memory_layout_column(false), polar_coordinates(false) {}
+
+            uint16_t number_of_beams;
+            uint16_t number_of_bins;
+            double start_bearing;
+            double angular_resolution;
+            double spatial_resolution;
+            bool memory_layout_column;
+            bool polar_coordinates;
+        };
+
+        bool geometryChanged(const SonarScan &scan) const
+        {
+            const double spatial_resolution = scan.getSpatialResolution();
+            return ping_count == 0
+                || geometry.number_of_beams != scan.number_of_beams
+                || geometry.number_of_bins != scan.number_of_bins
+                || geometry.start_bearing != scan.start_bearing.rad
+                || geometry.angular_resolution != scan.angular_resolution.rad
+                || (geometry.spatial_resolution != spatial_resolution
+                        && !(base::isNaN(geometry.spatial_resolution) && base::isNaN(spatial_resolution)))
+                || geometry.memory_layout_column != scan.memory_layout_column
+                || geometry.polar_coordinates != scan.polar_coordinates;
+        }
+
+        static void copyHeader(const SonarScan &scan, SonarScan &output)
+        {
+            output.time = scan.time;
+            output.time_beams = scan.time_beams;
+            output.number_of_beams = scan.number_of_beams;
+            output.number_of_bins = scan.number_of_bins;
+            output.start_bearing = scan.start_bearing;
+            output.angular_resolution = scan.angular_resolution;
+            output.sampling_interval = scan.sampling_interval;
+            output.speed_of_sound = scan.speed_of_sound;
+            output.beamwidth_horizontal = scan.beamwidth_horizontal;
+            output.beamwidth_vertical = scan.beamwidth_vertical;
+            output.memory_layout_column = scan.memory_layout_column;
+            output.polar_coordinates = scan.polar_coordinates;
+        }
+
+        SonarTemporalFilterConfig config;
+        uint16_t weight;
+        Geometry geometry;
+        size_t ping_count;
+        size_t next_slot;
+        //8.8 average for EXPONENTIAL, running sum for MEAN
+        std::vector<uint16_t> state;
+        std::vector<uint8_t> history;
+    };
+}}
+
+#endif
@@ -0,0 +1,469 @@
+#ifndef BASE_SAMPLES_VOXEL_GRID_FILTER_H__
+#define BASE_SAMPLES_VOXEL_GRID_FILTER_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <base/samples/Pointcloud.hpp>
+#include <base/samples/CompactPointcloud.hpp>
+
+namespace base { namespace samples {
+
+    /** Parameters of the VoxelGridFilter */
+    struct VoxelGridFilterConfig
+    {
+        /** how the points of a voxel are reduced to one */
+        enum Policy
+        {
+            /** the mean of the points and their channels */
+            CENTROID,
+            /** the first point of the voxel in the order of the input */
+            FIRST
+        };
+
+        VoxelGridFilterConfig()
+            : voxel_size(0.1), policy(CENTROID) {}
+
+        /** edge length of the voxels in m */
+        double voxel_size;
+        Policy policy;
+    };
+
+    /** Downsamples point clouds to one point per voxel
+     *
+     * The voxel of a point is packed into a 63 bit key with 21 bits per
+     * axis, which covers +-2^20 voxels around the origin. The voxels are
+     * found with open addressing hash tables (linear probing) instead of a
+     * tree, so binning a point costs a multiplication and usually a single
+     * probe.
+     *
+     * The input is split into chunks which are binned in parallel with
+     * OpenMP, each into its own table which accumulates the count, the
+     * first point and for CENTROID the sums of the coordinates and
+     * channels of its voxels. The chunk tables are then merged in the
+     * order of the chunks, so that the output is independent of the number
+     * of threads: the voxels are in the order of their first point.
+     *
+     * Colors of a Pointcloud and the channels of a CompactPointcloud are
+     * carried through. With CENTROID, colors, intensities, normals and
+     * times are averaged, the normals are normalized again and the ring is
+     * the one of the first point. Points with NaN or infinite coordinates
+     * are dropped.
+     *
+     * All tables are kept between calls, so that their memory is reused.
+     */
+    class VoxelGridFilter
+    {
+    public:
+        VoxelGridFilter(const VoxelGridFilterConfig &config = VoxelGridFilterConfig())
+        {
+            setConfig(config);
+        }
+
+        /** @throws std::runtime_error if the voxel size is not positive */
+        void setConfig(const VoxelGridFilterConfig &config)
+        {
+            if(!(config.voxel_size > 0))
+                throw std::runtime_error("VoxelGridFilter: the voxel size must be positive");
+            this->config = config;
+        }
+
+        const VoxelGridFilterConfig &getConfig() const
+        {
+            return config;
+        }
+
+        /** Downsamples input into output, whose memory is reused
+         *
+         * @return the number of voxels
+         * @throws std::runtime_error if a point is outside of the range of
+         *         the voxel keys
+         */
+        size_t filter(const Pointcloud &input, Pointcloud &output)
+        {
+            const bool has_colors = !input.points.empty() && input.colors.size() == input.points.size();
+            PointcloudAccessor accessor(input, has_colors);
+            bin(input.points.size(), accessor);
+
+            const size_t count = voxel_first.size();
+            output.time = input.time;
+            output.points.resize(count);
+            output.colors.resize(has_colors ? count : 0);
+            for(size_t v = 0; v < count; ++v)
+            {
+                if(config.policy == VoxelGridFilterConfig::FIRST)
+                {
+                    output.points[v] = input.points[voxel_first[v]];
+                    if(has_colors)
+                        output.colors[v] = input.colors[voxel_first[v]];
+                    continue;
+                }
+                const double *sum = &voxel_sums[v * width];
+                const double scale = 1.0 / voxel_counts[v];
+                output.points[v] = base::Point(sum[0] * scale, sum[1] * scale, sum[2] * scale);
+                if(has_colors)
+                    output.colors[v] = base::Vector4d(sum[3] * scale, sum[4] * scale, sum[5] * scale, sum[6] * scale);
+            }
+            return count;
+        }
+
+        /** Downsamples input into output, whose memory is reused. output
+         * has the channels of input
+         *
+         * @return the number of voxels
+         * @throws std::runtime_error if a point is outside of the range of
+         *         the voxel keys
+         */
+        size_t filter(const CompactPointcloud &input, CompactPointcloud &output)
+        {
+            CompactPointcloudAccessor accessor(input);
+            bin(input.size(), accessor);
+
+            const size_t count = voxel_first.size();
+            if(config.policy == VoxelGridFilterConfig::FIRST)
+            {
+                first_indices.assign(voxel_first.begin(), voxel_first.end());
+                input.select(first_indices, output);
+                return count;
+            }
+            output.time = input.time;
+            output.x.resize(count);
+            output.y.resize(count);
+            output.z.resize(count);
+            output.setChannels(input.getChannels());
+            const uint32_t channels = input.getChannels();
+            for(size_t v = 0; v < count; ++v)
+            {
+                const double *sum = &voxel_sums[v * width];
+                const double scale = 1.0 / voxel_counts[v];
+                output.x[v] = sum[0] * scale;
+                output.y[v] = sum[1] * scale;
+                output.z[v] = sum[2] * scale;
+                size_t j = 3;
+                if(channels & CompactPointcloud::INTENSITY)
+                    output.intensity[v] = sum[j++] * scale;
+                if(channels & CompactPointcloud::COLOR)
+                {
+                    output.colors[v] = detail::packColor(base::Vector4d(sum[j] * scale, sum[j + 1] * scale,
+                                sum[j + 2] * scale, sum[j + 3] * scale) / 255.0);
+                    j += 4;
+                }
+                if(channels & CompactPointcloud::NORMAL)
+                {
+                    Eigen::Vector3d normal(sum[j], sum[j + 1], sum[j + 2]);
+                    const double norm = normal.norm();
+                    if(norm > 0)
+                        normal /= norm;
+                    output.normal_x[v] = normal.x();
+                    output.normal_y[v] = normal.y();
+                    output.normal_z[v] = normal.z();
+                    j += 3;
+                }
+                if(channels & CompactPointcloud::TIME)
+                    output.time_offsets[v] = uint32_t(sum[j++] * scale + 0.5);
+                if(channels & CompactPointcloud::RING)
+                    output.rings[v] = input.rings[voxel_first[v]];
+            }
+            return count;
+        }
+
+        /** index of the first input point of each voxel of the last call */
+        const std::vector<uint32_t> &getFirstIndices() const
+        {
+            return voxel_first;
+        }
+
+        /** number of input points of each voxel of the last call */
+        const std::vector<uint32_t> &getCounts() const
+        {
+            return voxel_counts;
+        }
+
+    private:
+        static const int KEY_BITS = 21;
+        /** points per chunk of the parallel binning */
+        static const size_t CHUNK_SIZE = 65536;
+
+        /** coordinates and channels of a Pointcloud */
+        struct PointcloudAccessor
+        {
+            PointcloudAccessor(const Pointcloud &cloud, bool colors)
+                : cloud(cloud), colors(colors) {}
+
+            int getWidth() const
+            {
+                return colors ? 7 : 3;
+            }
+
+            void getPoint(size_t i, double &x, double &y, double &z) const
+            {
+                const base::Point &p = cloud.points[i];
+                x = p.x();
+                y = p.y();
+                z = p.z();
+            }
+
+            void addValues(size_t i, double *sum) const
+            {
+                const base::Point &p = cloud.points[i];
+                sum[0] += p.x();
+                sum[1] += p.y();
+                sum[2] += p.z();
+                if(colors)
+                {
+                    const base::Vector4d &c = cloud.colors[i];
+                    sum[3] += c[0];
+                    sum[4] += c[1];
+                    sum[5] += c[2];
+                    sum[6] += c[3];
+                }
+            }
+
+            const Pointcloud &cloud;
+            bool colors;
+        };
+
+        /** coordinates and averaged channels of a CompactPointcloud */
+        struct CompactPointcloudAccessor
+        {
+            CompactPointcloudAccessor(const CompactPointcloud &cloud)
+                : cloud(cloud), channels(cloud.getChannels()) {}
+
+            int getWidth() const
+            {
+                int width = 3;
+                width += channels & CompactPointcloud::INTENSITY ? 1 : 0;
+                width += channels & CompactPointcloud::COLOR ? 4 : 0;
+                width += channels & CompactPointcloud::NORMAL ? 3 : 0;
+                width += channels & CompactPointcloud::TIME ? 1 : 0;
+                return width;
+            }
+
+            void getPoint(size_t i, double &x, double &y, double &z) const
+            {
+                x = cloud.x[i];
+                y = cloud.y[i];
+                z = cloud.z[i];
+            }
+
+            void addValues(size_t i, double *sum) const
+            {
+                sum[0] += cloud.x[i];
+                sum[1] += cloud.y[i];
+                sum[2] += cloud.z[i];
+                size_t j = 3;
+                if(channels & CompactPointcloud::INTENSITY)
+                    sum[j++] += cloud.intensity[i];
+                if(channels & CompactPointcloud::COLOR)
+                {
+                    const uint32_t c = cloud.colors[i];
+                    sum[j++] += c & 0xFF;
+                    sum[j++] += (c >> 8) & 0xFF;
+                    sum[j++] += (c >> 16) & 0xFF;
+                    sum[j++] += c >> 24;
+                }
+                if(channels & CompactPointcloud::NORMAL)
+                {
+                    sum[j++] += cloud.normal_x[i];
+                    sum[j++] += cloud.normal_y[i];
+                    sum[j++] += cloud.normal_z[i];
+                }
+                if(channels & CompactPointcloud::TIME)
+                    sum[j++] += cloud.time_offsets[i];
+            }
+
+            const CompactPointcloud &cloud;
+            uint32_t channels;
+        };
+
+        /** open addressing hash table from voxel keys to voxel indices,
+         * with the voxels in the order of insertion */
+        struct Table
+        {
+            std::vector<uint64_t> keys;
+            std::vector<uint32_t> slots;
+            uint64_t mask;
+            int shift;
+
+            std::vector<uint64_t> voxel_keys;
+            std::vector<uint32_t> first;
+            std::vector<uint32_t> counts;
+            std::vector<double> sums;
+
+            static uint64_t empty()
+            {
+                return ~uint64_t(0);
+            }
+
+            /** clears the table, which is sized for the given number of
+             * voxels and grows when it is half full */
+            void reset(size_t size)
+            {
+                voxel_keys.clear();
+                first.clear();
+                counts.clear();
+                sums.clear();
+                size_t capacity = 1024;
+                while(capacity < 2 * size)
+                    capacity *= 2;
+                resizeTable(capacity);
+            }
+
+            /** returns the index of the voxel of key, which is added with
+             * first point index if it is new */
+            uint32_t insert(uint64_t key, uint32_t index, int width)
+            {
+                uint64_t slot = find(key);
+                if(keys[slot] == key)
+                    return slots[slot];
+                const uint32_t voxel = voxel_keys.size();
+                keys[slot] = key;
+                slots[slot] = voxel;
+                voxel_keys.push_back(key);
+                first.push_back(index);
+                counts.push_back(0);
+                sums.resize(sums.size() + width, 0.0);
+                if(2 * voxel_keys.size() > mask)
+                    resizeTable(2 * (mask + 1));
+                return voxel;
+            }
+
+        private:
+            /** slot of key or the empty slot where it belongs */
+            uint64_t find(uint64_t key) const
+            {
+                //Fibonacci hashing, the high bits are the best mixed
+                uint64_t slot = (key * 0x9E3779B97F4A7C15ull) >> shift;
+                while(keys[slot] != key && keys[slot] != empty())
+                    slot = (slot + 1) & mask;
+                return slot;
+            }
+
+            void resizeTable(size_t capacity)
+            {
+                shift = 64;
+                for(size_t c = capacity; c > 1; c /= 2)
+                    --shift;
+                mask = capacity - 1;
+                //only the used part of a larger table is cleared
+                if(keys.size() < capacity)
+                {
+                    keys.resize(capacity);
+                    slots.resize(capacity);
+                }
+                std::fill(keys.begin(), keys.begin() + capacity, empty());
+                for(size_t v = 0; v < voxel_keys.size(); ++v)
+                {
+                    const uint64_t slot = find(voxel_keys[v]);
+                    keys[slot] = voxel_keys[v];
+                    slots[slot] = v;
+                }
+            }
+        };
+
+        template<class Accessor>
+        void bin(size_t size, const Accessor &accessor)
+        {
+            if(size >= (size_t(1) << 32))
+                throw std::runtime_error("VoxelGridFilter: too many points");
+            width = config.policy == VoxelGridFilterConfig::CENTROID ? accessor.getWidth() : 0;
+            const int chunk_count = int((size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+            if(chunks.size() < size_t(chunk_count))
+                chunks.resize(chunk_count);
+            const double scale = 1.0 / config.voxel_size;
+            const int width = this->width;
+            bool out_of_range = false;
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(||:out_of_range)
+#endif
+            for(int c = 0; c < chunk_count; ++c)
+            {
+                Table &table = chunks[c];
+                const size_t begin = c * CHUNK_SIZE;
+                const size_t end = std::min(size, begin + CHUNK_SIZE);
+                //the previous number of voxels is a good guess for the next
+                table.reset(table.voxel_keys.size());
+                for(size_t i = begin; i < end; ++i)
+                {
+                    double x, y, z;
+                    accessor.getPoint(i, x, y, z);
+                    //drops NaN and infinite coordinates
+                    if(!(x - x == 0 && y - y == 0 && z - z == 0))
+                        continue;
+                    uint64_t key;
+                    if(!getKey(x * scale, y * scale, z * scale, key))
+                    {
+                        out_of_range = true;
+                        continue;
+                    }
+                    const uint32_t voxel = table.insert(key, i, width);
+                    ++table.counts[voxel];
+                    if(width)
+                        accessor.addValues(i, &table.sums[size_t(voxel) * width]);
+                }
+            }
+            if(out_of_range)
+                throw std::runtime_error("VoxelGridFilter: a point is outside of the range of the voxel keys");
+
+            //merge the chunks in order
+            size_t total = 0;
+            for(int c = 0; c < chunk_count; ++c)
+                total += chunks[c].voxel_keys.size();
+            if(chunk_count == 1)
+            {
+                voxel_first.swap(chunks[0].first);
+                voxel_counts.swap(chunks[0].counts);
+                voxel_sums.swap(chunks[0].sums);
+                return;
+            }
+            merged.reset(total);
+            for(int c = 0; c < chunk_count; ++c)
+            {
+                const Table &table = chunks[c];
+                for(size_t v = 0; v < table.voxel_keys.size(); ++v)
+                {
+                    const uint32_t voxel = merged.insert(table.voxel_keys[v], table.first[v], width);
+                    merged.counts[voxel] += table.counts[v];
+                    if(!width)
+                        continue;
+                    double *sum = &merged.sums[size_t(voxel) * width];
+                    const double *chunk_sum = &table.sums[v * width];
+                    for(int j = 0; j < width; ++j)
+                        sum[j] += chunk_sum[j];
+                }
+            }
+            voxel_first.swap(merged.first);
+            voxel_counts.swap(merged.counts);
+            voxel_sums.swap(merged.sums);
+        }
+
+        static bool getKey(double x, double y, double z, uint64_t &key)
+        {
+            const double limit = double(1 << (KEY_BITS - 1));
+            const double fx = floor(x), fy = floor(y), fz = floor(z);
+            if(!(fx >= -limit && fx < limit && fy >= -limit && fy < limit && fz >= -limit && fz < limit))
+                return false;
+            const uint64_t ix = uint64_t(int64_t(fx) + (1 << (KEY_BITS - 1)));
+            const uint64_t iy = uint64_t(int64_t(fy) + (1 << (KEY_BITS - 1)));
+            const uint64_t iz = uint64_t(int64_t(fz) + (1 << (KEY_BITS - 1)));
+            key = ix | (iy << KEY_BITS) | (iz << (2 * KEY_BITS));
+            return true;
+        }
+
+        VoxelGridFilterConfig config;
+        int width;
+        std::vector<Table> chunks;
+        Table merged;
+
+        std::vector<uint32_t> voxel_first;
+        std::vector<uint32_t> voxel_counts;
+        std::vector<double> voxel_sums;
+        std::vector<size_t> first_indices;
+    };
+}}
+
+#endif
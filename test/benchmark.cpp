@@ -1,9 +1,445 @@
 #include <base/TimeMark.hpp>
+#include <base/samples/SonarScan.hpp>
+#include <base/samples/CompressedSonarScan.hpp>
+#include <base/samples/LaserScanConverter.hpp>
+#include <base/samples/CompactLaserScan.hpp>
+#include <base/samples/MultiLayerLaserScanConverter.hpp>
+#include <base/samples/LaserScanMatcher.hpp>
+#include <base/samples/LaserScanFusion.hpp>
+#include <base/samples/DistanceImageConverter.hpp>
+#include <base/samples/CompactPointcloud.hpp>
+#include <base/samples/VoxelGridFilter.hpp>
+#include <base/samples/KDTree.hpp>
 #include <iostream>
+#include <sstream>
+#include <map>
 #include "bench_func.h"
 
+void benchmarkSonarScanToggleMemoryLayout()
+{
+    //representative multibeam geometries (beams x bins)
+    const int sizes[][2] = {{128,500},{256,1000},{512,2000},{768,4000}};
+    for(int s=0;s<4;++s)
+    {
+        const int count = 100;
+        base::samples::SonarScan sonar_scan(sizes[s][0],sizes[s][1],base::Angle::fromDeg(60),base::Angle::fromDeg(0.25));
+        std::vector<uint8_t> buffer;
+        std::stringstream label;
+        label << "SonarScan::toggleMemoryLayout " << sizes[s][0] << "x" << sizes[s][1];
+        {
+            base::TimeMark t(label.str() + " naive");
+            for(int i=0;i<count;++i)
+            {
+                std::vector<uint8_t> temp(sonar_scan.data.size());
+                for(int row=0;row < sonar_scan.number_of_beams;++row)
+                    for(int column=0;column < sonar_scan.number_of_bins;++column)
+                        temp[row*sonar_scan.number_of_bins+column] = sonar_scan.data[column*sonar_scan.number_of_beams+row];
+                sonar_scan.data.swap(temp);
+            }
+            std::cerr << t << std::endl;
+        }
+        {
+            base::TimeMark t(label.str());
+            for(int i=0;i<count;++i)
+                sonar_scan.toggleMemoryLayout();
+            std::cerr << t << std::endl;
+        }
+        {
+            base::TimeMark t(label.str() + " with scratch buffer");
+            for(int i=0;i<count;++i)
+                sonar_scan.toggleMemoryLayout(buffer);
+            std::cerr << t << std::endl;
+        }
+    }
+}
+
+void benchmarkCompressedSonarScan()
+{
+    //512 beams x 2000 bins, mostly empty water column with one echo per beam
+    const int count = 100;
+    base::samples::SonarScan sonar_scan(512,2000,base::Angle::fromDeg(60),base::Angle::fromDeg(0.25),false);
+    sonar_scan.reset(0);
+    for(int beam=0;beam<512;++beam)
+    {
+        uint8_t *row = &sonar_scan.data[beam*2000];
+        for(int bin=0;bin<20;++bin)
+            row[bin] = 200;
+        for(int bin=0;bin<100;++bin)
+            row[500+beam+bin] = 100+(bin*7)%16+rand()%3;
+    }
+    base::samples::CompressedSonarScan compressed;
+    base::samples::SonarScan result;
+    {
+        base::TimeMark t("CompressedSonarScan::compress 512x2000");
+        for(int i=0;i<count;++i)
+            compressed.compress(sonar_scan);
+        std::cerr << t << " ratio " << double(compressed.data.size())/sonar_scan.data.size() << std::endl;
+    }
+    {
+        base::TimeMark t("CompressedSonarScan::decompress 512x2000");
+        for(int i=0;i<count;++i)
+            compressed.decompress(result);
+        std::cerr << t << std::endl;
+    }
+}
+
+void benchmarkLaserScanConverter()
+{
+    const int count = 10000;
+    base::samples::LaserScan laser_scan;
+    laser_scan.start_angle = -M_PI*0.75;
+    laser_scan.angular_resolution = M_PI*1.5/1080;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+    for(int i=0;i<1081;++i)
+        laser_scan.ranges.push_back(i%50 ? 1000+i*20 : base::samples::TOO_FAR);
+    Eigen::Affine3d transform(Eigen::Translation3d(1,2,3)*Eigen::AngleAxisd(0.5,Eigen::Vector3d::UnitZ()));
+    std::vector<Eigen::Vector3d> points;
+    {
+        base::TimeMark t("LaserScan::convertScanToPointCloud 1081 beams");
+        for(int i=0;i<count;++i)
+            laser_scan.convertScanToPointCloud(points,transform);
+        std::cerr << t << std::endl;
+    }
+    base::samples::LaserScanConverter converter;
+    {
+        base::TimeMark t("LaserScanConverter::convert 1081 beams");
+        for(int i=0;i<count;++i)
+            converter.convert(laser_scan,points,transform);
+        std::cerr << t << std::endl;
+    }
+    std::vector<float> x,y,z;
+    {
+        base::TimeMark t("LaserScanConverter::convert float SoA 1081 beams");
+        for(int i=0;i<count;++i)
+            converter.convert(laser_scan,x,y,z,transform);
+        std::cerr << t << std::endl;
+    }
+}
+
+void benchmarkCompactLaserScan()
+{
+    const int count = 100000;
+    base::samples::LaserScan laser_scan;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 60000;
+    for(int i=0;i<1081;++i)
+    {
+        laser_scan.ranges.push_back(i%50 ? 1000+i*20 : base::samples::TOO_FAR);
+        laser_scan.remission.push_back(i%256);
+    }
+    base::samples::CompactLaserScan compact;
+    {
+        base::TimeMark t("CompactLaserScan::compress 1081 beams");
+        for(int i=0;i<count;++i)
+            compact.compress(laser_scan,4,base::samples::CompactLaserScan::REMISSION_UINT8);
+        std::cerr << t << std::endl;
+    }
+    base::samples::LaserScan restored;
+    {
+        base::TimeMark t("CompactLaserScan::decompress 1081 beams");
+        for(int i=0;i<count;++i)
+            compact.decompress(restored);
+        std::cerr << t << std::endl;
+    }
+}
+
+void benchmarkMultiLayerLaserScanConverter()
+{
+    const int count = 100;
+    std::vector<double> elevations;
+    for(int i=0;i<128;++i)
+        elevations.push_back((-22.5+i*45.0/127)*M_PI/180);
+    base::samples::MultiLayerLaserScan scan;
+    scan.init(elevations,2048,-M_PI,2*M_PI/2048);
+    scan.minRange = 100;
+    scan.maxRange = 100000;
+    for(size_t i=0;i<scan.ranges.size();++i)
+        scan.ranges[i] = i%50 ? 1000+i%20000 : uint32_t(base::samples::TOO_FAR);
+    Eigen::Affine3d transform(Eigen::Translation3d(1,2,3)*Eigen::AngleAxisd(0.5,Eigen::Vector3d::UnitZ()));
+    base::samples::MultiLayerLaserScanConverter converter;
+    base::samples::Pointcloud cloud;
+    {
+        base::TimeMark t("MultiLayerLaserScanConverter::convert 128x2048");
+        for(int i=0;i<count;++i)
+            converter.convert(scan,cloud,transform);
+        std::cerr << t << std::endl;
+    }
+    std::vector<float> x,y,z;
+    {
+        base::TimeMark t("MultiLayerLaserScanConverter::convert float SoA 128x2048");
+        for(int i=0;i<count;++i)
+            converter.convert(scan,x,y,z,transform);
+        std::cerr << t << std::endl;
+    }
+}
+
+//simulates a scan with 1080 beams in a 20x12 m hall with pillars
+static void simulateHallScan(double x, double y, double yaw, base::samples::LaserScan &scan)
+{
+    std::vector<double> walls;
+    const double hall[] = {-10,-6,10,-6, 10,-6,10,6, 10,6,-10,6, -10,6,-10,-6};
+    walls.insert(walls.end(),hall,hall+16);
+    for(int i=-4;i<=4;++i)
+    {
+        const double px = i*2.1, py = i%2 ? 2.5 : -3;
+        const double pillar[] = {px,py,px+0.4,py, px+0.4,py,px+0.4,py+0.4, px+0.4,py+0.4,px,py+0.4, px,py+0.4,px,py};
+        walls.insert(walls.end(),pillar,pillar+16);
+    }
+    scan.reset();
+    scan.start_angle = -0.75*M_PI;
+    scan.angular_resolution = 1.5*M_PI/1080;
+    scan.minRange = 100;
+    scan.maxRange = 30000;
+    for(int i=0;i<1080;++i)
+    {
+        const double angle = yaw+scan.start_angle+i*scan.angular_resolution;
+        const double dx = cos(angle), dy = sin(angle);
+        double range = 1e9;
+        for(size_t j=0;j<walls.size();j+=4)
+        {
+            const double ex = walls[j+2]-walls[j], ey = walls[j+3]-walls[j+1];
+            const double det = ex*dy-ey*dx;
+            if(fabs(det) < 1e-12)
+                continue;
+            const double wx = walls[j]-x, wy = walls[j+1]-y;
+            const double t = (ex*wy-ey*wx)/det;
+            const double u = (dx*wy-dy*wx)/det;
+            if(t > 0 && u >= 0 && u <= 1)
+                range = std::min(range,t);
+        }
+        scan.ranges.push_back(range < 30 ? uint32_t(range*1000) : uint32_t(base::samples::TOO_FAR));
+    }
+}
+
+void benchmarkLaserScanMatcher()
+{
+    //a sequence of scans along a path, each is matched against the previous one
+    const int count = 100;
+    std::vector<base::samples::LaserScan> scans(count);
+    std::vector<base::Pose2D> poses(count);
+    for(int i=0;i<count;++i)
+    {
+        poses[i] = base::Pose2D(base::Vector2d(-7+i*0.14,0.8*sin(i*0.1)),0.3*sin(i*0.07));
+        simulateHallScan(poses[i].position.x(),poses[i].position.y(),poses[i].orientation,scans[i]);
+    }
+    base::samples::LaserScanMatcherConfig config;
+    for(int levels=1;levels<=5;levels+=4)
+    {
+        config.levels = levels;
+        base::samples::LaserScanMatcher matcher(config);
+        base::Pose2D result;
+        double max_error = 0;
+        base::TimeMark t(levels == 1 ? "LaserScanMatcher::match exhaustive" : "LaserScanMatcher::match branch and bound");
+        for(int i=1;i<count;++i)
+        {
+            matcher.setReference(scans[i-1]);
+            matcher.match(scans[i],base::Pose2D(),result);
+            //the relative pose of the scan in the frame of the previous one
+            const Eigen::Vector2d delta = Eigen::Rotation2Dd(-poses[i-1].orientation)*(poses[i].position-poses[i-1].position);
+            max_error = std::max(max_error,(result.position-delta).norm());
+        }
+        std::cerr << t << " (" << count-1 << " scans, max error " << max_error << " m)" << std::endl;
+    }
+}
+
+void benchmarkLaserScanFusion()
+{
+    //four scanners with 270 degrees at the corners of the platform
+    const int count = 1000;
+    base::samples::LaserScanFusion fusion;
+    std::vector<base::samples::LaserScan> scans(4);
+    for(int s=0;s<4;++s)
+    {
+        const double yaw = M_PI/4+s*M_PI/2;
+        fusion.addSensor(Eigen::Affine3d(Eigen::Translation3d(0.4*cos(yaw),0.3*sin(yaw),0)*Eigen::AngleAxisd(yaw,Eigen::Vector3d::UnitZ())));
+        scans[s].start_angle = -M_PI*0.75;
+        scans[s].angular_resolution = M_PI*1.5/1080;
+        scans[s].minRange = 50;
+        scans[s].maxRange = 30000;
+        for(int i=0;i<1081;++i)
+            scans[s].ranges.push_back(i%20 ? 500+(i*37)%20000 : base::samples::TOO_FAR);
+    }
+    base::samples::LaserScan result;
+    base::TimeMark t("LaserScanFusion::fuse 4x1081 beams");
+    for(int i=0;i<count;++i)
+        fusion.fuse(scans,result);
+    std::cerr << t << std::endl;
+}
+
+void benchmarkDistanceImageConverter()
+{
+    const int count = 100;
+    base::samples::DistanceImage image;
+    image.setIntrinsic(525,525,319.5,239.5);
+    image.setSize(640,480);
+    for(size_t i=0;i<image.data.size();++i)
+        image.data[i] = i%13 ? 0.5f+(i%1000)*0.005f : std::numeric_limits<float>::quiet_NaN();
+    {
+        base::TimeMark t("DistanceImage::getPointCloud 640x480");
+        for(int i=0;i<count;++i)
+            image.getPointCloud();
+        std::cerr << t << std::endl;
+    }
+    base::samples::DistanceImageConverter converter;
+    base::samples::Pointcloud cloud;
+    {
+        base::TimeMark t("DistanceImageConverter::convert 640x480");
+        for(int i=0;i<count;++i)
+            converter.convert(image,cloud);
+        std::cerr << t << std::endl;
+    }
+    std::vector<float> x,y,z;
+    {
+        base::TimeMark t("DistanceImageConverter::convert float SoA 640x480");
+        for(int i=0;i<count;++i)
+            converter.convert(image,x,y,z);
+        std::cerr << t << std::endl;
+    }
+}
+
+void benchmarkCompactPointcloud()
+{
+    const int count = 20;
+    base::samples::Pointcloud cloud;
+    for(int i=0;i<1000000;++i)
+    {
+        cloud.points.push_back(base::Point((i%1000)*0.01,(i/1000)*0.01,(i%77)*0.01));
+        cloud.colors.push_back(base::Vector4d((i%255)/255.0,0.5,0.25,1));
+    }
+    base::samples::CompactPointcloud compact;
+    {
+        base::TimeMark t("CompactPointcloud::fromPointcloud 1M colored points");
+        for(int i=0;i<count;++i)
+            compact.fromPointcloud(cloud);
+        std::cerr << t << std::endl;
+    }
+    {
+        base::TimeMark t("CompactPointcloud::toPointcloud 1M colored points");
+        for(int i=0;i<count;++i)
+            compact.toPointcloud(cloud);
+        std::cerr << t << std::endl;
+    }
+    Eigen::Affine3d transform(Eigen::Translation3d(1,2,3)*Eigen::AngleAxisd(0.5,Eigen::Vector3d::UnitZ()));
+    {
+        base::TimeMark t("Pointcloud transform 1M points");
+        for(int i=0;i<count;++i)
+            for(size_t j=0;j<cloud.points.size();++j)
+                cloud.points[j] = transform*cloud.points[j];
+        std::cerr << t << std::endl;
+    }
+    {
+        base::TimeMark t("CompactPointcloud::transform 1M points");
+        for(int i=0;i<count;++i)
+            compact.transform(transform);
+        std::cerr << t << std::endl;
+    }
+}
+
+void benchmarkVoxelGridFilter()
+{
+    //a lidar sweep of 300k points
+    const int count = 20;
+    base::samples::Pointcloud cloud;
+    for(int i=0;i<300000;++i)
+    {
+        const double azimuth = (i%2048)*2*M_PI/2048, elevation = (i/2048)*0.005-0.2;
+        const double range = 6+3*sin(3*azimuth)+(i%7)*0.01;
+        cloud.points.push_back(base::Point(range*cos(elevation)*cos(azimuth),range*cos(elevation)*sin(azimuth),range*sin(elevation)));
+    }
+    {
+        base::TimeMark t("std::map voxel grid 300k points");
+        for(int i=0;i<count;++i)
+        {
+            std::map<std::pair<int,std::pair<int,int> >,std::pair<base::Point,int> > voxels;
+            for(size_t j=0;j<cloud.points.size();++j)
+            {
+                const base::Point &p = cloud.points[j];
+                std::pair<base::Point,int> &voxel = voxels[std::make_pair(int(floor(p.x()*10)),std::make_pair(int(floor(p.y()*10)),int(floor(p.z()*10))))];
+                if(!voxel.second)
+                    voxel.first = base::Point::Zero();
+                voxel.first += p;
+                ++voxel.second;
+            }
+        }
+        std::cerr << t << std::endl;
+    }
+    base::samples::VoxelGridFilter filter;
+    base::samples::Pointcloud output;
+    {
+        base::TimeMark t("VoxelGridFilter::filter 300k points");
+        for(int i=0;i<count;++i)
+            filter.filter(cloud,output);
+        std::cerr << t << " (" << output.points.size() << " voxels)" << std::endl;
+    }
+}
+
+void benchmarkKDTree()
+{
+    std::vector<base::Point> queries;
+    for(int i=0;i<100000;++i)
+        queries.push_back(base::Point(rand()%1000*0.01,rand()%1000*0.01,rand()%1000*0.002));
+    std::vector<uint32_t> indices;
+    std::vector<double> distances;
+    std::vector<float> float_distances;
+    std::vector<std::vector<uint32_t> > radius_indices;
+    for(int size=100000;size<=10000000;size*=10)
+    {
+        base::samples::Pointcloud cloud;
+        cloud.points.reserve(size);
+        srand(1);
+        for(int i=0;i<size;++i)
+            cloud.points.push_back(base::Point(rand()%100000*0.0001,rand()%100000*0.0001,rand()%100000*0.00002));
+        std::stringstream name;
+        name << size << " points";
+
+        base::samples::PointcloudKDTree tree;
+        {
+            base::TimeMark t("KDTree::build Pointcloud " + name.str());
+            tree.build(cloud);
+            std::cerr << t << std::endl;
+        }
+        {
+            base::TimeMark t("KDTree::knnSearch k=8 100k queries Pointcloud " + name.str());
+            tree.knnSearch(queries,8,indices,distances);
+            std::cerr << t << std::endl;
+        }
+        {
+            base::TimeMark t("KDTree::radiusSearch 100k queries Pointcloud " + name.str());
+            tree.radiusSearch(queries,sqrt(30.0/size),radius_indices);
+            std::cerr << t << std::endl;
+        }
+
+        base::samples::CompactPointcloud compact;
+        compact.fromPointcloud(cloud);
+        base::samples::CompactPointcloudKDTree compact_tree;
+        {
+            base::TimeMark t("KDTree::build CompactPointcloud " + name.str());
+            compact_tree.build(compact);
+            std::cerr << t << std::endl;
+        }
+        {
+            base::TimeMark t("KDTree::knnSearch k=8 100k queries CompactPointcloud " + name.str());
+            compact_tree.knnSearch(queries,8,indices,float_distances);
+            std::cerr << t << std::endl;
+        }
+    }
+}
+
 int main()
 {
+    benchmarkSonarScanToggleMemoryLayout();
+    benchmarkCompressedSonarScan();
+    benchmarkLaserScanConverter();
+    benchmarkCompactLaserScan();
+    benchmarkMultiLayerLaserScanConverter();
+    benchmarkLaserScanMatcher();
+    benchmarkLaserScanFusion();
+    benchmarkDistanceImageConverter();
+    benchmarkCompactPointcloud();
+    benchmarkVoxelGridFilter();
+    benchmarkKDTree();
+
     const int count = 100000000;
     {
 	base::TimeMark t("Float Aligned Vector3");
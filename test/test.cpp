@@ -20,16 +20,38 @@
 #include <base/Pressure.hpp>
 //#include <base/samples/CompressedFrame.hpp>
 #include <base/samples/DistanceImage.hpp>
+#include <base/samples/DistanceImageConverter.hpp>
 #include <base/samples/Frame.hpp>
+#include <base/samples/FrameQuality.hpp>
 #include <base/samples/IMUSensors.hpp>
 #include <base/samples/Joints.hpp>
 #include <base/samples/LaserScan.hpp>
+#include <base/samples/LaserScanConverter.hpp>
+#include <base/samples/CompactLaserScan.hpp>
+#include <base/samples/LaserScanFilter.hpp>
+#include <base/samples/MultiLayerLaserScanConverter.hpp>
+#include <base/samples/OccupancyGrid.hpp>
+#include <base/samples/LaserScanLineExtractor.hpp>
+#include <base/samples/LaserScanMatcher.hpp>
+#include <base/samples/LaserScanFusion.hpp>
 #include <base/samples/Pointcloud.hpp>
+#include <base/samples/CompactPointcloud.hpp>
+#include <base/samples/VoxelGridFilter.hpp>
+#include <base/samples/KDTree.hpp>
 #include <base/samples/Pressure.hpp>
 #include <base/samples/RigidBodyAcceleration.hpp>
 #include <base/samples/RigidBodyState.hpp>
 #include <base/samples/SonarBeam.hpp>
 #include <base/samples/SonarScan.hpp>
+#include <base/samples/SonarScanAccumulator.hpp>
+#include <base/samples/SonarEchoDetector.hpp>
+#include <base/samples/SonarMosaic.hpp>
+#include <base/samples/CompressedSonarScan.hpp>
+#include <base/samples/SonarTemporalFilter.hpp>
+#include <base/samples/SonarScanResampler.hpp>
+#include <base/samples/SonarMotionCompensation.hpp>
+#include <base/samples/SonarScanConverter.hpp>
+#include <base/samples/SonarSignalConditioner.hpp>
 #include <base/Temperature.hpp>
 #include <base/Time.hpp>
 #include <base/TimeMark.hpp>
@@ -46,6 +68,8 @@
 #include <Eigen/SVD>
 #include <Eigen/LU>
 
+#include <map>
+
 using namespace std;
 
 BOOST_AUTO_TEST_CASE(joint_state)
@@ -247,6 +271,838 @@ BOOST_AUTO_TEST_CASE(sonar_scan)
     BOOST_CHECK(temp_beam.beam == sonar_beam.beam);
 }
 
+BOOST_AUTO_TEST_CASE(sonar_scan_toggle_memory_layout)
+{
+    //sizes which are not a multiple of the SIMD block and tile sizes
+    const int sizes[][2] = {{1,1},{16,16},{37,530},{130,67},{256,1000}};
+    std::vector<uint8_t> buffer;
+    for(int s=0;s<5;++s)
+    {
+        base::samples::SonarScan sonar_scan(sizes[s][0],sizes[s][1],base::Angle::fromDeg(20),base::Angle::fromDeg(1),false);
+        for(size_t i=0;i<sonar_scan.data.size();++i)
+            sonar_scan.data[i] = (i*31+7)%251;
+        std::vector<uint8_t> original = sonar_scan.data;
+
+        sonar_scan.toggleMemoryLayout(buffer);
+        BOOST_CHECK(sonar_scan.memory_layout_column);
+        bool equal = true;
+        for(int beam=0;beam<sonar_scan.number_of_beams;++beam)
+            for(int bin=0;bin<sonar_scan.number_of_bins;++bin)
+                equal &= sonar_scan.data[bin*sonar_scan.number_of_beams+beam] == original[beam*sonar_scan.number_of_bins+bin];
+        BOOST_CHECK(equal);
+
+        sonar_scan.toggleMemoryLayout(buffer);
+        BOOST_CHECK(!sonar_scan.memory_layout_column);
+        BOOST_CHECK(sonar_scan.data == original);
+    }
+}
+
+struct BeamMaximum
+{
+    std::vector<uint8_t> maxima;
+    void operator()(uint16_t index,base::samples::SonarScan::ConstView beam)
+    {
+        //the beams are visited in order
+        BOOST_CHECK_EQUAL(index,maxima.size());
+        maxima.push_back(*std::max_element(beam.begin(),beam.end()));
+    }
+};
+
+BOOST_AUTO_TEST_CASE(sonar_scan_views)
+{
+    base::samples::SonarScan sonar_scan(7,11,base::Angle::fromDeg(3),base::Angle::fromDeg(1),false);
+    for(int beam=0;beam<7;++beam)
+        for(int bin=0;bin<11;++bin)
+            sonar_scan.data[beam*11+bin] = beam*11+bin;
+    base::samples::SonarScan column_scan(sonar_scan);
+    column_scan.toggleMemoryLayout();
+
+    for(int layout=0;layout<2;++layout)
+    {
+        base::samples::SonarScan &scan = layout ? column_scan : sonar_scan;
+        const base::samples::SonarScan &const_scan = scan;
+        for(int beam=0;beam<7;++beam)
+        {
+            base::samples::SonarScan::ConstView view = const_scan.beamView(beam);
+            BOOST_REQUIRE_EQUAL(view.size(),11);
+            BOOST_CHECK_EQUAL(view.isContiguous(),!scan.memory_layout_column);
+            for(int bin=0;bin<11;++bin)
+                BOOST_CHECK_EQUAL(view[bin],beam*11+bin);
+            std::vector<int> bins(11);
+            view.copyTo(&bins[0]);
+            for(int bin=0;bin<11;++bin)
+                BOOST_CHECK_EQUAL(bins[bin],beam*11+bin);
+            std::vector<uint8_t> raw_bins(11);
+            view.copyTo(&raw_bins[0]);
+            BOOST_CHECK(std::equal(raw_bins.begin(),raw_bins.end(),bins.begin()));
+            BOOST_CHECK_EQUAL(view.end()-view.begin(),11);
+        }
+        for(int bin=0;bin<11;++bin)
+        {
+            base::samples::SonarScan::ConstView view = const_scan.binView(bin);
+            BOOST_REQUIRE_EQUAL(view.size(),7);
+            for(int beam=0;beam<7;++beam)
+                BOOST_CHECK_EQUAL(view[beam],beam*11+bin);
+        }
+        BOOST_CHECK_THROW(scan.beamView(7),std::runtime_error);
+        BOOST_CHECK_THROW(scan.binView(11),std::runtime_error);
+
+        BeamMaximum maximum = const_scan.forEachBeam(BeamMaximum());
+        BOOST_REQUIRE_EQUAL(maximum.maxima.size(),7);
+        for(int beam=0;beam<7;++beam)
+            BOOST_CHECK_EQUAL(maximum.maxima[beam],beam*11+10);
+
+        //writing through a view
+        base::samples::SonarScan::View view = scan.beamView(2);
+        std::fill(view.begin(),view.end(),255);
+        BOOST_CHECK_EQUAL(scan.binView(5)[2],255);
+        BOOST_CHECK_EQUAL(scan.binView(5)[3],3*11+5);
+    }
+    column_scan.toggleMemoryLayout();
+    BOOST_CHECK(column_scan.data == sonar_scan.data);
+
+    BOOST_CHECK_SMALL(sonar_scan.getBeamBearing(2).getDeg()-1,1e-9);
+    sonar_scan.time = base::Time::fromSeconds(10);
+    BOOST_CHECK(sonar_scan.getBeamTime(3) == sonar_scan.time);
+    sonar_scan.time_beams.resize(7);
+    sonar_scan.time_beams[3] = base::Time::fromSeconds(5);
+    BOOST_CHECK(sonar_scan.getBeamTime(3) == base::Time::fromSeconds(5));
+    BOOST_CHECK(sonar_scan.getBeamTime(4) == sonar_scan.time);
+}
+
+BOOST_AUTO_TEST_CASE(sonar_scan_converter)
+{
+    base::samples::SonarScan sonar_scan(31,100,base::Angle::fromDeg(30),base::Angle::fromDeg(2),false);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 2000;   //0.1 m per bin
+    sonar_scan.time = base::Time::now();
+    for(int beam=0;beam<sonar_scan.number_of_beams;++beam)
+        for(int bin=0;bin<sonar_scan.number_of_bins;++bin)
+            sonar_scan.data[beam*sonar_scan.number_of_bins+bin] = beam*8;
+
+    base::samples::SonarScanConverter converter(200,100,0.1,base::samples::SonarScanConverter::NEAREST,7);
+    base::samples::frame::Frame frame;
+    converter.convert(sonar_scan,frame);
+    BOOST_CHECK(frame.getWidth() == 200);
+    BOOST_CHECK(frame.getHeight() == 100);
+    BOOST_CHECK(frame.isGrayscale());
+    BOOST_CHECK(frame.time == sonar_scan.time);
+    BOOST_CHECK(frame.getStatus() == base::samples::frame::STATUS_VALID);
+
+    //straight ahead is the center beam
+    BOOST_CHECK_EQUAL(frame.at<uint8_t>(99,50),15*8);
+    BOOST_CHECK_EQUAL(frame.at<uint8_t>(100,10),15*8);
+    //left side of the image is the start bearing
+    double bearing = base::Angle::deg2Rad(29.5);
+    int column = 100 - 0.5 - 5*sin(bearing)/0.1;
+    int row = 100 - 0.5 - 5*cos(bearing)/0.1;
+    BOOST_CHECK_EQUAL(frame.at<uint8_t>(column,row),0);
+    //outside of the fan and behind the maximum range
+    BOOST_CHECK_EQUAL(frame.at<uint8_t>(0,99),7);
+    BOOST_CHECK_EQUAL(frame.at<uint8_t>(100,0),7);
+
+    //both memory layouts and interpolation modes lead to the same image for
+    //data which is constant along each beam
+    base::samples::frame::Frame frame2;
+    base::samples::SonarScan column_scan(sonar_scan);
+    column_scan.toggleMemoryLayout();
+    converter.convert(column_scan,frame2);
+    BOOST_CHECK(frame.image == frame2.image);
+
+    converter.setInterpolation(base::samples::SonarScanConverter::BILINEAR);
+    converter.convert(column_scan,frame2);
+    int max_difference = 0;
+    for(size_t i=0;i<frame.image.size();++i)
+        if(frame.image[i] != 7)
+            max_difference = std::max(max_difference,abs(int(frame.image[i])-int(frame2.image[i])));
+    BOOST_CHECK(max_difference <= 4);
+    BOOST_CHECK(abs(frame2.at<uint8_t>(100,50)-15*8) <= 4);
+
+    //changing the geometry rebuilds the table
+    sonar_scan.init(10,10,base::Angle::fromDeg(180),base::Angle::fromDeg(36),false);
+    sonar_scan.sampling_interval = 0.001;
+    sonar_scan.speed_of_sound = 2000;
+    converter.setOutput(50,50);
+    converter.convert(sonar_scan,frame);
+    BOOST_CHECK(frame.getWidth() == 50);
+    BOOST_CHECK_CLOSE(converter.getPixelSize(),0.4,1e-6);
+
+    sonar_scan.polar_coordinates = false;
+    BOOST_CHECK_THROW(converter.convert(sonar_scan,frame),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sonar_scan_accumulator)
+{
+    for(int layout=0;layout<2;++layout)
+    {
+        base::samples::SonarScanAccumulator accumulator(50,100,base::Angle::fromDeg(20),base::Angle::fromDeg(1),layout);
+        BOOST_CHECK(!accumulator.hasChanges());
+        BOOST_CHECK(!accumulator.isSweepComplete());
+        BOOST_CHECK(accumulator.getSonarScan().time_beams.size() == 50);
+
+        base::samples::SonarScan reference(50,100,base::Angle::fromDeg(20),base::Angle::fromDeg(1),false);
+        base::samples::SonarBeam sonar_beam;
+        sonar_beam.speed_of_sound = 1500;
+        sonar_beam.beamwidth_horizontal = 0.1;
+        sonar_beam.beamwidth_vertical = 0.2;
+        sonar_beam.sampling_interval = 0.01;
+        sonar_beam.beam.resize(100);
+
+        //wrong bearing or too many bins
+        sonar_beam.bearing = base::Angle::fromDeg(25);
+        BOOST_CHECK_THROW(accumulator.addSonarBeam(sonar_beam),std::runtime_error);
+        sonar_beam.bearing = base::Angle::fromDeg(20);
+        sonar_beam.beam.resize(101);
+        BOOST_CHECK_THROW(accumulator.addSonarBeam(sonar_beam),std::runtime_error);
+        sonar_beam.beam.resize(100);
+
+        for(int i=20;i>-30;--i)
+        {
+            sonar_beam.bearing = base::Angle::fromDeg(i);
+            sonar_beam.time = base::Time::fromSeconds(100+i);
+            for(int bin=0;bin<100;++bin)
+                sonar_beam.beam[bin] = i+bin+30;
+            accumulator.addSonarBeam(sonar_beam);
+            reference.addSonarBeam(sonar_beam,false);
+            BOOST_CHECK(accumulator.isSweepComplete() == (i == -29));
+        }
+        BOOST_CHECK(accumulator.getChangedBeams().size() == 50);
+
+        base::samples::SonarScan scan(accumulator.getSonarScan());
+        if(scan.memory_layout_column)
+            scan.toggleMemoryLayout();
+        BOOST_CHECK(scan.data == reference.data);
+        BOOST_CHECK(scan.time_beams == reference.time_beams);
+        BOOST_CHECK(scan.sampling_interval == reference.sampling_interval);
+        BOOST_CHECK(scan.speed_of_sound == reference.speed_of_sound);
+
+        //incremental updates
+        accumulator.clearChanges();
+        accumulator.startSweep();
+        BOOST_CHECK(!accumulator.hasChanges());
+        sonar_beam.bearing = base::Angle::fromDeg(3);
+        sonar_beam.beam.resize(10);
+        accumulator.addSonarBeam(sonar_beam);
+        accumulator.addSonarBeam(sonar_beam);
+        BOOST_CHECK(accumulator.getChangedBeams().size() == 1);
+        BOOST_CHECK(accumulator.getChangedBeams()[0] == 17);
+        BOOST_CHECK(!accumulator.isSweepComplete());
+
+        std::vector<base::samples::SonarBeam> beams;
+        accumulator.getChangedSonarBeams(beams);
+        BOOST_REQUIRE(beams.size() == 1);
+        BOOST_CHECK_SMALL(beams[0].bearing.rad-sonar_beam.bearing.rad,0.0001);
+        BOOST_CHECK(beams[0].time == sonar_beam.time);
+        BOOST_CHECK(beams[0].beam.size() == 100);
+        BOOST_CHECK(std::equal(sonar_beam.beam.begin(),sonar_beam.beam.end(),beams[0].beam.begin()));
+        BOOST_CHECK(beams[0].beam[10] == 0 && beams[0].beam[99] == 0);
+
+        //a range change clears the sweep
+        accumulator.clearChanges();
+        sonar_beam.sampling_interval = 0.02;
+        accumulator.addSonarBeam(sonar_beam);
+        BOOST_CHECK(accumulator.getChangedBeams().size() == 50);
+        BOOST_CHECK(accumulator.getSonarScan().time_beams[0].isNull());
+        BOOST_CHECK(accumulator.getSonarScan().sampling_interval == 0.02);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sonar_signal_conditioner)
+{
+    base::samples::SonarScan sonar_scan(37,101,base::Angle::fromDeg(20),base::Angle::fromDeg(1),false);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 1500;
+    for(size_t i=0;i<sonar_scan.data.size();++i)
+        sonar_scan.data[i] = (i*37+11)%97;
+
+    //TVG only
+    base::samples::SonarSignalConditionerConfig config;
+    config.spreading_coefficient = 20;
+    config.absorption = 0.5;
+    base::samples::SonarSignalConditioner conditioner(config);
+    base::samples::SonarScan tvg_scan(sonar_scan);
+    conditioner.process(tvg_scan);
+    double resolution = sonar_scan.getSpatialResolution();
+    int max_error = 0;
+    for(int beam=0;beam<sonar_scan.number_of_beams;++beam)
+    {
+        for(int bin=0;bin<sonar_scan.number_of_bins;++bin)
+        {
+            double range = (bin+0.5)*resolution;
+            double gain = pow(10.0,(20*log10(std::max(range,1.0))+2*0.5*range)/20.0);
+            int expected = std::min(255.0,sonar_scan.data[beam*101+bin]*gain);
+            max_error = std::max(max_error,abs(expected-tvg_scan.data[beam*101+bin]));
+        }
+    }
+    BOOST_CHECK(max_error <= 1);
+
+    //all stages lead to the same result for both memory layouts and single beams
+    config.normalize = true;
+    config.median = true;
+    conditioner.setConfig(config);
+    base::samples::SonarScan row_scan(sonar_scan);
+    base::samples::SonarScan column_scan(sonar_scan);
+    column_scan.toggleMemoryLayout();
+    conditioner.process(row_scan);
+    conditioner.process(column_scan);
+    column_scan.toggleMemoryLayout();
+    BOOST_CHECK(row_scan.data == column_scan.data);
+
+    //reference 3x3 median without the median stage
+    config.median = false;
+    conditioner.setConfig(config);
+    base::samples::SonarScan unfiltered(sonar_scan);
+    conditioner.process(unfiltered);
+    bool median_equal = true;
+    for(int beam=1;beam<sonar_scan.number_of_beams-1;++beam)
+    {
+        for(int bin=1;bin<sonar_scan.number_of_bins-1;++bin)
+        {
+            std::vector<uint8_t> window;
+            for(int i=-1;i<=1;++i)
+                for(int j=-1;j<=1;++j)
+                    window.push_back(unfiltered.data[(beam+i)*101+bin+j]);
+            std::nth_element(window.begin(),window.begin()+4,window.end());
+            median_equal &= row_scan.data[beam*101+bin] == window[4];
+        }
+    }
+    BOOST_CHECK(median_equal);
+
+    //normalization reaches the target for each beam
+    for(int beam=0;beam<sonar_scan.number_of_beams;++beam)
+        BOOST_CHECK(*std::max_element(unfiltered.data.begin()+beam*101,unfiltered.data.begin()+(beam+1)*101) >= 254);
+
+    base::samples::SonarBeam sonar_beam;
+    sonar_scan.getSonarBeam(base::Angle::fromDeg(10),sonar_beam);
+    conditioner.process(sonar_beam);
+    BOOST_CHECK(std::equal(sonar_beam.beam.begin(),sonar_beam.beam.end(),unfiltered.data.begin()+10*101));
+
+    config.median = true;
+    conditioner.setConfig(config);
+    sonar_scan.getSonarBeam(base::Angle::fromDeg(10),sonar_beam);
+    conditioner.process(sonar_beam);
+    for(int bin=1;bin<100;++bin)
+    {
+        uint8_t a = unfiltered.data[10*101+bin-1], b = unfiltered.data[10*101+bin], c = unfiltered.data[10*101+bin+1];
+        BOOST_CHECK_EQUAL(sonar_beam.beam[bin],std::max(std::min(a,b),std::min(std::max(a,b),c)));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sonar_echo_detector)
+{
+    base::samples::SonarScan sonar_scan(41,300,base::Angle::fromDeg(20),base::Angle::fromDeg(1),false);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 2000;   //0.1 m per bin
+    for(int beam=0;beam<sonar_scan.number_of_beams;++beam)
+    {
+        uint8_t *row = &sonar_scan.data[beam*300];
+        row[2] = 250;               //ringing of the transducer
+        row[20+beam] = 100;         //first echo
+        row[40+beam*3] = 200+beam%10;   //strongest echo
+    }
+    //beam without echo
+    std::fill(sonar_scan.data.begin()+40*300,sonar_scan.data.end(),0);
+
+    base::samples::SonarEchoDetectorConfig config;
+    config.threshold = 90;
+    config.min_range = 0.5;
+    config.intensity_as_color = true;
+    base::samples::SonarEchoDetector detector(config);
+    base::samples::Pointcloud cloud;
+
+    base::samples::SonarScan column_scan(sonar_scan);
+    column_scan.toggleMemoryLayout();
+    for(int layout=0;layout<2;++layout)
+    {
+        const base::samples::SonarScan &scan = layout ? column_scan : sonar_scan;
+        config.mode = base::samples::SonarEchoDetectorConfig::FIRST_ECHO;
+        detector.setConfig(config);
+        detector.detect(scan,cloud);
+        BOOST_REQUIRE(cloud.points.size() == 40);
+        BOOST_REQUIRE(cloud.colors.size() == 40);
+        for(int beam=0;beam<40;++beam)
+        {
+            BOOST_CHECK_EQUAL(detector.getEchoBins()[beam],20+beam);
+            double bearing = base::Angle::deg2Rad(20-beam);
+            BOOST_CHECK_SMALL(cloud.points[beam].x()-(20+beam)*0.1*cos(bearing),1e-6);
+            BOOST_CHECK_SMALL(cloud.points[beam].y()-(20+beam)*0.1*sin(bearing),1e-6);
+            BOOST_CHECK_SMALL(cloud.colors[beam].x()-100/255.0,1e-6);
+        }
+        BOOST_CHECK(detector.getEchoBins()[40] == base::samples::SonarEchoDetector::NO_ECHO);
+
+        config.mode = base::samples::SonarEchoDetectorConfig::STRONGEST_ECHO;
+        config.max_range = 15;
+        detector.setConfig(config);
+        Eigen::Affine3d transform(Eigen::Translation3d(1,2,3));
+        detector.detect(scan,cloud,transform);
+        BOOST_CHECK(cloud.points.size() == 40);
+        for(int beam=0;beam<37;++beam)
+        {
+            BOOST_CHECK_EQUAL(detector.getEchoBins()[beam],40+beam*3);
+            BOOST_CHECK_EQUAL(detector.getEchoIntensities()[beam],200+beam%10);
+            BOOST_CHECK_SMALL(cloud.points[beam].z()-3,1e-6);
+        }
+        //the strongest echo is behind the maximum range
+        BOOST_CHECK_EQUAL(detector.getEchoBins()[38],20+38);
+        config.max_range = std::numeric_limits<double>::infinity();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sonar_mosaic)
+{
+    base::samples::SonarScan sonar_scan(31,100,base::Angle::fromDeg(15),base::Angle::fromDeg(1),false);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 2000;   //0.1 m per bin
+    std::fill(sonar_scan.data.begin(),sonar_scan.data.end(),200);
+    base::samples::SonarScan second_scan(sonar_scan);
+    std::fill(second_scan.data.begin(),second_scan.data.end(),100);
+
+    //sonar looking along the y-axis of the world
+    base::samples::RigidBodyState pose;
+    pose.position = Eigen::Vector3d(100,-50,2);
+    pose.orientation = Eigen::Quaterniond(Eigen::AngleAxisd(M_PI/2,Eigen::Vector3d::UnitZ()));
+
+    base::samples::SonarMosaicConfig config;
+    config.cell_size = 0.5;
+    config.tile_size = 16;
+    base::samples::SonarMosaic mosaic(config);
+    mosaic.integrate(sonar_scan,pose);
+    uint8_t value;
+    uint16_t count;
+    BOOST_REQUIRE(mosaic.getCell(100.1,-45,value,count));
+    BOOST_CHECK_EQUAL(value,200);
+    BOOST_CHECK(!mosaic.getCell(105,-50,value,count));
+    BOOST_CHECK(!mosaic.getCell(100,-30,value,count));
+
+    //the fan is covered without holes
+    for(double range=1;range<9.5;range+=0.25)
+    {
+        for(double bearing=-14;bearing<=14;bearing+=0.5)
+        {
+            double angle = base::Angle::deg2Rad(bearing)+M_PI/2;
+            BOOST_CHECK(mosaic.getCell(100+range*cos(angle),-50+range*sin(angle),value,count));
+        }
+    }
+
+    mosaic.integrate(second_scan,pose);
+    BOOST_REQUIRE(mosaic.getCell(100.1,-45,value,count));
+    BOOST_CHECK_EQUAL(value,150);
+
+    config.blending = base::samples::SonarMosaicConfig::MAXIMUM;
+    base::samples::SonarMosaic max_mosaic(config);
+    max_mosaic.integrate(second_scan,pose);
+    max_mosaic.integrate(sonar_scan,pose);
+    BOOST_REQUIRE(max_mosaic.getCell(100.1,-45,value,count));
+    BOOST_CHECK_EQUAL(value,200);
+
+    //integrating a batch in parallel gives the same result as integrating
+    //the pings one after another
+    std::vector<base::samples::SonarScan> scans;
+    std::vector<base::samples::RigidBodyState> poses;
+    for(int i=0;i<8;++i)
+    {
+        scans.push_back(i%2 ? sonar_scan : second_scan);
+        poses.push_back(pose);
+        poses.back().position.x() += i*3;
+    }
+    config.blending = base::samples::SonarMosaicConfig::AVERAGE;
+    base::samples::SonarMosaic sequential(config);
+    for(size_t i=0;i<scans.size();++i)
+        sequential.integrate(scans[i],poses[i]);
+    base::samples::SonarMosaic batch(config);
+    batch.integrate(scans,poses);
+    BOOST_CHECK_EQUAL(batch.getTileCount(),sequential.getTileCount());
+    base::samples::frame::Frame expected, frame;
+    sequential.render(90,-55,80,80,expected);
+    batch.render(90,-55,80,80,frame);
+    BOOST_CHECK(expected.image == frame.image);
+
+    //tiles west and south of the origin
+    base::samples::RigidBodyState west_pose = pose;
+    west_pose.position.x() = -100;
+    base::samples::SonarMosaic west(config);
+    west.integrate(sonar_scan,west_pose);
+    BOOST_REQUIRE(west.getCell(-99.9,-45,value,count));
+    BOOST_CHECK_EQUAL(value,200);
+    BOOST_CHECK(!west.getCell(100.1,-45,value,count));
+
+    //evicted tiles are stored in the swap directory
+    char directory[] = "/tmp/sonar_mosaic_XXXXXX";
+    BOOST_REQUIRE(mkdtemp(directory));
+    config.max_tiles_in_memory = 2;
+    config.swap_directory = directory;
+    {
+        base::samples::SonarMosaic swapping(config);
+        swapping.integrate(scans,poses);
+        BOOST_CHECK(swapping.getTilesInMemory() <= 2);
+        BOOST_CHECK_EQUAL(swapping.getTileCount(),sequential.getTileCount());
+        swapping.render(90,-55,80,80,frame);
+        BOOST_CHECK(expected.image == frame.image);
+        BOOST_CHECK(swapping.getTilesInMemory() <= 2);
+    }
+    //the swap files are removed with the mosaic
+    BOOST_CHECK_EQUAL(rmdir(directory),0);
+}
+
+BOOST_AUTO_TEST_CASE(compressed_sonar_scan)
+{
+    base::samples::SonarScan sonar_scan(64,500,base::Angle::fromDeg(60),base::Angle::fromDeg(2),false);
+    sonar_scan.time = base::Time::fromMicroseconds(1000);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 1500;
+    sonar_scan.beamwidth_horizontal = base::Angle::fromDeg(1);
+    sonar_scan.beamwidth_vertical = base::Angle::fromDeg(20);
+    sonar_scan.time_beams.resize(64);
+    srand(42);
+    for(int beam=0;beam<64;++beam)
+    {
+        sonar_scan.time_beams[beam] = base::Time::fromMicroseconds(1000+beam);
+        uint8_t *row = &sonar_scan.data[beam*500];
+        std::fill(row,row+500,0);
+        for(int bin=0;bin<10;++bin)     //ringing
+            row[bin] = 255;
+        for(int bin=0;bin<40;++bin)     //smooth echo
+            row[100+beam+bin] = 100+bin%8;
+        for(int bin=300;bin<350;++bin)  //noise
+            row[bin] = rand()%256;
+        row[499] = beam;
+    }
+
+    base::samples::CompressedSonarScan compressed(sonar_scan);
+    BOOST_CHECK(compressed.data.size() < sonar_scan.data.size()/4);
+    base::samples::SonarScan result;
+    compressed.decompress(result);
+    BOOST_CHECK(result.data == sonar_scan.data);
+    BOOST_CHECK(result.time_beams == sonar_scan.time_beams);
+    BOOST_CHECK(result.time == sonar_scan.time);
+    BOOST_CHECK_EQUAL(result.number_of_beams,64);
+    BOOST_CHECK_EQUAL(result.number_of_bins,500);
+    BOOST_CHECK(result.start_bearing == sonar_scan.start_bearing);
+    BOOST_CHECK(result.angular_resolution == sonar_scan.angular_resolution);
+    BOOST_CHECK_EQUAL(result.sampling_interval,sonar_scan.sampling_interval);
+    BOOST_CHECK_EQUAL(result.speed_of_sound,sonar_scan.speed_of_sound);
+    BOOST_CHECK(result.beamwidth_horizontal == sonar_scan.beamwidth_horizontal);
+    BOOST_CHECK(result.beamwidth_vertical == sonar_scan.beamwidth_vertical);
+    BOOST_CHECK_EQUAL(result.memory_layout_column,false);
+    BOOST_CHECK_EQUAL(result.polar_coordinates,true);
+
+    base::samples::SonarBeam sonar_beam;
+    sonar_scan.getSonarBeam(base::Angle::fromDeg(50),sonar_beam);
+    sonar_beam.time = base::Time::fromMicroseconds(55);
+    base::samples::CompressedSonarBeam compressed_beam(sonar_beam);
+    base::samples::SonarBeam result_beam;
+    compressed_beam.decompress(result_beam);
+    BOOST_CHECK(result_beam.beam == sonar_beam.beam);
+    BOOST_CHECK(result_beam.time == sonar_beam.time);
+    BOOST_CHECK(result_beam.bearing == sonar_beam.bearing);
+    BOOST_CHECK_EQUAL(result_beam.sampling_interval,sonar_beam.sampling_interval);
+    BOOST_CHECK_EQUAL(result_beam.beamwidth_vertical,sonar_beam.beamwidth_vertical);
+
+    sonar_beam.beam.clear();
+    compressed_beam.compress(sonar_beam);
+    compressed_beam.decompress(result_beam);
+    BOOST_CHECK(result_beam.beam.empty());
+
+    sonar_scan.toggleMemoryLayout();
+    compressed.compress(sonar_scan);
+    compressed.decompress(result);
+    BOOST_CHECK(result.data == sonar_scan.data);
+    BOOST_CHECK_EQUAL(result.memory_layout_column,true);
+
+    //random data and long runs of all kinds
+    std::vector<uint8_t> random(100000);
+    for(size_t i=0;i<random.size();++i)
+    {
+        int kind = (i/1000)%4;
+        random[i] = kind == 0 ? rand()%256 : kind == 1 ? 0 : kind == 2 ? 77 : 128+(rand()%3);
+    }
+    sonar_scan.number_of_beams = 200;
+    sonar_scan.data = random;
+    compressed.compress(sonar_scan);
+    compressed.decompress(result);
+    BOOST_CHECK(result.data == random);
+
+    //a count which does not match the header
+    compressed.number_of_bins = 400;
+    BOOST_CHECK_THROW(compressed.decompress(result),std::runtime_error);
+    compressed.number_of_bins = 500;
+
+    //corrupted data
+    compressed.data.resize(compressed.data.size()/2);
+    BOOST_CHECK_THROW(compressed.decompress(result),std::runtime_error);
+
+    //a beam whose count is larger than its tokens hold, 2^40 values
+    compressed_beam.data.clear();
+    base::samples::detail::writeVarint(size_t(1) << 40,compressed_beam.data);
+    compressed_beam.data.push_back(base::samples::detail::ZERO_RUN | 9);
+    BOOST_CHECK_THROW(compressed_beam.decompress(result_beam),std::runtime_error);
+    //the last token of a beam holds too many values
+    compressed_beam.data.clear();
+    base::samples::detail::writeVarint(5,compressed_beam.data);
+    compressed_beam.data.push_back(base::samples::detail::LITERAL | 5);
+    compressed_beam.data.insert(compressed_beam.data.end(),6,uint8_t(1));
+    BOOST_CHECK_THROW(compressed_beam.decompress(result_beam),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sonar_temporal_filter)
+{
+    //size which is not a multiple of the SIMD width
+    std::vector<base::samples::SonarScan> scans;
+    srand(7);
+    for(int ping=0;ping<10;++ping)
+    {
+        scans.push_back(base::samples::SonarScan(13,37,base::Angle::fromDeg(30),base::Angle::fromDeg(1),false));
+        scans.back().sampling_interval = 0.0001;
+        scans.back().speed_of_sound = 1500;
+        scans.back().time = base::Time::fromMicroseconds(ping);
+        for(size_t i=0;i<scans.back().data.size();++i)
+            scans.back().data[i] = rand()%256;
+    }
+    const size_t size = scans[0].data.size();
+
+    base::samples::SonarTemporalFilterConfig config;
+    config.mode = base::samples::SonarTemporalFilterConfig::MEAN;
+    config.window = 3;
+    base::samples::SonarTemporalFilter filter(config);
+    base::samples::SonarScan output;
+    for(int ping=0;ping<10;++ping)
+    {
+        filter.process(scans[ping],output);
+        BOOST_CHECK(output.time == scans[ping].time);
+        int count = std::min(ping+1,3);
+        BOOST_CHECK_EQUAL(filter.getPingCount(),count);
+        for(size_t i=0;i<size;++i)
+        {
+            int sum = 0;
+            for(int j=ping-count+1;j<=ping;++j)
+                sum += scans[j].data[i];
+            BOOST_REQUIRE_EQUAL(output.data[i],(sum+count/2)/count);
+        }
+    }
+
+    config.mode = base::samples::SonarTemporalFilterConfig::MEDIAN;
+    config.window = 4;
+    filter.setConfig(config);
+    for(int ping=0;ping<10;++ping)
+    {
+        filter.process(scans[ping],output);
+        int count = std::min(ping+1,4);
+        for(size_t i=0;i<size;++i)
+        {
+            std::vector<int> values;
+            for(int j=ping-count+1;j<=ping;++j)
+                values.push_back(scans[j].data[i]);
+            std::sort(values.begin(),values.end());
+            int median = count%2 ? values[count/2] : (values[count/2-1]+values[count/2]+1)/2;
+            BOOST_REQUIRE_EQUAL(output.data[i],median);
+        }
+    }
+
+    config.mode = base::samples::SonarTemporalFilterConfig::EXPONENTIAL;
+    config.alpha = 0.25;
+    filter.setConfig(config);
+    std::vector<double> average(scans[0].data.begin(),scans[0].data.end());
+    for(int ping=0;ping<10;++ping)
+    {
+        filter.process(scans[ping],output);
+        for(size_t i=0;i<size;++i)
+        {
+            if(ping)
+                average[i] = 0.75*average[i]+0.25*scans[ping].data[i];
+            BOOST_REQUIRE(fabs(output.data[i]-average[i]) <= 1);
+        }
+    }
+
+    //a new geometry resets the filter, in place processing
+    base::samples::SonarScan scan(20,20,base::Angle::fromDeg(30),base::Angle::fromDeg(1),false);
+    scan.sampling_interval = 0.0001;
+    scan.speed_of_sound = 1500;
+    std::fill(scan.data.begin(),scan.data.end(),100);
+    filter.process(scan,scan);
+    BOOST_CHECK_EQUAL(filter.getPingCount(),1);
+    BOOST_CHECK_EQUAL(scan.data[0],100);
+    for(int ping=0;ping<50;++ping)
+    {
+        std::fill(scan.data.begin(),scan.data.end(),200);
+        filter.process(scan,scan);
+    }
+    BOOST_CHECK(abs(scan.data[0]-200) <= 1);
+    BOOST_CHECK(abs(scan.data[399]-200) <= 1);
+
+    //in place running mean over alternating pings, size which is not a
+    //multiple of the SIMD width
+    config.mode = base::samples::SonarTemporalFilterConfig::MEAN;
+    config.window = 2;
+    filter.setConfig(config);
+    for(int ping=0;ping<10;++ping)
+    {
+        std::fill(scan.data.begin(),scan.data.end(),ping%2 ? 100 : 0);
+        filter.process(scan,scan);
+        BOOST_REQUIRE_EQUAL(scan.data[0],ping ? 50 : 0);
+        BOOST_REQUIRE_EQUAL(scan.data[399],ping ? 50 : 0);
+    }
+
+    config.window = 17;
+    config.mode = base::samples::SonarTemporalFilterConfig::MEAN;
+    BOOST_CHECK_THROW(filter.setConfig(config),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(sonar_scan_resampler)
+{
+    base::samples::SonarScan sonar_scan(30,190,base::Angle::fromDeg(15),base::Angle::fromDeg(1),false);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 1000;   //0.05 m per bin
+    sonar_scan.time_beams.resize(30);
+    for(int beam=0;beam<30;++beam)
+    {
+        sonar_scan.time_beams[beam] = base::Time::fromMicroseconds(beam);
+        for(int bin=0;bin<190;++bin)
+            sonar_scan.data[beam*190+bin] = 2*beam+bin;
+    }
+
+    //every second beam and bin, the last bins are out of range
+    base::samples::SonarScanResamplerConfig config(15,120,base::Angle::fromDeg(14),base::Angle::fromDeg(2),0.1);
+    base::samples::SonarScanResampler resampler(config);
+    base::samples::SonarScan output;
+    resampler.resample(sonar_scan,output);
+    BOOST_CHECK_EQUAL(output.number_of_beams,15);
+    BOOST_CHECK_EQUAL(output.number_of_bins,120);
+    BOOST_CHECK_EQUAL(output.data.size(),15*120);
+    BOOST_CHECK_CLOSE(output.getSpatialResolution(),0.1,1e-6);
+    BOOST_CHECK_CLOSE(output.start_bearing.getDeg(),14,1e-6);
+    BOOST_CHECK_CLOSE(output.angular_resolution.getDeg(),2,1e-6);
+    BOOST_CHECK(output.time_beams[3] == base::Time::fromMicroseconds(7));
+    for(int beam=0;beam<15;++beam)
+    {
+        for(int bin=0;bin<120;++bin)
+        {
+            int expected = bin < 95 ? 2*(1+2*beam)+2*bin : 0;
+            BOOST_REQUIRE_EQUAL(output.data[beam*120+bin],expected);
+        }
+    }
+
+    //interpolation between beams and bins, beams outside of the input
+    config = base::samples::SonarScanResamplerConfig(40,300,base::Angle::fromDeg(20.2),base::Angle::fromDeg(0.5),0.0125);
+    resampler.setConfig(config);
+    resampler.resample(sonar_scan,output);
+    for(int beam=0;beam<40;++beam)
+    {
+        double position = -5.2+beam*0.5;
+        for(int bin=0;bin<300;++bin)
+        {
+            int value = output.data[beam*300+bin];
+            if(position < -0.5 || position > 29.5)
+                BOOST_REQUIRE_EQUAL(value,0);
+            else
+                BOOST_REQUIRE(fabs(value-(2*std::min(std::max(position,0.0),29.0)+bin*0.25)) <= 1);
+        }
+    }
+
+    //the column layout gives the same result
+    base::samples::SonarScan column_scan(sonar_scan);
+    column_scan.toggleMemoryLayout();
+    base::samples::SonarScan column_output;
+    resampler.resample(column_scan,column_output);
+    BOOST_CHECK(column_output.memory_layout_column);
+    column_output.toggleMemoryLayout();
+    BOOST_CHECK(column_output.data == output.data);
+
+    BOOST_CHECK_THROW(resampler.resample(sonar_scan,sonar_scan),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rigid_body_state_interpolator)
+{
+    std::vector<base::samples::RigidBodyState> poses;
+    for(int i=0;i<20;++i)
+    {
+        base::samples::RigidBodyState pose;
+        pose.time = base::Time::fromSeconds(i);
+        pose.position = Eigen::Vector3d(i,2*i,0);
+        pose.orientation = Eigen::Quaterniond(Eigen::AngleAxisd(0.1*i,Eigen::Vector3d::UnitZ()));
+        poses.push_back(pose);
+    }
+    base::samples::RigidBodyStateInterpolator interpolator(poses);
+    Eigen::Affine3d transform;
+    BOOST_CHECK(!interpolator.getTransform(base::Time::fromSeconds(-1),transform));
+    BOOST_CHECK(!interpolator.getTransform(base::Time::fromSeconds(19.5),transform));
+    //forward, backward and far queries
+    const double times[] = {0.5,1.25,1.5,7.75,3.5,19,0};
+    for(int i=0;i<7;++i)
+    {
+        BOOST_REQUIRE(interpolator.getTransform(base::Time::fromSeconds(times[i]),transform));
+        BOOST_CHECK_SMALL((transform.translation()-Eigen::Vector3d(times[i],2*times[i],0)).norm(),1e-9);
+        Eigen::AngleAxisd rotation(transform.linear());
+        BOOST_CHECK_SMALL(rotation.angle()*rotation.axis().z()-0.1*times[i],1e-9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sonar_motion_compensation)
+{
+    //scanning sonar moving towards a wall at x = 10 m with 1 m/s, one beam
+    //every 0.5 s
+    base::samples::SonarScan sonar_scan(21,150,base::Angle::fromDeg(40),base::Angle::fromDeg(4),false);
+    sonar_scan.sampling_interval = 0.0001;
+    sonar_scan.speed_of_sound = 2000;   //0.1 m per bin
+    sonar_scan.reset(0);
+    sonar_scan.time = base::Time::fromSeconds(100);
+    sonar_scan.time_beams.resize(21);
+    for(int beam=0;beam<21;++beam)
+    {
+        double t = beam*0.5;
+        sonar_scan.time_beams[beam] = base::Time::fromSeconds(100+t);
+        double range = (10-t)/cos(base::Angle::deg2Rad(40-4*beam));
+        sonar_scan.data[beam*150+int(range/0.1+0.5)] = 200;
+    }
+    std::vector<base::samples::RigidBodyState> poses;
+    for(int i=0;i<=8;++i)
+    {
+        base::samples::RigidBodyState pose;
+        pose.time = base::Time::fromSeconds(100+i);
+        pose.position = Eigen::Vector3d(i,0,0);
+        pose.orientation = Eigen::Quaterniond::Identity();
+        poses.push_back(pose);
+    }
+
+    base::samples::SonarMotionCompensationConfig config;
+    config.threshold = 100;
+    config.intensity_as_color = true;
+    config.width = 256;
+    config.height = 256;
+    config.pixel_size = 0.1;
+    base::samples::SonarMotionCompensation compensation(config);
+    base::samples::Pointcloud cloud;
+    //the last beams are after the pose history
+    BOOST_CHECK_EQUAL(compensation.compensate(sonar_scan,poses,cloud),17);
+    BOOST_REQUIRE_EQUAL(cloud.points.size(),17);
+    BOOST_REQUIRE_EQUAL(cloud.colors.size(),17);
+    for(size_t i=0;i<cloud.points.size();++i)
+    {
+        BOOST_CHECK_SMALL(cloud.points[i].x()-10,0.1);
+        BOOST_CHECK_SMALL(cloud.points[i].z(),1e-9);
+    }
+
+    //the wall is straight in the frame of the sonar at scan time, up to
+    //the width of the beams
+    base::samples::frame::Frame frame;
+    BOOST_CHECK_EQUAL(compensation.compensate(sonar_scan,poses,frame),17);
+    int wall_pixels = 0;
+    for(int row=0;row<256;++row)
+    {
+        for(int column=0;column<256;++column)
+        {
+            if(frame.image[row*256+column] != 200)
+                continue;
+            ++wall_pixels;
+            BOOST_CHECK(row >= 24 && row <= 32);
+        }
+    }
+    BOOST_CHECK(wall_pixels > 17);
+
+    //without pose at scan time no image is generated
+    sonar_scan.time = base::Time::fromSeconds(50);
+    BOOST_CHECK_EQUAL(compensation.compensate(sonar_scan,poses,frame),0);
+}
+
 BOOST_AUTO_TEST_CASE( time_test )
 {
     std::cout << base::Time::fromSeconds( 35.553 ) << std::endl;
@@ -321,6 +1177,1133 @@ BOOST_AUTO_TEST_CASE(time_fromString)
 
 }
 
+BOOST_AUTO_TEST_CASE( laser_scan_converter )
+{
+    base::samples::LaserScan laser_scan;
+    laser_scan.start_angle = -M_PI*0.75;
+    laser_scan.angular_resolution = M_PI*1.5/1002;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+    srand(3);
+    for(int i=0;i<1003;++i)
+    {
+        int kind = rand()%10;
+        laser_scan.ranges.push_back(kind == 0 ? base::samples::TOO_FAR : kind == 1 ? 50 : kind == 2 ? 40000 : 100+rand()%29901);
+    }
+    laser_scan.ranges[0] = 100;
+    laser_scan.ranges[1] = 30000;
+
+    Eigen::Affine3d transform(Eigen::Translation3d(1,-2,0.5)*Eigen::AngleAxisd(0.3,Eigen::Vector3d(1,2,3).normalized()));
+    base::samples::LaserScanConverter converter;
+    for(int skip=0;skip<2;++skip)
+    {
+        std::vector<Eigen::Vector3d> expected;
+        laser_scan.convertScanToPointCloud(expected,transform,skip);
+
+        std::vector<Eigen::Vector3d> points;
+        BOOST_REQUIRE_EQUAL(converter.convert(laser_scan,points,transform,skip),expected.size());
+        std::vector<float> x,y,z;
+        BOOST_REQUIRE_EQUAL(converter.convert(laser_scan,x,y,z,transform,skip),expected.size());
+        BOOST_REQUIRE_EQUAL(x.size(),expected.size());
+        for(size_t i=0;i<expected.size();++i)
+        {
+            if(base::isNaN(expected[i].x()))
+            {
+                BOOST_CHECK(base::isNaN(points[i].x()) && base::isNaN(points[i].y()) && base::isNaN(points[i].z()));
+                BOOST_CHECK(base::isNaN(x[i]) && base::isNaN(y[i]) && base::isNaN(z[i]));
+                continue;
+            }
+            BOOST_CHECK_SMALL((points[i]-expected[i]).norm(),1e-9);
+            BOOST_CHECK_SMALL((Eigen::Vector3d(x[i],y[i],z[i])-expected[i]).norm(),1e-4);
+        }
+    }
+
+    //a new geometry updates the cached directions
+    laser_scan.ranges.assign(10,1000);
+    laser_scan.start_angle = 0.5;
+    std::vector<Eigen::Vector3d> points;
+    BOOST_CHECK_EQUAL(converter.convert(laser_scan,points),10);
+    BOOST_CHECK_EQUAL(converter.getCosines().size(),10);
+    BOOST_CHECK_SMALL(points[9].x()-cos(0.5+9*laser_scan.angular_resolution),1e-9);
+    BOOST_CHECK_SMALL(points[9].y()-sin(0.5+9*laser_scan.angular_resolution),1e-9);
+}
+
+//looks up poses by linear search and interpolates them with Eigen
+struct PoseHistoryLookup
+{
+    const std::vector<base::samples::RigidBodyState> &poses;
+    PoseHistoryLookup(const std::vector<base::samples::RigidBodyState> &poses) : poses(poses) {}
+    bool get(const base::Time &time, base::samples::RigidBodyState &state, bool) const
+    {
+        for(size_t i=0;i+1<poses.size();++i)
+        {
+            if(time < poses[i].time || poses[i+1].time < time)
+                continue;
+            double ratio = (time-poses[i].time).toSeconds()/(poses[i+1].time-poses[i].time).toSeconds();
+            state.time = time;
+            state.position = poses[i].position+ratio*(poses[i+1].position-poses[i].position);
+            state.orientation = poses[i].orientation.slerp(ratio,poses[i+1].orientation);
+            return true;
+        }
+        return false;
+    }
+};
+
+BOOST_AUTO_TEST_CASE( laser_scan_converter_interpolated )
+{
+    base::samples::LaserScan laser_scan;
+    laser_scan.start_angle = -M_PI*0.75;
+    laser_scan.angular_resolution = M_PI*1.5/720;
+    laser_scan.speed = M_PI*2*40;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+    srand(5);
+    for(int i=0;i<721;++i)
+        laser_scan.ranges.push_back(rand()%8 == 0 ? 50 : 100+rand()%29901);
+
+    //the poses only cover the second half of the scan
+    base::Time start = base::Time::fromSeconds(100);
+    double scan_duration = laser_scan.ranges.size()*laser_scan.angular_resolution/laser_scan.speed;
+    std::vector<base::samples::RigidBodyState> poses;
+    for(int i=0;i<20;++i)
+    {
+        base::samples::RigidBodyState state;
+        state.time = start + base::Time::fromSeconds(scan_duration*(0.4+i*0.05));
+        state.position = Eigen::Vector3d(0.3*i,-0.1*i,0.01*i*i);
+        state.orientation = Eigen::AngleAxisd(0.05*i,Eigen::Vector3d(0.1,0.2,1).normalized())
+            *Eigen::AngleAxisd(0.02*i,Eigen::Vector3d::UnitX());
+        poses.push_back(state);
+    }
+
+    base::samples::LaserScanConverter converter;
+    for(int skip=0;skip<2;++skip)
+    {
+        std::vector<Eigen::Vector3d> expected;
+        laser_scan.convertScanToPointCloudInterpolated(expected,PoseHistoryLookup(poses),start,skip);
+        BOOST_REQUIRE(!expected.empty());
+
+        std::vector<Eigen::Vector3d> points, nlerp_points;
+        BOOST_REQUIRE_EQUAL(converter.convertInterpolated(laser_scan,poses,start,points,skip),expected.size());
+        BOOST_REQUIRE_EQUAL(converter.convertInterpolated(laser_scan,poses,start,nlerp_points,skip,
+                    base::samples::RigidBodyStateInterpolator::NLERP),expected.size());
+        for(size_t i=0;i<expected.size();++i)
+        {
+            if(base::isNaN(expected[i].x()))
+            {
+                BOOST_CHECK(base::isNaN(points[i].x()) && base::isNaN(nlerp_points[i].x()));
+                continue;
+            }
+            BOOST_CHECK_SMALL((points[i]-expected[i]).norm(),1e-9);
+            BOOST_CHECK_SMALL((nlerp_points[i]-expected[i]).norm(),1e-3);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE( compact_laser_scan )
+{
+    base::samples::LaserScan laser_scan;
+    laser_scan.time = base::Time::fromSeconds(10);
+    laser_scan.start_angle = -M_PI*0.5;
+    laser_scan.angular_resolution = M_PI/180;
+    laser_scan.speed = 20;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 120000;
+    srand(7);
+    for(int i=0;i<181;++i)
+    {
+        int kind = rand()%8;
+        laser_scan.ranges.push_back(kind < base::samples::END_LASER_RANGE_ERRORS ? kind : 2*(rand()%60000+base::samples::END_LASER_RANGE_ERRORS));
+        laser_scan.remission.push_back((rand()%256)*0.5f);
+    }
+
+    for(int scale=1;scale<=2;++scale)
+    {
+        base::samples::CompactLaserScan compact;
+        //ranges above 65535mm are clamped with a scale of 1
+        BOOST_CHECK_EQUAL(compact.compress(laser_scan,scale,base::samples::CompactLaserScan::REMISSION_UINT8,0.5f),scale == 2);
+        BOOST_CHECK_EQUAL(compact.ranges.size(),181);
+        BOOST_CHECK_EQUAL(compact.remission8.size(),181);
+        BOOST_CHECK(compact.remission16.empty());
+        base::samples::LaserScan restored;
+        compact.decompress(restored);
+        BOOST_CHECK_EQUAL(restored.time,laser_scan.time);
+        BOOST_CHECK_EQUAL(restored.start_angle,laser_scan.start_angle);
+        BOOST_CHECK_EQUAL(restored.maxRange,laser_scan.maxRange);
+        if(scale == 1)
+            continue;
+        BOOST_CHECK_EQUAL_COLLECTIONS(restored.ranges.begin(),restored.ranges.end(),laser_scan.ranges.begin(),laser_scan.ranges.end());
+        BOOST_CHECK_EQUAL_COLLECTIONS(restored.remission.begin(),restored.remission.end(),laser_scan.remission.begin(),laser_scan.remission.end());
+    }
+
+    //a scale which is not a power of two
+    for(size_t i=0;i<laser_scan.ranges.size();++i)
+        if(laser_scan.ranges[i] >= base::samples::END_LASER_RANGE_ERRORS)
+            laser_scan.ranges[i] = 3*(laser_scan.ranges[i]/4);
+    base::samples::CompactLaserScan compact(laser_scan,3,base::samples::CompactLaserScan::REMISSION_UINT16,0.5f);
+    base::samples::LaserScan restored;
+    compact.decompress(restored);
+    BOOST_CHECK_EQUAL_COLLECTIONS(restored.ranges.begin(),restored.ranges.end(),laser_scan.ranges.begin(),laser_scan.ranges.end());
+    BOOST_CHECK_EQUAL_COLLECTIONS(restored.remission.begin(),restored.remission.end(),laser_scan.remission.begin(),laser_scan.remission.end());
+
+    //lossy conversions are reported and keep the error codes
+    laser_scan.ranges[3] = 1001;
+    laser_scan.ranges[4] = base::samples::MEASUREMENT_ERROR;
+    laser_scan.remission[5] = 0.3f;
+    BOOST_CHECK(!compact.compress(laser_scan,2));
+    compact.decompress(restored);
+    BOOST_CHECK_EQUAL(restored.ranges[4],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK(abs(int(restored.ranges[3])-1001) <= 1);
+    BOOST_CHECK_EQUAL(restored.remission[5],0);
+    BOOST_CHECK(!compact.compress(laser_scan,1,base::samples::CompactLaserScan::REMISSION_NONE));
+    compact.decompress(restored);
+    BOOST_CHECK(restored.remission.empty());
+
+    //ties are rounded up in the SIMD part and in the tail
+    laser_scan.remission[0] = 2.5f;
+    laser_scan.remission[180] = 2.5f;
+    compact.compress(laser_scan,2,base::samples::CompactLaserScan::REMISSION_UINT8,1.0f);
+    BOOST_CHECK_EQUAL(compact.remission8[0],3);
+    BOOST_CHECK_EQUAL(compact.remission8[180],3);
+    compact.compress(laser_scan,2,base::samples::CompactLaserScan::REMISSION_UINT16,1.0f);
+    BOOST_CHECK_EQUAL(compact.remission16[0],3);
+    BOOST_CHECK_EQUAL(compact.remission16[180],3);
+}
+
+BOOST_AUTO_TEST_CASE( laser_scan_filter )
+{
+    base::samples::LaserScan laser_scan;
+    laser_scan.angular_resolution = M_PI/720;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+
+    //median filter against a sorted window
+    srand(11);
+    for(int i=0;i<203;++i)
+        laser_scan.ranges.push_back(rand()%10 == 0 ? base::samples::TOO_FAR : 1000+rand()%1000);
+    for(int window=3;window<=5;window+=2)
+    {
+        base::samples::LaserScanFilterConfig config;
+        config.median_window = window;
+        base::samples::LaserScanFilter filter(config);
+        base::samples::LaserScan filtered = laser_scan;
+        BOOST_CHECK_EQUAL(filter.process(filtered),0);
+        int half = window/2;
+        for(int i=0;i<203;++i)
+        {
+            std::vector<uint32_t> values;
+            for(int k=i-half;k<=i+half;++k)
+                if(k >= 0 && k < 203 && laser_scan.isRangeValid(laser_scan.ranges[k]))
+                    values.push_back(laser_scan.ranges[k]);
+            if(int(values.size()) != window)
+            {
+                BOOST_CHECK_EQUAL(filtered.ranges[i],laser_scan.ranges[i]);
+                continue;
+            }
+            std::sort(values.begin(),values.end());
+            BOOST_CHECK_EQUAL(filtered.ranges[i],values[half]);
+        }
+    }
+    base::samples::LaserScanFilterConfig invalid;
+    invalid.median_window = 4;
+    BOOST_CHECK_THROW(base::samples::LaserScanFilter filter(invalid),std::runtime_error);
+
+    //a near wall and a far wall with two mixed pixels in between, one
+    //isolated beam and one beam with a low remission
+    laser_scan.ranges.assign(100,2000);
+    laser_scan.remission.assign(100,100);
+    for(int i=50;i<100;++i)
+        laser_scan.ranges[i] = 5000;
+    laser_scan.ranges[50] = 3000;
+    laser_scan.ranges[51] = 4000;
+    laser_scan.ranges[80] = 1000;
+    laser_scan.ranges[90] = base::samples::TOO_NEAR;
+    laser_scan.remission[20] = 5;
+    laser_scan.remission[90] = 5;
+
+    base::samples::LaserScanFilterConfig config;
+    config.min_remission = 10;
+    config.shadow_min_angle = 10*M_PI/180;
+    config.shadow_window = 1;
+    base::samples::LaserScanFilter filter(config);
+    base::samples::LaserScan filtered = laser_scan;
+    //beam 52 is the first point of the far wall and sees the mixed pixel
+    //in front of it at a grazing angle as well. The isolated beam 80 makes
+    //its farther neighbours shadow points
+    BOOST_CHECK_EQUAL(filter.process(filtered),6);
+    BOOST_CHECK_EQUAL(filtered.ranges[20],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK_EQUAL(filtered.ranges[50],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK_EQUAL(filtered.ranges[51],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK_EQUAL(filtered.ranges[52],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK_EQUAL(filtered.ranges[79],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK_EQUAL(filtered.ranges[81],base::samples::MEASUREMENT_ERROR);
+    BOOST_CHECK_EQUAL(filtered.ranges[90],base::samples::TOO_NEAR);
+    BOOST_CHECK_EQUAL(filtered.ranges[49],2000);
+    BOOST_CHECK_EQUAL(filtered.ranges[53],5000);
+    BOOST_CHECK_EQUAL(filtered.ranges[80],1000);
+
+    //a second filter removes the isolated beam
+    base::samples::LaserScanFilterConfig outlier_config;
+    outlier_config.outlier_distance = 300;
+    outlier_config.outlier_window = 2;
+    outlier_config.outlier_min_neighbors = 1;
+    filter.setConfig(outlier_config);
+    BOOST_CHECK_EQUAL(filter.process(filtered),1);
+    BOOST_CHECK_EQUAL(filtered.ranges[80],base::samples::OTHER_RANGE_ERRORS);
+    BOOST_CHECK_EQUAL(filtered.ranges[53],5000);
+}
+
+BOOST_AUTO_TEST_CASE( multi_layer_laser_scan )
+{
+    std::vector<double> elevations;
+    for(int i=0;i<15;++i)
+        elevations.push_back((-15+2*i)*M_PI/180);
+    base::samples::MultiLayerLaserScan scan;
+    scan.init(elevations,101,-M_PI,2*M_PI/100);
+    scan.minRange = 500;
+    scan.maxRange = 100000;
+    BOOST_CHECK_EQUAL(scan.getRingCount(),15);
+    BOOST_CHECK_EQUAL(scan.getColumnCount(),101);
+    BOOST_REQUIRE_EQUAL(scan.ranges.size(),15*101);
+    BOOST_CHECK(!scan.isValidPoint(3,7));
+    BOOST_CHECK_THROW(scan.isValidPoint(15,0),std::out_of_range);
+
+    srand(13);
+    for(size_t i=0;i<scan.ranges.size();++i)
+    {
+        int kind = rand()%10;
+        scan.ranges[i] = kind == 0 ? base::samples::TOO_FAR : kind == 1 ? 100 : 500+rand()%99501;
+    }
+    scan.time = base::Time::fromSeconds(5);
+    scan.time_offsets.resize(scan.ranges.size(),0);
+    scan.time_offsets[scan.getIndex(4,10)] = 250;
+    BOOST_CHECK_EQUAL(scan.getPointTime(4,10),base::Time::fromSeconds(5)+base::Time::fromMicroseconds(250));
+
+    Eigen::Vector3d point;
+    scan.ranges[scan.getIndex(2,25)] = 10000;
+    BOOST_REQUIRE(scan.getPoint(2,25,point));
+    BOOST_CHECK_SMALL((point-Eigen::Vector3d(0,-10*cos(elevations[2]),10*sin(elevations[2]))).norm(),1e-9);
+
+    Eigen::Affine3d transform(Eigen::Translation3d(1,-2,0.5)*Eigen::AngleAxisd(0.3,Eigen::Vector3d(1,2,3).normalized()));
+    base::samples::MultiLayerLaserScanConverter converter;
+    for(int skip=0;skip<2;++skip)
+    {
+        std::vector<Eigen::Vector3d> expected;
+        for(uint32_t column=0;column<scan.getColumnCount();++column)
+        {
+            for(uint32_t ring=0;ring<scan.getRingCount();++ring)
+            {
+                if(scan.getPoint(ring,column,point))
+                    expected.push_back(transform*point);
+                else if(!skip)
+                    expected.push_back(Eigen::Vector3d::Constant(base::NaN<double>()));
+            }
+        }
+        base::samples::Pointcloud cloud;
+        BOOST_REQUIRE_EQUAL(converter.convert(scan,cloud,transform,skip),expected.size());
+        BOOST_REQUIRE_EQUAL(cloud.points.size(),expected.size());
+        std::vector<float> x,y,z;
+        BOOST_REQUIRE_EQUAL(converter.convert(scan,x,y,z,transform,skip),expected.size());
+        for(size_t i=0;i<expected.size();++i)
+        {
+            if(base::isNaN(expected[i].x()))
+            {
+                BOOST_CHECK(base::isNaN(cloud.points[i].x()) && base::isNaN(x[i]));
+                continue;
+            }
+            BOOST_CHECK_SMALL((cloud.points[i]-expected[i]).norm(),1e-9);
+            BOOST_CHECK_SMALL((Eigen::Vector3d(x[i],y[i],z[i])-expected[i]).norm(),1e-3);
+        }
+    }
+
+    scan.ranges.pop_back();
+    base::samples::Pointcloud cloud;
+    BOOST_CHECK_THROW(converter.convert(scan,cloud),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( occupancy_grid )
+{
+    //a scanner in the middle of a square room of about 10x10m
+    base::samples::LaserScan laser_scan;
+    laser_scan.start_angle = -M_PI;
+    laser_scan.angular_resolution = 2*M_PI/1440;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+    for(int i=0;i<1440;++i)
+    {
+        double angle = laser_scan.start_angle+i*laser_scan.angular_resolution;
+        double range = 5.04/std::max(fabs(cos(angle)),fabs(sin(angle)));
+        laser_scan.ranges.push_back(uint32_t(range*1000));
+    }
+    laser_scan.ranges[0] = base::samples::TOO_FAR;
+
+    base::samples::OccupancyGridConfig config;
+    config.cell_size = 0.1;
+    config.tile_size = 16;
+    config.width = 12;
+    config.height = 12;
+    base::samples::OccupancyGrid grid(config);
+    Eigen::Affine3d pose(Eigen::Translation3d(0.05,0.05,1));
+    grid.integrate(laser_scan,pose);
+
+    //every cell is updated at most once per scan
+    BOOST_CHECK_EQUAL(grid.getLogOdds(0.05,0.05),config.miss_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(2.55,0.05),config.miss_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(-3.05,2.05),config.miss_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(5.05,1.05),config.hit_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(-1.05,-4.95),config.hit_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(6.05,0.05),0);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(100,100),0);
+    int free_cells = 0;
+    for(int x=-48;x<48;++x)
+        for(int y=-48;y<48;++y)
+        {
+            int16_t value = grid.getLogOdds(x*0.1+0.05,y*0.1+0.05);
+            BOOST_REQUIRE(value == 0 || value == config.miss_log_odds || value == config.hit_log_odds);
+            free_cells += value == config.miss_log_odds;
+        }
+    BOOST_CHECK(free_cells > 9000);
+
+    //the log-odds are clamped
+    for(int i=0;i<10;++i)
+        grid.integrate(laser_scan,pose);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(2.55,0.05),config.min_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(5.05,1.05),config.max_log_odds);
+    BOOST_CHECK(grid.getProbability(5.05,1.05) > 0.96);
+    BOOST_CHECK(grid.getProbability(2.55,0.05) < 0.13);
+
+    //moving the window keeps the tiles which stay inside
+    double min_x,min_y,max_x,max_y;
+    grid.moveTo(10,0);
+    grid.getBounds(min_x,min_y,max_x,max_y);
+    BOOST_CHECK_SMALL(min_x,1e-9);
+    BOOST_CHECK_CLOSE(max_x,19.2,1e-6);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(2.55,0.05),config.min_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(-4.05,0.05),0);
+    grid.moveTo(0,0);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(-4.05,0.05),0);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(2.55,0.05),config.min_log_odds);
+
+    //the window follows the sensor
+    pose.translation() = Eigen::Vector3d(40,0,1);
+    grid.integrate(laser_scan,pose);
+    grid.getBounds(min_x,min_y,max_x,max_y);
+    BOOST_CHECK(min_x < 35 && max_x > 45);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(42.55,0.05),config.miss_log_odds);
+    BOOST_CHECK_EQUAL(grid.getLogOdds(2.55,0.05),0);
+
+    config.tile_size = 20;
+    BOOST_CHECK_THROW(base::samples::OccupancyGrid invalid(config),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( laser_scan_line_extractor )
+{
+    //a scanner in a room from -3.5 to 3.5 in x and -1.7 to 2.8 in y
+    base::samples::LaserScan laser_scan;
+    laser_scan.start_angle = -M_PI;
+    laser_scan.angular_resolution = 2*M_PI/720;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+    srand(17);
+    for(int i=0;i<720;++i)
+    {
+        double angle = laser_scan.start_angle+i*laser_scan.angular_resolution;
+        double c = cos(angle), s = sin(angle);
+        double range = std::min(c > 0 ? 3.5/c : c < 0 ? -3.5/c : 1e9, s > 0 ? 2.8/s : s < 0 ? -1.7/s : 1e9);
+        range += (rand()%5-2)*0.001;
+        laser_scan.ranges.push_back(uint32_t(range*1000));
+    }
+    //invalid beams do not split a wall
+    laser_scan.ranges[100] = base::samples::TOO_FAR;
+
+    base::samples::LaserScanLineExtractor extractor;
+    std::vector<base::samples::LaserLineSegment> segments;
+    //the walls in the order of the beams: -x, -y, +x, +y and -x again,
+    //as the scan starts in the middle of the -x wall
+    BOOST_REQUIRE_EQUAL(extractor.extract(laser_scan,segments),5);
+    double alphas[] = {M_PI, -M_PI/2, 0, M_PI/2, M_PI};
+    double distances[] = {3.5, 1.7, 3.5, 2.8, 3.5};
+    for(int i=0;i<5;++i)
+    {
+        const base::samples::LaserLineSegment &segment = segments[i];
+        double alpha_error = fabs(remainder(segment.alpha-alphas[i],2*M_PI));
+        BOOST_CHECK_SMALL(alpha_error,0.01);
+        BOOST_CHECK_SMALL(segment.distance-distances[i],0.01);
+        BOOST_CHECK(segment.rms < 0.005);
+        BOOST_CHECK(segment.point_count > 50);
+        BOOST_CHECK(segment.line_covariance(0,0) > 0 && segment.line_covariance.determinant() > 0);
+        BOOST_CHECK(segment.start_covariance.determinant() > 0);
+        BOOST_CHECK(segment.end_covariance.determinant() > 0);
+        //the end points lie on the line
+        BOOST_CHECK_SMALL(segment.start.x()*cos(segment.alpha)+segment.start.y()*sin(segment.alpha)-segment.distance,1e-9);
+        BOOST_CHECK_SMALL(segment.end.x()*cos(segment.alpha)+segment.end.y()*sin(segment.alpha)-segment.distance,1e-9);
+        //the uncertainty across the line grows with the distance from its center
+        BOOST_CHECK(segment.line_covariance(1,1) < segment.start_covariance.trace());
+    }
+    BOOST_CHECK(segments[0].first_beam <= 1);
+    BOOST_CHECK(segments[4].last_beam >= 718);
+    //the corner between the -y and +x wall is at (3.5,-1.7) in the sensor frame
+    BOOST_CHECK((segments[1].end-base::Vector2d(3.5,-1.7)).norm() < 0.1);
+    BOOST_CHECK((segments[2].start-base::Vector2d(3.5,-1.7)).norm() < 0.1);
+
+    //a gap splits a wall into two segments
+    for(int i=375;i<385;++i)
+        laser_scan.ranges[i] = 1000;
+    BOOST_CHECK_EQUAL(extractor.extract(laser_scan,segments),6);
+
+    //invalid beams which leave a gap larger than max_gap split a straight
+    //wall at x=2, the gap is 0.42 from y=-0.22 to y=0.2
+    base::samples::LaserScan wall_scan;
+    wall_scan.start_angle = -0.6;
+    wall_scan.angular_resolution = 0.01;
+    wall_scan.minRange = 100;
+    wall_scan.maxRange = 30000;
+    for(int i=0;i<=120;++i)
+        wall_scan.ranges.push_back(uint32_t(2000/cos(wall_scan.start_angle+i*wall_scan.angular_resolution)));
+    for(int i=50;i<70;++i)
+        wall_scan.ranges[i] = base::samples::TOO_FAR;
+    BOOST_REQUIRE_EQUAL(extractor.extract(wall_scan,segments),2);
+    BOOST_CHECK_EQUAL(segments[0].first_beam,0);
+    BOOST_CHECK_EQUAL(segments[0].last_beam,49);
+    BOOST_CHECK_EQUAL(segments[1].first_beam,70);
+    BOOST_CHECK_EQUAL(segments[1].last_beam,120);
+    BOOST_CHECK_SMALL(segments[0].end.y()+0.221,0.005);
+    BOOST_CHECK_SMALL(segments[1].start.y()-0.201,0.005);
+}
+
+//simulates a scan in a room from -3.5 to 3.5 in x and -1.7 to 2.8 in y
+//with a box from 1 to 1.6 in x and 0.5 to 1.2 in y
+static void simulateRoomScan(double x, double y, double yaw, base::samples::LaserScan &laser_scan)
+{
+    const double walls[][4] = {{-3.5,-1.7,3.5,-1.7},{3.5,-1.7,3.5,2.8},{3.5,2.8,-3.5,2.8},{-3.5,2.8,-3.5,-1.7},
+        {1,0.5,1.6,0.5},{1.6,0.5,1.6,1.2},{1.6,1.2,1,1.2},{1,1.2,1,0.5}};
+    laser_scan.reset();
+    laser_scan.start_angle = -M_PI;
+    laser_scan.angular_resolution = 2*M_PI/720;
+    laser_scan.minRange = 100;
+    laser_scan.maxRange = 30000;
+    for(int i=0;i<720;++i)
+    {
+        double angle = yaw+laser_scan.start_angle+i*laser_scan.angular_resolution;
+        double dx = cos(angle), dy = sin(angle);
+        double range = 1e9;
+        for(int j=0;j<8;++j)
+        {
+            double ex = walls[j][2]-walls[j][0], ey = walls[j][3]-walls[j][1];
+            double det = ex*dy-ey*dx;
+            if(fabs(det) < 1e-12)
+                continue;
+            double wx = walls[j][0]-x, wy = walls[j][1]-y;
+            double t = (ex*wy-ey*wx)/det;
+            double u = (dx*wy-dy*wx)/det;
+            if(t > 0 && u >= 0 && u <= 1)
+                range = std::min(range,t);
+        }
+        laser_scan.ranges.push_back(uint32_t(range*1000));
+    }
+}
+
+BOOST_AUTO_TEST_CASE( laser_scan_matcher )
+{
+    base::samples::LaserScan reference, scan;
+    simulateRoomScan(0,0,0,reference);
+    simulateRoomScan(0.23,-0.17,0.12,scan);
+
+    base::samples::LaserScanMatcher matcher;
+    base::Pose2D result;
+    //no reference
+    BOOST_CHECK(matcher.match(scan,base::Pose2D(),result) < 0);
+
+    matcher.setReference(reference);
+    double score = matcher.match(scan,base::Pose2D(),result);
+    BOOST_CHECK(score > 0.75);
+    BOOST_CHECK_SMALL(result.position.x()-0.23,0.051);
+    BOOST_CHECK_SMALL(result.position.y()+0.17,0.051);
+    BOOST_CHECK_SMALL(result.orientation-0.12,0.01);
+
+    //the same result from another guess inside the search window
+    base::Pose2D result2;
+    BOOST_CHECK_EQUAL(matcher.match(scan,base::Pose2D(base::Vector2d(0.1,0.1),0.05),result2) > 0.75,true);
+    BOOST_CHECK_SMALL(result2.position.x()-0.23,0.051);
+    BOOST_CHECK_SMALL(result2.position.y()+0.17,0.051);
+    BOOST_CHECK_SMALL(result2.orientation-0.12,0.01);
+
+    //the match is the best pose of an exhaustive search
+    base::samples::LaserScanMatcherConfig config;
+    config.levels = 1;
+    base::samples::LaserScanMatcher exhaustive(config);
+    exhaustive.setReference(reference);
+    base::Pose2D result3;
+    BOOST_CHECK_CLOSE(exhaustive.match(scan,base::Pose2D(),result3),score,1e-9);
+
+    //the true pose is outside of a small search window
+    config.levels = 5;
+    config.search_x = 0.1;
+    config.search_y = 0.1;
+    config.search_yaw = 0.05;
+    config.min_score = 0.8;
+    matcher.setConfig(config);
+    matcher.setReference(reference);
+    BOOST_CHECK(matcher.match(scan,base::Pose2D(),result) < 0);
+
+    config.resolution = 0;
+    BOOST_CHECK_THROW(matcher.setConfig(config),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( laser_scan_fusion )
+{
+    //two scanners with 270 degrees at the front left and back right corners
+    Eigen::Affine3d front(Eigen::Translation3d(0.3,0.2,0.1)*Eigen::AngleAxisd(M_PI/4,Eigen::Vector3d::UnitZ()));
+    Eigen::Affine3d back(Eigen::Translation3d(-0.3,-0.2,0.1)*Eigen::AngleAxisd(-M_PI*0.75,Eigen::Vector3d::UnitZ()));
+    std::vector<base::samples::LaserScan> scans(2);
+    srand(11);
+    for(int s=0;s<2;++s)
+    {
+        scans[s].time = base::Time::fromSeconds(10+s*0.01);
+        scans[s].start_angle = -M_PI*0.75;
+        scans[s].angular_resolution = M_PI*1.5/1080;
+        scans[s].speed = M_PI*2*40;
+        scans[s].minRange = 50;
+        scans[s].maxRange = 20000;
+        for(int i=0;i<1081;++i)
+        {
+            scans[s].ranges.push_back(rand()%10 == 0 ? base::samples::TOO_FAR : 50+rand()%19951);
+            scans[s].remission.push_back(i+s*10000);
+        }
+    }
+
+    base::samples::LaserScanFusion fusion;
+    BOOST_CHECK_EQUAL(fusion.addSensor(front),0);
+    BOOST_CHECK_EQUAL(fusion.addSensor(back),1);
+    BOOST_CHECK_EQUAL(fusion.getBinCount(),720);
+
+    //closest point of each bin
+    std::vector<double> expected(720,1e9);
+    std::vector<float> expected_remission(720);
+    for(int s=0;s<2;++s)
+    {
+        std::vector<Eigen::Vector3d> points;
+        scans[s].convertScanToPointCloud(points,s ? back : front,false);
+        for(size_t i=0;i<points.size();++i)
+        {
+            if(base::isNaN(points[i].x()))
+                continue;
+            size_t bin = fusion.getBin(atan2(points[i].y(),points[i].x()));
+            double range = points[i].head<2>().norm()*1000;
+            if(range < expected[bin])
+            {
+                expected[bin] = range;
+                expected_remission[bin] = scans[s].remission[i];
+            }
+        }
+    }
+
+    base::samples::LaserScan result;
+    size_t valid = fusion.fuse(scans,result);
+    BOOST_CHECK_EQUAL(result.ranges.size(),720);
+    BOOST_CHECK_EQUAL(result.remission.size(),720);
+    BOOST_CHECK_EQUAL(result.time,scans[1].time);
+    BOOST_CHECK_CLOSE(result.start_angle,-M_PI,1e-9);
+    size_t expected_valid = 0;
+    for(size_t i=0;i<720;++i)
+    {
+        if(expected[i] == 1e9)
+        {
+            BOOST_CHECK(result.ranges[i] == base::samples::TOO_FAR || result.ranges[i] == base::samples::OTHER_RANGE_ERRORS);
+            continue;
+        }
+        ++expected_valid;
+        BOOST_CHECK(result.isRangeValid(result.ranges[i]));
+        BOOST_CHECK_SMALL(result.ranges[i]-expected[i],0.51);
+        BOOST_CHECK_EQUAL(result.remission[i],expected_remission[i]);
+    }
+    BOOST_CHECK_EQUAL(valid,expected_valid);
+    BOOST_CHECK(valid > 600);
+
+    //the table is reused, the result does not change
+    base::samples::LaserScan result2;
+    fusion.fuse(scans,result2);
+    BOOST_CHECK(result2.ranges == result.ranges);
+
+    //a beam which is too far marks its bin
+    for(int s=0;s<2;++s)
+        for(size_t i=0;i<scans[s].ranges.size();++i)
+            scans[s].ranges[i] = base::samples::TOO_FAR;
+    BOOST_CHECK_EQUAL(fusion.fuse(scans,result2),0);
+    BOOST_CHECK_EQUAL(std::count(result2.ranges.begin(),result2.ranges.end(),uint32_t(base::samples::TOO_FAR)),720);
+
+    //the body stands still, so the interpolated result is the same
+    std::vector<base::samples::RigidBodyState> poses(2);
+    poses[0].time = base::Time::fromSeconds(9);
+    poses[1].time = base::Time::fromSeconds(11);
+    for(int i=0;i<2;++i)
+    {
+        poses[i].position = Eigen::Vector3d(5,-2,0);
+        poses[i].orientation = Eigen::AngleAxisd(0.3,Eigen::Vector3d::UnitZ());
+    }
+    std::vector<base::samples::LaserScan> restored(2);
+    srand(11);
+    for(int s=0;s<2;++s)
+    {
+        restored[s] = scans[s];
+        for(size_t i=0;i<restored[s].ranges.size();++i)
+            restored[s].ranges[i] = rand()%10 == 0 ? base::samples::TOO_FAR : 50+rand()%19951;
+    }
+    BOOST_CHECK_EQUAL(fusion.fuseInterpolated(restored,poses,base::Time::fromSeconds(10),result2),valid);
+    for(size_t i=0;i<720;++i)
+        BOOST_CHECK_SMALL(double(result2.ranges[i])-double(result.ranges[i]),1.01);
+    BOOST_CHECK_EQUAL(result2.time,base::Time::fromSeconds(10));
+
+    //the body moves along x: the points are compensated into the body frame at 10.1 s
+    poses[1].position = Eigen::Vector3d(25,-2,0);
+    fusion.fuseInterpolated(restored,poses,base::Time::fromSeconds(10.1),result2);
+    std::fill(expected.begin(),expected.end(),1e9);
+    for(int s=0;s<2;++s)
+    {
+        const base::samples::LaserScan &scan = restored[s];
+        std::vector<Eigen::Vector3d> points;
+        scan.convertScanToPointCloud(points,s ? back : front,false);
+        for(size_t i=0;i<points.size();++i)
+        {
+            if(base::isNaN(points[i].x()))
+                continue;
+            double time = scan.time.toSeconds()+(scan.start_angle/scan.angular_resolution+i)*scan.angular_resolution/scan.speed;
+            Eigen::Vector3d offset = poses[0].orientation.conjugate()*Eigen::Vector3d(10*(time-10.1),0,0);
+            Eigen::Vector3d point = points[i]+offset;
+            size_t bin = fusion.getBin(atan2(point.y(),point.x()));
+            expected[bin] = std::min(expected[bin],point.head<2>().norm()*1000);
+        }
+    }
+    for(size_t i=0;i<720;++i)
+        if(expected[i] != 1e9)
+            BOOST_CHECK_SMALL(result2.ranges[i]-expected[i],0.51);
+
+    BOOST_CHECK_THROW(fusion.fuse(std::vector<base::samples::LaserScan>(1),result),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( distance_image_converter )
+{
+    base::samples::DistanceImage image;
+    image.time = base::Time::fromSeconds(20);
+    image.setIntrinsic(525,530,18.5,11);
+    image.setSize(37,23);
+    srand(3);
+    const float special[] = {std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::infinity(),
+        0.0f, std::numeric_limits<float>::denorm_min(), -2.5f};
+    for(size_t i=0;i<image.data.size();++i)
+        image.data[i] = rand()%4 ? 0.5f+rand()%1000*0.01f : special[rand()%5];
+    //a row without any valid pixel
+    for(int x=0;x<37;++x)
+        image.data[5*37+x] = std::numeric_limits<float>::quiet_NaN();
+
+    base::samples::Pointcloud expected = image.getPointCloud();
+    BOOST_CHECK_EQUAL(expected.time,image.time);
+    base::samples::DistanceImageConverter converter;
+    base::samples::Pointcloud cloud;
+    for(int run=0;run<2;++run)
+    {
+        BOOST_REQUIRE_EQUAL(converter.convert(image,cloud),expected.points.size());
+        BOOST_CHECK_EQUAL(cloud.time,image.time);
+        for(size_t i=0;i<expected.points.size();++i)
+            BOOST_CHECK_SMALL((cloud.points[i]-expected.points[i]).norm(),1e-6);
+    }
+
+    //organized cloud with NaN points
+    BOOST_REQUIRE_EQUAL(converter.convert(image,cloud,false),image.data.size());
+    size_t valid = 0;
+    for(size_t y=0;y<23;++y)
+    {
+        for(size_t x=0;x<37;++x)
+        {
+            Eigen::Vector3d point;
+            const base::Point &converted = cloud.points[y*37+x];
+            if(image.getScenePoint(x,y,point))
+            {
+                BOOST_CHECK_SMALL((converted-point).norm(),1e-6);
+                ++valid;
+            }
+            else
+                BOOST_CHECK(base::isNaN(converted.x()) && base::isNaN(converted.y()) && base::isNaN(converted.z()));
+        }
+    }
+    BOOST_CHECK_EQUAL(valid,expected.points.size());
+
+    //float structure of arrays
+    std::vector<float> x,y,z;
+    BOOST_REQUIRE_EQUAL(converter.convert(image,x,y,z),expected.points.size());
+    for(size_t i=0;i<expected.points.size();++i)
+        BOOST_CHECK_SMALL((Eigen::Vector3d(x[i],y[i],z[i])-expected.points[i]).norm(),1e-5);
+
+    //the ray table follows the intrinsics
+    image.setIntrinsic(300,300,18,11);
+    converter.convert(image,cloud);
+    expected = image.getPointCloud();
+    BOOST_REQUIRE_EQUAL(cloud.points.size(),expected.points.size());
+    for(size_t i=0;i<expected.points.size();++i)
+        BOOST_CHECK_SMALL((cloud.points[i]-expected.points[i]).norm(),1e-6);
+
+    image.data.pop_back();
+    BOOST_CHECK_THROW(converter.convert(image,cloud),std::runtime_error);
+}
+
+struct IntensityKernel
+{
+    IntensityKernel() : count(0), sum(0) {}
+    size_t count;
+    double sum;
+    void operator()(base::samples::CompactPointcloud::Block block)
+    {
+        BOOST_REQUIRE(block.intensity && block.rings && !block.colors && !block.normal_x);
+        BOOST_CHECK_EQUAL(block.begin,count);
+        for(size_t i=0;i<block.size;++i)
+            block.intensity[i] = block.x[i]+block.rings[i];
+        count += block.size;
+    }
+    void operator()(base::samples::CompactPointcloud::ConstBlock block)
+    {
+        for(size_t i=0;i<block.size;++i)
+            sum += block.intensity[i];
+        count += block.size;
+    }
+};
+
+BOOST_AUTO_TEST_CASE( compact_pointcloud )
+{
+    base::samples::Pointcloud cloud;
+    cloud.time = base::Time::fromSeconds(30);
+    srand(8);
+    for(int i=0;i<1003;++i)
+    {
+        cloud.points.push_back(base::Point(rand()%2001*0.01-10,rand()%2001*0.01-10,rand()%401*0.01-2));
+        cloud.colors.push_back(base::Vector4d(rand()%256/255.0,rand()%256/255.0,rand()%256/255.0,1));
+    }
+    cloud.colors[0] = base::Vector4d(-0.5,1.5,0.5,0);
+
+    base::samples::CompactPointcloud compact;
+    compact.fromPointcloud(cloud);
+    BOOST_CHECK_EQUAL(compact.time,cloud.time);
+    BOOST_REQUIRE_EQUAL(compact.size(),1003);
+    BOOST_CHECK_EQUAL(compact.getChannels(),uint32_t(base::samples::CompactPointcloud::COLOR));
+    //out of range colors are clamped, red is the lowest byte
+    BOOST_CHECK_EQUAL(compact.colors[0],0x0080FF00u);
+    //NaN components become 0
+    BOOST_CHECK_EQUAL(base::samples::detail::packColor(base::Vector4d(base::NaN<double>(),1,0.5,base::NaN<double>())),0x0080FF00u);
+
+    base::samples::Pointcloud restored;
+    compact.toPointcloud(restored);
+    BOOST_CHECK_EQUAL(restored.time,cloud.time);
+    BOOST_REQUIRE_EQUAL(restored.points.size(),cloud.points.size());
+    BOOST_REQUIRE_EQUAL(restored.colors.size(),cloud.colors.size());
+    for(size_t i=0;i<cloud.points.size();++i)
+    {
+        BOOST_CHECK_EQUAL(restored.points[i],cloud.points[i].cast<float>().cast<double>());
+        if(i)
+            BOOST_CHECK_SMALL((restored.colors[i]-cloud.colors[i]).norm(),1e-9);
+    }
+
+    //transformation of points and normals
+    compact.setChannels(base::samples::CompactPointcloud::COLOR | base::samples::CompactPointcloud::NORMAL);
+    BOOST_CHECK_EQUAL(compact.normal_z.size(),1003);
+    std::fill(compact.normal_z.begin(),compact.normal_z.end(),1.0f);
+    Eigen::Affine3d transform(Eigen::Translation3d(1,-2,3)*Eigen::AngleAxisd(0.4,Eigen::Vector3d(1,2,3).normalized()));
+    compact.transform(transform);
+    const Eigen::Vector3d normal = transform.linear()*Eigen::Vector3d::UnitZ();
+    for(size_t i=0;i<cloud.points.size();++i)
+    {
+        BOOST_CHECK_SMALL((compact.getPoint(i).cast<double>()-transform*cloud.points[i]).norm(),1e-4);
+        BOOST_CHECK_SMALL((Eigen::Vector3d(compact.normal_x[i],compact.normal_y[i],compact.normal_z[i])-normal).norm(),1e-6);
+    }
+
+    Eigen::Vector3f min, max;
+    BOOST_REQUIRE(compact.getBounds(min,max));
+    Eigen::Vector3f expected_min = compact.getPoint(0), expected_max = expected_min;
+    for(size_t i=1;i<compact.size();++i)
+    {
+        expected_min = expected_min.cwiseMin(compact.getPoint(i));
+        expected_max = expected_max.cwiseMax(compact.getPoint(i));
+    }
+    BOOST_CHECK_EQUAL(min,expected_min);
+    BOOST_CHECK_EQUAL(max,expected_max);
+
+    //channels follow the points
+    compact.setChannels(base::samples::CompactPointcloud::INTENSITY | base::samples::CompactPointcloud::RING);
+    BOOST_CHECK(compact.colors.empty() && compact.normal_x.empty());
+    for(size_t i=0;i<compact.size();++i)
+    {
+        compact.intensity[i] = i;
+        compact.rings[i] = i%16;
+        if(i%7 == 3)
+            compact.y[i] = std::numeric_limits<float>::quiet_NaN();
+    }
+    BOOST_CHECK_EQUAL(compact.removeInvalid(),143);
+    BOOST_REQUIRE_EQUAL(compact.size(),860);
+    BOOST_REQUIRE_EQUAL(compact.intensity.size(),860);
+    BOOST_REQUIRE_EQUAL(compact.rings.size(),860);
+    for(size_t i=0;i<compact.size();++i)
+    {
+        const size_t original = size_t(compact.intensity[i]);
+        BOOST_CHECK(original%7 != 3);
+        BOOST_CHECK_EQUAL(compact.rings[i],original%16);
+        BOOST_CHECK_SMALL((compact.getPoint(i).cast<double>()-transform*cloud.points[original]).norm(),1e-4);
+    }
+
+    std::vector<size_t> indices;
+    indices.push_back(5);
+    indices.push_back(2);
+    base::samples::CompactPointcloud selected;
+    compact.select(indices,selected);
+    BOOST_REQUIRE_EQUAL(selected.size(),2);
+    BOOST_CHECK_EQUAL(selected.getChannels(),compact.getChannels());
+    BOOST_CHECK_EQUAL(selected.intensity[0],compact.intensity[5]);
+    BOOST_CHECK_EQUAL(selected.rings[1],compact.rings[2]);
+    BOOST_CHECK_EQUAL(selected.getPoint(1),compact.getPoint(2));
+
+    //blocks cover all points and the present channels
+    BOOST_CHECK_EQUAL(compact.forEachBlock(IntensityKernel(),100).count,860);
+    double sum = 0;
+    for(size_t i=0;i<compact.size();++i)
+    {
+        BOOST_CHECK_EQUAL(compact.intensity[i],compact.x[i]+compact.rings[i]);
+        sum += compact.intensity[i];
+    }
+    const base::samples::CompactPointcloud &const_compact = compact;
+    IntensityKernel sums = const_compact.forEachBlock(IntensityKernel());
+    BOOST_CHECK_EQUAL(sums.count,860);
+    BOOST_CHECK_CLOSE(sums.sum,sum,1e-9);
+    base::samples::CompactPointcloud::ConstBlock block = const_compact.getBlock(10,20);
+    BOOST_CHECK_EQUAL(block.size,10);
+    BOOST_CHECK_EQUAL(block.rings,&compact.rings[10]);
+    BOOST_CHECK(!block.time_offsets);
+
+    //an empty cloud keeps its channels
+    base::samples::CompactPointcloud empty;
+    empty.setChannels(base::samples::CompactPointcloud::TIME);
+    base::samples::CompactPointcloud copy = empty;
+    copy.push_back(1,2,3);
+    BOOST_CHECK_EQUAL(copy.time_offsets.size(),1);
+    BOOST_CHECK(copy.intensity.empty());
+    copy.clear();
+    BOOST_CHECK_EQUAL(copy.getChannels(),0);
+    BOOST_CHECK(!copy.getBounds(min,max));
+}
+
+BOOST_AUTO_TEST_CASE( voxel_grid_filter )
+{
+    //more points than fit into one chunk of the parallel binning
+    base::samples::Pointcloud cloud;
+    cloud.time = base::Time::fromSeconds(40);
+    srand(21);
+    for(int i=0;i<150000;++i)
+    {
+        cloud.points.push_back(base::Point(rand()%10000*0.001-5,rand()%10000*0.001-5,rand()%2000*0.001));
+        cloud.colors.push_back(base::Vector4d(rand()%256/255.0,0.5,0.25,1));
+    }
+    cloud.points[10].y() = std::numeric_limits<double>::quiet_NaN();
+    cloud.points[11].z() = -std::numeric_limits<double>::infinity();
+
+    //reference with a map from voxel to the points in the order of the input
+    typedef std::pair<int,std::pair<int,int> > VoxelKey;
+    const double voxel_size = 0.25;
+    std::map<VoxelKey,std::vector<size_t> > voxels;
+    std::vector<VoxelKey > order;
+    for(size_t i=0;i<cloud.points.size();++i)
+    {
+        const base::Point &p = cloud.points[i];
+        if(base::isNaN(p.y()) || base::isInfinity(p.z()))
+            continue;
+        VoxelKey key(int(floor(p.x()/voxel_size)),std::make_pair(int(floor(p.y()/voxel_size)),int(floor(p.z()/voxel_size))));
+        std::vector<size_t> &points = voxels[key];
+        if(points.empty())
+            order.push_back(key);
+        points.push_back(i);
+    }
+
+    base::samples::VoxelGridFilterConfig config;
+    config.voxel_size = voxel_size;
+    base::samples::VoxelGridFilter filter(config);
+    base::samples::Pointcloud output;
+    for(int run=0;run<2;++run)
+    {
+        BOOST_REQUIRE_EQUAL(filter.filter(cloud,output),order.size());
+        BOOST_CHECK_EQUAL(output.time,cloud.time);
+        BOOST_REQUIRE_EQUAL(output.colors.size(),order.size());
+        for(size_t v=0;v<order.size();++v)
+        {
+            const std::vector<size_t> &points = voxels[order[v]];
+            base::Point centroid = base::Point::Zero();
+            base::Vector4d color = base::Vector4d::Zero();
+            for(size_t j=0;j<points.size();++j)
+            {
+                centroid += cloud.points[points[j]];
+                color += cloud.colors[points[j]];
+            }
+            BOOST_CHECK_SMALL((output.points[v]-centroid/points.size()).norm(),1e-9);
+            BOOST_CHECK_SMALL((output.colors[v]-color/points.size()).norm(),1e-9);
+            BOOST_CHECK_EQUAL(filter.getFirstIndices()[v],points[0]);
+            BOOST_CHECK_EQUAL(filter.getCounts()[v],points.size());
+        }
+    }
+
+    //FIRST keeps no sums, the chunks are merged as well
+    config.policy = base::samples::VoxelGridFilterConfig::FIRST;
+    filter.setConfig(config);
+    BOOST_REQUIRE_EQUAL(filter.filter(cloud,output),order.size());
+    for(size_t v=0;v<order.size();++v)
+    {
+        const size_t first = voxels[order[v]][0];
+        BOOST_CHECK_EQUAL(output.points[v],cloud.points[first]);
+        BOOST_CHECK_EQUAL(output.colors[v],cloud.colors[first]);
+        BOOST_CHECK_EQUAL(filter.getFirstIndices()[v],first);
+        BOOST_CHECK_EQUAL(filter.getCounts()[v],voxels[order[v]].size());
+    }
+
+    //channels of a compact cloud
+    base::samples::CompactPointcloud compact, compact_output;
+    compact.fromPointcloud(cloud);
+    compact.setChannels(base::samples::CompactPointcloud::COLOR | base::samples::CompactPointcloud::INTENSITY
+            | base::samples::CompactPointcloud::NORMAL | base::samples::CompactPointcloud::RING);
+    for(size_t i=0;i<compact.size();++i)
+    {
+        compact.colors[i] = 0xFF000000u | (i%2 ? 0x64 : 0xC8);
+        compact.intensity[i] = i%3;
+        compact.normal_z[i] = 1;
+        compact.normal_x[i] = i%2 ? 0.5 : -0.5;
+        compact.rings[i] = i%32;
+    }
+    BOOST_REQUIRE_EQUAL(filter.filter(compact,compact_output),order.size());
+    BOOST_CHECK_EQUAL(compact_output.getChannels(),compact.getChannels());
+    for(size_t v=0;v<order.size();++v)
+    {
+        const size_t first = voxels[order[v]][0];
+        BOOST_CHECK_EQUAL(compact_output.getPoint(v),compact.getPoint(first));
+        BOOST_CHECK_EQUAL(compact_output.intensity[v],compact.intensity[first]);
+        BOOST_CHECK_EQUAL(compact_output.rings[v],compact.rings[first]);
+    }
+
+    config.policy = base::samples::VoxelGridFilterConfig::CENTROID;
+    filter.setConfig(config);
+    BOOST_REQUIRE_EQUAL(filter.filter(compact,compact_output),order.size());
+    BOOST_REQUIRE_EQUAL(compact_output.rings.size(),order.size());
+    for(size_t v=0;v<order.size();++v)
+    {
+        const std::vector<size_t> &points = voxels[order[v]];
+        Eigen::Vector3d centroid = Eigen::Vector3d::Zero(), normal = Eigen::Vector3d::Zero();
+        double intensity = 0, red = 0;
+        for(size_t j=0;j<points.size();++j)
+        {
+            centroid += compact.getPoint(points[j]).cast<double>();
+            normal += Eigen::Vector3d(compact.normal_x[points[j]],0,1);
+            intensity += compact.intensity[points[j]];
+            red += compact.colors[points[j]] & 0xFF;
+        }
+        BOOST_CHECK_SMALL((compact_output.getPoint(v).cast<double>()-centroid/points.size()).norm(),1e-5);
+        BOOST_CHECK_SMALL(compact_output.intensity[v]-intensity/points.size(),1e-5);
+        BOOST_CHECK_SMALL((Eigen::Vector3d(compact_output.normal_x[v],compact_output.normal_y[v],compact_output.normal_z[v])
+                    -normal.normalized()).norm(),1e-6);
+        BOOST_CHECK_EQUAL(compact_output.colors[v]&0xFF,uint32_t(red/points.size()+0.5));
+        BOOST_CHECK_EQUAL(compact_output.colors[v]>>24,0xFFu);
+        BOOST_CHECK_EQUAL(compact_output.rings[v],compact.rings[points[0]]);
+    }
+
+    //an empty cloud, points outside of the key range
+    BOOST_CHECK_EQUAL(filter.filter(base::samples::Pointcloud(),output),0);
+    BOOST_CHECK(output.points.empty());
+    cloud.points[5].x() = 1e6;
+    BOOST_CHECK_THROW(filter.filter(cloud,output),std::runtime_error);
+    config.voxel_size = 0;
+    BOOST_CHECK_THROW(filter.setConfig(config),std::runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE( kd_tree )
+{
+    base::samples::Pointcloud cloud;
+    srand(13);
+    for(int i=0;i<5000;++i)
+        cloud.points.push_back(base::Point(rand()%10000*0.001,rand()%10000*0.0005,rand()%10000*0.0002));
+    //duplicates
+    for(int i=0;i<20;++i)
+        cloud.points.push_back(cloud.points[7]);
+    //NaN points of an organized cloud are not indexed
+    size_t valid = cloud.points.size();
+    for(size_t i=3;i<cloud.points.size();i+=7,--valid)
+        cloud.points[i].x() = base::NaN<double>();
+    std::vector<base::Point> queries;
+    for(int i=0;i<200;++i)
+        queries.push_back(base::Point(rand()%12000*0.001-1,rand()%6000*0.001-0.5,rand()%3000*0.001-0.5));
+    queries.push_back(cloud.points[7]);
+
+    base::samples::PointcloudKDTree tree(8);
+    tree.build(cloud);
+    BOOST_CHECK_EQUAL(tree.size(),valid);
+    const size_t k = 10;
+    std::vector<uint32_t> indices;
+    std::vector<double> distances;
+    tree.knnSearch(queries,k,indices,distances);
+    BOOST_REQUIRE_EQUAL(indices.size(),queries.size()*k);
+    std::vector<std::vector<uint32_t> > radius_indices;
+    tree.radiusSearch(queries,0.3,radius_indices);
+    BOOST_REQUIRE_EQUAL(radius_indices.size(),queries.size());
+    for(size_t q=0;q<queries.size();++q)
+    {
+        std::vector<std::pair<double,uint32_t> > expected;
+        std::vector<uint32_t> expected_radius;
+        for(size_t i=0;i<cloud.points.size();++i)
+        {
+            if(base::isNaN(cloud.points[i].x()))
+                continue;
+            const double distance = (cloud.points[i]-queries[q]).squaredNorm();
+            expected.push_back(std::make_pair(distance,uint32_t(i)));
+            if(distance <= 0.09)
+                expected_radius.push_back(i);
+        }
+        std::sort(expected.begin(),expected.end());
+        for(size_t j=0;j<k;++j)
+        {
+            BOOST_CHECK_SMALL(distances[q*k+j]-expected[j].first,1e-12);
+            BOOST_CHECK_SMALL((cloud.points[indices[q*k+j]]-queries[q]).squaredNorm()-expected[j].first,1e-12);
+        }
+        std::vector<uint32_t> found = radius_indices[q];
+        std::sort(found.begin(),found.end());
+        BOOST_CHECK(found == expected_radius);
+    }
+    //the duplicates are the nearest neighbours of themselves
+    BOOST_CHECK_EQUAL(distances[200*k+k-1],0);
+
+    //single queries, less points than neighbours
+    std::vector<uint32_t> single;
+    BOOST_CHECK_EQUAL(tree.knnSearch(queries[0],1,single,distances),1);
+    BOOST_CHECK_EQUAL(single[0],indices[0]);
+    base::samples::Pointcloud small;
+    small.points.assign(cloud.points.begin(),cloud.points.begin()+3);
+    base::samples::PointcloudKDTree small_tree;
+    small_tree.build(small);
+    BOOST_CHECK_EQUAL(small_tree.knnSearch(queries[0],5,single,distances),3);
+    small_tree.knnSearch(queries,5,indices,distances);
+    BOOST_CHECK_EQUAL(indices[3],base::samples::PointcloudKDTree::invalidIndex());
+    BOOST_CHECK(base::isInfinity(distances[4]));
+
+    //empty clouds
+    base::samples::PointcloudKDTree empty_tree;
+    empty_tree.build(base::samples::Pointcloud());
+    BOOST_CHECK_EQUAL(empty_tree.knnSearch(queries[0],3,single,distances),0);
+    BOOST_CHECK_EQUAL(empty_tree.radiusSearch(queries[0],1.0,single),0);
+
+    //the compact cloud gives the same neighbours
+    base::samples::CompactPointcloud compact;
+    compact.fromPointcloud(cloud);
+    base::samples::CompactPointcloudKDTree compact_tree;
+    compact_tree.build(compact);
+    std::vector<float> compact_distances;
+    for(size_t q=0;q<queries.size();++q)
+    {
+        compact_tree.knnSearch(queries[q],1,single,compact_distances);
+        tree.knnSearch(queries[q],1,indices,distances);
+        BOOST_REQUIRE_EQUAL(single.size(),1);
+        BOOST_CHECK_SMALL(compact_distances[0]-distances[0],1e-5);
+        compact_tree.radiusSearch(queries[q],0.3,single);
+        BOOST_CHECK(std::abs(int(single.size())-int(radius_indices[q].size())) <= 1);
+    }
+}
+
 BOOST_AUTO_TEST_CASE( laser_scan_test )
 {
     //configure laser scan
@@ -882,6 +2865,73 @@ BOOST_AUTO_TEST_CASE( frame_test )
     BOOST_CHECK(frame2.getWidth() == 200);
 }
 
+BOOST_AUTO_TEST_CASE( frame_quality_test )
+{
+    using namespace base::samples::frame;
+
+    Frame frame(101,60,8,MODE_GRAYSCALE);
+    for(int y=0;y<frame.getHeight();++y)
+        for(int x=0;x<frame.getWidth();++x)
+            frame.at<uint8_t>(x,y) = ((x/3+y/5)%2)*200+(x*7+y*13)%50;
+    frame.at<uint8_t>(10,10) = 0;
+    frame.at<uint8_t>(12,10) = 255;
+
+    //reference implementation
+    for(int step=1;step<=5;++step)
+    {
+        FrameQualityConfig config;
+        config.row_step = step;
+        config.column_step = step;
+        config.underexposure_level = 10;
+        config.overexposure_level = 240;
+        config.tenengrad_threshold = 1000;
+
+        double sum_l = 0, sum_l2 = 0, sum_t = 0, sum_i = 0, under = 0, over = 0, count = 0;
+        for(int y=1;y<frame.getHeight()-1;y+=step)
+        {
+            for(int x=1;x<frame.getWidth()-1;x+=step)
+            {
+                int c = frame.at<uint8_t>(x,y);
+                int l = frame.at<uint8_t>(x,y-1)+frame.at<uint8_t>(x,y+1)+frame.at<uint8_t>(x-1,y)+frame.at<uint8_t>(x+1,y)-4*c;
+                int gx = frame.at<uint8_t>(x+1,y-1)-frame.at<uint8_t>(x-1,y-1)
+                    +2*(frame.at<uint8_t>(x+1,y)-frame.at<uint8_t>(x-1,y))
+                    +frame.at<uint8_t>(x+1,y+1)-frame.at<uint8_t>(x-1,y+1);
+                int gy = frame.at<uint8_t>(x-1,y+1)+2*frame.at<uint8_t>(x,y+1)+frame.at<uint8_t>(x+1,y+1)
+                    -frame.at<uint8_t>(x-1,y-1)-2*frame.at<uint8_t>(x,y-1)-frame.at<uint8_t>(x+1,y-1);
+                sum_l += l;
+                sum_l2 += l*l;
+                if(gx*gx+gy*gy > 1000)
+                    sum_t += gx*gx+gy*gy;
+                sum_i += c;
+                under += c <= 10;
+                over += c >= 240;
+                ++count;
+            }
+        }
+
+        FrameQuality quality = computeFrameQuality(frame,config);
+        BOOST_CHECK_EQUAL(quality.sample_count,count);
+        BOOST_CHECK_CLOSE(quality.laplacian_variance,sum_l2/count-(sum_l/count)*(sum_l/count),1e-6);
+        BOOST_CHECK_CLOSE(quality.tenengrad,sum_t/count,1e-6);
+        BOOST_CHECK_CLOSE(quality.mean_intensity,sum_i/count,1e-6);
+        BOOST_CHECK_CLOSE(quality.underexposed_fraction+1,under/count+1,1e-6);
+        BOOST_CHECK_CLOSE(quality.overexposed_fraction+1,over/count+1,1e-6);
+    }
+
+    //a blurred frame must be less sharp
+    Frame blurred(frame);
+    for(int y=0;y<frame.getHeight();++y)
+        for(int x=1;x<frame.getWidth()-1;++x)
+            blurred.at<uint8_t>(x,y) = (frame.at<uint8_t>(x-1,y)+2*frame.at<uint8_t>(x,y)+frame.at<uint8_t>(x+1,y))/4;
+    FrameQuality sharp_quality = computeFrameQuality(frame);
+    FrameQuality blurred_quality = computeFrameQuality(blurred);
+    BOOST_CHECK(sharp_quality.laplacian_variance > blurred_quality.laplacian_variance);
+    BOOST_CHECK(sharp_quality.tenengrad > blurred_quality.tenengrad);
+
+    Frame rgb(10,10,8,MODE_RGB);
+    BOOST_CHECK_THROW(computeFrameQuality(rgb),std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE( rbs_validity )
 {
     base::samples::RigidBodyState rbs;
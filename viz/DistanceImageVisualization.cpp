@@ -13,6 +13,7 @@ DistanceImageVisualization::~DistanceImageVisualization()
 
 void DistanceImageVisualization::updateData(const base::samples::DistanceImage& data)
 {
-    PointcloudVisualization::updateData(data.getPointCloud());
+    converter.convert(data, cloud);
+    PointcloudVisualization::updateData(cloud);
 }
 
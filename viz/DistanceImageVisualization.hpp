@@ -3,6 +3,7 @@
 
 #include <vizkit3d/Vizkit3DPlugin.hpp>
 #include <base/samples/DistanceImage.hpp>
+#include <base/samples/DistanceImageConverter.hpp>
 
 #include <boost/noncopyable.hpp>
 #include "PointcloudVisualization.hpp"
@@ -25,6 +26,8 @@ namespace vizkit3d
 	
 
     private:
+        base::samples::DistanceImageConverter converter;
+        base::samples::Pointcloud cloud;
     };
 }
 #endif